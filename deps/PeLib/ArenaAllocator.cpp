@@ -0,0 +1,34 @@
+/*
+* ArenaAllocator.cpp - Part of the PeLib library.
+*
+* This software is licensed under the zlib/libpng License.
+* For more details see http://www.opensource.org/licenses/zlib-license.php
+* or the license information file (license.htm) in the root directory
+* of PeLib.
+*/
+
+#include "ArenaAllocator.h"
+
+namespace PeLib
+{
+	/// Resource of the calling thread; 0 means the process-wide default.
+	static thread_local std::pmr::memory_resource* tlsResource = 0;
+
+	std::pmr::memory_resource* getMemoryResource()
+	{
+		return tlsResource ? tlsResource : std::pmr::get_default_resource();
+	}
+
+	/**
+	* Only containers created afterwards use the new resource; existing ones keep the resource they
+	* were created with.
+	* @param pResource Resource to allocate from, or 0 for the process-wide default.
+	* @return The previous resource of the calling thread, or 0 if it used the default.
+	**/
+	std::pmr::memory_resource* setMemoryResource(std::pmr::memory_resource* pResource)
+	{
+		std::pmr::memory_resource* pPrevious = tlsResource;
+		tlsResource = pResource;
+		return pPrevious;
+	}
+}
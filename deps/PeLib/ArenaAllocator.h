@@ -0,0 +1,122 @@
+/*
+* ArenaAllocator.h - Part of the PeLib library.
+*
+* This software is licensed under the zlib/libpng License.
+* For more details see http://www.opensource.org/licenses/zlib-license.php
+* or the license information file (license.htm) in the root directory
+* of PeLib.
+*/
+
+#ifndef ARENAALLOCATOR_H
+#define ARENAALLOCATOR_H
+
+#include <cstddef>
+#include <memory_resource>
+#include <type_traits>
+#include <vector>
+
+namespace PeLib
+{
+	/// Returns the memory resource PeLib's containers allocate from on the calling thread.
+	std::pmr::memory_resource* getMemoryResource();
+	/// Makes PeLib's containers on the calling thread allocate from pResource; 0 restores the default.
+	std::pmr::memory_resource* setMemoryResource(std::pmr::memory_resource* pResource);
+
+	/// Makes PeLib allocate from a memory resource until the end of the scope.
+	/**
+	* Parsing one file makes thousands of small allocations which are all freed together. A worker
+	* which parses one file after another can hand PeLib a std::pmr::monotonic_buffer_resource and
+	* release it after each file instead. Everything PeLib creates inside the scope must be destroyed
+	* before the resource releases its memory. Copies allocate from the resource of the thread making
+	* them, so a copy made outside the scope (see #PeLib::freeze) may outlive it.
+	**/
+	class ArenaScope
+	{
+		private:
+		  std::pmr::memory_resource* m_pPrevious;
+
+		  ArenaScope(const ArenaScope&);
+		  ArenaScope& operator=(const ArenaScope&);
+
+		public:
+		  explicit ArenaScope(std::pmr::memory_resource* pResource) : m_pPrevious(setMemoryResource(pResource))
+		  {
+		  }
+
+		  ~ArenaScope()
+		  {
+			  setMemoryResource(m_pPrevious);
+		  }
+	};
+
+	/// Allocator for PeLib's containers.
+	/**
+	* Like std::pmr::polymorphic_allocator, but a default-constructed allocator, including the one a
+	* copied container gets, picks the calling thread's resource (see #PeLib::setMemoryResource)
+	* instead of the process-wide default. As with polymorphic_allocator, a container keeps its
+	* resource for life: assigning to it copies or moves the elements into its own resource, and
+	* swapping containers with different resources is undefined. The directory readers therefore
+	* move their temporaries into place instead of swapping them, since the two may have been
+	* created inside and outside an #PeLib::ArenaScope.
+	**/
+	template<typename T>
+	class ArenaAllocator
+	{
+		private:
+		  std::pmr::memory_resource* m_pResource;
+
+		public:
+		  typedef T value_type;
+		  typedef std::false_type propagate_on_container_copy_assignment;
+		  typedef std::false_type propagate_on_container_move_assignment;
+		  typedef std::false_type propagate_on_container_swap;
+
+		  ArenaAllocator() : m_pResource(getMemoryResource())
+		  {
+		  }
+
+		  template<typename U>
+		  ArenaAllocator(const ArenaAllocator<U>& other) : m_pResource(other.resource())
+		  {
+		  }
+
+		  T* allocate(std::size_t n)
+		  {
+			  return static_cast<T*>(m_pResource->allocate(n * sizeof(T), alignof(T)));
+		  }
+
+		  void deallocate(T* p, std::size_t n)
+		  {
+			  m_pResource->deallocate(p, n * sizeof(T), alignof(T));
+		  }
+
+		  /// Copies allocate from the copying thread's resource, not the one of the original.
+		  ArenaAllocator select_on_container_copy_construction() const
+		  {
+			  return ArenaAllocator();
+		  }
+
+		  std::pmr::memory_resource* resource() const
+		  {
+			  return m_pResource;
+		  }
+	};
+
+	template<typename T, typename U>
+	bool operator==(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs)
+	{
+		return lhs.resource() == rhs.resource() || lhs.resource()->is_equal(*rhs.resource());
+	}
+
+	template<typename T, typename U>
+	bool operator!=(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs)
+	{
+		return !(lhs == rhs);
+	}
+
+	/// Vector type of PeLib's per-file containers.
+	template<typename T>
+	using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+}
+
+#endif
@@ -54,7 +54,7 @@ namespace PeLib
 	**/
 	int BoundImportDirectory::getModuleIndex(const std::string& strModuleName) const
 	{
-		std::vector<PELIB_IMAGE_BOUND_DIRECTORY>::const_iterator Iter = std::find_if(m_vIbd.begin(), m_vIbd.end(), std::bind2nd(std::mem_fun_ref(&PELIB_IMAGE_BOUND_DIRECTORY::equal), strModuleName));
+		ArenaVector<PELIB_IMAGE_BOUND_DIRECTORY>::const_iterator Iter = std::find_if(m_vIbd.begin(), m_vIbd.end(), std::bind2nd(std::mem_fun_ref(&PELIB_IMAGE_BOUND_DIRECTORY::equal), strModuleName));
 		
 		if (Iter == m_vIbd.end())
 		{
@@ -72,24 +72,40 @@ namespace PeLib
 		return static_cast<unsigned int>(m_vIbd.size());
 	}
 
-	int BoundImportDirectory::read(InputBuffer& inpBuffer, unsigned char* data, unsigned int dwSize)
+	int BoundImportDirectory::read(InputBuffer& inpBuffer, unsigned char* data, unsigned int dwSize, ParseBudget* pBudget)
 	{
-		std::vector<PELIB_IMAGE_BOUND_DIRECTORY> currentDirectory;
+		ArenaVector<PELIB_IMAGE_BOUND_DIRECTORY> currentDirectory;
 		
 		do
 		{
 			PELIB_IMAGE_BOUND_DIRECTORY ibdCurrent;
 			
+			// The directory must end with an empty descriptor before its data runs out.
+			if (dwSize - inpBuffer.get() < PELIB_IMAGE_BOUND_IMPORT_DESCRIPTOR::size())
+			{
+				return ERROR_INVALID_FILE;
+			}
+
 			inpBuffer >> ibdCurrent.ibdDescriptor.TimeDateStamp;
 			inpBuffer >> ibdCurrent.ibdDescriptor.OffsetModuleName;
 			inpBuffer >> ibdCurrent.ibdDescriptor.NumberOfModuleForwarderRefs;
 
 			if (ibdCurrent.ibdDescriptor.TimeDateStamp == 0 && ibdCurrent.ibdDescriptor.OffsetModuleName == 0 && ibdCurrent.ibdDescriptor.NumberOfModuleForwarderRefs == 0) break;
+
+			if (pBudget && !pBudget->chargeEntries(1 + ibdCurrent.ibdDescriptor.NumberOfModuleForwarderRefs))
+			{
+				return ERROR_BUDGET_EXCEEDED;
+			}
 			
 			for (int i=0;i<ibdCurrent.ibdDescriptor.NumberOfModuleForwarderRefs;i++)
 			{
 				PELIB_IMAGE_BOUND_DIRECTORY currentForwarder;
 				
+				if (dwSize - inpBuffer.get() < PELIB_IMAGE_BOUND_IMPORT_DESCRIPTOR::size())
+				{
+					return ERROR_INVALID_FILE;
+				}
+
 				inpBuffer >> currentForwarder.ibdDescriptor.TimeDateStamp;
 				inpBuffer >> currentForwarder.ibdDescriptor.OffsetModuleName;
 				inpBuffer >> currentForwarder.ibdDescriptor.NumberOfModuleForwarderRefs;
@@ -110,7 +126,7 @@ namespace PeLib
 			}
 			
 			currentDirectory[i].strModuleName = "";
-			for (int k=0;data[wOmn + k] != 0 && k + wOmn < dwSize;k++)
+			for (dword k=0;k + wOmn < dwSize && data[wOmn + k] != 0;k++)
 			{
 				currentDirectory[i].strModuleName += data[wOmn + k];
 			}
@@ -126,14 +142,14 @@ namespace PeLib
 				
 //				m_vIbd[i].moduleForwarders[j].strModuleName.assign((char*)(&vBimpDir[wOmn]));
 				currentDirectory[i].moduleForwarders[j].strModuleName = "";
-				for (int k=0;data[wOmn + k] != 0 && k + wOmn < dwSize;k++)
+				for (dword k=0;k + wOmn < dwSize && data[wOmn + k] != 0;k++)
 				{
 					currentDirectory[i].moduleForwarders[j].strModuleName += data[wOmn + k];
 				}
 			}
 		}
 		
-		std::swap(m_vIbd, currentDirectory);
+		m_vIbd = std::move(currentDirectory);
 		
 		return NO_ERROR;
 	}
@@ -143,21 +159,27 @@ namespace PeLib
 	* @param strModuleName The name of the PE file from which the BoundImport directory is read.
 	* @param dwOffset The file offset where the BoundImport directory can be found (see #PeFile::PeHeader::getIDBoundImportRVA).
 	* @param dwSize The size of the BoundImport directory (see #PeFile::PeHeader::getIDBoundImportSize).
+	* @param pBudget Optional budget to charge the work against.
 	**/
-	int BoundImportDirectory::read(const std::string& strModuleName, dword dwOffset, unsigned int uiSize)
+	int BoundImportDirectory::read(const std::string& strModuleName, dword dwOffset, unsigned int uiSize, ParseBudget* pBudget)
 	{
-		std::ifstream ifFile(strModuleName.c_str(), std::ios::binary);
+		FileStream ifFile(strModuleName, std::ios::in | std::ios::binary);
 
 		if (!ifFile)
 		{
 			return ERROR_OPENING_FILE;
 		}
 		
-		if (fileSize(ifFile) < dwOffset + uiSize)
+		if (fileSize(ifFile) < static_cast<qword>(dwOffset) + uiSize)
 		{
 			return ERROR_INVALID_FILE;
 		}
 		
+		if (pBudget && !pBudget->chargeBytes(uiSize))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
+		
 		ifFile.seekg(dwOffset, std::ios::beg);
 		
 		std::vector<unsigned char> vBimpDir(uiSize);
@@ -165,15 +187,20 @@ namespace PeLib
 
 		InputBuffer inpBuffer(vBimpDir);
 		
-		return read(inpBuffer, &vBimpDir[0], uiSize);
+		return read(inpBuffer, &vBimpDir[0], uiSize, pBudget);
  	}
  	
- 	int BoundImportDirectory::read(unsigned char* pcBuffer, unsigned int uiSize)
+ 	int BoundImportDirectory::read(unsigned char* pcBuffer, unsigned int uiSize, ParseBudget* pBudget)
  	{
+		if (pBudget && !pBudget->chargeBytes(uiSize))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
+
 		std::vector<unsigned char> vBimpDir(pcBuffer, pcBuffer + uiSize);
 		InputBuffer inpBuffer(vBimpDir);
 		
-		return read(inpBuffer, &vBimpDir[0], uiSize);
+		return read(inpBuffer, &vBimpDir[0], uiSize, pBudget);
  	}
  	
  	unsigned int BoundImportDirectory::totalModules() const
@@ -196,6 +223,7 @@ namespace PeLib
 	**/
 	void BoundImportDirectory::rebuild(std::vector<byte>& vBuffer, bool fMakeValid) const
 	{
+		PELIB_TRACE_SPAN("BoundImportDirectory::rebuild");
 		std::map<std::string, word> filename_offsets;
 		
 		OutputBuffer obBuffer(vBuffer);
@@ -332,17 +360,18 @@ namespace PeLib
 	**/
 	int BoundImportDirectory::write(const std::string& strFilename, dword dwOffset,  bool fMakeValid) const
 	{
-		std::fstream ofFile(strFilename.c_str(), std::ios_base::in);
+		PELIB_TRACE_SPAN("BoundImportDirectory::write");
+		FileStream ofFile(strFilename, std::ios_base::in);
 		
 		if (!ofFile)
 		{
 			ofFile.clear();
-			ofFile.open(strFilename.c_str(), std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::out | std::ios_base::binary);
 		}
 		else
 		{
 			ofFile.close();
-			ofFile.open(strFilename.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
 		}
 
 		if (!ofFile)
@@ -24,9 +24,9 @@ namespace PeLib
 	class BoundImportDirectory
 	{
 		private:
-		  std::vector<PELIB_IMAGE_BOUND_DIRECTORY> m_vIbd; ///< Stores the individual BoundImport fields.
+		  ArenaVector<PELIB_IMAGE_BOUND_DIRECTORY> m_vIbd; ///< Stores the individual BoundImport fields.
 		  
-		  int read(InputBuffer& inpBuffer, unsigned char* data, unsigned int dwSize);
+		  int read(InputBuffer& inpBuffer, unsigned char* data, unsigned int dwSize, ParseBudget* pBudget);
 		  unsigned int totalModules() const;
 		public:
 		  /// Adds another bound import.
@@ -36,8 +36,8 @@ namespace PeLib
 		  /// Returns the number of files in the BoundImport directory.
 		  unsigned int calcNumberOfModules() const; // EXPORT
 		  /// Reads the BoundImport directory table from a PE file.
-		  int read(const std::string& strFileName, dword dwOffset, unsigned int uiSize); // EXPORT
-		  int read(unsigned char* pcBuffer, unsigned int uiSize); // EXPORT
+		  int read(const std::string& strFileName, dword dwOffset, unsigned int uiSize, ParseBudget* pBudget = 0); // EXPORT
+		  int read(unsigned char* pcBuffer, unsigned int uiSize, ParseBudget* pBudget = 0); // EXPORT
 		  /// Rebuilds the BoundImport directory.
 		  void rebuild(std::vector<byte>& vBuffer, bool fMakeValid = true) const; // EXPORT
 		  /// Empties the BoundImport directory.
@@ -42,12 +42,17 @@ namespace PeLib
 		std::swap(ichCurr, m_ichComHeader);
 	}
 	
-	int ComHeaderDirectory::read(unsigned char* buffer, unsigned int buffersize)
+	int ComHeaderDirectory::read(unsigned char* buffer, unsigned int buffersize, ParseBudget* pBudget)
 	{
 		if (buffersize < PELIB_IMAGE_COR20_HEADER::size())
 		{
 			return ERROR_INVALID_FILE;
 		}
+
+		if (pBudget && !pBudget->chargeBytes(buffersize))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
 		
 		std::vector<byte> vComDescDirectory(buffer, buffer + buffersize);
 		
@@ -61,22 +66,28 @@ namespace PeLib
 	* @param strFilename Name of the file.
 	* @param uiOffset File offset of the COM+ descriptor.
 	* @param uiSize Size of the COM+ descriptor.
+	* @param pBudget Optional budget to charge the work against.
 	**/
-	int ComHeaderDirectory::read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize)
+	int ComHeaderDirectory::read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, ParseBudget* pBudget)
 	{
-		std::ifstream ifFile(strFilename.c_str(), std::ios::binary);
-		unsigned int ulFileSize = fileSize(ifFile);
+		FileStream ifFile(strFilename, std::ios::in | std::ios::binary);
+		qword ulFileSize = fileSize(ifFile);
 
 		if (!ifFile)
 		{
 			return ERROR_OPENING_FILE;
 		}
 		
-		if (ulFileSize < uiOffset + uiSize)
+		if (ulFileSize < static_cast<qword>(uiOffset) + uiSize)
 		{
 			return ERROR_INVALID_FILE;
 		}
 
+		if (pBudget && !pBudget->chargeBytes(uiSize))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
+
 		ifFile.seekg(uiOffset, std::ios::beg);
 
 		std::vector<byte> vComDescDirectory(uiSize);
@@ -93,6 +104,7 @@ namespace PeLib
 	**/
 	void ComHeaderDirectory::rebuild(std::vector<byte>& vBuffer) const
 	{
+		PELIB_TRACE_SPAN("ComHeaderDirectory::rebuild");
 		OutputBuffer obBuffer(vBuffer);
 		
 		obBuffer << m_ichComHeader.cb;
@@ -130,17 +142,18 @@ namespace PeLib
 	**/
 	int ComHeaderDirectory::write(const std::string& strFilename, unsigned int dwOffset) const
 	{
-		std::fstream ofFile(strFilename.c_str(), std::ios_base::in);
+		PELIB_TRACE_SPAN("ComHeaderDirectory::write");
+		FileStream ofFile(strFilename, std::ios_base::in);
 		
 		if (!ofFile)
 		{
 			ofFile.clear();
-			ofFile.open(strFilename.c_str(), std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::out | std::ios_base::binary);
 		}
 		else
 		{
 			ofFile.close();
-			ofFile.open(strFilename.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
 		}
 
 		if (!ofFile)
@@ -29,8 +29,8 @@ namespace PeLib
 
 		public:
 		  /// Read a file's COM+ runtime descriptor directory.
-		  int read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize); // EXPORT
-		  int read(unsigned char* buffer, unsigned int buffersize); // EXPORT
+		  int read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, ParseBudget* pBudget = 0); // EXPORT
+		  int read(unsigned char* buffer, unsigned int buffersize, ParseBudget* pBudget = 0); // EXPORT
 		  /// Rebuild the COM+ descriptor.
 		  void rebuild(std::vector<byte>& vBuffer) const; // EXPORT
 		  /// Returns the size of the current COM+ descriptor.
@@ -12,6 +12,7 @@
 
 #include "PeLibInc.h"
 #include "DebugDirectory.h"
+#include "buffer/MemoryInputStream.h"
 
 namespace PeLib
 {
@@ -20,9 +21,9 @@ namespace PeLib
 		m_vDebugInfo.clear();
 	}
 	
-	std::vector<PELIB_IMG_DEBUG_DIRECTORY> DebugDirectory::read(InputBuffer& ibBuffer, unsigned int uiSize)
+	ArenaVector<PELIB_IMG_DEBUG_DIRECTORY> DebugDirectory::read(InputBuffer& ibBuffer, unsigned int uiSize)
 	{
-		std::vector<PELIB_IMG_DEBUG_DIRECTORY> currDebugInfo;
+		ArenaVector<PELIB_IMG_DEBUG_DIRECTORY> currDebugInfo;
 		
 		PELIB_IMG_DEBUG_DIRECTORY iddCurr;
 		
@@ -44,18 +45,23 @@ namespace PeLib
 		return currDebugInfo;
 	}
 	
-	int DebugDirectory::read(unsigned char* buffer, unsigned int buffersize)
+	int DebugDirectory::read(unsigned char* buffer, unsigned int buffersize, ParseBudget* pBudget)
 	{
 		// XXX: Note, debug data is not read at all. This might or might not change
 		//      in the future.
 		
+		if (pBudget && (!pBudget->chargeBytes(buffersize) || !pBudget->chargeEntries(buffersize / PELIB_IMAGE_DEBUG_DIRECTORY::size())))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
+
 		std::vector<byte> vDebugDirectory(buffer, buffer + buffersize);
 		
 		InputBuffer ibBuffer(vDebugDirectory);
 		
-		std::vector<PELIB_IMG_DEBUG_DIRECTORY> currDebugInfo = read(ibBuffer, buffersize);
+		ArenaVector<PELIB_IMG_DEBUG_DIRECTORY> currDebugInfo = read(ibBuffer, buffersize);
 		
-		std::swap(currDebugInfo, m_vDebugInfo);
+		m_vDebugInfo = std::move(currDebugInfo);
 		
 		return NO_ERROR;
 	}
@@ -64,22 +70,53 @@ namespace PeLib
 	* @param strFilename Name of the file which will be read.
 	* @param uiOffset File offset of the Debug directory.
 	* @param uiSize Size of the Debug directory.
+	* @param pBudget Optional budget to charge the work against.
 	**/
-	int DebugDirectory::read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize)
+	int DebugDirectory::read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, ParseBudget* pBudget)
 	{
-		std::ifstream ifFile(strFilename.c_str(), std::ios::binary);
-		unsigned int ulFileSize = fileSize(ifFile);
+		FileStream ifFile(strFilename, std::ios::in | std::ios::binary);
 
 		if (!ifFile)
 		{
 			return ERROR_OPENING_FILE;
 		}
 		
-		if (ulFileSize < uiOffset + uiSize)
+		return read(ifFile, uiOffset, uiSize, pBudget);
+	}
+
+	/**
+	* @param pcBuffer Pointer to the first byte of an in-memory image of the file.
+	* @param uiBufferSize Size of the buffer.
+	* @param uiOffset File offset of the Debug directory.
+	* @param uiSize Size of the Debug directory.
+	* @param pBudget Optional budget to charge the work against.
+	**/
+	int DebugDirectory::read(const unsigned char* pcBuffer, unsigned int uiBufferSize, unsigned int uiOffset, unsigned int uiSize, ParseBudget* pBudget)
+	{
+		MemoryInputStream misBuffer(pcBuffer, uiBufferSize);
+		return read(misBuffer, uiOffset, uiSize, pBudget);
+	}
+
+	/**
+	* @param ifFile Stream over the whole file.
+	* @param uiOffset File offset of the Debug directory.
+	* @param uiSize Size of the Debug directory.
+	* @param pBudget Optional budget to charge the work against.
+	**/
+	int DebugDirectory::read(std::istream& ifFile, unsigned int uiOffset, unsigned int uiSize, ParseBudget* pBudget)
+	{
+		qword ulFileSize = fileSize(ifFile);
+
+		if (uiOffset > ulFileSize || uiSize > ulFileSize - uiOffset)
 		{
 			return ERROR_INVALID_FILE;
 		}
 
+		if (pBudget && (!pBudget->chargeBytes(uiSize) || !pBudget->chargeEntries(uiSize / PELIB_IMAGE_DEBUG_DIRECTORY::size())))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
+
 		ifFile.seekg(uiOffset, std::ios::beg);
 
 		std::vector<byte> vDebugDirectory(uiSize);
@@ -87,17 +124,25 @@ namespace PeLib
 		
 		InputBuffer ibBuffer(vDebugDirectory);
 		
-		std::vector<PELIB_IMG_DEBUG_DIRECTORY> currDebugInfo = read(ibBuffer, uiSize);
+		ArenaVector<PELIB_IMG_DEBUG_DIRECTORY> currDebugInfo = read(ibBuffer, uiSize);
 		
 		for (unsigned int i=0;i<currDebugInfo.size();i++)
 		{
+			if (!currDebugInfo[i].idd.SizeOfData)
+				continue;
+
+			if (pBudget && !pBudget->chargeBytes(currDebugInfo[i].idd.SizeOfData))
+			{
+				return ERROR_BUDGET_EXCEEDED;
+			}
+
 			ifFile.seekg(currDebugInfo[i].idd.PointerToRawData, std::ios::beg);
 			currDebugInfo[i].data.resize(currDebugInfo[i].idd.SizeOfData);
 			ifFile.read(reinterpret_cast<char*>(&currDebugInfo[i].data[0]), currDebugInfo[i].idd.SizeOfData);
 			if (!ifFile) return ERROR_INVALID_FILE;
 		}
 		
-		std::swap(currDebugInfo, m_vDebugInfo);
+		m_vDebugInfo = std::move(currDebugInfo);
 		
 		return NO_ERROR;
 	}
@@ -108,6 +153,7 @@ namespace PeLib
 	**/
 	void DebugDirectory::rebuild(std::vector<byte>& vBuffer) const
 	{
+		PELIB_TRACE_SPAN("DebugDirectory::rebuild");
 		OutputBuffer obBuffer(vBuffer);
 		
 		for (unsigned int i=0;i<m_vDebugInfo.size();i++)
@@ -137,17 +183,18 @@ namespace PeLib
 	**/
 	int DebugDirectory::write(const std::string& strFilename, unsigned int uiOffset) const
 	{
-		std::fstream ofFile(strFilename.c_str(), std::ios_base::in);
+		PELIB_TRACE_SPAN("DebugDirectory::write");
+		FileStream ofFile(strFilename, std::ios_base::in);
 		
 		if (!ofFile)
 		{
 			ofFile.clear();
-			ofFile.open(strFilename.c_str(), std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::out | std::ios_base::binary);
 		}
 		else
 		{
 			ofFile.close();
-			ofFile.open(strFilename.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
 		}
 
 		if (!ofFile)
@@ -20,15 +20,19 @@ namespace PeLib
 	{
 		private:
 		  /// Stores the various DebugDirectory structures.
-		  std::vector<PELIB_IMG_DEBUG_DIRECTORY> m_vDebugInfo;
+		  ArenaVector<PELIB_IMG_DEBUG_DIRECTORY> m_vDebugInfo;
 		  
-		  std::vector<PELIB_IMG_DEBUG_DIRECTORY> read(InputBuffer& ibBuffer, unsigned int uiSize);
+		  ArenaVector<PELIB_IMG_DEBUG_DIRECTORY> read(InputBuffer& ibBuffer, unsigned int uiSize);
 
 		public:
 		  void clear(); // EXPORT
 		  /// Reads the Debug directory from a file.
-		  int read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize); // EXPORT
-		  int read(unsigned char* buffer, unsigned int buffersize);
+		  int read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, ParseBudget* pBudget = 0); // EXPORT
+		  int read(unsigned char* buffer, unsigned int buffersize, ParseBudget* pBudget = 0);
+		  /// Reads the Debug directory and its data from an in-memory image of a file.
+		  int read(const unsigned char* pcBuffer, unsigned int uiBufferSize, unsigned int uiOffset, unsigned int uiSize, ParseBudget* pBudget = 0); // EXPORT
+		  /// Reads the Debug directory and its data from a stream over a whole file.
+		  int read(std::istream& ifFile, unsigned int uiOffset, unsigned int uiSize, ParseBudget* pBudget = 0); // EXPORT
 		  /// Rebuilds the current Debug directory.
 		  void rebuild(std::vector<byte>& obBuffer) const; // EXPORT
 		  /// Returns the size the current Debug directory needs after rebuilding.
@@ -14,6 +14,7 @@
 
 #include "PeLibInc.h"
 #include "ExportDirectory.h"
+#include "buffer/MemoryInputStream.h"
 
 namespace PeLib
 {
@@ -51,7 +52,7 @@ namespace PeLib
 	**/
 	int ExportDirectory::getFunctionIndex(const std::string& strFunctionName) const
 	{
-		std::vector<PELIB_EXP_FUNC_INFORMATION>::const_iterator Iter = std::find_if(m_ied.functions.begin(), m_ied.functions.end(), std::bind2nd(std::mem_fun_ref(&PELIB_EXP_FUNC_INFORMATION::equal), strFunctionName));
+		ArenaVector<PELIB_EXP_FUNC_INFORMATION>::const_iterator Iter = std::find_if(m_ied.functions.begin(), m_ied.functions.end(), std::bind2nd(std::mem_fun_ref(&PELIB_EXP_FUNC_INFORMATION::equal), strFunctionName));
 		
 		if (Iter == m_ied.functions.end())
 		{
@@ -67,24 +68,62 @@ namespace PeLib
 	* @param uiOffset File offset of the export directory.
 	* @param uiSize Size of the export directory.
 	* @param pehHeader A valid PE header which is necessary because some RVA calculations need to be done.
-    * \todo: Proper use of InputBuffer
+	* @param pBudget Optional budget which is charged for everything the directory allocates.
 	**/
-	int ExportDirectory::read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, const PeHeader& pehHeader)
+	int ExportDirectory::read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, const PeHeader& pehHeader, ParseBudget* pBudget)
 	{
-		std::ifstream ifFile(strFilename.c_str(), std::ios::binary);
+		FileStream ifFile(strFilename, std::ios::in | std::ios::binary);
 		
 		if (!ifFile)
 		{
 			return ERROR_OPENING_FILE;
 		}
 		
-		unsigned int filesize = fileSize(ifFile);
+		return read(ifFile, uiOffset, uiSize, pehHeader, pBudget);
+	}
+
+	/**
+	* @param pcBuffer Pointer to the first byte of an in-memory image of the file.
+	* @param uiBufferSize Size of the buffer.
+	* @param uiOffset File offset of the export directory.
+	* @param uiSize Size of the export directory.
+	* @param pehHeader A valid PE header which is necessary because some RVA calculations need to be done.
+	* @param pBudget Optional budget which is charged for everything the directory allocates.
+	**/
+	int ExportDirectory::read(const unsigned char* pcBuffer, unsigned int uiBufferSize, unsigned int uiOffset, unsigned int uiSize, const PeHeader& pehHeader, ParseBudget* pBudget)
+	{
+		MemoryInputStream misBuffer(pcBuffer, uiBufferSize);
+		return read(misBuffer, uiOffset, uiSize, pehHeader, pBudget);
+	}
+
+	/**
+	* @param ifFile Stream over the whole file.
+	* @param uiOffset File offset of the export directory.
+	* @param uiSize Size of the export directory.
+	* @param pehHeader A valid PE header which is necessary because some RVA calculations need to be done.
+	* @param pBudget Optional budget which is charged for everything the directory allocates.
+    * \todo: Proper use of InputBuffer
+	**/
+	int ExportDirectory::read(std::istream& ifFile, unsigned int uiOffset, unsigned int uiSize, const PeHeader& pehHeader, ParseBudget* pBudget)
+	{
+		qword filesize = fileSize(ifFile);
 		
-		if (filesize < uiOffset + uiSize)
+		if (uiOffset > filesize || uiSize > filesize - uiOffset)
+		{
+			return ERROR_INVALID_FILE;
+		}
+
+		// The directory is read field by field from a buffer of uiSize bytes.
+		if (uiSize < PELIB_IMAGE_EXPORT_DIRECTORY::size())
 		{
 			return ERROR_INVALID_FILE;
 		}
 
+		if (pBudget && !pBudget->chargeBytes(uiSize))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
+
 		ifFile.seekg(uiOffset, std::ios::beg);
 
 		PELIB_IMAGE_EXP_DIRECTORY iedCurr;
@@ -160,6 +199,12 @@ namespace PeLib
 		PELIB_EXP_FUNC_INFORMATION efiCurr;
 		efiCurr.ordinal = 0; efiCurr.addroffunc = 0; efiCurr.addrofname = 0;
 
+		// Both counts come straight from the file, so they are charged before anything is allocated.
+		if (pBudget && (!pBudget->chargeEntries(iedCurr.ied.NumberOfFunctions) || !pBudget->chargeEntries(iedCurr.ied.NumberOfNames)))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
+
 		for (unsigned int i=0;i<iedCurr.ied.NumberOfFunctions;i++)
 		{
 			if (const PeHeader32* p32 = dynamic_cast<const PeHeader32*>(&pehHeader))
@@ -216,7 +261,7 @@ namespace PeLib
 			word ordinal;
 			ifFile.read(reinterpret_cast<char*>(&ordinal), sizeof(ordinal));
 			
-			if (!ifFile)
+			if (!ifFile || ordinal >= iedCurr.functions.size())
 				return ERROR_INVALID_FILE;
 			
 			iedCurr.functions[ordinal].ordinal = ordinal;
@@ -279,6 +324,9 @@ namespace PeLib
 			}
 			while (c != 0);
 
+			if (pBudget && !pBudget->chargeBytes(static_cast<unsigned int>(strFname.size())))
+				return ERROR_BUDGET_EXCEEDED;
+
 			iedCurr.functions[ordinal].funcname = strFname;
 		}
 
@@ -294,6 +342,7 @@ namespace PeLib
 	**/
 	void ExportDirectory::rebuild(std::vector<byte>& vBuffer, dword dwRva) const
 	{
+		PELIB_TRACE_SPAN("ExportDirectory::rebuild");
 		unsigned int uiSizeDirectory = sizeof(PELIB_IMAGE_EXPORT_DIRECTORY);
 
 		unsigned int uiSizeNames = 0;
@@ -386,17 +435,18 @@ namespace PeLib
 	**/
 	int ExportDirectory::write(const std::string& strFilename, unsigned int uiOffset, unsigned int uiRva) const
 	{
-		std::fstream ofFile(strFilename.c_str(), std::ios_base::in);
+		PELIB_TRACE_SPAN("ExportDirectory::write");
+		FileStream ofFile(strFilename, std::ios_base::in);
 		
 		if (!ofFile)
 		{
 			ofFile.clear();
-			ofFile.open(strFilename.c_str(), std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::out | std::ios_base::binary);
 		}
 		else
 		{
 			ofFile.close();
-			ofFile.open(strFilename.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
 		}
 		
 		if (!ofFile)
@@ -36,7 +36,11 @@ namespace PeLib
 		  /// Identifies a function through it's name.
 		  int getFunctionIndex(const std::string& strFunctionName) const; // EXPORT
 		  /// Read a file's export directory.
-		  int read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, const PeHeader& pehHeader); // EXPORT
+		  int read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, const PeHeader& pehHeader, ParseBudget* pBudget = 0); // EXPORT
+		  /// Read the export directory from an in-memory image of a file.
+		  int read(const unsigned char* pcBuffer, unsigned int uiBufferSize, unsigned int uiOffset, unsigned int uiSize, const PeHeader& pehHeader, ParseBudget* pBudget = 0); // EXPORT
+		  /// Read the export directory from a stream over a whole file.
+		  int read(std::istream& ifFile, unsigned int uiOffset, unsigned int uiSize, const PeHeader& pehHeader, ParseBudget* pBudget = 0); // EXPORT
 		  /// Rebuild the current export directory.
 		  void rebuild(std::vector<byte>& vBuffer, dword dwRva) const; // EXPORT
 		  void removeFunction(unsigned int index); // EXPORT
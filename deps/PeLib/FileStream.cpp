@@ -0,0 +1,179 @@
+/*
+* FileStream.cpp - Part of the PeLib library.
+*
+* This software is licensed under the zlib/libpng License.
+* For more details see http://www.opensource.org/licenses/zlib-license.php
+* or the license information file (license.htm) in the root directory
+* of PeLib.
+*/
+
+#include "FileStream.h"
+
+#include <chrono>
+
+namespace PeLib
+{
+	/// Innermost scope of the calling thread.
+	static thread_local IoScope* tlsScope = 0;
+
+	static unsigned long long ioClock()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	IoStats::IoStats()
+	{
+		reset();
+	}
+
+	void IoStats::reset()
+	{
+		ullOpens = 0;
+		ullSeeks = 0;
+		ullReads = 0;
+		ullWrites = 0;
+		ullBytesRead = 0;
+		ullBytesWritten = 0;
+		ullBytesMapped = 0;
+		ullNanoseconds = 0;
+	}
+
+	IoStats& IoStats::operator+=(const IoStats& other)
+	{
+		ullOpens += other.ullOpens;
+		ullSeeks += other.ullSeeks;
+		ullReads += other.ullReads;
+		ullWrites += other.ullWrites;
+		ullBytesRead += other.ullBytesRead;
+		ullBytesWritten += other.ullBytesWritten;
+		ullBytesMapped += other.ullBytesMapped;
+		ullNanoseconds += other.ullNanoseconds;
+		return *this;
+	}
+
+	IoScope::IoScope(IoStats& stats) : m_pStats(&stats), m_pParent(tlsScope), m_bInstalled(true)
+	{
+		for (IoScope* pScope = tlsScope; pScope; pScope = pScope->m_pParent)
+		{
+			if (pScope->m_pStats == m_pStats)
+			{
+				m_bInstalled = false;
+				return;
+			}
+		}
+		tlsScope = this;
+	}
+
+	IoScope::~IoScope()
+	{
+		if (m_bInstalled)
+		{
+			tlsScope = m_pParent;
+		}
+	}
+
+	void IoScope::charge(const IoStats& ioDelta)
+	{
+		for (IoScope* pScope = tlsScope; pScope; pScope = pScope->m_pParent)
+		{
+			*pScope->m_pStats += ioDelta;
+		}
+	}
+
+	std::streamsize FileBuffer::xsgetn(char_type* pcBuffer, std::streamsize iCount)
+	{
+		IoStats ioDelta;
+		unsigned long long ullBegin = ioClock();
+		std::streamsize iRead = std::filebuf::xsgetn(pcBuffer, iCount);
+		ioDelta.ullNanoseconds = ioClock() - ullBegin;
+		ioDelta.ullReads = 1;
+		ioDelta.ullBytesRead = iRead > 0 ? iRead : 0;
+		IoScope::charge(ioDelta);
+		return iRead;
+	}
+
+	std::streamsize FileBuffer::xsputn(const char_type* pcBuffer, std::streamsize iCount)
+	{
+		IoStats ioDelta;
+		unsigned long long ullBegin = ioClock();
+		std::streamsize iWritten = std::filebuf::xsputn(pcBuffer, iCount);
+		ioDelta.ullNanoseconds = ioClock() - ullBegin;
+		ioDelta.ullWrites = 1;
+		ioDelta.ullBytesWritten = iWritten > 0 ? iWritten : 0;
+		IoScope::charge(ioDelta);
+		return iWritten;
+	}
+
+	FileBuffer::pos_type FileBuffer::seekoff(off_type iOffset, std::ios_base::seekdir dir, std::ios_base::openmode mode)
+	{
+		IoStats ioDelta;
+		unsigned long long ullBegin = ioClock();
+		pos_type iPosition = std::filebuf::seekoff(iOffset, dir, mode);
+		ioDelta.ullNanoseconds = ioClock() - ullBegin;
+		ioDelta.ullSeeks = 1;
+		IoScope::charge(ioDelta);
+		return iPosition;
+	}
+
+	FileBuffer::pos_type FileBuffer::seekpos(pos_type iPosition, std::ios_base::openmode mode)
+	{
+		IoStats ioDelta;
+		unsigned long long ullBegin = ioClock();
+		pos_type iNewPosition = std::filebuf::seekpos(iPosition, mode);
+		ioDelta.ullNanoseconds = ioClock() - ullBegin;
+		ioDelta.ullSeeks = 1;
+		IoScope::charge(ioDelta);
+		return iNewPosition;
+	}
+
+	FileBuffer* FileBuffer::open(const std::string& strFilename, std::ios_base::openmode mode)
+	{
+		IoStats ioDelta;
+		unsigned long long ullBegin = ioClock();
+		std::filebuf* pOpened = std::filebuf::open(strFilename.c_str(), mode);
+		ioDelta.ullNanoseconds = ioClock() - ullBegin;
+		ioDelta.ullOpens = 1;
+		IoScope::charge(ioDelta);
+		return pOpened ? this : 0;
+	}
+
+	FileStream::FileStream() : std::iostream(0)
+	{
+		init(&m_fbBuffer);
+	}
+
+	/**
+	* @param strFilename Name of the file.
+	* @param mode Mode to open the file with, as for std::fstream.
+	**/
+	FileStream::FileStream(const std::string& strFilename, std::ios_base::openmode mode) : std::iostream(0)
+	{
+		init(&m_fbBuffer);
+		open(strFilename, mode);
+	}
+
+	void FileStream::open(const std::string& strFilename, std::ios_base::openmode mode)
+	{
+		if (m_fbBuffer.open(strFilename, mode))
+		{
+			clear();
+		}
+		else
+		{
+			setstate(std::ios_base::failbit);
+		}
+	}
+
+	bool FileStream::is_open() const
+	{
+		return m_fbBuffer.is_open();
+	}
+
+	void FileStream::close()
+	{
+		if (!m_fbBuffer.close())
+		{
+			setstate(std::ios_base::failbit);
+		}
+	}
+}
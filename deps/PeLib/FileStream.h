@@ -0,0 +1,103 @@
+/*
+* FileStream.h - Part of the PeLib library.
+*
+* This software is licensed under the zlib/libpng License.
+* For more details see http://www.opensource.org/licenses/zlib-license.php
+* or the license information file (license.htm) in the root directory
+* of PeLib.
+*/
+
+#ifndef FILESTREAM_H
+#define FILESTREAM_H
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace PeLib
+{
+	/// Counters of the file I/O done through #PeLib::FileStream.
+	struct IoStats
+	{
+		unsigned long long ullOpens; ///< Calls to open, including failed ones.
+		unsigned long long ullSeeks; ///< Seeks, including those done by tellg and tellp.
+		unsigned long long ullReads; ///< Calls to read.
+		unsigned long long ullWrites; ///< Calls to write.
+		unsigned long long ullBytesRead; ///< Bytes returned by all reads.
+		unsigned long long ullBytesWritten; ///< Bytes accepted by all writes.
+		unsigned long long ullBytesMapped; ///< Bytes of files mapped into memory, whose opens are counted too.
+		unsigned long long ullNanoseconds; ///< Time spent inside all of the calls above.
+
+		IoStats();
+
+		/// Sets all counters to zero.
+		void reset(); // EXPORT
+		/// Adds the counters of another IoStats.
+		IoStats& operator+=(const IoStats& other); // EXPORT
+	};
+
+	/// Charges all file I/O of the calling thread to an IoStats until the end of the scope.
+	/**
+	* Scopes nest, and I/O is charged to every scope which is open on the thread, so the totals of a
+	* whole run include those of each file parsed during it. Opening a scope for an IoStats which
+	* already has one open further out does nothing, so nothing is counted twice. An IoStats may only
+	* have scopes on one thread at a time.
+	**/
+	class IoScope
+	{
+		private:
+		  IoStats* m_pStats;
+		  IoScope* m_pParent;
+		  bool m_bInstalled;
+
+		  IoScope(const IoScope&);
+		  IoScope& operator=(const IoScope&);
+
+		public:
+		  explicit IoScope(IoStats& stats);
+		  ~IoScope();
+
+		  /// Adds ioDelta to every scope which is open on the calling thread.
+		  static void charge(const IoStats& ioDelta);
+	};
+
+	/// File buffer which charges every open, seek, read and write to the thread's #PeLib::IoScope.
+	class FileBuffer : public std::filebuf
+	{
+		protected:
+		  std::streamsize xsgetn(char_type* pcBuffer, std::streamsize iCount) override;
+		  std::streamsize xsputn(const char_type* pcBuffer, std::streamsize iCount) override;
+		  pos_type seekoff(off_type iOffset, std::ios_base::seekdir dir, std::ios_base::openmode mode) override;
+		  pos_type seekpos(pos_type iPosition, std::ios_base::openmode mode) override;
+
+		public:
+		  FileBuffer* open(const std::string& strFilename, std::ios_base::openmode mode);
+	};
+
+	/// The stream all of PeLib's file access goes through.
+	/**
+	* A drop-in replacement for std::fstream: unlike std::ifstream and std::ofstream it doesn't add
+	* std::ios::in or std::ios::out to the mode, so callers pass exactly the mode they need.
+	**/
+	class FileStream : public std::iostream
+	{
+		private:
+		  FileBuffer m_fbBuffer;
+
+		  FileStream(const FileStream&);
+		  FileStream& operator=(const FileStream&);
+
+		public:
+		  FileStream();
+		  FileStream(const std::string& strFilename, std::ios_base::openmode mode);
+
+		  /// Opens a file, setting failbit if it can't be opened.
+		  void open(const std::string& strFilename, std::ios_base::openmode mode);
+		  /// Returns true if a file is open.
+		  bool is_open() const;
+		  /// Closes the file, setting failbit if that fails.
+		  void close();
+	};
+}
+
+#endif
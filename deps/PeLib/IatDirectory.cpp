@@ -14,11 +14,16 @@
 
 namespace PeLib
 {
-	int IatDirectory::read(InputBuffer& inputBuffer, unsigned int size)
+	int IatDirectory::read(InputBuffer& inputBuffer, unsigned int size, ParseBudget* pBudget)
 	{
 		dword dwAddr;
 
-		std::vector<dword> vIat;
+		if (pBudget && (!pBudget->chargeEntries(size/sizeof(dword)) || !pBudget->chargeBytes(size)))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
+
+		ArenaVector<dword> vIat;
 
 		for (unsigned int i=0;i<size/sizeof(dword);i++)
 		{
@@ -26,7 +31,7 @@ namespace PeLib
 			vIat.push_back(dwAddr);
 		}
 		
-		std::swap(vIat, m_vIat);
+		m_vIat = std::move(vIat);
 		
 		return NO_ERROR;
 	}
@@ -36,35 +41,46 @@ namespace PeLib
 	* @param strFilename Name of the file.
 	* @param dwOffset File offset of the IAT (see #PeFile::PeHeader::getIDIatRVA).
 	* @param dwSize Size of the IAT (see #PeFile::PeHeader::getIDIatSize).
+	* @param pBudget Optional budget to charge the work against.
 	**/
-	int IatDirectory::read(const std::string& strFilename, unsigned int dwOffset, unsigned int dwSize)
+	int IatDirectory::read(const std::string& strFilename, unsigned int dwOffset, unsigned int dwSize, ParseBudget* pBudget)
 	{
-		std::ifstream ifFile(strFilename.c_str(), std::ios::binary);
+		FileStream ifFile(strFilename, std::ios::in | std::ios::binary);
 		
 		if (!ifFile)
 		{
 			return ERROR_OPENING_FILE;
 		}
 		
-		if (fileSize(ifFile) < dwOffset + dwSize)
+		if (fileSize(ifFile) < static_cast<qword>(dwOffset) + dwSize)
 		{
 			return ERROR_INVALID_FILE;
 		}
 		
+		if (pBudget && !pBudget->chargeBytes(dwSize))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
+		
 		ifFile.seekg(dwOffset, std::ios::beg);
 		
 		std::vector<byte> vBuffer(dwSize);
 		ifFile.read(reinterpret_cast<char*>(&vBuffer[0]), dwSize);
 
 		InputBuffer inpBuffer(vBuffer);
-		return read(inpBuffer, dwSize);
+		return read(inpBuffer, dwSize, pBudget);
 	}
 	
-	int IatDirectory::read(unsigned char* buffer, unsigned int buffersize)
+	int IatDirectory::read(unsigned char* buffer, unsigned int buffersize, ParseBudget* pBudget)
 	{
+		if (pBudget && !pBudget->chargeBytes(buffersize))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
+
 		std::vector<byte> vBuffer(buffer, buffer + buffersize);
 		InputBuffer inpBuffer(vBuffer);
-		return read(inpBuffer, buffersize);
+		return read(inpBuffer, buffersize, pBudget);
 	}
 	
 	/**
@@ -112,7 +128,7 @@ namespace PeLib
 	**/
 	void IatDirectory::removeAddress(unsigned int index)
 	{
-		std::vector<dword>::iterator pos = m_vIat.begin() + index;
+		ArenaVector<dword>::iterator pos = m_vIat.begin() + index;
 		m_vIat.erase(pos);
 	}
 	
@@ -130,6 +146,7 @@ namespace PeLib
 	**/
 	void IatDirectory::rebuild(std::vector<byte>& vBuffer) const
 	{
+		PELIB_TRACE_SPAN("IatDirectory::rebuild");
 		vBuffer.reserve(size());
 		OutputBuffer obBuffer(vBuffer);
 	
@@ -147,17 +164,18 @@ namespace PeLib
 	/// Writes the current IAT to a file.
 	int IatDirectory::write(const std::string& strFilename, unsigned int uiOffset) const
 	{
-		std::fstream ofFile(strFilename.c_str(), std::ios_base::in);
+		PELIB_TRACE_SPAN("IatDirectory::write");
+		FileStream ofFile(strFilename, std::ios_base::in);
 		
 		if (!ofFile)
 		{
 			ofFile.clear();
-			ofFile.open(strFilename.c_str(), std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::out | std::ios_base::binary);
 		}
 		else
 		{
 			ofFile.close();
-			ofFile.open(strFilename.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
 		}
 
 		if (!ofFile)
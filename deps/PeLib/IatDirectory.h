@@ -24,14 +24,14 @@ namespace PeLib
 	class IatDirectory
 	{
 		private:
-		  std::vector<dword> m_vIat; ///< Stores the individual IAT fields.
+		  ArenaVector<dword> m_vIat; ///< Stores the individual IAT fields.
 		  
-		  int read(InputBuffer& inputBuffer, unsigned int size);
+		  int read(InputBuffer& inputBuffer, unsigned int size, ParseBudget* pBudget);
 		  
 		public:
 		  /// Reads the Import Address Table from a PE file.
-		  int read(const std::string& strFilename, unsigned int dwOffset, unsigned int dwSize); // EXPORT
-		  int read(unsigned char* buffer, unsigned int buffersize); // EXPORT
+		  int read(const std::string& strFilename, unsigned int dwOffset, unsigned int dwSize, ParseBudget* pBudget = 0); // EXPORT
+		  int read(unsigned char* buffer, unsigned int buffersize, ParseBudget* pBudget = 0); // EXPORT
 		  /// Returns the number of fields in the IAT.
 		  unsigned int calcNumberOfAddresses() const; // EXPORT
 		  /// Adds another address to the IAT.
@@ -15,6 +15,7 @@
 
 #include "PeLibAux.h"
 #include "PeHeader.h"
+#include "buffer/MemoryInputStream.h"
 
 namespace PeLib
 {
@@ -37,14 +38,14 @@ namespace PeLib
 	template<int bits>
 	class ImportDirectory
 	{
-		typedef typename std::vector<PELIB_IMAGE_IMPORT_DIRECTORY<bits> >::iterator ImpDirFileIterator;
-		typedef typename std::vector<PELIB_IMAGE_IMPORT_DIRECTORY<bits> >::const_iterator ConstImpDirFileIterator;
+		typedef typename ArenaVector<PELIB_IMAGE_IMPORT_DIRECTORY<bits> >::iterator ImpDirFileIterator;
+		typedef typename ArenaVector<PELIB_IMAGE_IMPORT_DIRECTORY<bits> >::const_iterator ConstImpDirFileIterator;
 	
 		private:
 		  /// Stores information about already imported DLLs.
-		  std::vector<PELIB_IMAGE_IMPORT_DIRECTORY<bits> > m_vOldiid;
+		  ArenaVector<PELIB_IMAGE_IMPORT_DIRECTORY<bits> > m_vOldiid;
 		  /// Stores information about imported DLLs which will be added.
-		  std::vector<PELIB_IMAGE_IMPORT_DIRECTORY<bits> > m_vNewiid;
+		  ArenaVector<PELIB_IMAGE_IMPORT_DIRECTORY<bits> > m_vNewiid;
 
 		// I can't convince Borland C++ to compile the function outside of the class declaration.
 		// That's why the function definition is here.
@@ -62,7 +63,7 @@ namespace PeLib
 					
 					if (FileIter != EndIter)
 					{
-						typename std::vector<PELIB_THUNK_DATA<bits> >::const_iterator Iter = std::find_if(FileIter->originalfirstthunk.begin(), FileIter->originalfirstthunk.end(), std::bind2nd(std::mem_fun_ref(comp), value));
+						typename ArenaVector<PELIB_THUNK_DATA<bits> >::const_iterator Iter = std::find_if(FileIter->originalfirstthunk.begin(), FileIter->originalfirstthunk.end(), std::bind2nd(std::mem_fun_ref(comp), value));
 						if (Iter != FileIter->originalfirstthunk.end())
 						{
 							return true;
@@ -108,7 +109,11 @@ namespace PeLib
 		  /// Get the number of fucntions which are imported by a specific file.
 		  dword getNumberOfFunctions(dword dwFilenr, currdir cdDir) const; // EXPORT
 		  /// Read a file's import directory.
-		  int read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, const PeHeaderT<bits>& pehHeader); // EXPORT
+		  int read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, const PeHeaderT<bits>& pehHeader, ParseBudget* pBudget = 0); // EXPORT
+		  /// Read the import directory from an in-memory image of a file.
+		  int read(const unsigned char* pcBuffer, unsigned int uiBufferSize, unsigned int uiOffset, unsigned int uiSize, const PeHeaderT<bits>& pehHeader, ParseBudget* pBudget = 0); // EXPORT
+		  /// Read the import directory from a stream over a whole file.
+		  int read(std::istream& ifFile, unsigned int uiOffset, unsigned int uiSize, const PeHeaderT<bits>& pehHeader, ParseBudget* pBudget = 0); // EXPORT
 		  /// Rebuild the import directory.
 		  void rebuild(std::vector<byte>& vBuffer, dword dwRva, bool fixEntries = true) const; // EXPORT
 		  /// Remove a file from the import directory.
@@ -243,7 +248,7 @@ namespace PeLib
 	template<int bits>
 	unsigned int ImportDirectory<bits>::getFileIndex(const std::string& strFilename, currdir cdDir) const
 	{
-		const std::vector<PELIB_IMAGE_IMPORT_DIRECTORY<bits> >* currDir;
+		const ArenaVector<PELIB_IMAGE_IMPORT_DIRECTORY<bits> >* currDir;
 		
 		if (cdDir == OLDDIR)
 		{
@@ -441,29 +446,71 @@ namespace PeLib
 
 	/**
 	* Read an import directory from a file.
-	* \todo Check if streams failed.
 	* @param strFilename Name of the file which will be read.
 	* @param uiOffset Offset of the import directory (see #PeLib::PeHeader::getIDImportRVA).
 	* @param uiSize Size of the import directory (see #PeLib::PeHeader::getIDImportSize).
 	* @param pehHeader A valid PE header.
+	* @param pBudget Optional budget which is charged for everything the directory allocates.
 	**/
 	template<int bits>
-	int ImportDirectory<bits>::read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, const PeHeaderT<bits>& pehHeader)
+	int ImportDirectory<bits>::read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, const PeHeaderT<bits>& pehHeader, ParseBudget* pBudget)
 	{
-		std::ifstream ifFile(strFilename.c_str(), std::ios_base::binary);
+		FileStream ifFile(strFilename, std::ios_base::in | std::ios_base::binary);
 
 		if (!ifFile)
 		{
 			return ERROR_OPENING_FILE;
 		}
+
+		return read(ifFile, uiOffset, uiSize, pehHeader, pBudget);
+	}
+
+	/**
+	* Read an import directory from an in-memory image of a file.
+	* @param pcBuffer Pointer to the first byte of the file.
+	* @param uiBufferSize Size of the buffer.
+	* @param uiOffset Offset of the import directory (see #PeLib::PeHeader::getIDImportRVA).
+	* @param uiSize Size of the import directory (see #PeLib::PeHeader::getIDImportSize).
+	* @param pehHeader A valid PE header.
+	* @param pBudget Optional budget which is charged for everything the directory allocates.
+	**/
+	template<int bits>
+	int ImportDirectory<bits>::read(const unsigned char* pcBuffer, unsigned int uiBufferSize, unsigned int uiOffset, unsigned int uiSize, const PeHeaderT<bits>& pehHeader, ParseBudget* pBudget)
+	{
+		MemoryInputStream misBuffer(pcBuffer, uiBufferSize);
+		return read(misBuffer, uiOffset, uiSize, pehHeader, pBudget);
+	}
+
+	/**
+	* Read an import directory from a stream over a whole file.
+	* \todo Check if streams failed.
+	* @param ifFile Stream over the whole file.
+	* @param uiOffset Offset of the import directory (see #PeLib::PeHeader::getIDImportRVA).
+	* @param uiSize Size of the import directory (see #PeLib::PeHeader::getIDImportSize).
+	* @param pehHeader A valid PE header.
+	* @param pBudget Optional budget which is charged for everything the directory allocates.
+	**/
+	template<int bits>
+	int ImportDirectory<bits>::read(std::istream& ifFile, unsigned int uiOffset, unsigned int uiSize, const PeHeaderT<bits>& pehHeader, ParseBudget* pBudget)
+	{
+		qword ullFileSize = fileSize(ifFile);
 		
-		unsigned int uiFileSize = fileSize(ifFile);
-		
-		if (uiFileSize < uiOffset + uiSize)
+		if (uiOffset > ullFileSize || uiSize > ullFileSize - uiOffset)
+		{
+			return ERROR_INVALID_FILE;
+		}
+
+		// The first descriptor is read before the size is checked against the next one.
+		if (uiSize < PELIB_IMAGE_IMPORT_DESCRIPTOR::size())
 		{
 			return ERROR_INVALID_FILE;
 		}
 
+		if (pBudget && !pBudget->chargeBytes(uiSize))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
+
 		ifFile.seekg(uiOffset, std::ios_base::beg);
 
 		std::vector<unsigned char> vImportdirectory(uiSize);
@@ -474,7 +521,7 @@ namespace PeLib
 
 		InputBuffer inpBuffer(vImportdirectory);
 
-		std::vector<PELIB_IMAGE_IMPORT_DIRECTORY<bits> > vOldIidCurr;
+		ArenaVector<PELIB_IMAGE_IMPORT_DIRECTORY<bits> > vOldIidCurr;
 
 		do // Read and store all descriptors
 		{
@@ -487,6 +534,8 @@ namespace PeLib
 			if (iidCurr.impdesc.OriginalFirstThunk != 0 || iidCurr.impdesc.TimeDateStamp != 0 || iidCurr.impdesc.ForwarderChain != 0 ||
 			iidCurr.impdesc.Name != 0 || iidCurr.impdesc.FirstThunk != 0)
 			{
+				if (pBudget && !pBudget->chargeEntries(1))
+					return ERROR_BUDGET_EXCEEDED;
 				vOldIidCurr.push_back(iidCurr);
 			}
 
@@ -512,6 +561,9 @@ namespace PeLib
 				dllname += namebuffer;
 			} while (true);
 			
+			if (pBudget && !pBudget->chargeBytes(static_cast<unsigned int>(dllname.size())))
+				return ERROR_BUDGET_EXCEEDED;
+
 			vOldIidCurr[i].name = dllname;
 			
 		}
@@ -531,13 +583,15 @@ namespace PeLib
 
 			do
 			{
-				if (uiFileSize < pehHeader.rvaToOffset(uiVaoft) + sizeof(tdCurr.itd.Ordinal))
+				if (ullFileSize < static_cast<qword>(pehHeader.rvaToOffset(uiVaoft)) + sizeof(tdCurr.itd.Ordinal))
 				{
 					return ERROR_INVALID_FILE;
 				}
 				uiVaoft += sizeof(tdCurr.itd.Ordinal);
 				
 				ifFile.read(reinterpret_cast<char*>(&tdCurr.itd.Ordinal), sizeof(tdCurr.itd.Ordinal));
+				if (tdCurr.itd.Ordinal && pBudget && !pBudget->chargeEntries(1))
+					return ERROR_BUDGET_EXCEEDED;
 				if (tdCurr.itd.Ordinal) vOldIidCurr[i].originalfirstthunk.push_back(tdCurr);
 			} while (tdCurr.itd.Ordinal);
 		}
@@ -552,7 +606,7 @@ namespace PeLib
 
 			do
 			{
-				if (uiFileSize < pehHeader.rvaToOffset(uiVaoft) + sizeof(tdCurr.itd.Ordinal))
+				if (ullFileSize < static_cast<qword>(pehHeader.rvaToOffset(uiVaoft)) + sizeof(tdCurr.itd.Ordinal))
 				{
 					return ERROR_INVALID_FILE;
 				}
@@ -560,6 +614,8 @@ namespace PeLib
 				uiVaoft += sizeof(tdCurr.itd.Ordinal);
 				
 				ifFile.read(reinterpret_cast<char*>(&tdCurr.itd.Ordinal), sizeof(tdCurr.itd.Ordinal));
+				if (tdCurr.itd.Ordinal && pBudget && !pBudget->chargeEntries(1))
+					return ERROR_BUDGET_EXCEEDED;
 				if (tdCurr.itd.Ordinal) vOldIidCurr[i].firstthunk.push_back(tdCurr);
 			} while (tdCurr.itd.Ordinal);
 		}
@@ -592,6 +648,9 @@ namespace PeLib
 						funcname += namebuffer;
 					} while (true);
 			
+					if (pBudget && !pBudget->chargeBytes(static_cast<unsigned int>(funcname.size())))
+						return ERROR_BUDGET_EXCEEDED;
+
 					vOldIidCurr[i].originalfirstthunk[j].fname = funcname;
 				}
 			}
@@ -619,11 +678,14 @@ namespace PeLib
 						funcname += namebuffer;
 					} while (true);
 			
+					if (pBudget && !pBudget->chargeBytes(static_cast<unsigned int>(funcname.size())))
+						return ERROR_BUDGET_EXCEEDED;
+
 					vOldIidCurr[i].firstthunk[j].fname = funcname;
 				}
 			}
 		}
-		std::swap(vOldIidCurr, m_vOldiid);
+		m_vOldiid = std::move(vOldIidCurr);
 		return NO_ERROR;
 	}
 
@@ -636,6 +698,7 @@ namespace PeLib
 	template<int bits>
 	void ImportDirectory<bits>::rebuild(std::vector<byte>& vBuffer, dword dwRva, bool fixEntries) const
 	{
+		PELIB_TRACE_SPAN("ImportDirectory::rebuild");
 		unsigned int uiImprva = dwRva;
 		unsigned int uiSizeofdescriptors = (static_cast<unsigned int>(m_vNewiid.size() + m_vOldiid.size()) + 1) * PELIB_IMAGE_IMPORT_DESCRIPTOR::size();
 		
@@ -812,17 +875,18 @@ namespace PeLib
 	template<int bits>
 	int ImportDirectory<bits>::write(const std::string& strFilename, unsigned int uiOffset, unsigned int uiRva)
 	{
-		std::fstream ofFile(strFilename.c_str(), std::ios_base::in);
+		PELIB_TRACE_SPAN("ImportDirectory::write");
+		FileStream ofFile(strFilename, std::ios_base::in);
 		
 		if (!ofFile)
 		{
 			ofFile.clear();
-			ofFile.open(strFilename.c_str(), std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::out | std::ios_base::binary);
 		}
 		else
 		{
 			ofFile.close();
-			ofFile.open(strFilename.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
 		}
 		
 		if (!ofFile)
@@ -109,7 +109,7 @@ namespace PeLib
 	**/
 	int MzHeader::read(const std::string& strFilename)
 	{
-		std::ifstream ifFile(strFilename.c_str(), std::ios::binary);
+		FileStream ifFile(strFilename, std::ios::in | std::ios::binary);
 
 		if (!ifFile)
 		{
@@ -148,8 +148,7 @@ namespace PeLib
 			return ERROR_INVALID_FILE;
 		}
 		
-		std::vector<byte> vBuffer(pcBuffer, pcBuffer + uiSize);
-		for (int i=0;i<0x40;i++) std::cout << std::hex << (int)vBuffer[i] << " ";
+		std::vector<byte> vBuffer(pcBuffer, pcBuffer + PELIB_IMAGE_DOS_HEADER::size());
 
 		originalOffset = originalOffs;
 		
@@ -166,6 +165,7 @@ namespace PeLib
 	**/
 	void MzHeader::rebuild(std::vector<byte>& vBuffer) const
 	{
+		PELIB_TRACE_SPAN("MzHeader::rebuild");
 		OutputBuffer obBuffer(vBuffer);
 
 		obBuffer << m_idhHeader.e_magic;
@@ -219,17 +219,18 @@ namespace PeLib
 	**/
 	int MzHeader::write(const std::string& strFilename, dword dwOffset = 0) const
 	{
-		std::fstream ofFile(strFilename.c_str(), std::ios_base::in);
+		PELIB_TRACE_SPAN("MzHeader::write");
+		FileStream ofFile(strFilename, std::ios_base::in);
 		
 		if (!ofFile)
 		{
 			ofFile.clear();
-			ofFile.open(strFilename.c_str(), std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::out | std::ios_base::binary);
 		}
 		else
 		{
 			ofFile.close();
-			ofFile.open(strFilename.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
 		}
 		
 		if (!ofFile)
@@ -166,4 +166,41 @@ namespace PeLib
 		return m_debugdir;
 	}
 
+	/**
+	* The budget's usage starts from zero, so the same limits can be handed to every file.
+	* @param budget Limits for all directory readers of the current file.
+	**/
+	void PeFile::setParseBudget(const ParseBudget& budget)
+	{
+		m_budget = budget;
+		m_budget.reset();
+	}
+
+	
+	const ParseBudget& PeFile::parseBudget() const
+	{
+		return m_budget;
+	}
+
+	
+	ParseBudget& PeFile::parseBudget()
+	{
+		return m_budget;
+	}
+
+	/**
+	* Counts the I/O of the readers which read from disc; reading from a buffer does none. Writes
+	* are done by the headers and directories themselves and are counted by the caller's IoScope.
+	**/
+	const IoStats& PeFile::ioStats() const
+	{
+		return m_io;
+	}
+
+	
+	IoStats& PeFile::ioStats()
+	{
+		return m_io;
+	}
+
 }
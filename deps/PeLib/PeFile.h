@@ -75,6 +75,8 @@ namespace PeLib
 		  ComHeaderDirectory m_comdesc; ///< COM+ descriptor directory of the current file.
 		  IatDirectory m_iat; ///< Import address table of the current file.
 		  DebugDirectory m_debugdir;
+		  ParseBudget m_budget; ///< Limits what the directory readers may allocate for the current file.
+		  IoStats m_io; ///< File I/O done while reading the current file.
 		public:
 		  virtual ~PeFile();
 		  
@@ -148,6 +150,18 @@ namespace PeLib
 		  const DebugDirectory& debugDir() const;
 		  /// Accessor function for the debug directory.
 		  DebugDirectory& debugDir(); // EXPORT
+
+		  /// Sets the budget which all directory readers of the current file are charged against.
+		  void setParseBudget(const ParseBudget& budget); // EXPORT
+		  /// Accessor function for the parse budget.
+		  const ParseBudget& parseBudget() const;
+		  /// Accessor function for the parse budget.
+		  ParseBudget& parseBudget(); // EXPORT
+
+		  /// Accessor function for the I/O the readers of the current file did so far.
+		  const IoStats& ioStats() const; // EXPORT
+		  /// Accessor function for the I/O the readers of the current file did so far.
+		  IoStats& ioStats(); // EXPORT
 		  
 	};
 	
@@ -163,6 +177,9 @@ namespace PeLib
 		  PeHeader32_64 m_peh; ///< PE header of the current file.
 		  ImportDirectory<bits> m_impdir; ///< Import directory of the current file.
 		  TlsDirectory<bits> m_tlsdir;
+
+		  /// Locates a data directory inside an in-memory image of the file.
+		  int getDirectoryOffset(dword dwRva, dword dwSize, unsigned int uiSize, unsigned int& uiOffset) const;
 		
 		public:
 		  /// Default constructor which exists only for the sake of allowing to construct files without filenames.
@@ -199,6 +216,29 @@ namespace PeLib
 		  /// Reads the Debug directory of the current file.		  
 		  int readDebugDirectory() ;
 		  int readTlsDirectory() ;
+
+		  /// Reads the MZ header from an in-memory image of the file.
+		  int readMzHeader(const unsigned char* pcBuffer, unsigned int uiSize);
+		  /// Reads the PE header from an in-memory image of the file.
+		  int readPeHeader(const unsigned char* pcBuffer, unsigned int uiSize);
+		  /// Reads the export directory from an in-memory image of the file.
+		  int readExportDirectory(const unsigned char* pcBuffer, unsigned int uiSize);
+		  /// Reads the import directory from an in-memory image of the file.
+		  int readImportDirectory(const unsigned char* pcBuffer, unsigned int uiSize);
+		  /// Reads the bound import directory from an in-memory image of the file.
+		  int readBoundImportDirectory(const unsigned char* pcBuffer, unsigned int uiSize);
+		  /// Reads the resource directory from an in-memory image of the file.
+		  int readResourceDirectory(const unsigned char* pcBuffer, unsigned int uiSize);
+		  /// Reads the relocations directory from an in-memory image of the file.
+		  int readRelocationsDirectory(const unsigned char* pcBuffer, unsigned int uiSize);
+		  /// Reads the COM+ descriptor directory from an in-memory image of the file.
+		  int readComHeaderDirectory(const unsigned char* pcBuffer, unsigned int uiSize);
+		  /// Reads the IAT directory from an in-memory image of the file.
+		  int readIatDirectory(const unsigned char* pcBuffer, unsigned int uiSize);
+		  /// Reads the Debug directory from an in-memory image of the file.
+		  int readDebugDirectory(const unsigned char* pcBuffer, unsigned int uiSize);
+		  /// Reads the TLS directory from an in-memory image of the file.
+		  int readTlsDirectory(const unsigned char* pcBuffer, unsigned int uiSize);
 		  
 		  unsigned int getBits() const
 		  {
@@ -267,6 +307,8 @@ namespace PeLib
 	template<int bits>
 	int PeFileT<bits>::readPeHeader() 
 	{
+		PELIB_TRACE_SPAN("PeFile::readPeHeader");
+		IoScope ioScope(m_io);
 		return peHeader().read(getFileName(), mzHeader().getAddressOfPeHeader());
 	}
 
@@ -274,11 +316,13 @@ namespace PeLib
 	template<int bits>
 	int PeFileT<bits>::readImportDirectory() 
 	{
+		PELIB_TRACE_SPAN("PeFile::readImportDirectory");
+		IoScope ioScope(m_io);
 		if (peHeader().calcNumberOfRvaAndSizes() >= 2
 			&& peHeader().getIddImportRva()
 			&& peHeader().getIddImportSize())
 		{
-			return impDir().read(getFileName(), static_cast<unsigned int>(peHeader().rvaToOffset(peHeader().getIddImportRva())), peHeader().getIddImportSize(), peHeader());
+			return impDir().read(getFileName(), static_cast<unsigned int>(peHeader().rvaToOffset(peHeader().getIddImportRva())), peHeader().getIddImportSize(), peHeader(), &m_budget);
 		}
 		return ERROR_DIRECTORY_DOES_NOT_EXIST;
 	}
@@ -352,16 +396,265 @@ namespace PeLib
 	template<int bits>
 	int PeFileT<bits>::readMzHeader() 
 	{
+		PELIB_TRACE_SPAN("PeFile::readMzHeader");
+		IoScope ioScope(m_io);
 		return mzHeader().read(getFileName());
 	}
 	
+	/**
+	* Reads the MZ header from a buffer which holds the whole file, without touching the filesystem.
+	* @param pcBuffer Pointer to the first byte of the file.
+	* @param uiSize Size of the buffer.
+	**/
+	template<int bits>
+	int PeFileT<bits>::readMzHeader(const unsigned char* pcBuffer, unsigned int uiSize)
+	{
+		PELIB_TRACE_SPAN("PeFile::readMzHeader");
+		return mzHeader().read(const_cast<unsigned char*>(pcBuffer), uiSize);
+	}
+
+	/**
+	* Reads the PE header from a buffer which holds the whole file. The MZ header must be read first.
+	* @param pcBuffer Pointer to the first byte of the file.
+	* @param uiSize Size of the buffer.
+	**/
+	template<int bits>
+	int PeFileT<bits>::readPeHeader(const unsigned char* pcBuffer, unsigned int uiSize)
+	{
+		PELIB_TRACE_SPAN("PeFile::readPeHeader");
+		unsigned int uiOffset = mzHeader().getAddressOfPeHeader();
+		if (uiOffset >= uiSize)
+		{
+			return ERROR_INVALID_FILE;
+		}
+		return peHeader().read(pcBuffer + uiOffset, uiSize - uiOffset, uiOffset);
+	}
+
+	/**
+	* Translates a data directory's RVA and checks the directory lies entirely inside the buffer.
+	* @param dwRva RVA of the directory.
+	* @param dwSize Size of the directory.
+	* @param uiSize Size of the buffer which holds the whole file.
+	* @param uiOffset Receives the file offset of the directory.
+	**/
+	template<int bits>
+	int PeFileT<bits>::getDirectoryOffset(dword dwRva, dword dwSize, unsigned int uiSize, unsigned int& uiOffset) const
+	{
+		uiOffset = static_cast<unsigned int>(peHeader().rvaToOffset(dwRva));
+		if (uiOffset >= uiSize || uiSize - uiOffset < dwSize)
+		{
+			return ERROR_INVALID_FILE;
+		}
+		return NO_ERROR;
+	}
+
+	/**
+	* Reads the export directory from a buffer which holds the whole file. The PE header must be read first.
+	* @param pcBuffer Pointer to the first byte of the file.
+	* @param uiSize Size of the buffer.
+	**/
+	template<int bits>
+	int PeFileT<bits>::readExportDirectory(const unsigned char* pcBuffer, unsigned int uiSize)
+	{
+		PELIB_TRACE_SPAN("PeFile::readExportDirectory");
+		if (peHeader().calcNumberOfRvaAndSizes() >= 1
+			&& peHeader().getIddExportRva() && peHeader().getIddExportSize())
+		{
+			unsigned int uiOffset;
+			if (getDirectoryOffset(peHeader().getIddExportRva(), peHeader().getIddExportSize(), uiSize, uiOffset) != NO_ERROR)
+			{
+				return ERROR_INVALID_FILE;
+			}
+			return expDir().read(pcBuffer, uiSize, uiOffset, peHeader().getIddExportSize(), peHeader(), &m_budget);
+		}
+		return ERROR_DIRECTORY_DOES_NOT_EXIST;
+	}
+
+	/**
+	* Reads the import directory from a buffer which holds the whole file. The PE header must be read first.
+	* @param pcBuffer Pointer to the first byte of the file.
+	* @param uiSize Size of the buffer.
+	**/
+	template<int bits>
+	int PeFileT<bits>::readImportDirectory(const unsigned char* pcBuffer, unsigned int uiSize)
+	{
+		PELIB_TRACE_SPAN("PeFile::readImportDirectory");
+		if (peHeader().calcNumberOfRvaAndSizes() >= 2
+			&& peHeader().getIddImportRva() && peHeader().getIddImportSize())
+		{
+			unsigned int uiOffset;
+			if (getDirectoryOffset(peHeader().getIddImportRva(), peHeader().getIddImportSize(), uiSize, uiOffset) != NO_ERROR)
+			{
+				return ERROR_INVALID_FILE;
+			}
+			return impDir().read(pcBuffer, uiSize, uiOffset, peHeader().getIddImportSize(), peHeader(), &m_budget);
+		}
+		return ERROR_DIRECTORY_DOES_NOT_EXIST;
+	}
+
+	/**
+	* Reads the bound import directory from a buffer which holds the whole file. The PE header must be read first.
+	* @param pcBuffer Pointer to the first byte of the file.
+	* @param uiSize Size of the buffer.
+	**/
+	template<int bits>
+	int PeFileT<bits>::readBoundImportDirectory(const unsigned char* pcBuffer, unsigned int uiSize)
+	{
+		PELIB_TRACE_SPAN("PeFile::readBoundImportDirectory");
+		if (peHeader().calcNumberOfRvaAndSizes() >= 12
+			&& peHeader().getIddBoundImportRva() && peHeader().getIddBoundImportSize())
+		{
+			unsigned int uiOffset;
+			if (getDirectoryOffset(peHeader().getIddBoundImportRva(), peHeader().getIddBoundImportSize(), uiSize, uiOffset) != NO_ERROR)
+			{
+				return ERROR_INVALID_FILE;
+			}
+			return boundImpDir().read(const_cast<unsigned char*>(pcBuffer) + uiOffset, peHeader().getIddBoundImportSize(), &m_budget);
+		}
+		return ERROR_DIRECTORY_DOES_NOT_EXIST;
+	}
+
+	/**
+	* Reads the resource directory from a buffer which holds the whole file. The PE header must be read first.
+	* @param pcBuffer Pointer to the first byte of the file.
+	* @param uiSize Size of the buffer.
+	**/
+	template<int bits>
+	int PeFileT<bits>::readResourceDirectory(const unsigned char* pcBuffer, unsigned int uiSize)
+	{
+		PELIB_TRACE_SPAN("PeFile::readResourceDirectory");
+		if (peHeader().calcNumberOfRvaAndSizes() >= 3
+			&& peHeader().getIddResourceRva() && peHeader().getIddResourceSize())
+		{
+			unsigned int uiOffset;
+			if (getDirectoryOffset(peHeader().getIddResourceRva(), peHeader().getIddResourceSize(), uiSize, uiOffset) != NO_ERROR)
+			{
+				return ERROR_INVALID_FILE;
+			}
+			return resDir().read(pcBuffer + uiOffset, peHeader().getIddResourceSize(), peHeader().getIddResourceRva(), &m_budget);
+		}
+		return ERROR_DIRECTORY_DOES_NOT_EXIST;
+	}
+
+	/**
+	* Reads the relocations directory from a buffer which holds the whole file. The PE header must be read first.
+	* @param pcBuffer Pointer to the first byte of the file.
+	* @param uiSize Size of the buffer.
+	**/
+	template<int bits>
+	int PeFileT<bits>::readRelocationsDirectory(const unsigned char* pcBuffer, unsigned int uiSize)
+	{
+		PELIB_TRACE_SPAN("PeFile::readRelocationsDirectory");
+		if (peHeader().calcNumberOfRvaAndSizes() >= 6
+			&& peHeader().getIddBaseRelocRva() && peHeader().getIddBaseRelocSize())
+		{
+			unsigned int uiOffset;
+			if (getDirectoryOffset(peHeader().getIddBaseRelocRva(), peHeader().getIddBaseRelocSize(), uiSize, uiOffset) != NO_ERROR)
+			{
+				return ERROR_INVALID_FILE;
+			}
+			return relocDir().read(pcBuffer + uiOffset, peHeader().getIddBaseRelocSize(), &m_budget);
+		}
+		return ERROR_DIRECTORY_DOES_NOT_EXIST;
+	}
+
+	/**
+	* Reads the COM+ descriptor directory from a buffer which holds the whole file. The PE header must be read first.
+	* @param pcBuffer Pointer to the first byte of the file.
+	* @param uiSize Size of the buffer.
+	**/
+	template<int bits>
+	int PeFileT<bits>::readComHeaderDirectory(const unsigned char* pcBuffer, unsigned int uiSize)
+	{
+		PELIB_TRACE_SPAN("PeFile::readComHeaderDirectory");
+		if (peHeader().calcNumberOfRvaAndSizes() >= 15
+			&& peHeader().getIddComHeaderRva() && peHeader().getIddComHeaderSize())
+		{
+			unsigned int uiOffset;
+			if (getDirectoryOffset(peHeader().getIddComHeaderRva(), peHeader().getIddComHeaderSize(), uiSize, uiOffset) != NO_ERROR)
+			{
+				return ERROR_INVALID_FILE;
+			}
+			return comDir().read(const_cast<unsigned char*>(pcBuffer) + uiOffset, peHeader().getIddComHeaderSize(), &m_budget);
+		}
+		return ERROR_DIRECTORY_DOES_NOT_EXIST;
+	}
+
+	/**
+	* Reads the IAT directory from a buffer which holds the whole file. The PE header must be read first.
+	* @param pcBuffer Pointer to the first byte of the file.
+	* @param uiSize Size of the buffer.
+	**/
+	template<int bits>
+	int PeFileT<bits>::readIatDirectory(const unsigned char* pcBuffer, unsigned int uiSize)
+	{
+		PELIB_TRACE_SPAN("PeFile::readIatDirectory");
+		if (peHeader().calcNumberOfRvaAndSizes() >= 13
+			&& peHeader().getIddIatRva() && peHeader().getIddIatSize())
+		{
+			unsigned int uiOffset;
+			if (getDirectoryOffset(peHeader().getIddIatRva(), peHeader().getIddIatSize(), uiSize, uiOffset) != NO_ERROR)
+			{
+				return ERROR_INVALID_FILE;
+			}
+			return iatDir().read(const_cast<unsigned char*>(pcBuffer) + uiOffset, peHeader().getIddIatSize(), &m_budget);
+		}
+		return ERROR_DIRECTORY_DOES_NOT_EXIST;
+	}
+
+	/**
+	* Reads the Debug directory and its data from a buffer which holds the whole file. The PE header must be read first.
+	* @param pcBuffer Pointer to the first byte of the file.
+	* @param uiSize Size of the buffer.
+	**/
+	template<int bits>
+	int PeFileT<bits>::readDebugDirectory(const unsigned char* pcBuffer, unsigned int uiSize)
+	{
+		PELIB_TRACE_SPAN("PeFile::readDebugDirectory");
+		if (peHeader().calcNumberOfRvaAndSizes() >= 7
+			&& peHeader().getIddDebugRva() && peHeader().getIddDebugSize())
+		{
+			unsigned int uiOffset;
+			if (getDirectoryOffset(peHeader().getIddDebugRva(), peHeader().getIddDebugSize(), uiSize, uiOffset) != NO_ERROR)
+			{
+				return ERROR_INVALID_FILE;
+			}
+			return debugDir().read(pcBuffer, uiSize, uiOffset, peHeader().getIddDebugSize(), &m_budget);
+		}
+		return ERROR_DIRECTORY_DOES_NOT_EXIST;
+	}
+
+	/**
+	* Reads the TLS directory from a buffer which holds the whole file. The PE header must be read first.
+	* @param pcBuffer Pointer to the first byte of the file.
+	* @param uiSize Size of the buffer.
+	**/
+	template<int bits>
+	int PeFileT<bits>::readTlsDirectory(const unsigned char* pcBuffer, unsigned int uiSize)
+	{
+		PELIB_TRACE_SPAN("PeFile::readTlsDirectory");
+		if (peHeader().calcNumberOfRvaAndSizes() >= 10
+			&& peHeader().getIddTlsRva() && peHeader().getIddTlsSize())
+		{
+			unsigned int uiOffset;
+			if (getDirectoryOffset(peHeader().getIddTlsRva(), peHeader().getIddTlsSize(), uiSize, uiOffset) != NO_ERROR)
+			{
+				return ERROR_INVALID_FILE;
+			}
+			return tlsDir().read(const_cast<unsigned char*>(pcBuffer) + uiOffset, peHeader().getIddTlsSize(), &m_budget);
+		}
+		return ERROR_DIRECTORY_DOES_NOT_EXIST;
+	}
+	
 	template<int bits>
 	int PeFileT<bits>::readExportDirectory() 
 	{
+		PELIB_TRACE_SPAN("PeFile::readExportDirectory");
+		IoScope ioScope(m_io);
 		if (peHeader().calcNumberOfRvaAndSizes() >= 1
 			&& peHeader().getIddExportRva() && peHeader().getIddExportSize())
 		{
-			return expDir().read(getFileName(), static_cast<unsigned int>(peHeader().rvaToOffset(peHeader().getIddExportRva())), peHeader().getIddExportSize(), peHeader());
+			return expDir().read(getFileName(), static_cast<unsigned int>(peHeader().rvaToOffset(peHeader().getIddExportRva())), peHeader().getIddExportSize(), peHeader(), &m_budget);
 		}
 		return ERROR_DIRECTORY_DOES_NOT_EXIST;
 	}
@@ -370,10 +663,12 @@ namespace PeLib
 	template<int bits>
 	int PeFileT<bits>::readBoundImportDirectory() 
 	{
+		PELIB_TRACE_SPAN("PeFile::readBoundImportDirectory");
+		IoScope ioScope(m_io);
 		if (peHeader().calcNumberOfRvaAndSizes() >= 12
 			&& peHeader().getIddBoundImportRva() && peHeader().getIddBoundImportSize())
 		{
-			return boundImpDir().read(getFileName(), static_cast<unsigned int>(peHeader().rvaToOffset(peHeader().getIddBoundImportRva())), peHeader().getIddBoundImportSize());
+			return boundImpDir().read(getFileName(), static_cast<unsigned int>(peHeader().rvaToOffset(peHeader().getIddBoundImportRva())), peHeader().getIddBoundImportSize(), &m_budget);
 		}
 		return ERROR_DIRECTORY_DOES_NOT_EXIST;
 	}
@@ -381,10 +676,12 @@ namespace PeLib
 	template<int bits>
 	int PeFileT<bits>::readResourceDirectory() 
 	{
+		PELIB_TRACE_SPAN("PeFile::readResourceDirectory");
+		IoScope ioScope(m_io);
 		if (peHeader().calcNumberOfRvaAndSizes() >= 3
 			&& peHeader().getIddResourceRva() && peHeader().getIddResourceSize())
 		{
-			return resDir().read(getFileName(), static_cast<unsigned int>(peHeader().rvaToOffset(peHeader().getIddResourceRva())), peHeader().getIddResourceSize(), peHeader().getIddResourceRva());
+			return resDir().read(getFileName(), static_cast<unsigned int>(peHeader().rvaToOffset(peHeader().getIddResourceRva())), peHeader().getIddResourceSize(), peHeader().getIddResourceRva(), &m_budget);
 		}
 		return ERROR_DIRECTORY_DOES_NOT_EXIST;
 	}
@@ -392,10 +689,12 @@ namespace PeLib
 	template<int bits>
 	int PeFileT<bits>::readRelocationsDirectory() 
 	{
+		PELIB_TRACE_SPAN("PeFile::readRelocationsDirectory");
+		IoScope ioScope(m_io);
 		if (peHeader().calcNumberOfRvaAndSizes() >= 6
 			&& peHeader().getIddBaseRelocRva() && peHeader().getIddBaseRelocSize())
 		{
-			return relocDir().read(getFileName(), static_cast<unsigned int>(peHeader().rvaToOffset(peHeader().getIddBaseRelocRva())), peHeader().getIddBaseRelocSize());
+			return relocDir().read(getFileName(), static_cast<unsigned int>(peHeader().rvaToOffset(peHeader().getIddBaseRelocRva())), peHeader().getIddBaseRelocSize(), &m_budget);
 		}
 		return ERROR_DIRECTORY_DOES_NOT_EXIST;
 	}
@@ -403,23 +702,25 @@ namespace PeLib
 	template<int bits>
 	int PeFileT<bits>::readComHeaderDirectory() 
 	{
+		PELIB_TRACE_SPAN("PeFile::readComHeaderDirectory");
+		IoScope ioScope(m_io);
 		if (peHeader().calcNumberOfRvaAndSizes() >= 15
 			&& peHeader().getIddComHeaderRva() && peHeader().getIddComHeaderSize())
 		{
-			return comDir().read(getFileName(), static_cast<unsigned int>(peHeader().rvaToOffset(peHeader().getIddComHeaderRva())), peHeader().getIddComHeaderSize());
+			return comDir().read(getFileName(), static_cast<unsigned int>(peHeader().rvaToOffset(peHeader().getIddComHeaderRva())), peHeader().getIddComHeaderSize(), &m_budget);
 		}
-			std::cout << peHeader().getIddComHeaderRva() << std::endl;
-			std::exit(0);
 		return ERROR_DIRECTORY_DOES_NOT_EXIST;
 	}
 
 	template<int bits>
 	int PeFileT<bits>::readIatDirectory() 
 	{
+		PELIB_TRACE_SPAN("PeFile::readIatDirectory");
+		IoScope ioScope(m_io);
 		if (peHeader().calcNumberOfRvaAndSizes() >= 13
 			&& peHeader().getIddIatRva() && peHeader().getIddIatSize())
 		{
-			return iatDir().read(getFileName(), static_cast<unsigned int>(peHeader().rvaToOffset(peHeader().getIddIatRva())), peHeader().getIddIatSize());
+			return iatDir().read(getFileName(), static_cast<unsigned int>(peHeader().rvaToOffset(peHeader().getIddIatRva())), peHeader().getIddIatSize(), &m_budget);
 		}
 		return ERROR_DIRECTORY_DOES_NOT_EXIST;
 	}
@@ -427,10 +728,12 @@ namespace PeLib
 	template<int bits>
 	int PeFileT<bits>::readDebugDirectory() 
 	{
+		PELIB_TRACE_SPAN("PeFile::readDebugDirectory");
+		IoScope ioScope(m_io);
 		if (peHeader().calcNumberOfRvaAndSizes() >= 7
 			&& peHeader().getIddDebugRva() && peHeader().getIddDebugSize())
 		{
-			return debugDir().read(getFileName(), static_cast<unsigned int>(peHeader().rvaToOffset(peHeader().getIddDebugRva())), peHeader().getIddDebugSize());
+			return debugDir().read(getFileName(), static_cast<unsigned int>(peHeader().rvaToOffset(peHeader().getIddDebugRva())), peHeader().getIddDebugSize(), &m_budget);
 		}
 		return ERROR_DIRECTORY_DOES_NOT_EXIST;
 	}
@@ -438,10 +741,12 @@ namespace PeLib
 	template<int bits>
 	int PeFileT<bits>::readTlsDirectory() 
 	{
+		PELIB_TRACE_SPAN("PeFile::readTlsDirectory");
+		IoScope ioScope(m_io);
 		if (peHeader().calcNumberOfRvaAndSizes() >= 10
 			&& peHeader().getIddTlsRva() && peHeader().getIddTlsSize())
 		{
-			return tlsDir().read(getFileName(), static_cast<unsigned int>(peHeader().rvaToOffset(peHeader().getIddTlsRva())), peHeader().getIddTlsSize());
+			return tlsDir().read(getFileName(), static_cast<unsigned int>(peHeader().rvaToOffset(peHeader().getIddTlsRva())), peHeader().getIddTlsSize(), &m_budget);
 		}
 		return ERROR_DIRECTORY_DOES_NOT_EXIST;
 	}
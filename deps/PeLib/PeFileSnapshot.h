@@ -0,0 +1,189 @@
+/*
+* PeFileSnapshot.h - Part of the PeLib library.
+*
+* This software is licensed under the zlib/libpng License.
+* For more details see http://www.opensource.org/licenses/zlib-license.php
+* or the license information file (license.htm) in the root directory
+* of PeLib.
+*/
+
+#ifndef PEFILESNAPSHOT_H
+#define PEFILESNAPSHOT_H
+
+#include "PeFile.h"
+
+#include <memory>
+
+namespace PeLib
+{
+	/**
+	* An immutable copy of everything a PeFileT has parsed so far.<br>
+	* A PeFileT can't be shared between threads: its const lookups fill caches on first use and
+	* any read function replaces the directories underneath other callers. A snapshot copies the
+	* headers and directories once, fills every cache up front and only hands out const references
+	* afterwards, so any number of threads may query the same snapshot at once without locking.
+	* The snapshot doesn't refer back to the file it was taken from, which may be changed or
+	* destroyed freely. Its copies allocate from the calling thread's resource, though, so one
+	* taken inside an #PeLib::ArenaScope dies with the arena; #PeLib::freeze copies from the
+	* process-wide default instead, and its snapshots may outlive the arena the file was read in.
+	**/
+	template<int bits>
+	class PeFileSnapshotT
+	{
+		typedef typename PeFile_Traits<bits>::PeHeader32_64 PeHeader32_64;
+
+		private:
+		  const std::string m_filename; ///< Name of the file the snapshot was taken from.
+		  const MzHeader m_mzh; ///< MZ header of the file.
+		  const PeHeader32_64 m_peh; ///< PE header of the file.
+		  const ImportDirectory<bits> m_impdir; ///< Import directory of the file.
+		  const ExportDirectory m_expdir; ///< Export directory of the file.
+		  const BoundImportDirectory m_boundimpdir; ///< BoundImportDirectory of the file.
+		  const ResourceDirectory m_resdir; ///< ResourceDirectory of the file.
+		  const RelocationsDirectory m_relocs; ///< Relocations directory of the file.
+		  const ComHeaderDirectory m_comdesc; ///< COM+ descriptor directory of the file.
+		  const IatDirectory m_iat; ///< Import address table of the file.
+		  const DebugDirectory m_debugdir; ///< Debug directory of the file.
+		  const TlsDirectory<bits> m_tlsdir; ///< TLS directory of the file.
+
+		  PeFileSnapshotT(const PeFileSnapshotT&);
+		  PeFileSnapshotT& operator=(const PeFileSnapshotT&);
+
+		public:
+		  /// Copies everything that was read from peFile.
+		  explicit PeFileSnapshotT(const PeFileT<bits>& peFile);
+
+		  /// Returns the name of the file the snapshot was taken from.
+		  const std::string& getFileName() const; // EXPORT
+
+		  unsigned int getBits() const
+		  {
+			  return bits;
+		  }
+
+		  /// Accessor function for the MZ header.
+		  const MzHeader& mzHeader() const; // EXPORT
+		  /// Accessor function for the PE header.
+		  const PeHeader32_64& peHeader() const; // EXPORT
+		  /// Accessor function for the import directory.
+		  const ImportDirectory<bits>& impDir() const; // EXPORT
+		  /// Accessor function for the export directory.
+		  const ExportDirectory& expDir() const; // EXPORT
+		  /// Accessor function for the bound import directory.
+		  const BoundImportDirectory& boundImpDir() const; // EXPORT
+		  /// Accessor function for the resource directory.
+		  const ResourceDirectory& resDir() const; // EXPORT
+		  /// Accessor function for the relocations directory.
+		  const RelocationsDirectory& relocDir() const; // EXPORT
+		  /// Accessor function for the COM+ descriptor directory.
+		  const ComHeaderDirectory& comDir() const; // EXPORT
+		  /// Accessor function for the IAT directory.
+		  const IatDirectory& iatDir() const; // EXPORT
+		  /// Accessor function for the debug directory.
+		  const DebugDirectory& debugDir() const; // EXPORT
+		  /// Accessor function for the TLS directory.
+		  const TlsDirectory<bits>& tlsDir() const; // EXPORT
+	};
+
+	typedef PeFileSnapshotT<32> PeFileSnapshot32;
+	typedef PeFileSnapshotT<64> PeFileSnapshot64;
+
+	/// Takes a snapshot of a parsed file which can be shared between threads, and outlive any arena.
+	template<int bits>
+	std::shared_ptr<const PeFileSnapshotT<bits> > freeze(const PeFileT<bits>& peFile)
+	{
+		ArenaScope defaultResource(0);
+		return std::make_shared<const PeFileSnapshotT<bits> >(peFile);
+	}
+
+	/**
+	* The copy must not be read concurrently with changes to peFile itself; once the constructor
+	* returned, peFile is no longer needed. Everything is copied into the calling thread's resource.
+	* @param peFile A file whose headers and directories have already been read.
+	**/
+	template<int bits>
+	PeFileSnapshotT<bits>::PeFileSnapshotT(const PeFileT<bits>& peFile)
+		: m_filename(peFile.getFileName()), m_mzh(peFile.mzHeader()), m_peh(peFile.peHeader()),
+		m_impdir(peFile.impDir()), m_expdir(peFile.expDir()), m_boundimpdir(peFile.boundImpDir()),
+		m_resdir(peFile.resDir()), m_relocs(peFile.relocDir()), m_comdesc(peFile.comDir()),
+		m_iat(peFile.iatDir()), m_debugdir(peFile.debugDir()), m_tlsdir(peFile.tlsDir())
+	{
+		// The PE header is the only part with lazily filled caches; filling them here is
+		// what makes the const lookups safe to call from several threads.
+		m_peh.prepareLayout();
+	}
+
+	template<int bits>
+	const std::string& PeFileSnapshotT<bits>::getFileName() const
+	{
+		return m_filename;
+	}
+
+	template<int bits>
+	const MzHeader& PeFileSnapshotT<bits>::mzHeader() const
+	{
+		return m_mzh;
+	}
+
+	template<int bits>
+	const typename PeFileSnapshotT<bits>::PeHeader32_64& PeFileSnapshotT<bits>::peHeader() const
+	{
+		return m_peh;
+	}
+
+	template<int bits>
+	const ImportDirectory<bits>& PeFileSnapshotT<bits>::impDir() const
+	{
+		return m_impdir;
+	}
+
+	template<int bits>
+	const ExportDirectory& PeFileSnapshotT<bits>::expDir() const
+	{
+		return m_expdir;
+	}
+
+	template<int bits>
+	const BoundImportDirectory& PeFileSnapshotT<bits>::boundImpDir() const
+	{
+		return m_boundimpdir;
+	}
+
+	template<int bits>
+	const ResourceDirectory& PeFileSnapshotT<bits>::resDir() const
+	{
+		return m_resdir;
+	}
+
+	template<int bits>
+	const RelocationsDirectory& PeFileSnapshotT<bits>::relocDir() const
+	{
+		return m_relocs;
+	}
+
+	template<int bits>
+	const ComHeaderDirectory& PeFileSnapshotT<bits>::comDir() const
+	{
+		return m_comdesc;
+	}
+
+	template<int bits>
+	const IatDirectory& PeFileSnapshotT<bits>::iatDir() const
+	{
+		return m_iat;
+	}
+
+	template<int bits>
+	const DebugDirectory& PeFileSnapshotT<bits>::debugDir() const
+	{
+		return m_debugdir;
+	}
+
+	template<int bits>
+	const TlsDirectory<bits>& PeFileSnapshotT<bits>::tlsDir() const
+	{
+		return m_tlsdir;
+	}
+}
+
+#endif
@@ -40,16 +40,28 @@ namespace PeLib
 		private:
 			void readBaseOfData(InputBuffer& ibBuffer, PELIB_IMAGE_NT_HEADERS<x>& header) const;
 			void rebuildBaseOfData(OutputBuffer& obBuffer) const;
+
+			/// Marks the cached layout values as stale.
+			void invalidateLayout();
+			/// Recalculates the cached layout values from the current header.
+			void updateLayout() const;
 		
 		protected:
-		  std::vector<PELIB_IMAGE_SECTION_HEADER> m_vIsh; ///< Stores section header information.
+		  ArenaVector<PELIB_IMAGE_SECTION_HEADER> m_vIsh; ///< Stores section header information.
 		  PELIB_IMAGE_NT_HEADERS<x> m_inthHeader; ///< Stores Nt header information.
 		  dword m_uiOffset; ///< Equivalent to the value returned by #PeLib::MzHeader::getAddressOfPeFile
 
+		  mutable bool m_bLayoutValid; ///< True if the cached layout values below match the header.
+		  mutable dword m_dwStartOfCode; ///< Cached return value of #PeLib::PeHeaderT<x>::calcStartOfCode.
+		  mutable ArenaVector<word> m_vRvaOrder; ///< Sections with a non-zero virtual span, ordered by Rva.
+		  mutable ArenaVector<word> m_vOffsetOrder; ///< Sections with raw data, ordered by file offset.
+		  mutable bool m_bRvaOverlap; ///< True if two sections overlap in memory; lookups fall back to a linear scan.
+		  mutable bool m_bOffsetOverlap; ///< True if two sections overlap on disk; lookups fall back to a linear scan.
+
 		public:
 		  typedef typename FieldSizes<x>::VAR4_8 VAR4_8;
 		
-		  PeHeaderT() : m_uiOffset(0)
+		  PeHeaderT() : m_uiOffset(0), m_bLayoutValid(false), m_dwStartOfCode(0), m_bRvaOverlap(false), m_bOffsetOverlap(false)
 		  {
 		  }
 			
@@ -64,6 +76,9 @@ namespace PeLib
 		  /// Returns the address of the physically first section (not the first defined section).
 		  unsigned int calcStartOfCode() const; // EXPORT
 
+		  /// Calculates the cached layout values now instead of on the next lookup.
+		  void prepareLayout() const; // EXPORT
+
 		  /// Calculates the offset for a new section of size uiSize.
 		  unsigned int calcOffset() const; // EXPORT
 
@@ -100,7 +115,7 @@ namespace PeLib
 
 		  void readHeader(InputBuffer& ibBuffer, PELIB_IMAGE_NT_HEADERS<x>& header) const;
 		  void readDataDirectories(InputBuffer& ibBuffer, PELIB_IMAGE_NT_HEADERS<x>& header) const;
-		  std::vector<PELIB_IMAGE_SECTION_HEADER> readSections(InputBuffer& ibBuffer, PELIB_IMAGE_NT_HEADERS<x>& header) const;
+		  ArenaVector<PELIB_IMAGE_SECTION_HEADER> readSections(InputBuffer& ibBuffer, PELIB_IMAGE_NT_HEADERS<x>& header) const;
 	
 		  /// Rebuilds the current PE header.
 		  void rebuild(std::vector<byte>& vBuffer) const; // EXPORT
@@ -446,12 +461,94 @@ namespace PeLib
 	void PeHeaderT<x>::addDataDirectory()
 	{
 		m_inthHeader.dataDirectories.push_back(PELIB_IMAGE_DATA_DIRECTORY());
+		invalidateLayout();
 	}
 
 	template<int x>
 	void PeHeaderT<x>::removeDataDirectory(dword index)
 	{
 		m_inthHeader.dataDirectories.erase(m_inthHeader.dataDirectories.begin() + index);
+		invalidateLayout();
+	}
+
+	template<int x>
+	void PeHeaderT<x>::invalidateLayout()
+	{
+		m_bLayoutValid = false;
+	}
+
+	/**
+	* Recalculates the values which depend on the section table and the data directories: the start of code
+	* and the section orderings used by #PeLib::PeHeaderT<x>::getSectionWithRva and
+	* #PeLib::PeHeaderT<x>::getSectionWithOffset. Every setter which changes one of these inputs calls
+	* #PeLib::PeHeaderT<x>::invalidateLayout, so the work is only redone after the header actually changed.
+	**/
+	template<int x>
+	void PeHeaderT<x>::updateLayout() const
+	{
+		m_vRvaOrder.clear();
+		m_vOffsetOrder.clear();
+
+		for (word i=0;i<calcNumberOfSections();i++)
+		{
+			// Sections which can never match a lookup are left out of the orderings.
+			if (std::max(getVirtualSize(i), getSizeOfRawData(i))) m_vRvaOrder.push_back(i);
+			if (getPointerToRawData(i) && getSizeOfRawData(i)) m_vOffsetOrder.push_back(i);
+		}
+
+		std::stable_sort(m_vRvaOrder.begin(), m_vRvaOrder.end(), [this](word a, word b) { return getVirtualAddress(a) < getVirtualAddress(b); });
+		std::stable_sort(m_vOffsetOrder.begin(), m_vOffsetOrder.end(), [this](word a, word b) { return getPointerToRawData(a) < getPointerToRawData(b); });
+
+		// Overlapping (or wrapping) sections are resolved by section number, which a binary search can't do.
+		unsigned long long ullEnd = 0;
+		m_bRvaOverlap = false;
+		for (word i : m_vRvaOrder)
+		{
+			if (getVirtualAddress(i) < ullEnd) m_bRvaOverlap = true;
+			ullEnd = std::max<unsigned long long>(ullEnd, static_cast<unsigned long long>(getVirtualAddress(i)) + std::max(getVirtualSize(i), getSizeOfRawData(i)));
+		}
+		if (ullEnd > 0xFFFFFFFF) m_bRvaOverlap = true;
+
+		ullEnd = 0;
+		m_bOffsetOverlap = false;
+		for (word i : m_vOffsetOrder)
+		{
+			if (getPointerToRawData(i) < ullEnd) m_bOffsetOverlap = true;
+			ullEnd = std::max<unsigned long long>(ullEnd, static_cast<unsigned long long>(getPointerToRawData(i)) + getSizeOfRawData(i));
+		}
+		if (ullEnd > 0xFFFFFFFF) m_bOffsetOverlap = true;
+
+		// The orderings are complete, so rvaToOffset below may already use them.
+		m_bLayoutValid = true;
+
+		dword dwMinOffset = 0xFFFFFFFF;
+		for (dword i=0;i<calcNumberOfRvaAndSizes() && i<15;i++)
+		{
+			if (!getImageDataDirectoryRva(i)) continue;
+			VAR4_8 dwOffset = rvaToOffset(getImageDataDirectoryRva(i));
+			if (dwOffset < dwMinOffset) dwMinOffset = static_cast<dword>(dwOffset);
+		}
+
+		for (word i=0;i<calcNumberOfSections();i++)
+		{
+			if ((getPointerToRawData(i) < dwMinOffset || dwMinOffset == 0xFFFFFFFF) && getSizeOfRawData(i))
+			{
+				if (getPointerToRawData(i)) dwMinOffset = getPointerToRawData(i);
+			}
+		}
+
+		m_dwStartOfCode = dwMinOffset;
+	}
+
+	/**
+	* The const lookups fill the layout cache on first use, so two threads calling them on a fresh
+	* header would both write to it. Once this was called, const functions no longer write to the
+	* header until a setter changes it again.
+	**/
+	template<int x>
+	void PeHeaderT<x>::prepareLayout() const
+	{
+		if (!m_bLayoutValid) updateLayout();
 	}
 		  
 	/**
@@ -496,6 +593,7 @@ namespace PeLib
 
 		PELIB_IMAGE_SECTION_HEADER ishdCurr;
 		m_vIsh.push_back(ishdCurr);
+		invalidateLayout();
 
 		setSectionName(uiSecnr, strName);
 		setSizeOfRawData(uiSecnr, alignOffset(dwSize, getFileAlignment()));
@@ -520,7 +618,7 @@ namespace PeLib
 		//                  An example for such a file is dbeng6.exe (made by Sybase).
 		//                  In this file each and every section has a VSize of 0 but it still runs.
 		
-		std::vector<PELIB_IMAGE_SECTION_HEADER>::const_iterator ishLastSection = std::max_element(m_vIsh.begin(), m_vIsh.end(), std::mem_fun_ref(&PELIB_IMAGE_SECTION_HEADER::biggerVirtualAddress));
+		ArenaVector<PELIB_IMAGE_SECTION_HEADER>::const_iterator ishLastSection = std::max_element(m_vIsh.begin(), m_vIsh.end(), std::mem_fun_ref(&PELIB_IMAGE_SECTION_HEADER::biggerVirtualAddress));
 		if (ishLastSection->VirtualSize != 0) return ishLastSection->VirtualAddress + ishLastSection->VirtualSize;
 		return ishLastSection->VirtualAddress + std::max(ishLastSection->VirtualSize, ishLastSection->SizeOfRawData);
 	}
@@ -542,7 +640,7 @@ namespace PeLib
 	* Returns the first offset of the file that's actually used for something different than the header.
 	* That something is not necessarily code, it can be a data directory too.
 	* This offset can be the beginning of a section or the beginning of a directory.
-	* \todo Some optimizization is surely possible here.
+	* The value is cached, see #PeLib::PeHeaderT<x>::updateLayout.
 	* \todo There are PE files with sections beginning at offset 0. They
 	* need to be considered. Returning 0 for these files doesn't really make sense.
 	* So far these sections are disregarded.
@@ -550,32 +648,8 @@ namespace PeLib
 	template<int x>
 	unsigned int PeHeaderT<x>::calcStartOfCode() const
 	{
-		unsigned int directories = calcNumberOfRvaAndSizes();
-		dword dwMinOffset = 0xFFFFFFFF;
-		if (directories >= 1 && getIddExportRva() && rvaToOffset(getIddExportRva()) < dwMinOffset) dwMinOffset = rvaToOffset(getIddExportRva());
-		if (directories >= 2 && getIddImportRva() && rvaToOffset(getIddImportRva()) < dwMinOffset) dwMinOffset = rvaToOffset(getIddImportRva());
-		if (directories >= 3 && getIddResourceRva() && rvaToOffset(getIddResourceRva()) < dwMinOffset) dwMinOffset = rvaToOffset(getIddResourceRva());
-		if (directories >= 4 && getIddExceptionRva()  && rvaToOffset(getIddExceptionRva()) < dwMinOffset) dwMinOffset = rvaToOffset(getIddExceptionRva());
-		if (directories >= 5 && getIddSecurityRva()  && rvaToOffset(getIddSecurityRva()) < dwMinOffset) dwMinOffset = rvaToOffset(getIddSecurityRva());
-		if (directories >= 6 && getIddBaseRelocRva()  && rvaToOffset(getIddBaseRelocRva()) < dwMinOffset) dwMinOffset = rvaToOffset(getIddBaseRelocRva());
-		if (directories >= 7 && getIddDebugRva()  && rvaToOffset(getIddDebugRva()) < dwMinOffset) dwMinOffset = rvaToOffset(getIddDebugRva());
-		if (directories >= 8 && getIddArchitectureRva()  && rvaToOffset(getIddArchitectureRva()) < dwMinOffset) dwMinOffset = rvaToOffset(getIddArchitectureRva());
-		if (directories >= 9 && getIddGlobalPtrRva()  && rvaToOffset(getIddGlobalPtrRva()) < dwMinOffset) dwMinOffset = rvaToOffset(getIddGlobalPtrRva());
-		if (directories >= 10 && getIddTlsRva()  && rvaToOffset(getIddTlsRva()) < dwMinOffset) dwMinOffset = rvaToOffset(getIddTlsRva());
-		if (directories >= 11 && getIddLoadConfigRva()  && rvaToOffset(getIddLoadConfigRva()) < dwMinOffset) dwMinOffset = rvaToOffset(getIddLoadConfigRva());
-		if (directories >= 12 && getIddBoundImportRva()  && rvaToOffset(getIddBoundImportRva()) < dwMinOffset) dwMinOffset = rvaToOffset(getIddBoundImportRva());
-		if (directories >= 13 && getIddIatRva()  && rvaToOffset(getIddIatRva()) < dwMinOffset) dwMinOffset = rvaToOffset(getIddIatRva());
-		if (directories >= 14 && getIddDelayImportRva()  && rvaToOffset(getIddDelayImportRva()) < dwMinOffset) dwMinOffset = rvaToOffset(getIddDelayImportRva());
-		if (directories >= 15 && getIddComHeaderRva()  && rvaToOffset(getIddComHeaderRva()) < dwMinOffset) dwMinOffset = rvaToOffset(getIddComHeaderRva());
-		
-		for (word i=0;i<calcNumberOfSections();i++)
-		{
-			if ((getPointerToRawData(i) < dwMinOffset || dwMinOffset == 0xFFFFFFFF) && getSizeOfRawData(i))
-			{
-				if (getPointerToRawData(i)) dwMinOffset = getPointerToRawData(i);
-			}
-		}
-		return dwMinOffset;
+		if (!m_bLayoutValid) updateLayout();
+		return m_dwStartOfCode;
 	}
 
 	/**
@@ -636,11 +710,12 @@ namespace PeLib
 	template<int x>
 	void PeHeaderT<x>::enlargeLastSection(unsigned int uiSize)
 	{
-		std::vector<PELIB_IMAGE_SECTION_HEADER>::iterator ishLastSection = std::max_element(m_vIsh.begin(), m_vIsh.end(), std::mem_fun_ref(&PELIB_IMAGE_SECTION_HEADER::biggerFileOffset));
+		ArenaVector<PELIB_IMAGE_SECTION_HEADER>::iterator ishLastSection = std::max_element(m_vIsh.begin(), m_vIsh.end(), std::mem_fun_ref(&PELIB_IMAGE_SECTION_HEADER::biggerFileOffset));
 		unsigned int uiRawDataSize = alignOffset(ishLastSection->SizeOfRawData + uiSize, getFileAlignment());
 		
 		ishLastSection->SizeOfRawData = uiRawDataSize;
 		ishLastSection->VirtualSize = ishLastSection->SizeOfRawData;
+		invalidateLayout();
 		
 		setSizeOfImage(calcSizeOfImage());
 	}
@@ -658,6 +733,18 @@ namespace PeLib
 		// only exists in memory.
 		
 		if (!dwOffset) return std::numeric_limits<word>::max();
+
+		if (!m_bLayoutValid) updateLayout();
+		if (!m_bOffsetOverlap)
+		{
+			// Last section starting at or before dwOffset is the only candidate.
+			ArenaVector<word>::const_iterator it = std::upper_bound(m_vOffsetOrder.begin(), m_vOffsetOrder.end(), dwOffset,
+				[this](VAR4_8 off, word i) { return off < getPointerToRawData(i); });
+			if (it == m_vOffsetOrder.begin()) return std::numeric_limits<word>::max();
+			--it;
+			if (getPointerToRawData(*it) + getSizeOfRawData(*it) > dwOffset) return *it;
+			return std::numeric_limits<word>::max();
+		}
 		
 		for (word i=0;i<calcNumberOfSections();i++)
 		{
@@ -681,6 +768,19 @@ namespace PeLib
 		//                  That's why it's necessary to use std::max(Vsize, RawSize) here.
 		//                  An example for such a file is dbeng6.exe (made by Sybase).
 		//                  In this file each and every section has a VSize of 0 but it still runs.
+
+		if (!m_bLayoutValid) updateLayout();
+		if (!m_bRvaOverlap)
+		{
+			// Last section starting at or before dwRva is the only candidate.
+			ArenaVector<word>::const_iterator it = std::upper_bound(m_vRvaOrder.begin(), m_vRvaOrder.end(), dwRva,
+				[this](VAR4_8 rva, word i) { return rva < getVirtualAddress(i); });
+			if (it == m_vRvaOrder.begin()) return -1;
+			--it;
+			dword max = getVirtualSize(*it) >= getSizeOfRawData(*it) ? getVirtualSize(*it) : getSizeOfRawData(*it);
+			if (getVirtualAddress(*it) + max > dwRva) return *it;
+			return -1;
+		}
 		
 		for (word i=0;i<calcNumberOfSections();i++)
 		{
@@ -833,12 +933,12 @@ namespace PeLib
 	}
 	
 	template<int x>
-	std::vector<PELIB_IMAGE_SECTION_HEADER> PeHeaderT<x>::readSections(InputBuffer& ibBuffer, PELIB_IMAGE_NT_HEADERS<x>& header) const
+	ArenaVector<PELIB_IMAGE_SECTION_HEADER> PeHeaderT<x>::readSections(InputBuffer& ibBuffer, PELIB_IMAGE_NT_HEADERS<x>& header) const
 	{
 		const unsigned int nrSections = header.FileHeader.NumberOfSections;
 		PELIB_IMAGE_SECTION_HEADER ishCurr;
 
-		std::vector<PELIB_IMAGE_SECTION_HEADER> vIshdCurr;
+		ArenaVector<PELIB_IMAGE_SECTION_HEADER> vIshdCurr;
 
 		for (unsigned int i=0;i<nrSections;i++)
 		{
@@ -873,7 +973,9 @@ namespace PeLib
 		
 		readHeader(ibBuffer, header);
 		
-		if (uiSize < m_inthHeader.size() + header.OptionalHeader.NumberOfRvaAndSizes * 8 + header.FileHeader.NumberOfSections * 0x28)
+		// Both counts come from the file, so their tables are sized in 64 bits where they can't wrap around.
+		qword qwTableSize = static_cast<qword>(header.OptionalHeader.NumberOfRvaAndSizes) * 8 + static_cast<qword>(header.FileHeader.NumberOfSections) * 0x28;
+		if (uiSize < m_inthHeader.size() + qwTableSize)
 		{
 			return ERROR_INVALID_FILE;
 		}
@@ -888,6 +990,7 @@ namespace PeLib
 		m_vIsh = readSections(ibBuffer, header);
 
 		std::swap(m_inthHeader, header);
+		invalidateLayout();
 
 		m_uiOffset = uiOffset;
 
@@ -904,7 +1007,7 @@ namespace PeLib
 	template<int x>
 	int PeHeaderT<x>::read(std::string strFilename, unsigned int uiOffset)
 	{
-		std::ifstream ifFile(strFilename.c_str(), std::ios::binary);
+		FileStream ifFile(strFilename, std::ios::in | std::ios::binary);
 		
 		if (!ifFile)
 		{
@@ -912,7 +1015,7 @@ namespace PeLib
 		}
 		
 		// File too small
-		if (fileSize(ifFile) < uiOffset + m_inthHeader.size())
+		if (fileSize(ifFile) < static_cast<qword>(uiOffset) + m_inthHeader.size())
 		{
 			return ERROR_INVALID_FILE;
 		}
@@ -927,7 +1030,13 @@ namespace PeLib
 		
 		readHeader(ibBuffer, header);
 
-		vBuffer.resize(header.OptionalHeader.NumberOfRvaAndSizes * 8 + header.FileHeader.NumberOfSections * 0x28);
+		qword qwTableSize = static_cast<qword>(header.OptionalHeader.NumberOfRvaAndSizes) * 8 + static_cast<qword>(header.FileHeader.NumberOfSections) * 0x28;
+		if (fileSize(ifFile) < static_cast<qword>(uiOffset) + m_inthHeader.size() + qwTableSize)
+		{
+			return ERROR_INVALID_FILE;
+		}
+
+		vBuffer.resize(static_cast<std::size_t>(qwTableSize));
 
 		ifFile.read(reinterpret_cast<char*>(&vBuffer[0]), static_cast<std::streamsize>(vBuffer.size()));
 		if (!ifFile)
@@ -949,6 +1058,7 @@ namespace PeLib
 		m_vIsh = readSections(ibBuffer, header);
 
 		std::swap(m_inthHeader, header);
+		invalidateLayout();
 
 		m_uiOffset = uiOffset;
 
@@ -966,6 +1076,7 @@ namespace PeLib
 	template<int x>
 	void PeHeaderT<x>::rebuild(std::vector<byte>& vBuffer) const
 	{
+		PELIB_TRACE_SPAN("PeHeader::rebuild");
 		OutputBuffer obBuffer(vBuffer);
 
 		obBuffer << m_inthHeader.Signature;
@@ -1106,17 +1217,18 @@ namespace PeLib
 	template<int x>
 	int PeHeaderT<x>::write(std::string strFilename, unsigned int uiOffset) const
 	{
-		std::fstream ofFile(strFilename.c_str(), std::ios_base::in);
+		PELIB_TRACE_SPAN("PeHeader::write");
+		FileStream ofFile(strFilename, std::ios_base::in);
 		
 		if (!ofFile)
 		{
 			ofFile.clear();
-			ofFile.open(strFilename.c_str(), std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::out | std::ios_base::binary);
 		}
 		else
 		{
 			ofFile.close();
-			ofFile.open(strFilename.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
 		}
 		
 		if (!ofFile)
@@ -1148,17 +1260,18 @@ namespace PeLib
 	template<int x>
 	int PeHeaderT<x>::writeSectionData(const std::string& strFilename, word wSecnr, const std::vector<byte>& vBuffer) const
 	{
-		std::fstream ofFile(strFilename.c_str(), std::ios_base::in);
+		PELIB_TRACE_SPAN("PeHeader::writeSectionData");
+		FileStream ofFile(strFilename, std::ios_base::in);
 		
 		if (!ofFile)
 		{
 			ofFile.clear();
-			ofFile.open(strFilename.c_str(), std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::out | std::ios_base::binary);
 		}
 		else
 		{
 			ofFile.close();
-			ofFile.open(strFilename.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
 		}
 
 		if (!ofFile)
@@ -1170,7 +1283,7 @@ namespace PeLib
 
 		ofFile.seekp(getPointerToRawData(wSecnr), std::ios::beg);
 
-		ofFile.write(reinterpret_cast<const char*>(&vBuffer[0]), std::min(static_cast<unsigned int>(vBuffer.size()), getSizeOfRawData(wSecnr)));
+		ofFile.write(reinterpret_cast<const char*>(&vBuffer[0]), static_cast<std::streamsize>(std::min<qword>(vBuffer.size(), getSizeOfRawData(wSecnr))));
 
 		ofFile.close();
 		
@@ -1180,17 +1293,18 @@ namespace PeLib
 	template<int x>
 	int PeHeaderT<x>::writeSections(const std::string& strFilename) const
 	{
-		std::fstream ofFile(strFilename.c_str(), std::ios_base::in);
+		PELIB_TRACE_SPAN("PeHeader::writeSections");
+		FileStream ofFile(strFilename, std::ios_base::in);
 		
 		if (!ofFile)
 		{
 			ofFile.clear();
-			ofFile.open(strFilename.c_str(), std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::out | std::ios_base::binary);
 		}
 		else
 		{
 			ofFile.close();
-			ofFile.open(strFilename.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
 		}
 
 		if (!ofFile)
@@ -1198,17 +1312,21 @@ namespace PeLib
 			return ERROR_OPENING_FILE;
 		}
 
-		unsigned int uiFilesize = fileSize(ofFile);
+		qword ullFilesize = fileSize(ofFile);
 
+		// Grows the file to hold every section. The end of a section can lie past 4 GB, and the
+		// padding goes out in pieces so it never has to be held in memory all at once.
+		std::vector<char> vBuffer(0x10000);
 		for (int i=0;i<calcNumberOfSections();i++)
 		{
-			if (uiFilesize < getPointerToRawData(i) + getSizeOfRawData(i))
+			qword ullSectionEnd = static_cast<qword>(getPointerToRawData(i)) + getSizeOfRawData(i);
+			if (ullFilesize < ullSectionEnd)
 			{
-				unsigned int uiToWrite = getPointerToRawData(i) + getSizeOfRawData(i) - uiFilesize;
-				std::vector<char> vBuffer(uiToWrite);
 				ofFile.seekp(0, std::ios::end);
-				ofFile.write(&vBuffer[0], static_cast<unsigned int>(vBuffer.size()));
-				uiFilesize = getPointerToRawData(i) + getSizeOfRawData(i);
+				for (; ullFilesize < ullSectionEnd; ullFilesize += std::min<qword>(vBuffer.size(), ullSectionEnd - ullFilesize))
+				{
+					ofFile.write(&vBuffer[0], static_cast<std::streamsize>(std::min<qword>(vBuffer.size(), ullSectionEnd - ullFilesize)));
+				}
 			}
 		}
 
@@ -1880,6 +1998,7 @@ namespace PeLib
 	void PeHeaderT<x>::setImageDataDirectoryRva(dword dwDirectory, dword value)
 	{
 		m_inthHeader.dataDirectories[dwDirectory].VirtualAddress = value;
+		invalidateLayout();
 	}
 
 	/**
@@ -2390,6 +2509,7 @@ namespace PeLib
 	void PeHeaderT<x>::setIddDebugRva(dword dwValue)
 	{
 		m_inthHeader.dataDirectories[PELIB_IMAGE_DIRECTORY_ENTRY_DEBUG].VirtualAddress = dwValue;
+		invalidateLayout();
 	}
 
 	template<int x>
@@ -2402,6 +2522,7 @@ namespace PeLib
 	void PeHeaderT<x>::setIddDelayImportRva(dword dwValue)
 	{
 		m_inthHeader.dataDirectories[PELIB_IMAGE_DIRECTORY_ENTRY_DELAY_IMPORT].VirtualAddress = dwValue;
+		invalidateLayout();
 	}
 
 	template<int x>
@@ -2414,6 +2535,7 @@ namespace PeLib
 	void PeHeaderT<x>::setIddExceptionRva(dword dwValue)
 	{
 		m_inthHeader.dataDirectories[PELIB_IMAGE_DIRECTORY_ENTRY_EXCEPTION].VirtualAddress = dwValue;
+		invalidateLayout();
 	}
 
 	template<int x>
@@ -2426,6 +2548,7 @@ namespace PeLib
 	void PeHeaderT<x>::setIddGlobalPtrRva(dword dwValue)
 	{
 		m_inthHeader.dataDirectories[PELIB_IMAGE_DIRECTORY_ENTRY_GLOBALPTR].VirtualAddress = dwValue;
+		invalidateLayout();
 	}
 
 	template<int x>
@@ -2438,6 +2561,7 @@ namespace PeLib
 	void PeHeaderT<x>::setIddIatRva(dword dwValue)
 	{
 		m_inthHeader.dataDirectories[PELIB_IMAGE_DIRECTORY_ENTRY_IAT].VirtualAddress = dwValue;
+		invalidateLayout();
 	}
 
 	template<int x>
@@ -2450,6 +2574,7 @@ namespace PeLib
 	void PeHeaderT<x>::setIddLoadConfigRva(dword dwValue)
 	{
 		m_inthHeader.dataDirectories[PELIB_IMAGE_DIRECTORY_ENTRY_LOAD_CONFIG].VirtualAddress = dwValue;
+		invalidateLayout();
 	}
 
 	template<int x>
@@ -2462,6 +2587,7 @@ namespace PeLib
 	void PeHeaderT<x>::setIddResourceRva(dword dwValue)
 	{
 		m_inthHeader.dataDirectories[PELIB_IMAGE_DIRECTORY_ENTRY_RESOURCE].VirtualAddress = dwValue;
+		invalidateLayout();
 	}
 
 	template<int x>
@@ -2474,6 +2600,7 @@ namespace PeLib
 	void PeHeaderT<x>::setIddSecurityRva(dword dwValue)
 	{
 		m_inthHeader.dataDirectories[PELIB_IMAGE_DIRECTORY_ENTRY_SECURITY].VirtualAddress = dwValue;
+		invalidateLayout();
 	}
 
 	template<int x>
@@ -2486,6 +2613,7 @@ namespace PeLib
 	void PeHeaderT<x>::setIddTlsRva(dword dwValue)
 	{
 		m_inthHeader.dataDirectories[PELIB_IMAGE_DIRECTORY_ENTRY_TLS].VirtualAddress = dwValue;
+		invalidateLayout();
 	}
 
 	template<int x>
@@ -2502,6 +2630,7 @@ namespace PeLib
 	void PeHeaderT<x>::setIddExportRva(dword dwValue)
 	{
 		m_inthHeader.dataDirectories[PELIB_IMAGE_DIRECTORY_ENTRY_EXPORT].VirtualAddress = dwValue;
+		invalidateLayout();
 	}
 
 	/**
@@ -2518,6 +2647,7 @@ namespace PeLib
 	void PeHeaderT<x>::setIddBaseRelocRva(dword value)
 	{
 		m_inthHeader.dataDirectories[PELIB_IMAGE_DIRECTORY_ENTRY_BASERELOC].VirtualAddress = value;
+		invalidateLayout();
 	}
 
 	template<int x>
@@ -2530,6 +2660,7 @@ namespace PeLib
 	void PeHeaderT<x>::setIddArchitectureRva(dword value)
 	{
 		m_inthHeader.dataDirectories[PELIB_IMAGE_DIRECTORY_ENTRY_ARCHITECTURE].VirtualAddress = value;
+		invalidateLayout();
 	}
 
 	template<int x>
@@ -2542,6 +2673,7 @@ namespace PeLib
 	void PeHeaderT<x>::setIddComHeaderRva(dword value)
 	{
 		m_inthHeader.dataDirectories[PELIB_IMAGE_DIRECTORY_ENTRY_COM_DESCRIPTOR].VirtualAddress = value;
+		invalidateLayout();
 	}
 
 	template<int x>
@@ -2558,6 +2690,7 @@ namespace PeLib
 	void PeHeaderT<x>::setIddImportRva(dword dwValue)
 	{
 		m_inthHeader.dataDirectories[PELIB_IMAGE_DIRECTORY_ENTRY_IMPORT].VirtualAddress = dwValue;
+		invalidateLayout();
 	}
 
 	/**
@@ -2590,6 +2723,7 @@ namespace PeLib
 	void PeHeaderT<x>::setVirtualSize(word wSectionnr, dword dwValue)
 	{
 		m_vIsh[wSectionnr].VirtualSize = dwValue;
+		invalidateLayout();
 	}
 
 	/**
@@ -2601,6 +2735,7 @@ namespace PeLib
 	void PeHeaderT<x>::setVirtualAddress(word wSectionnr, dword dwValue)
 	{
 		m_vIsh[wSectionnr].VirtualAddress = dwValue;
+		invalidateLayout();
 	}
 
 	/**
@@ -2612,6 +2747,7 @@ namespace PeLib
 	void PeHeaderT<x>::setSizeOfRawData(word wSectionnr, dword dwValue)
 	{
 		m_vIsh[wSectionnr].SizeOfRawData = dwValue;
+		invalidateLayout();
 	}
 
 	/**
@@ -2623,6 +2759,7 @@ namespace PeLib
 	void PeHeaderT<x>::setPointerToRawData(word wSectionnr, dword dwValue)
 	{
 		m_vIsh[wSectionnr].PointerToRawData = dwValue;
+		invalidateLayout();
 	}
 
 	/**
@@ -23,5 +23,6 @@
 #define PELIB_H
 
 #include "PeFile.h"
+#include "PeFileSnapshot.h"
 
 #endif
@@ -17,6 +17,7 @@
 #ifdef _MSC_VER
 	#include <ctype.h>
 #endif
+#include <cstring>
 
 namespace PeLib
 {
@@ -32,44 +33,167 @@ namespace PeLib
 		return VirtualAddress < ish.VirtualAddress;
 	}
 
+	ParseBudget::ParseBudget()
+		: m_uiMaxBytes(UINT_MAX), m_uiMaxNodes(UINT_MAX), m_uiMaxEntries(UINT_MAX), m_uiMaxDepth(UINT_MAX),
+		m_uiMaxMilliseconds(UINT_MAX), m_uiBytes(0), m_uiNodes(0), m_uiEntries(0), m_uiDepth(0), m_bExceeded(false)
+	{
+		reset();
+	}
+
+	/**
+	* @param uiMaxBytes Bytes the readers may allocate in total.
+	* @param uiMaxNodes Resource tree nodes and leaves which may be read in total.
+	* @param uiMaxEntries Table entries which may be read in total.
+	* @param uiMaxDepth Deepest resource tree level which may be read.
+	* @param uiMaxMilliseconds Wall-clock time the readers may take in total; UINT_MAX for no limit.
+	**/
+	ParseBudget::ParseBudget(unsigned int uiMaxBytes, unsigned int uiMaxNodes, unsigned int uiMaxEntries, unsigned int uiMaxDepth, unsigned int uiMaxMilliseconds)
+		: m_uiMaxBytes(uiMaxBytes), m_uiMaxNodes(uiMaxNodes), m_uiMaxEntries(uiMaxEntries), m_uiMaxDepth(uiMaxDepth),
+		m_uiMaxMilliseconds(uiMaxMilliseconds), m_uiBytes(0), m_uiNodes(0), m_uiEntries(0), m_uiDepth(0), m_bExceeded(false)
+	{
+		reset();
+	}
+
+	bool ParseBudget::charge(unsigned int& uiUsed, unsigned int uiMax, unsigned int uiAmount)
+	{
+		if (m_bExceeded || uiAmount > uiMax - uiUsed || expired())
+		{
+			m_bExceeded = true;
+			return false;
+		}
+		uiUsed += uiAmount;
+		return true;
+	}
+
+	bool ParseBudget::chargeBytes(unsigned int uiBytes)
+	{
+		return charge(m_uiBytes, m_uiMaxBytes, uiBytes);
+	}
+
+	bool ParseBudget::chargeNodes(unsigned int uiNodes)
+	{
+		return charge(m_uiNodes, m_uiMaxNodes, uiNodes);
+	}
+
+	bool ParseBudget::chargeEntries(unsigned int uiEntries)
+	{
+		return charge(m_uiEntries, m_uiMaxEntries, uiEntries);
+	}
+
+	bool ParseBudget::enterLevel()
+	{
+		return charge(m_uiDepth, m_uiMaxDepth, 1);
+	}
+
+	void ParseBudget::leaveLevel()
+	{
+		if (m_uiDepth) m_uiDepth--;
+	}
+
+	bool ParseBudget::exceeded() const
+	{
+		return m_bExceeded;
+	}
+
+	bool ParseBudget::expired() const
+	{
+		return m_uiMaxMilliseconds != UINT_MAX && std::chrono::steady_clock::now() >= m_tpDeadline;
+	}
+
+	void ParseBudget::reset()
+	{
+		m_uiBytes = m_uiNodes = m_uiEntries = m_uiDepth = 0;
+		m_bExceeded = false;
+		if (m_uiMaxMilliseconds != UINT_MAX)
+			m_tpDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_uiMaxMilliseconds);
+	}
+
+	unsigned int ParseBudget::getBytes() const
+	{
+		return m_uiBytes;
+	}
+
+	unsigned int ParseBudget::getNodes() const
+	{
+		return m_uiNodes;
+	}
+
+	unsigned int ParseBudget::getEntries() const
+	{
+		return m_uiEntries;
+	}
+
+	unsigned int ParseBudget::getMaxBytes() const
+	{
+		return m_uiMaxBytes;
+	}
+
+	unsigned int ParseBudget::getMaxNodes() const
+	{
+		return m_uiMaxNodes;
+	}
+
+	unsigned int ParseBudget::getMaxEntries() const
+	{
+		return m_uiMaxEntries;
+	}
+
+	unsigned int ParseBudget::getMaxDepth() const
+	{
+		return m_uiMaxDepth;
+	}
+
+	unsigned int ParseBudget::getMaxMilliseconds() const
+	{
+		return m_uiMaxMilliseconds;
+	}
+
 	unsigned int alignOffset(unsigned int uiOffset, unsigned int uiAlignment)
 	{
 		if (!uiAlignment) return uiAlignment;
 		return (uiOffset % uiAlignment) ? uiOffset + (uiAlignment - uiOffset % uiAlignment) : uiOffset;
 	}
 
-	unsigned int fileSize(const std::string& filename)
+	/**
+	* Files can be larger than any offset a PE header can hold, for example because of a big overlay,
+	* so their sizes are 64-bit. Offsets and sizes from the headers are added to dwords before they
+	* are compared against it, so a value near 4 GB can't wrap around and pass the check.
+	* @return The size of the file, or 0 if it can't be determined.
+	**/
+	qword fileSize(const std::string& filename)
 	{
-		std::fstream file(filename.c_str());
+		FileStream file(filename, std::ios::in | std::ios::out);
 		file.seekg(0, std::ios::end);
-		return file.tellg();
+		std::streamoff filesize = file.tellg();
+		return (filesize < 0) ? 0 : static_cast<qword>(filesize);
 	}
 
-	unsigned int fileSize(std::ifstream& file)
+	qword fileSize(std::ifstream& file)
 	{
-		unsigned int oldpos = file.tellg();
-		file.seekg(0, std::ios::end);
-		unsigned int filesize = file.tellg();
-		file.seekg(oldpos, std::ios::beg);
-		return filesize;
+		return fileSize(static_cast<std::istream&>(file));
 	}
 	
-	unsigned int fileSize(std::fstream& file)
+	qword fileSize(std::fstream& file)
 	{
-		unsigned int oldpos = file.tellg();
+		return fileSize(static_cast<std::istream&>(file));
+	}
+	
+	qword fileSize(std::istream& file)
+	{
+		std::streampos oldpos = file.tellg();
 		file.seekg(0, std::ios::end);
-		unsigned int filesize = file.tellg();
-		file.seekg(oldpos, std::ios::beg);
-		return filesize;
+		std::streamoff filesize = file.tellg();
+		file.seekg(oldpos);
+		return (filesize < 0) ? 0 : static_cast<qword>(filesize);
 	}
 	
-	unsigned int fileSize(std::ofstream& file)
+	qword fileSize(std::ofstream& file)
 	{
-		unsigned int oldpos = file.tellp();
+		std::streampos oldpos = file.tellp();
 		file.seekp(0, std::ios::end);
-		unsigned int filesize = file.tellp();
-		file.seekp(oldpos, std::ios::beg);
-		return filesize;
+		std::streamoff filesize = file.tellp();
+		file.seekp(oldpos);
+		return (filesize < 0) ? 0 : static_cast<qword>(filesize);
 	}
 	
 	bool isEqualNc(const std::string& s1, const std::string& s2)
@@ -208,21 +332,140 @@ namespace PeLib
 		return isEqualNc(this->funcname, strFunctionName);
 	}
 	
+	/// Bytes read up front by openPeFile; enough for the headers of nearly every file.
+	const unsigned int PELIB_HEADER_WINDOW = 0x1000;
+
+	/**
+	* Reads a little-endian value from a buffer which may be too short for it.
+	* @return False, if the value doesn't lie entirely inside the buffer.
+	**/
+	template<typename T>
+	static bool peekValue(const unsigned char* pcBuffer, unsigned int uiSize, unsigned long long ullOffset, T& value)
+	{
+		if (ullOffset > uiSize || uiSize - ullOffset < sizeof(T))
+		{
+			return false;
+		}
+		memcpy(&value, pcBuffer + ullOffset, sizeof(T));
+		return true;
+	}
+
+	/**
+	* Works out how many bytes from the start of the file #PeLib::PeHeaderT<x>::read needs: the NT headers
+	* up to the end of the section table, sized by the fields in the NT headers themselves.
+	* @return The size, or 0 if the buffer is too short to tell.
+	**/
+	template<int bits>
+	static unsigned long long calcHeaderRegionSize(const unsigned char* pcBuffer, unsigned int uiSize)
+	{
+		dword dwPeOffset, dwNumberOfRvaAndSizes;
+		word wNumberOfSections;
+		unsigned int uiFixedSize = sizeof(dword) + PELIB_IMAGE_FILE_HEADER::size() + PELIB_IMAGE_OPTIONAL_HEADER<bits>::size();
+
+		if (!peekValue(pcBuffer, uiSize, 0x3C, dwPeOffset)
+			|| !peekValue(pcBuffer, uiSize, dwPeOffset + 6ULL, wNumberOfSections)
+			|| !peekValue(pcBuffer, uiSize, dwPeOffset + uiFixedSize - sizeof(dword), dwNumberOfRvaAndSizes))
+		{
+			return 0;
+		}
+
+		return dwPeOffset + uiFixedSize + dwNumberOfRvaAndSizes * 8ULL + wNumberOfSections * 0x28ULL;
+	}
+
+	/**
+	* Extends a buffer which holds the start of a file by reading on from where it ends.
+	* @param ullSize Size the buffer should have; files which are smaller only fill it up to their end.
+	**/
+	static int extendHeaderRegion(std::istream& ifFile, qword ullFileSize, unsigned long long ullSize, std::vector<unsigned char>& vBuffer)
+	{
+		qword ullOldSize = vBuffer.size();
+		qword ullNewSize = std::min<qword>(ullSize, ullFileSize);
+		if (ullNewSize <= ullOldSize)
+		{
+			return NO_ERROR;
+		}
+
+		// Headers are at the start of the file, so this is only ever more than a buffer can hold for broken ones.
+		if (ullNewSize > static_cast<size_t>(-1) / 2)
+		{
+			return ERROR_INVALID_FILE;
+		}
+
+		vBuffer.resize(static_cast<size_t>(ullNewSize));
+		ifFile.seekg(static_cast<std::streamoff>(ullOldSize), std::ios::beg);
+		if (!ifFile.read(reinterpret_cast<char*>(&vBuffer[static_cast<size_t>(ullOldSize)]), static_cast<std::streamsize>(ullNewSize - ullOldSize)))
+		{
+			return ERROR_INVALID_FILE;
+		}
+		return NO_ERROR;
+	}
+
 	/**
+	* Reads the part of a file which holds the MZ header, the PE header and the section table. The first
+	* #PeLib::PELIB_HEADER_WINDOW bytes are read at once; only files whose headers extend past them need
+	* more reads for the rest. Headers which are cut off by the end of the file are left truncated, so
+	* parsing them fails just like it would from disc.
 	* @param strFilename Name of a file.
+	* @param vBuffer Receives the start of the file.
+	**/
+	static int readHeaderRegion(const std::string& strFilename, std::vector<unsigned char>& vBuffer)
+	{
+		FileStream ifFile(strFilename, std::ios::in | std::ios::binary);
+
+		if (!ifFile)
+		{
+			return ERROR_OPENING_FILE;
+		}
+
+		qword ullFileSize = fileSize(ifFile);
+		vBuffer.clear();
+		if (!ullFileSize || extendHeaderRegion(ifFile, ullFileSize, PELIB_HEADER_WINDOW, vBuffer) != NO_ERROR)
+		{
+			return ERROR_INVALID_FILE;
+		}
+
+		// The type and the size of the rest are both in the fixed part of the NT headers, so that comes first.
+		dword dwPeOffset;
+		if (!peekValue(&vBuffer[0], static_cast<unsigned int>(vBuffer.size()), 0x3C, dwPeOffset))
+		{
+			return NO_ERROR;
+		}
+		unsigned long long ullFixedEnd = dwPeOffset + sizeof(dword) + PELIB_IMAGE_FILE_HEADER::size() + PELIB_IMAGE_OPTIONAL_HEADER<64>::size();
+		if (extendHeaderRegion(ifFile, ullFileSize, ullFixedEnd, vBuffer) != NO_ERROR)
+		{
+			return ERROR_INVALID_FILE;
+		}
+
+		unsigned int uiRead = static_cast<unsigned int>(vBuffer.size());
+		unsigned long long ullNeeded = 0;
+		unsigned int type = getFileType(&vBuffer[0], uiRead);
+		if (type == PEFILE32) ullNeeded = calcHeaderRegionSize<32>(&vBuffer[0], uiRead);
+		else if (type == PEFILE64) ullNeeded = calcHeaderRegionSize<64>(&vBuffer[0], uiRead);
+
+		return extendHeaderRegion(ifFile, ullFileSize, ullNeeded, vBuffer);
+	}
+
+	/**
+	* Only the signatures and the fields which tell the two formats apart are looked at; the headers
+	* aren't parsed.
+	* @param pcBuffer Pointer to the first byte of the file.
+	* @param uiSize Size of the buffer. It only needs to hold the start of the file up to the optional header.
 	* @return Either PEFILE32, PEFILE64 or PEFILE_UNKNOWN
 	**/
-	unsigned int getFileType(const std::string strFilename)
+	unsigned int getFileType(const unsigned char* pcBuffer, unsigned int uiSize)
 	{
-		word machine, magic;
-		
-		PeFile32 pef(strFilename);
-		if (pef.readMzHeader() != NO_ERROR) return PEFILE_UNKNOWN;
-		if (pef.readPeHeader() != NO_ERROR) return PEFILE_UNKNOWN;
-			
-		machine = pef.peHeader().getMachine();
-		magic = pef.peHeader().getMagic();
-	
+		word mzMagic, machine, magic;
+		dword dwPeOffset, dwPeSignature;
+
+		if (!peekValue(pcBuffer, uiSize, 0, mzMagic) || mzMagic != PELIB_IMAGE_DOS_SIGNATURE
+			|| !peekValue(pcBuffer, uiSize, 0x3C, dwPeOffset)
+			|| !peekValue(pcBuffer, uiSize, dwPeOffset, dwPeSignature) || dwPeSignature != PELIB_IMAGE_NT_SIGNATURE
+			|| !peekValue(pcBuffer, uiSize, dwPeOffset + 4ULL, machine)
+			|| !peekValue(pcBuffer, uiSize, dwPeOffset + 24ULL, magic))
+		{
+			return PEFILE_UNKNOWN;
+		}
+
 		if (machine == PELIB_IMAGE_FILE_MACHINE_I386 && magic == PELIB_IMAGE_NT_OPTIONAL_HDR32_MAGIC)
 		{
 			return PEFILE32;
@@ -237,30 +480,89 @@ namespace PeLib
 			return PEFILE_UNKNOWN;
 		}
 	}
-	
+
 	/**
-	* Opens a PE file. The return type is either PeFile32 or PeFile64 object. If an error occurs the return
-	* value is 0.
 	* @param strFilename Name of a file.
-	* @return Either a PeFile32 object, a PeFil64 object or 0.
+	* @return Either PEFILE32, PEFILE64 or PEFILE_UNKNOWN
 	**/
-	PeFile* openPeFile(const std::string& strFilename)
+	unsigned int getFileType(const std::string strFilename)
+	{
+		PeFile* pef = openPeFile(strFilename);
+		unsigned int type = pef ? pef->getBits() : static_cast<unsigned int>(PEFILE_UNKNOWN);
+		delete pef;
+		return type;
+	}
+
+	/**
+	* Reads the MZ and PE header of a file from memory into a new PeFile32 or PeFile64.
+	* @param pef The new file object, which is deleted if a header can't be read.
+	* @return pef, or 0 if a header can't be read.
+	**/
+	template<typename T>
+	static PeFile* readHeaders(T* pef, const unsigned char* pcBuffer, unsigned int uiSize)
 	{
-		unsigned int type = getFileType(strFilename);
-		
+		if (pef->readMzHeader(pcBuffer, uiSize) != NO_ERROR || pef->readPeHeader(pcBuffer, uiSize) != NO_ERROR)
+		{
+			delete pef;
+			return 0;
+		}
+		return pef;
+	}
+
+	/**
+	* Opens a PE file which is already in memory. The return type is either a PeFile32 or a PeFile64 object
+	* whose MZ and PE header have already been read. If an error occurs the return value is 0.
+	* @param pcBuffer Pointer to the first byte of the file.
+	* @param uiSize Size of the buffer. It only needs to hold the start of the file up to the end of the section table.
+	* @param strFilename Name of the file, which the returned object uses for any later reads from disc.
+	* @return Either a PeFile32 object, a PeFile64 object or 0.
+	**/
+	PeFile* openPeFile(const unsigned char* pcBuffer, unsigned int uiSize, const std::string& strFilename)
+	{
+		unsigned int type = getFileType(pcBuffer, uiSize);
+
 		if (type == PEFILE32)
 		{
-			return new PeFile32(strFilename);
+			return readHeaders(new PeFile32(strFilename), pcBuffer, uiSize);
 		}
 		else if (type == PEFILE64)
 		{
-			return new PeFile64(strFilename);
+			return readHeaders(new PeFile64(strFilename), pcBuffer, uiSize);
 		}
 		else
 		{
 			return 0;
 		}
 	}
+
+	/**
+	* Opens a PE file. The return type is either PeFile32 or PeFile64 object whose MZ and PE header have
+	* already been read, so there's no need to call #PeLib::PeFile::readMzHeader or
+	* #PeLib::PeFile::readPeHeader again. The header region is read from disc once, usually with a single
+	* read. If an error occurs the return value is 0.
+	* @param strFilename Name of a file.
+	* @return Either a PeFile32 object, a PeFil64 object or 0.
+	**/
+	PeFile* openPeFile(const std::string& strFilename)
+	{
+		PELIB_TRACE_SPAN("openPeFile");
+		std::vector<unsigned char> vHeaders;
+		IoStats ioHeaders;
+		{
+			IoScope ioScope(ioHeaders);
+			if (readHeaderRegion(strFilename, vHeaders) != NO_ERROR)
+			{
+				return 0;
+			}
+		}
+
+		PeFile* pef = openPeFile(&vHeaders[0], static_cast<unsigned int>(vHeaders.size()), strFilename);
+		if (pef)
+		{
+			pef->ioStats() += ioHeaders;
+		}
+		return pef;
+	}
 	
 	unsigned int PELIB_IMAGE_BOUND_DIRECTORY::size() const
 	{
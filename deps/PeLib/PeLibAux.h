@@ -17,9 +17,13 @@
 //#include "PeHeader.h"
 #include "buffer/OutputBuffer.h"
 #include "buffer/InputBuffer.h"
+#include "ArenaAllocator.h"
+#include "Trace.h"
+#include "FileStream.h"
 //#include "buffer/ResTree.h"
 #include <numeric>
 #include <limits>
+#include <chrono>
 
 namespace PeLib
 {
@@ -34,7 +38,67 @@ namespace PeLib
 		ERROR_NO_SECTION_ALIGNMENT = -6,
 		ERROR_ENTRY_NOT_FOUND = -7,
 		ERROR_DUPLICATE_ENTRY = -8,
-		ERROR_DIRECTORY_DOES_NOT_EXIST = -9
+		ERROR_DIRECTORY_DOES_NOT_EXIST = -9,
+		ERROR_BUDGET_EXCEEDED = -10
+	};
+
+	/// Limits how much work the directory readers may do for a single file.
+	/**
+	* Header fields decide how much the readers allocate and how many entries they walk, so a
+	* hostile file can ask for gigabytes. Every reader charges what it is about to allocate or
+	* walk against a ParseBudget first and fails with ERROR_BUDGET_EXCEEDED once a limit would
+	* be passed. Usage accumulates over all readers of a file until reset() is called.
+	* The time limit is wall-clock time since the budget was created or last reset, and is
+	* checked with every charge. A default-constructed budget is unlimited.
+	**/
+	class ParseBudget
+	{
+		private:
+		  unsigned int m_uiMaxBytes; ///< Bytes the readers may allocate.
+		  unsigned int m_uiMaxNodes; ///< Resource tree nodes and leaves.
+		  unsigned int m_uiMaxEntries; ///< Table entries (relocations, thunks, exports, ...).
+		  unsigned int m_uiMaxDepth; ///< Resource tree depth.
+		  unsigned int m_uiMaxMilliseconds; ///< Wall-clock time the readers may take.
+		  std::chrono::steady_clock::time_point m_tpDeadline;
+		  unsigned int m_uiBytes;
+		  unsigned int m_uiNodes;
+		  unsigned int m_uiEntries;
+		  unsigned int m_uiDepth;
+		  bool m_bExceeded;
+
+		  bool charge(unsigned int& uiUsed, unsigned int uiMax, unsigned int uiAmount);
+
+		public:
+		  /// Creates an unlimited budget.
+		  ParseBudget();
+		  ParseBudget(unsigned int uiMaxBytes, unsigned int uiMaxNodes, unsigned int uiMaxEntries, unsigned int uiMaxDepth, unsigned int uiMaxMilliseconds = UINT_MAX);
+
+		  /// Charges bytes which are about to be allocated.
+		  bool chargeBytes(unsigned int uiBytes);
+		  /// Charges resource tree nodes or leaves which are about to be read.
+		  bool chargeNodes(unsigned int uiNodes);
+		  /// Charges table entries which are about to be read.
+		  bool chargeEntries(unsigned int uiEntries);
+		  /// Enters one more level of the resource tree.
+		  bool enterLevel();
+		  /// Leaves a level entered with enterLevel().
+		  void leaveLevel();
+
+		  /// Returns true once any charge has failed.
+		  bool exceeded() const;
+		  /// Returns true if the time limit has passed, whether or not a charge has failed since.
+		  bool expired() const;
+		  /// Forgets all usage and restarts the clock, keeping the limits.
+		  void reset();
+
+		  unsigned int getBytes() const;
+		  unsigned int getNodes() const;
+		  unsigned int getEntries() const;
+		  unsigned int getMaxBytes() const;
+		  unsigned int getMaxNodes() const;
+		  unsigned int getMaxEntries() const;
+		  unsigned int getMaxDepth() const;
+		  unsigned int getMaxMilliseconds() const;
 	};
 
 	class PeFile;
@@ -274,6 +338,21 @@ namespace PeLib
 		PELIB_IMAGE_SUBSYSTEM_WINDOWS_CE_GUI       = 9
 	};
 
+	enum
+	{
+		PELIB_IMAGE_DLLCHARACTERISTICS_HIGH_ENTROPY_VA       = 0x0020,
+		PELIB_IMAGE_DLLCHARACTERISTICS_DYNAMIC_BASE          = 0x0040,
+		PELIB_IMAGE_DLLCHARACTERISTICS_FORCE_INTEGRITY       = 0x0080,
+		PELIB_IMAGE_DLLCHARACTERISTICS_NX_COMPAT             = 0x0100,
+		PELIB_IMAGE_DLLCHARACTERISTICS_NO_ISOLATION          = 0x0200,
+		PELIB_IMAGE_DLLCHARACTERISTICS_NO_SEH                = 0x0400,
+		PELIB_IMAGE_DLLCHARACTERISTICS_NO_BIND               = 0x0800,
+		PELIB_IMAGE_DLLCHARACTERISTICS_APPCONTAINER          = 0x1000,
+		PELIB_IMAGE_DLLCHARACTERISTICS_WDM_DRIVER            = 0x2000,
+		PELIB_IMAGE_DLLCHARACTERISTICS_GUARD_CF              = 0x4000,
+		PELIB_IMAGE_DLLCHARACTERISTICS_TERMINAL_SERVER_AWARE = 0x8000
+	};
+
 	enum
 	{
 		PELIB_RT_CURSOR = 1,		// 1
@@ -484,7 +563,7 @@ namespace PeLib
 		dword Signature;
 		PELIB_IMAGE_FILE_HEADER FileHeader;
 		PELIB_IMAGE_OPTIONAL_HEADER<x> OptionalHeader;
-		std::vector<PELIB_IMAGE_DATA_DIRECTORY> dataDirectories;
+		ArenaVector<PELIB_IMAGE_DATA_DIRECTORY> dataDirectories;
 		
 		unsigned int size() const
 		{
@@ -622,7 +701,7 @@ namespace PeLib
 	{
 		PELIB_IMAGE_BOUND_IMPORT_DESCRIPTOR ibdDescriptor; ///< Information about the imported file.
 		std::string strModuleName; ///< Name of the imported file.
-		std::vector<PELIB_IMAGE_BOUND_DIRECTORY> moduleForwarders;
+		ArenaVector<PELIB_IMAGE_BOUND_DIRECTORY> moduleForwarders;
 
 		// Will be used in std::find_if
 		// Passing by-reference not possible (see C++ Standard Core Language Defect Reports, Revision 29, Issue 106)
@@ -675,6 +754,16 @@ namespace PeLib
 
 	const unsigned int PELIB_IMAGE_SIZEOF_BASE_RELOCATION = 8;
 
+	enum
+	{
+		PELIB_IMAGE_REL_BASED_ABSOLUTE = 0,
+		PELIB_IMAGE_REL_BASED_HIGH     = 1,
+		PELIB_IMAGE_REL_BASED_LOW      = 2,
+		PELIB_IMAGE_REL_BASED_HIGHLOW  = 3,
+		PELIB_IMAGE_REL_BASED_HIGHADJ  = 4,
+		PELIB_IMAGE_REL_BASED_DIR64    = 10
+	};
+
 	struct PELIB_IMG_RES_DIR_ENTRY
 	{
 		PELIB_IMAGE_RESOURCE_DIRECTORY_ENTRY irde;
@@ -719,7 +808,7 @@ namespace PeLib
 		PELIB_IMAGE_EXPORT_DIRECTORY ied;
 		/// The original filename of current file.
 		std::string name;
-		std::vector<PELIB_EXP_FUNC_INFORMATION> functions;
+		ArenaVector<PELIB_EXP_FUNC_INFORMATION> functions;
 		inline unsigned int size() const
 		{
 			return PELIB_IMAGE_EXPORT_DIRECTORY::size() + name.size() + 1 + 
@@ -763,9 +852,9 @@ namespace PeLib
 		/// The name of an imported DLL.
 		std::string name;
 		/// All original first thunk values of an imported DLL.
-		std::vector<PELIB_THUNK_DATA<bits> > originalfirstthunk;
+		ArenaVector<PELIB_THUNK_DATA<bits> > originalfirstthunk;
 		/// All first thunk value of an imported DLL.
-		std::vector<PELIB_THUNK_DATA<bits> > firstthunk;
+		ArenaVector<PELIB_THUNK_DATA<bits> > firstthunk;
 		
 //		bool operator==(std::string strFilename) const;
 		inline unsigned int size() const
@@ -800,7 +889,7 @@ namespace PeLib
 	struct IMG_BASE_RELOC
     {
 		PELIB_IMAGE_BASE_RELOCATION ibrRelocation;
-		std::vector<word> vRelocData;
+		ArenaVector<word> vRelocData;
 	};
 	
 	struct PELIB_IMAGE_DEBUG_DIRECTORY
@@ -851,18 +940,23 @@ namespace PeLib
 	    static unsigned int size(){return 40;}
 	};
 
-	unsigned int fileSize(const std::string& filename);
-	unsigned int fileSize(std::ifstream& file);
-	unsigned int fileSize(std::ofstream& file);
-	unsigned int fileSize(std::fstream& file);
+	qword fileSize(const std::string& filename);
+	qword fileSize(std::ifstream& file);
+	qword fileSize(std::ofstream& file);
+	qword fileSize(std::fstream& file);
+	qword fileSize(std::istream& file);
 	bool isEqualNc(const std::string& s1, const std::string& s2);
 	unsigned int alignOffset(unsigned int uiOffset, unsigned int uiAlignment);
 	
 	/// Determines if a file is a 32bit or 64bit PE file.
 	unsigned int getFileType(const std::string strFilename);
+	/// Determines if a file in memory is a 32bit or 64bit PE file.
+	unsigned int getFileType(const unsigned char* pcBuffer, unsigned int uiSize);
 	
-	/// Opens a PE file.
+	/// Opens a PE file and reads its MZ and PE header.
 	PeFile* openPeFile(const std::string& strFilename);
+	/// Opens a PE file in memory and reads its MZ and PE header.
+	PeFile* openPeFile(const unsigned char* pcBuffer, unsigned int uiSize, const std::string& strFilename = "");
 
   /*  enum MzHeader_Field {e_magic, e_cblp, e_cp, e_crlc, e_cparhdr, e_minalloc, e_maxalloc,
                         e_ss, e_sp, e_csum, e_ip, e_cs, e_lfarlc, e_ovno, e_res, e_oemid,
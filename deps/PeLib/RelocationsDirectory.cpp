@@ -20,14 +20,17 @@ namespace PeLib
 		m_vRelocations[ulRelocation].vRelocData[ulDataNumber] = wData;
 	}
 	
-	void RelocationsDirectory::read(InputBuffer& inputbuffer, unsigned int uiSize)
+	int RelocationsDirectory::read(InputBuffer& inputbuffer, unsigned int uiSize, ParseBudget* pBudget)
 	{
 		IMG_BASE_RELOC ibrCurr;
 
-		std::vector<IMG_BASE_RELOC> vCurrReloc;
+		ArenaVector<IMG_BASE_RELOC> vCurrReloc;
 
 		do
 		{
+			// Padding too short for another block header ends the table.
+			if (uiSize - inputbuffer.get() < PELIB_IMAGE_SIZEOF_BASE_RELOCATION) break;
+
 			inputbuffer >> ibrCurr.ibrRelocation.VirtualAddress;
 			inputbuffer >> ibrCurr.ibrRelocation.SizeOfBlock;
 
@@ -36,7 +39,21 @@ namespace PeLib
 			// That's not how to check if there are relocations, some DLLs start at VA 0.
 			// if (!ibrCurr.ibrRelocation.VirtualAddress) break;
 
-			for (unsigned int i=0;i<(ibrCurr.ibrRelocation.SizeOfBlock - PELIB_IMAGE_SIZEOF_BASE_RELOCATION) / sizeof(word);i++)
+			// A block must hold its own header and end inside the directory, or its entries would be read from past the buffer.
+			if (ibrCurr.ibrRelocation.SizeOfBlock < PELIB_IMAGE_SIZEOF_BASE_RELOCATION
+				|| ibrCurr.ibrRelocation.SizeOfBlock - PELIB_IMAGE_SIZEOF_BASE_RELOCATION > uiSize - inputbuffer.get())
+			{
+				return ERROR_INVALID_FILE;
+			}
+
+			// SizeOfBlock comes straight from the file; a bogus one must not make us walk billions of entries.
+			unsigned int uiEntries = (ibrCurr.ibrRelocation.SizeOfBlock - PELIB_IMAGE_SIZEOF_BASE_RELOCATION) / sizeof(word);
+			if (pBudget && (!pBudget->chargeEntries(uiEntries) || !pBudget->chargeBytes(uiEntries * sizeof(word))))
+			{
+				return ERROR_BUDGET_EXCEEDED;
+			}
+
+			for (unsigned int i=0;i<uiEntries;i++)
 			{
 				word wData;
 				inputbuffer >> wData;
@@ -46,44 +63,51 @@ namespace PeLib
 			vCurrReloc.push_back(ibrCurr);
 		} while (ibrCurr.ibrRelocation.VirtualAddress && inputbuffer.get() < uiSize);
 
-		std::swap(vCurrReloc, m_vRelocations);
+		m_vRelocations = std::move(vCurrReloc);
+		return NO_ERROR;
 	}
 	
 	// TODO: Return value is wrong if buffer was too small.
-	int RelocationsDirectory::read(const unsigned char* buffer, unsigned int buffersize)
+	int RelocationsDirectory::read(const unsigned char* buffer, unsigned int buffersize, ParseBudget* pBudget)
 	{
+		if (pBudget && !pBudget->chargeBytes(buffersize))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
+
 		std::vector<unsigned char> vRelocDirectory(buffer, buffer + buffersize);
 
 		InputBuffer ibBuffer(vRelocDirectory);
-		read(ibBuffer, buffersize);
-	
-		return NO_ERROR;
+		return read(ibBuffer, buffersize, pBudget);
 	}
 
-	int RelocationsDirectory::read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize)
+	int RelocationsDirectory::read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, ParseBudget* pBudget)
 	{
-		std::ifstream ifFile(strFilename.c_str(), std::ios::binary);
-		unsigned int ulFileSize = fileSize(ifFile);
+		FileStream ifFile(strFilename, std::ios::in | std::ios::binary);
+		qword ulFileSize = fileSize(ifFile);
 
 		if (!ifFile)
 		{
 			return ERROR_OPENING_FILE;
 		}
 		
-		if (ulFileSize < uiOffset + uiSize)
+		if (ulFileSize < static_cast<qword>(uiOffset) + uiSize)
 		{
 			return ERROR_INVALID_FILE;
 		}
 
+		if (pBudget && !pBudget->chargeBytes(uiSize))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
+
 		ifFile.seekg(uiOffset, std::ios::beg);
 
 		std::vector<unsigned char> vRelocDirectory(uiSize);
 		ifFile.read(reinterpret_cast<char*>(&vRelocDirectory[0]), uiSize);
 
 		InputBuffer ibBuffer(vRelocDirectory);
-		read(ibBuffer, uiSize);
-		
-		return NO_ERROR;
+		return read(ibBuffer, uiSize, pBudget);
 	}
 	
 	unsigned int RelocationsDirectory::size() const
@@ -100,6 +124,7 @@ namespace PeLib
 	
 	void RelocationsDirectory::rebuild(std::vector<byte>& vBuffer) const
 	{
+		PELIB_TRACE_SPAN("RelocationsDirectory::rebuild");
 		OutputBuffer obBuffer(vBuffer);
 		
 		for (unsigned int i=0;i<m_vRelocations.size();i++)
@@ -179,17 +204,18 @@ namespace PeLib
 		  
 	int RelocationsDirectory::write(const std::string& strFilename, unsigned int uiOffset) const
 	{
-		std::fstream ofFile(strFilename.c_str(), std::ios_base::in);
+		PELIB_TRACE_SPAN("RelocationsDirectory::write");
+		FileStream ofFile(strFilename, std::ios_base::in);
 		
 		if (!ofFile)
 		{
 			ofFile.clear();
-			ofFile.open(strFilename.c_str(), std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::out | std::ios_base::binary);
 		}
 		else
 		{
 			ofFile.close();
-			ofFile.open(strFilename.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
 		}
 		
 		if (!ofFile)
@@ -22,9 +22,9 @@ namespace PeLib
 	class RelocationsDirectory
 	{
 		private:
-		  std::vector<IMG_BASE_RELOC> m_vRelocations; ///< Used to store the relocation data.
+		  ArenaVector<IMG_BASE_RELOC> m_vRelocations; ///< Used to store the relocation data.
 
-		  void read(InputBuffer& inputbuffer, unsigned int uiSize);
+		  int read(InputBuffer& inputbuffer, unsigned int uiSize, ParseBudget* pBudget);
 
 		public:
 		  /// Returns the number of relocations in the relocations directory.
@@ -33,8 +33,8 @@ namespace PeLib
 		  unsigned int calcNumberOfRelocationData(unsigned int ulRelocation) const; // EXPORT
 
 		  /// Read a file's relocations directory.
-		  int read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize); // EXPORT
-		  int read(const unsigned char* buffer, unsigned int buffersize); // EXPORT
+		  int read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, ParseBudget* pBudget = 0); // EXPORT
+		  int read(const unsigned char* buffer, unsigned int buffersize, ParseBudget* pBudget = 0); // EXPORT
 		  /// Rebuilds the relocations directory.
 		  void rebuild(std::vector<byte>& vBuffer) const; // EXPORT
 		  /// Returns the size of the relocations directory.
@@ -165,9 +165,10 @@ namespace PeLib
 	* @param inpBuffer An InputBuffer that holds the complete resource directory.
 	* @param uiOffset Offset of the resource leaf that's to be read.
 	* @param uiRva RVA of the beginning of the resource directory.
+	* @param pBudget Optional budget which is charged for the leaf and its data.
 	* @param pad Used for debugging purposes.
 	**/
-	int ResourceLeaf::read(InputBuffer& inpBuffer, unsigned int uiOffset, unsigned int uiRva/*, const std::string& pad*/)
+	int ResourceLeaf::read(InputBuffer& inpBuffer, unsigned int uiOffset, unsigned int uiRva, ParseBudget* pBudget/*, const std::string& pad*/)
 	{
 //		std::cout << pad << "Leaf:" << std::endl;
 		
@@ -191,14 +192,19 @@ namespace PeLib
 		std::cout << pad << std::hex << "CodePage: " << entry.CodePage << std::endl;
 		std::cout << pad << std::hex << "Reserved: " << entry.Reserved << std::endl;
 */		
-		// Invalid leaf.
-		if (entry.OffsetToData - uiRva + entry.Size > inpBuffer.size())
+		// Invalid leaf. Data in front of the directory, or an offset and size which only fit by wrapping around, are rejected too.
+		if (entry.OffsetToData < uiRva || static_cast<unsigned long long>(entry.OffsetToData - uiRva) + entry.Size > inpBuffer.size())
 		{
 //			std::cout << entry.OffsetToData << " XXX " << uiRva << " - " << entry.Size << " - " << inpBuffer.size() << std::endl;
 			return 1;
 		}
 		
 //		std::cout << entry.OffsetToData << " - " << uiRva << " - " << entry.Size << " - " << inpBuffer.size() << std::endl;
+		if (pBudget && !pBudget->chargeBytes(entry.Size))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
+
 		inpBuffer.set(entry.OffsetToData - uiRva);
 		m_data.assign(inpBuffer.data() + inpBuffer.get(), inpBuffer.data() + inpBuffer.get() + entry.Size);
 //		std::cout << pad << std::hex << "Vector: " << m_data.size() << std::endl;
@@ -436,9 +442,10 @@ namespace PeLib
 	* @param inpBuffer An InputBuffer that holds the complete resource directory.
 	* @param uiOffset Offset of the resource node that's to be read.
 	* @param uiRva RVA of the beginning of the resource directory.
+	* @param pBudget Optional budget which is charged for the node's level and children.
 	* @param pad Something I need for debugging. Will be removed soon.
 	**/
-	int ResourceNode::read(InputBuffer& inpBuffer, unsigned int uiOffset, unsigned int uiRva/*, const std::string& pad*/)
+	int ResourceNode::read(InputBuffer& inpBuffer, unsigned int uiOffset, unsigned int uiRva, ParseBudget* pBudget/*, const std::string& pad*/)
 	{
 		// Not enough space to be a valid node.
 		if (uiOffset + PELIB_IMAGE_RESOURCE_DIRECTORY::size() > inpBuffer.size())
@@ -471,10 +478,17 @@ namespace PeLib
 //		std::cout << std::hex << pad << "MinorVersion: " << header.MinorVersion << std::endl;
 //		std::cout << std::hex << pad << "NumberOfNamedEntries: " << header.NumberOfNamedEntries << std::endl;
 //		std::cout << std::hex << pad << "NumberOfIdEntries: " << header.NumberOfIdEntries << std::endl;
+
+		// Nodes can point back at their parents, so the depth limit is what stops a cycle.
+		if (pBudget && (!pBudget->chargeNodes(header.NumberOfNamedEntries + header.NumberOfIdEntries) || !pBudget->enterLevel()))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
 			
 		for (int i=0;i<header.NumberOfNamedEntries + header.NumberOfIdEntries;i++)
 		{
 			ResourceChild rc;
+			int iRet;
 			inpBuffer >> rc.entry.irde.Name;
 			inpBuffer >> rc.entry.irde.OffsetToData;
 			
@@ -510,12 +524,19 @@ namespace PeLib
 			if (rc.entry.irde.OffsetToData & PELIB_IMAGE_RESOURCE_DATA_IS_DIRECTORY)
 			{
 				rc.child = new ResourceNode;
-				rc.child->read(inpBuffer, rc.entry.irde.OffsetToData & ~PELIB_IMAGE_RESOURCE_DATA_IS_DIRECTORY, uiRva/*, pad + "  "*/);
+				iRet = rc.child->read(inpBuffer, rc.entry.irde.OffsetToData & ~PELIB_IMAGE_RESOURCE_DATA_IS_DIRECTORY, uiRva, pBudget/*, pad + "  "*/);
 			}
 			else
 			{
 				rc.child = new ResourceLeaf;
-				rc.child->read(inpBuffer, rc.entry.irde.OffsetToData, uiRva/*, pad + "  "*/);
+				iRet = rc.child->read(inpBuffer, rc.entry.irde.OffsetToData, uiRva, pBudget/*, pad + "  "*/);
+			}
+
+			// Other errors only leave a broken child behind, but an exhausted budget ends the whole read.
+			if (iRet == ERROR_BUDGET_EXCEEDED)
+			{
+				pBudget->leaveLevel();
+				return iRet;
 			}
 //			std::cout << std::hex << pad << "Entry " << i << "(Name): " << rc.entry.irde.Name << std::endl;
 //			std::cout << std::hex << pad << "Entry " << i << "(Offset): " << rc.entry.irde.OffsetToData << std::endl;
@@ -524,6 +545,11 @@ namespace PeLib
 			inpBuffer.set(lastPos);
 		}
 		
+		if (pBudget)
+		{
+			pBudget->leaveLevel();
+		}
+		
 		return 0;
 	}
 	
@@ -777,15 +803,16 @@ namespace PeLib
 	* @param uiOffset File offset of the resource directory.
 	* @param uiSize Raw size of the resource directory.
 	* @param uiResDirRva RVA of the beginning of the resource directory.
+	* @param pBudget Optional budget which is charged for everything the directory allocates.
 	**/
-	int ResourceDirectory::read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, unsigned int uiResDirRva)
+	int ResourceDirectory::read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, unsigned int uiResDirRva, ParseBudget* pBudget)
 	{
 		if (!uiSize || !uiOffset)
 		{
 			return 1;
 		}
 		
-		std::ifstream ifFile(strFilename.c_str(), std::ios::binary);
+		FileStream ifFile(strFilename, std::ios::in | std::ios::binary);
 		
 		if (!ifFile)
 		{
@@ -793,12 +820,17 @@ namespace PeLib
 			return 1;
 		}
 		
-		if (fileSize(ifFile) < uiOffset + uiSize)
+		if (fileSize(ifFile) < static_cast<qword>(uiOffset) + uiSize)
 		{
 //			throw Exceptions::InvalidFormat(ResourceDirectoryId, __LINE__);
 			return 1;
 		}
 
+		if (pBudget && !pBudget->chargeBytes(uiSize))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
+
 		ifFile.seekg(uiOffset, std::ios::beg);
 		
 		PELIB_IMAGE_RESOURCE_DIRECTORY irdCurrRoot;
@@ -809,10 +841,36 @@ namespace PeLib
 		InputBuffer inpBuffer(vResourceDirectory);
 		
 //		ResourceNode currNode;
-		return m_rnRoot.read(inpBuffer, 0, uiResDirRva/*, ""*/);
+		return m_rnRoot.read(inpBuffer, 0, uiResDirRva, pBudget/*, ""*/);
 //		std::swap(currNode, m_rnRoot);
 	}
 
+	/**
+	* Reads the resource directory from memory.
+	* @param pcBuffer Pointer to the first byte of the resource directory.
+	* @param uiSize Raw size of the resource directory.
+	* @param uiResDirRva RVA of the beginning of the resource directory.
+	* @param pBudget Optional budget which is charged for everything the directory allocates.
+	**/
+	int ResourceDirectory::read(const unsigned char* pcBuffer, unsigned int uiSize, unsigned int uiResDirRva, ParseBudget* pBudget)
+	{
+		if (!uiSize)
+		{
+			return 1;
+		}
+
+		if (pBudget && !pBudget->chargeBytes(uiSize))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
+
+		std::vector<byte> vResourceDirectory(pcBuffer, pcBuffer + uiSize);
+
+		InputBuffer inpBuffer(vResourceDirectory);
+		
+		return m_rnRoot.read(inpBuffer, 0, uiResDirRva, pBudget/*, ""*/);
+	}
+
 	/**
 	* Rebuilds the resource directory.
 	* @param vBuffer Buffer the source directory will be written to.
@@ -820,6 +878,7 @@ namespace PeLib
 	**/
 	void ResourceDirectory::rebuild(std::vector<byte>& vBuffer, unsigned int uiRva) const
 	{
+		PELIB_TRACE_SPAN("ResourceDirectory::rebuild");
 		OutputBuffer obBuffer(vBuffer);
 		unsigned int offs = 0;
 //		std::cout << "Root: " << m_rnRoot.children.size() << std::endl;
@@ -843,17 +902,18 @@ namespace PeLib
 	**/
 	int ResourceDirectory::write(const std::string& strFilename, unsigned int uiOffset, unsigned int uiRva) const
 	{
-		std::fstream ofFile(strFilename.c_str(), std::ios_base::in);
+		PELIB_TRACE_SPAN("ResourceDirectory::write");
+		FileStream ofFile(strFilename, std::ios_base::in);
 		
 		if (!ofFile)
 		{
 			ofFile.clear();
-			ofFile.open(strFilename.c_str(), std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::out | std::ios_base::binary);
 		}
 		else
 		{
 			ofFile.close();
-			ofFile.open(strFilename.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
 		}
 		
 		if (!ofFile)
@@ -879,7 +939,7 @@ namespace PeLib
 	**/
 	int ResourceDirectory::addResourceType(dword dwResTypeId)
 	{
-		std::vector<ResourceChild>::iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(&ResourceChild::equalId), dwResTypeId));
+		ArenaVector<ResourceChild>::iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(&ResourceChild::equalId), dwResTypeId));
 		if (Iter != m_rnRoot.children.end())
 		{
 			return 1;
@@ -900,7 +960,7 @@ namespace PeLib
 	**/
 	int ResourceDirectory::addResourceType(const std::string& strResTypeName)
 	{
-		std::vector<ResourceChild>::iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(&ResourceChild::equalName), strResTypeName));
+		ArenaVector<ResourceChild>::iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(&ResourceChild::equalName), strResTypeName));
 		if (Iter != m_rnRoot.children.end())
 		{
 			return 1;
@@ -921,7 +981,7 @@ namespace PeLib
 	**/
 	int ResourceDirectory::removeResourceType(dword dwResTypeId)
 	{
-		std::vector<ResourceChild>::iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(&ResourceChild::equalId), dwResTypeId));
+		ArenaVector<ResourceChild>::iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(&ResourceChild::equalId), dwResTypeId));
 		if (Iter == m_rnRoot.children.end())
 		{
 			return 1;
@@ -945,7 +1005,7 @@ namespace PeLib
 	**/
 	int ResourceDirectory::removeResourceType(const std::string& strResTypeName)
 	{
-		std::vector<ResourceChild>::iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(&ResourceChild::equalName), strResTypeName));
+		ArenaVector<ResourceChild>::iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(&ResourceChild::equalName), strResTypeName));
 		if (Iter == m_rnRoot.children.end())
 		{
 			return 1;
@@ -1115,7 +1175,7 @@ namespace PeLib
 	**/
 	int ResourceDirectory::resourceTypeIdToIndex(dword dwResTypeId) const
 	{
-		std::vector<ResourceChild>::const_iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(&ResourceChild::equalId), dwResTypeId));
+		ArenaVector<ResourceChild>::const_iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(&ResourceChild::equalId), dwResTypeId));
 		if (Iter == m_rnRoot.children.end()) return -1;
 		return static_cast<unsigned int>(std::distance(m_rnRoot.children.begin(), Iter));
 	}
@@ -1127,7 +1187,7 @@ namespace PeLib
 	**/
 	int ResourceDirectory::resourceTypeNameToIndex(const std::string& strResTypeName) const
 	{
-		std::vector<ResourceChild>::const_iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(&ResourceChild::equalName), strResTypeName));
+		ArenaVector<ResourceChild>::const_iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(&ResourceChild::equalName), strResTypeName));
 		if (Iter == m_rnRoot.children.end()) return -1;
 		return static_cast<unsigned int>(std::distance(m_rnRoot.children.begin(), Iter));
 	}
@@ -1139,7 +1199,7 @@ namespace PeLib
 	**/
 	unsigned int ResourceDirectory::getNumberOfResources(dword dwId) const
 	{
-//		std::vector<ResourceChild>::const_iterator IterD = m_rnRoot.children.begin();
+//		ArenaVector<ResourceChild>::const_iterator IterD = m_rnRoot.children.begin();
 //		std::cout << dwId << std::endl;
 //		while (IterD != m_rnRoot.children.end())
 //		{
@@ -1147,7 +1207,7 @@ namespace PeLib
 //			++IterD;
 //		}
 		
-		std::vector<ResourceChild>::const_iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(&ResourceChild::equalId), dwId));
+		ArenaVector<ResourceChild>::const_iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(&ResourceChild::equalId), dwId));
 		if (Iter == m_rnRoot.children.end())
 		{
 			return 0xFFFFFFFF;
@@ -1166,7 +1226,7 @@ namespace PeLib
 	**/
 	unsigned int ResourceDirectory::getNumberOfResources(const std::string& strResTypeName) const
 	{
-		std::vector<ResourceChild>::const_iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(&ResourceChild::equalName), strResTypeName));
+		ArenaVector<ResourceChild>::const_iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(&ResourceChild::equalName), strResTypeName));
 		if (Iter == m_rnRoot.children.end())
 		{
 			return 0xFFFFFFFF;
@@ -67,7 +67,7 @@ namespace PeLib
 		  unsigned int uiElementRva;
 		
 		  /// Reads the next resource element from the InputBuffer.
-		  virtual int read(InputBuffer&, unsigned int, unsigned int/*, const std::string&*/) = 0;
+		  virtual int read(InputBuffer&, unsigned int, unsigned int, ParseBudget*/*, const std::string&*/) = 0;
 		  /// Writes the next resource element into the OutputBuffer.
 		  virtual void rebuild(OutputBuffer&, unsigned int&, unsigned int, const std::string&) const = 0;
 		  
@@ -98,7 +98,7 @@ namespace PeLib
 		  PELIB_IMAGE_RESOURCE_DATA_ENTRY entry;
 		  
 		protected:
-		  int read(InputBuffer& inpBuffer, unsigned int uiOffset, unsigned int rva/*, const std::string&*/);
+		  int read(InputBuffer& inpBuffer, unsigned int uiOffset, unsigned int rva, ParseBudget* pBudget/*, const std::string&*/);
 		  /// Writes the next resource leaf into the OutputBuffer.
 		  void rebuild(OutputBuffer&, unsigned int& uiOffset, unsigned int uiRva, const std::string&) const;
 		
@@ -143,13 +143,13 @@ namespace PeLib
 		template<typename T> friend struct fixNumberOfEntries;
 		
 		/// The node's children.
-		std::vector<ResourceChild> children;
+		ArenaVector<ResourceChild> children;
 		/// The node's header. Equivalent to IMAGE_RESOURCE_DIRECTORY from the Win32 API.
 		PELIB_IMAGE_RESOURCE_DIRECTORY header;
 		
 		protected:
 		  /// Reads the next resource node.
-		  int read(InputBuffer& inpBuffer, unsigned int uiOffset, unsigned int rva/*, const std::string&*/);
+		  int read(InputBuffer& inpBuffer, unsigned int uiOffset, unsigned int rva, ParseBudget* pBudget/*, const std::string&*/);
 		  /// Writes the next resource node into the OutputBuffer.
 		  void rebuild(OutputBuffer&, unsigned int& uiOffset, unsigned int uiRva, const std::string&) const;
 		  
@@ -336,11 +336,11 @@ namespace PeLib
 		  
 		  /// Retrieves an iterator to a specified resource child.
 		  template<typename S, typename T>
-		  std::vector<ResourceChild>::const_iterator locateResourceT(S restypeid, T resid) const;
+		  ArenaVector<ResourceChild>::const_iterator locateResourceT(S restypeid, T resid) const;
 		  
 		  /// Retrieves an iterator to a specified resource child.
 		  template<typename S, typename T>
-		  std::vector<ResourceChild>::iterator locateResourceT(S restypeid, T resid);
+		  ArenaVector<ResourceChild>::iterator locateResourceT(S restypeid, T resid);
 		  
 		  /// Adds a new resource.
 		  template<typename S, typename T>
@@ -379,7 +379,9 @@ namespace PeLib
 		  /// Corrects a erroneous resource directory.
 		  void makeValid();
 		  /// Reads the resource directory from a file.
-		  int read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, unsigned int uiResDirRva);
+		  int read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, unsigned int uiResDirRva, ParseBudget* pBudget = 0);
+		  /// Reads the resource directory from memory.
+		  int read(const unsigned char* pcBuffer, unsigned int uiSize, unsigned int uiResDirRva, ParseBudget* pBudget = 0);
 		  /// Rebuilds the resource directory.
 		  void rebuild(std::vector<byte>& vBuffer, unsigned int uiRva) const;
 		  /// Returns the size of the rebuilt resource directory.
@@ -512,7 +514,7 @@ namespace PeLib
 	* @return A const_iterator to the specified resource.
 	**/
 	template<typename S, typename T>
-	std::vector<ResourceChild>::const_iterator ResourceDirectory::locateResourceT(S restypeid, T resid) const
+	ArenaVector<ResourceChild>::const_iterator ResourceDirectory::locateResourceT(S restypeid, T resid) const
 	{
 		typedef bool(ResourceChild::*CompFunc1)(S) const;
 		typedef bool(ResourceChild::*CompFunc2)(T) const;
@@ -520,14 +522,14 @@ namespace PeLib
 		CompFunc1 comp1 = ResComparer<S>::comp();
 		CompFunc2 comp2 = ResComparer<T>::comp();
 
-		std::vector<ResourceChild>::const_iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(comp1), restypeid));
+		ArenaVector<ResourceChild>::const_iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(comp1), restypeid));
 		if (Iter == m_rnRoot.children.end())
 		{
 			return Iter;
 		}
 		
 		ResourceNode* currNode = static_cast<ResourceNode*>(Iter->child);
-		std::vector<ResourceChild>::const_iterator ResIter = std::find_if(currNode->children.begin(), currNode->children.end(), std::bind2nd(std::mem_fun_ref(comp2), resid));
+		ArenaVector<ResourceChild>::const_iterator ResIter = std::find_if(currNode->children.begin(), currNode->children.end(), std::bind2nd(std::mem_fun_ref(comp2), resid));
 		if (ResIter == currNode->children.end())
 		{
 			return ResIter;
@@ -544,7 +546,7 @@ namespace PeLib
 	* @return An iterator to the specified resource.
 	**/
 	template<typename S, typename T>
-	std::vector<ResourceChild>::iterator ResourceDirectory::locateResourceT(S restypeid, T resid)
+	ArenaVector<ResourceChild>::iterator ResourceDirectory::locateResourceT(S restypeid, T resid)
 	{
 		typedef bool(ResourceChild::*CompFunc1)(S) const;
 		typedef bool(ResourceChild::*CompFunc2)(T) const;
@@ -552,14 +554,14 @@ namespace PeLib
 		CompFunc1 comp1 = ResComparer<S>::comp();
 		CompFunc2 comp2 = ResComparer<T>::comp();
 
-		std::vector<ResourceChild>::iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(comp1), restypeid));
+		ArenaVector<ResourceChild>::iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(comp1), restypeid));
 		if (Iter == m_rnRoot.children.end())
 		{
 			return Iter;
 		}
 		
 		ResourceNode* currNode = static_cast<ResourceNode*>(Iter->child);
-		std::vector<ResourceChild>::iterator ResIter = std::find_if(currNode->children.begin(), currNode->children.end(), std::bind2nd(std::mem_fun_ref(comp2), resid));
+		ArenaVector<ResourceChild>::iterator ResIter = std::find_if(currNode->children.begin(), currNode->children.end(), std::bind2nd(std::mem_fun_ref(comp2), resid));
 		if (ResIter == currNode->children.end())
 		{
 			return ResIter;
@@ -583,7 +585,7 @@ namespace PeLib
 		CompFunc1 comp1 = ResComparer<S>::comp();
 		CompFunc2 comp2 = ResComparer<T>::comp();
 
-		std::vector<ResourceChild>::iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(comp1), restypeid));
+		ArenaVector<ResourceChild>::iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(comp1), restypeid));
 		if (Iter == m_rnRoot.children.end())
 		{
 			return 1;
@@ -591,7 +593,7 @@ namespace PeLib
 		}
 		
 		ResourceNode* currNode = static_cast<ResourceNode*>(Iter->child);
-		std::vector<ResourceChild>::iterator ResIter = std::find_if(currNode->children.begin(), currNode->children.end(), std::bind2nd(std::mem_fun_ref(comp2), resid));
+		ArenaVector<ResourceChild>::iterator ResIter = std::find_if(currNode->children.begin(), currNode->children.end(), std::bind2nd(std::mem_fun_ref(comp2), resid));
 		if (ResIter != currNode->children.end())
 		{
 			return 1;
@@ -625,7 +627,7 @@ namespace PeLib
 		CompFunc1 comp1 = ResComparer<S>::comp();
 		CompFunc2 comp2 = ResComparer<T>::comp();
 		
-		std::vector<ResourceChild>::iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(comp1), restypeid));
+		ArenaVector<ResourceChild>::iterator Iter = std::find_if(m_rnRoot.children.begin(), m_rnRoot.children.end(), std::bind2nd(std::mem_fun_ref(comp1), restypeid));
 		if (Iter == m_rnRoot.children.end())
 		{
 			return 1;
@@ -633,7 +635,7 @@ namespace PeLib
 		}
 		
 		ResourceNode* currNode = static_cast<ResourceNode*>(Iter->child);
-		std::vector<ResourceChild>::iterator ResIter = std::find_if(currNode->children.begin(), currNode->children.end(), std::bind2nd(std::mem_fun_ref(comp2), resid));
+		ArenaVector<ResourceChild>::iterator ResIter = std::find_if(currNode->children.begin(), currNode->children.end(), std::bind2nd(std::mem_fun_ref(comp2), resid));
 		if (ResIter == currNode->children.end())
 		{
 			return 1;
@@ -656,7 +658,7 @@ namespace PeLib
 	template<typename S, typename T>
 	int ResourceDirectory::getResourceDataT(S restypeid, T resid, std::vector<byte>& data) const
 	{
-		std::vector<ResourceChild>::const_iterator ResIter = locateResourceT(restypeid, resid);
+		ArenaVector<ResourceChild>::const_iterator ResIter = locateResourceT(restypeid, resid);
 		ResourceNode* currNode = static_cast<ResourceNode*>(ResIter->child);
 		ResourceLeaf* currLeaf = static_cast<ResourceLeaf*>(currNode->children[0].child);
 		data.assign(currLeaf->m_data.begin(), currLeaf->m_data.end());
@@ -673,7 +675,7 @@ namespace PeLib
 	template<typename S, typename T>
 	int ResourceDirectory::setResourceDataT(S restypeid, T resid, std::vector<byte>& data)
 	{
-		std::vector<ResourceChild>::iterator ResIter = locateResourceT(restypeid, resid);
+		ArenaVector<ResourceChild>::iterator ResIter = locateResourceT(restypeid, resid);
 		ResourceNode* currNode = static_cast<ResourceNode*>(ResIter->child);
 		ResourceLeaf* currLeaf = static_cast<ResourceLeaf*>(currNode->children[0].child);
 		currLeaf->m_data.assign(data.begin(), data.end());
@@ -691,7 +693,7 @@ namespace PeLib
 	template<typename S, typename T>
 	dword ResourceDirectory::getResourceIdT(S restypeid, T resid) const
 	{
-		std::vector<ResourceChild>::const_iterator ResIter = locateResourceT(restypeid, resid);
+		ArenaVector<ResourceChild>::const_iterator ResIter = locateResourceT(restypeid, resid);
 		return ResIter->entry.irde.Name;
 	}
 	
@@ -704,7 +706,7 @@ namespace PeLib
 	template<typename S, typename T>
 	int ResourceDirectory::setResourceIdT(S restypeid, T resid, dword dwNewResId)
 	{
-		std::vector<ResourceChild>::iterator ResIter = locateResourceT(restypeid, resid);
+		ArenaVector<ResourceChild>::iterator ResIter = locateResourceT(restypeid, resid);
 		ResIter->entry.irde.Name = dwNewResId;
 		return 0;
 	}
@@ -719,7 +721,7 @@ namespace PeLib
 	template<typename S, typename T>
 	std::string ResourceDirectory::getResourceNameT(S restypeid, T resid) const
 	{
-		std::vector<ResourceChild>::const_iterator ResIter = locateResourceT(restypeid, resid);
+		ArenaVector<ResourceChild>::const_iterator ResIter = locateResourceT(restypeid, resid);
 		return ResIter->entry.wstrName;
 	}
 		  
@@ -732,7 +734,7 @@ namespace PeLib
 	template<typename S, typename T>
 	int ResourceDirectory::setResourceNameT(S restypeid, T resid, std::string strNewResName)
 	{
-		std::vector<ResourceChild>::iterator ResIter = locateResourceT(restypeid, resid);
+		ArenaVector<ResourceChild>::iterator ResIter = locateResourceT(restypeid, resid);
 		ResIter->entry.wstrName = strNewResName;
 		
 		return 0;
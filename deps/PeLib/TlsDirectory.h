@@ -29,8 +29,8 @@ namespace PeLib
 
 		public:
 		  /// Reads a file's TLS directory.
-		  int read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize); // EXPORT
-		  int read(unsigned char* buffer, unsigned int buffersize); // EXPORT
+		  int read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, ParseBudget* pBudget = 0); // EXPORT
+		  int read(unsigned char* buffer, unsigned int buffersize, ParseBudget* pBudget = 0); // EXPORT
 		  /// Rebuilds the TLS directory.
 		  void rebuild(std::vector<byte>& vBuffer) const; // EXPORT
 		  /// Returns the size of the TLS Directory.
@@ -81,13 +81,18 @@ namespace PeLib
 	}
 	
 	template<int bits>
-	int TlsDirectory<bits>::read(unsigned char* buffer, unsigned int buffersize)
+	int TlsDirectory<bits>::read(unsigned char* buffer, unsigned int buffersize, ParseBudget* pBudget)
 	{
 		if (buffersize < PELIB_IMAGE_TLS_DIRECTORY<bits>::size())
 		{
 			return ERROR_INVALID_FILE;
 		}
 
+		if (pBudget && !pBudget->chargeBytes(buffersize))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
+
 		std::vector<byte> vTlsDirectory(buffer, buffer + buffersize);
 		
 		InputBuffer ibBuffer(vTlsDirectory);
@@ -100,23 +105,29 @@ namespace PeLib
 	* @param strFilename Name of the file.
 	* @param uiOffset File offset of the TLS directory.
 	* @param uiSize Size of the TLS directory.
+	* @param pBudget Optional budget to charge the work against.
 	**/
 	template<int bits>
-	int TlsDirectory<bits>::read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize)
+	int TlsDirectory<bits>::read(const std::string& strFilename, unsigned int uiOffset, unsigned int uiSize, ParseBudget* pBudget)
 	{
-		std::ifstream ifFile(strFilename.c_str(), std::ios::binary);
-		unsigned int ulFileSize = fileSize(ifFile);
+		FileStream ifFile(strFilename, std::ios::in | std::ios::binary);
+		qword ulFileSize = fileSize(ifFile);
 
 		if (!ifFile)
 		{
 			return ERROR_OPENING_FILE;
 		}
 		
-		if (ulFileSize < uiOffset + uiSize)
+		if (ulFileSize < static_cast<qword>(uiOffset) + uiSize)
 		{
 			return ERROR_INVALID_FILE;
 		}
 
+		if (pBudget && !pBudget->chargeBytes(uiSize))
+		{
+			return ERROR_BUDGET_EXCEEDED;
+		}
+
 		ifFile.seekg(uiOffset, std::ios::beg);
 
 		std::vector<byte> vTlsDirectory(uiSize);
@@ -134,6 +145,7 @@ namespace PeLib
 	template<int bits>
 	void TlsDirectory<bits>::rebuild(std::vector<byte>& vBuffer) const
 	{
+		PELIB_TRACE_SPAN("TlsDirectory::rebuild");
 		OutputBuffer obBuffer(vBuffer);
 		
 		obBuffer << m_tls.StartAddressOfRawData;
@@ -162,17 +174,18 @@ namespace PeLib
 	template<int bits>
 	int TlsDirectory<bits>::write(const std::string& strFilename, unsigned int dwOffset) const
 	{
-		std::fstream ofFile(strFilename.c_str(), std::ios_base::in);
+		PELIB_TRACE_SPAN("TlsDirectory::write");
+		FileStream ofFile(strFilename, std::ios_base::in);
 		
 		if (!ofFile)
 		{
 			ofFile.clear();
-			ofFile.open(strFilename.c_str(), std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::out | std::ios_base::binary);
 		}
 		else
 		{
 			ofFile.close();
-			ofFile.open(strFilename.c_str(), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+			ofFile.open(strFilename, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
 		}
 
 		if (!ofFile)
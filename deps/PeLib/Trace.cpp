@@ -0,0 +1,218 @@
+/*
+* Trace.cpp - Part of the PeLib library.
+*
+* This software is licensed under the zlib/libpng License.
+* For more details see http://www.opensource.org/licenses/zlib-license.php
+* or the license information file (license.htm) in the root directory
+* of PeLib.
+*/
+
+#include "PeLibInc.h"
+#include "Trace.h"
+
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+
+namespace PeLib
+{
+	namespace
+	{
+		struct TraceRecord
+		{
+			const char* szName;
+			const char* szCategory;
+			unsigned long long ullBegin;
+			unsigned long long ullEnd;
+		};
+
+		/// Ring buffer of one thread. Only its own thread writes to it while tracing is on.
+		struct ThreadTrace
+		{
+			unsigned int uiThreadId;
+			unsigned long long ullGeneration;
+			std::vector<TraceRecord> vRecords;
+			std::size_t uiNext;
+			bool bWrapped;
+		};
+
+		const std::chrono::steady_clock::time_point g_tpEpoch = std::chrono::steady_clock::now();
+
+		std::mutex g_mutex; ///< Guards everything below, but not the contents of the buffers.
+		std::vector<std::shared_ptr<ThreadTrace> > g_vThreads;
+		std::size_t g_uiSpansPerThread = Trace::DEFAULT_SPANS_PER_THREAD;
+		unsigned int g_uiNextThreadId = 1;
+		std::atomic<unsigned long long> g_ullGeneration(0);
+
+		/// Buffers stay registered after their thread exits, so the thread only holds a reference.
+		thread_local std::shared_ptr<ThreadTrace> t_pTrace;
+
+		ThreadTrace& threadTrace()
+		{
+			unsigned long long ullGeneration = g_ullGeneration.load(std::memory_order_acquire);
+			if (!t_pTrace || t_pTrace->ullGeneration != ullGeneration)
+			{
+				std::lock_guard<std::mutex> lock(g_mutex);
+				t_pTrace = std::make_shared<ThreadTrace>();
+				t_pTrace->uiThreadId = g_uiNextThreadId++;
+				t_pTrace->ullGeneration = ullGeneration;
+				t_pTrace->vRecords.resize(std::max<std::size_t>(g_uiSpansPerThread, 1));
+				t_pTrace->uiNext = 0;
+				t_pTrace->bWrapped = false;
+				g_vThreads.push_back(t_pTrace);
+			}
+			return *t_pTrace;
+		}
+
+		void writeJsonString(std::ostream& osTrace, const char* szText)
+		{
+			osTrace << '"';
+			for (; *szText; szText++)
+			{
+				if (*szText == '"' || *szText == '\\') osTrace << '\\';
+				if (static_cast<unsigned char>(*szText) >= 0x20) osTrace << *szText;
+			}
+			osTrace << '"';
+		}
+	}
+
+	std::atomic<unsigned int> Trace::s_uiMode(0);
+
+	/// Innermost span open on the calling thread while phases are tracked.
+	static thread_local const char* tlsPhase = 0;
+
+	/**
+	* Threads pick up the new buffer size the next time they record a span.
+	* @param uiSpansPerThread Number of spans each thread keeps before it starts overwriting its oldest.
+	**/
+	void Trace::enable(std::size_t uiSpansPerThread)
+	{
+		std::lock_guard<std::mutex> lock(g_mutex);
+		g_vThreads.clear();
+		g_uiSpansPerThread = uiSpansPerThread;
+		g_uiNextThreadId = 1;
+		g_ullGeneration.fetch_add(1, std::memory_order_release);
+		s_uiMode.fetch_or(MODE_SPANS, std::memory_order_relaxed);
+	}
+
+	void Trace::disable()
+	{
+		s_uiMode.fetch_and(~MODE_SPANS, std::memory_order_relaxed);
+	}
+
+	/**
+	* Spans which were already open when phases were enabled aren't known; the threads start out
+	* without a phase.
+	**/
+	void Trace::enablePhases()
+	{
+		s_uiMode.fetch_or(MODE_PHASES, std::memory_order_relaxed);
+	}
+
+	void Trace::disablePhases()
+	{
+		s_uiMode.fetch_and(~MODE_PHASES, std::memory_order_relaxed);
+	}
+
+	/**
+	* Doesn't allocate, so it can be called from inside an allocator.
+	**/
+	const char* Trace::currentPhase()
+	{
+		return tlsPhase;
+	}
+
+	const char* Trace::enterPhase(const char* szName)
+	{
+		const char* szPrevious = tlsPhase;
+		tlsPhase = szName;
+		return szPrevious;
+	}
+
+	void Trace::leavePhase(const char* szPrevious)
+	{
+		tlsPhase = szPrevious;
+	}
+
+	unsigned long long Trace::now()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_tpEpoch).count();
+	}
+
+	/**
+	* @param szName Name of the span; a string literal.
+	* @param szCategory Category of the span; a string literal.
+	* @param ullBegin Start of the span, see #PeLib::Trace::now.
+	* @param ullEnd End of the span, see #PeLib::Trace::now.
+	**/
+	void Trace::record(const char* szName, const char* szCategory, unsigned long long ullBegin, unsigned long long ullEnd)
+	{
+		ThreadTrace& ttCurr = threadTrace();
+		TraceRecord& trCurr = ttCurr.vRecords[ttCurr.uiNext];
+		trCurr.szName = szName;
+		trCurr.szCategory = szCategory;
+		trCurr.ullBegin = ullBegin;
+		trCurr.ullEnd = ullEnd;
+
+		if (++ttCurr.uiNext == ttCurr.vRecords.size())
+		{
+			ttCurr.uiNext = 0;
+			ttCurr.bWrapped = true;
+		}
+	}
+
+	/**
+	* Spans are written as complete ("X") events with microsecond timestamps, one trace thread per
+	* recording thread, which chrome://tracing and Perfetto load as is.
+	* @param osTrace Stream the JSON document is written to.
+	**/
+	void Trace::writeChromeTrace(std::ostream& osTrace)
+	{
+		std::lock_guard<std::mutex> lock(g_mutex);
+
+		std::ios::fmtflags ffOld = osTrace.flags();
+		osTrace << std::dec << std::fixed << std::setprecision(3) << "{\"traceEvents\":[";
+
+		bool bFirst = true;
+		for (std::size_t i=0;i<g_vThreads.size();i++)
+		{
+			const ThreadTrace& ttCurr = *g_vThreads[i];
+			std::size_t uiCount = ttCurr.bWrapped ? ttCurr.vRecords.size() : ttCurr.uiNext;
+			std::size_t uiFirst = ttCurr.bWrapped ? ttCurr.uiNext : 0;
+
+			for (std::size_t j=0;j<uiCount;j++)
+			{
+				const TraceRecord& trCurr = ttCurr.vRecords[(uiFirst + j) % ttCurr.vRecords.size()];
+
+				osTrace << (bFirst ? "\n" : ",\n") << "{\"name\":";
+				writeJsonString(osTrace, trCurr.szName);
+				osTrace << ",\"cat\":";
+				writeJsonString(osTrace, trCurr.szCategory);
+				osTrace << ",\"ph\":\"X\",\"ts\":" << trCurr.ullBegin / 1000.0
+					<< ",\"dur\":" << (trCurr.ullEnd - trCurr.ullBegin) / 1000.0
+					<< ",\"pid\":1,\"tid\":" << ttCurr.uiThreadId << "}";
+				bFirst = false;
+			}
+		}
+
+		osTrace << "\n]}\n";
+		osTrace.flags(ffOld);
+	}
+
+	/**
+	* @param strFilename Name of the file; an existing file is overwritten.
+	**/
+	int Trace::writeChromeTrace(const std::string& strFilename)
+	{
+		FileStream ofFile(strFilename, std::ios::out | std::ios::trunc);
+
+		if (!ofFile)
+		{
+			return ERROR_OPENING_FILE;
+		}
+
+		writeChromeTrace(ofFile);
+		return ofFile ? NO_ERROR : ERROR_OPENING_FILE;
+	}
+}
@@ -0,0 +1,129 @@
+/*
+* Trace.h - Part of the PeLib library.
+*
+* This software is licensed under the zlib/libpng License.
+* For more details see http://www.opensource.org/licenses/zlib-license.php
+* or the license information file (license.htm) in the root directory
+* of PeLib.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+
+namespace PeLib
+{
+	/// Records timed spans into per-thread ring buffers and exports them as Chrome trace events.
+	/**
+	* Every thread which records a span gets its own ring buffer, so recording never takes a lock.
+	* Once a buffer is full the oldest spans are overwritten. Tracing is off until #PeLib::Trace::enable
+	* is called; while it's off, a #PeLib::TraceSpan costs one relaxed atomic load.<br>
+	* Span names and categories must be string literals (or otherwise outlive the trace), since only
+	* the pointers are stored.
+	**/
+	class Trace
+	{
+		private:
+		  static std::atomic<unsigned int> s_uiMode;
+
+		public:
+		  /// Bits of #PeLib::Trace::mode.
+		  enum
+		  {
+			  MODE_SPANS = 1, ///< Spans are recorded.
+			  MODE_PHASES = 2 ///< The innermost open span of each thread is tracked, see #PeLib::Trace::currentPhase.
+		  };
+
+		  /// Default number of spans each thread keeps.
+		  static const std::size_t DEFAULT_SPANS_PER_THREAD = 1 << 16;
+
+		  /// Starts recording, dropping everything recorded before.
+		  static void enable(std::size_t uiSpansPerThread = DEFAULT_SPANS_PER_THREAD); // EXPORT
+		  /// Stops recording; what was recorded so far is kept for export.
+		  static void disable(); // EXPORT
+		  /// Returns true while spans are being recorded.
+		  static bool enabled()
+		  {
+			  return (mode() & MODE_SPANS) != 0;
+		  }
+
+		  /// Starts tracking the innermost open span of each thread.
+		  static void enablePhases(); // EXPORT
+		  /// Stops tracking the innermost open span of each thread.
+		  static void disablePhases(); // EXPORT
+		  /// Returns what a #PeLib::TraceSpan has to do; 0 if nothing.
+		  static unsigned int mode()
+		  {
+			  return s_uiMode.load(std::memory_order_relaxed);
+		  }
+
+		  /// Returns the name of the innermost span open on the calling thread, or 0 if there's none.
+		  static const char* currentPhase(); // EXPORT
+		  /// Makes szName the calling thread's current phase and returns the previous one.
+		  static const char* enterPhase(const char* szName);
+		  /// Restores the phase enterPhase returned.
+		  static void leavePhase(const char* szPrevious);
+
+		  /// Returns nanoseconds since the trace clock's epoch.
+		  static unsigned long long now();
+		  /// Records a finished span on the calling thread's ring buffer.
+		  static void record(const char* szName, const char* szCategory, unsigned long long ullBegin, unsigned long long ullEnd);
+
+		  /// Writes all recorded spans as Chrome trace-event JSON. Threads should have stopped recording.
+		  static void writeChromeTrace(std::ostream& osTrace); // EXPORT
+		  /// Writes all recorded spans as Chrome trace-event JSON to a file.
+		  static int writeChromeTrace(const std::string& strFilename); // EXPORT
+	};
+
+	/// Records the time between its construction and destruction as a span.
+	class TraceSpan
+	{
+		private:
+		  const char* m_szName;
+		  const char* m_szCategory;
+		  const char* m_szPreviousPhase;
+		  unsigned long long m_ullBegin;
+		  unsigned int m_uiMode;
+
+		  TraceSpan(const TraceSpan&);
+		  TraceSpan& operator=(const TraceSpan&);
+
+		public:
+		  TraceSpan(const char* szName, const char* szCategory) : m_szName(0), m_szCategory(szCategory), m_szPreviousPhase(0), m_ullBegin(0), m_uiMode(Trace::mode())
+		  {
+			  if (m_uiMode & Trace::MODE_PHASES)
+			  {
+				  m_szPreviousPhase = Trace::enterPhase(szName);
+			  }
+			  if (m_uiMode & Trace::MODE_SPANS)
+			  {
+				  m_szName = szName;
+				  m_ullBegin = Trace::now();
+			  }
+		  }
+
+		  ~TraceSpan()
+		  {
+			  if (m_szName)
+			  {
+				  Trace::record(m_szName, m_szCategory, m_ullBegin, Trace::now());
+			  }
+			  if (m_uiMode & Trace::MODE_PHASES)
+			  {
+				  Trace::leavePhase(m_szPreviousPhase);
+			  }
+		  }
+	};
+}
+
+#define PELIB_TRACE_CONCAT2(a, b) a##b
+#define PELIB_TRACE_CONCAT(a, b) PELIB_TRACE_CONCAT2(a, b)
+
+/// Traces the rest of the enclosing scope as a span called name in category "pelib".
+#define PELIB_TRACE_SPAN(name) PeLib::TraceSpan PELIB_TRACE_CONCAT(peLibTraceSpan, __LINE__)(name, "pelib")
+
+#endif
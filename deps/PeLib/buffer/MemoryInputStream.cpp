@@ -0,0 +1,57 @@
+/*
+* MemoryInputStream.cpp - Part of the PeLib library.
+*
+* This software is licensed under the zlib/libpng License.
+* For more details see http://www.opensource.org/licenses/zlib-license.php
+* or the license information file (license.htm) in the root directory 
+* of PeLib.
+*/
+
+#include "MemoryInputStream.h"
+
+namespace PeLib
+{
+	MemoryStreamBuffer::MemoryStreamBuffer(const unsigned char* pcBuffer, unsigned int uiSize)
+	{
+		// The get area is never written through, so dropping const here is safe.
+		char* begin = const_cast<char*>(reinterpret_cast<const char*>(pcBuffer));
+		setg(begin, begin, begin + uiSize);
+	}
+
+	MemoryStreamBuffer::pos_type MemoryStreamBuffer::seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which)
+	{
+		if (!(which & std::ios_base::in))
+		{
+			return pos_type(off_type(-1));
+		}
+
+		off_type base = 0;
+		if (dir == std::ios_base::cur)
+		{
+			base = gptr() - eback();
+		}
+		else if (dir == std::ios_base::end)
+		{
+			base = egptr() - eback();
+		}
+
+		off_type pos = base + off;
+		if (pos < 0 || pos > egptr() - eback())
+		{
+			return pos_type(off_type(-1));
+		}
+
+		setg(eback(), eback() + pos, egptr());
+		return pos_type(pos);
+	}
+
+	MemoryStreamBuffer::pos_type MemoryStreamBuffer::seekpos(pos_type pos, std::ios_base::openmode which)
+	{
+		return seekoff(off_type(pos), std::ios_base::beg, which);
+	}
+
+	MemoryInputStream::MemoryInputStream(const unsigned char* pcBuffer, unsigned int uiSize) : std::istream(nullptr), m_sbBuffer(pcBuffer, uiSize)
+	{
+		rdbuf(&m_sbBuffer);
+	}
+}
@@ -0,0 +1,44 @@
+/*
+* MemoryInputStream.h - Part of the PeLib library.
+*
+* This software is licensed under the zlib/libpng License.
+* For more details see http://www.opensource.org/licenses/zlib-license.php
+* or the license information file (license.htm) in the root directory 
+* of PeLib.
+*/
+
+#ifndef MEMORYINPUTSTREAM_H
+#define MEMORYINPUTSTREAM_H
+
+#include <istream>
+#include <streambuf>
+
+namespace PeLib
+{
+	/// Read-only, seekable stream buffer over memory owned by the caller.
+	class MemoryStreamBuffer : public std::streambuf
+	{
+		public:
+		  MemoryStreamBuffer(const unsigned char* pcBuffer, unsigned int uiSize);
+
+		protected:
+		  pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which);
+		  pos_type seekpos(pos_type pos, std::ios_base::openmode which);
+	};
+
+	/// An std::istream over an in-memory image of a file.
+	/**
+	* Lets the readers which seek around the whole file parse a buffer without copying it.
+	* The buffer must outlive the stream.
+	**/
+	class MemoryInputStream : public std::istream
+	{
+		private:
+		  MemoryStreamBuffer m_sbBuffer;
+
+		public:
+		  MemoryInputStream(const unsigned char* pcBuffer, unsigned int uiSize);
+	};
+}
+
+#endif
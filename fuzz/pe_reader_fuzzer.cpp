@@ -0,0 +1,185 @@
+/*
+	fuzz target for every PeLib reader, run entirely from memory.
+
+	libFuzzer:
+		clang++ -std=c++17 -g -O1 -fsanitize=fuzzer,address -I../deps/PeLib \
+			pe_reader_fuzzer.cpp ../deps/PeLib/*.cpp ../deps/PeLib/buffer/*.cpp -o pe_reader_fuzzer
+		./pe_reader_fuzzer -rss_limit_mb=512 corpus/ ../samples/
+
+	AFL (and replaying a crash without libFuzzer) builds the same source
+	with -DPE_READER_FUZZER_MAIN, which adds a main() that feeds each file
+	named on the command line, or stdin, to the target:
+		afl-clang-fast++ -std=c++17 -DPE_READER_FUZZER_MAIN -I../deps/PeLib \
+			pe_reader_fuzzer.cpp ../deps/PeLib/*.cpp ../deps/PeLib/buffer/*.cpp -o pe_reader_afl
+		afl-fuzz -i ../samples -o findings -- ./pe_reader_afl @@
+
+	corpus/ holds inputs which once crashed a reader, kept as seeds so every
+	run replays them first; add the input of each fixed crash there. the
+	AFL build replays them too:
+		for seed in corpus/*; do ./pe_reader_afl "$seed" || echo "$seed"; done
+
+	every input gets a ParseBudget which grows with its size, so a reader
+	is allowed work in proportion to what it was given. running into the
+	budget is how a reader is supposed to turn a hostile header down, and
+	is fine. what fails the run is cost the budget didn't see: taking well
+	past its time limit, or PeLib allocating well past its byte limit,
+	both of which mean some loop or allocation isn't being charged.
+*/
+#include "PeLib.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory_resource>
+#include <vector>
+#include <stdint.h>
+
+
+/* what the readers may spend on an input; the fixed part lets tiny inputs parse at all */
+const unsigned int FUZZ_BYTES_PER_INPUT_BYTE = 64;
+const unsigned int FUZZ_BASE_BYTES = 1024 * 1024;
+const unsigned int FUZZ_ENTRIES_PER_INPUT_BYTE = 1;
+const unsigned int FUZZ_BASE_ENTRIES = 64 * 1024;
+const unsigned int FUZZ_NODES_PER_INPUT_BYTE = 1;
+const unsigned int FUZZ_BASE_NODES = 4 * 1024;
+const unsigned int FUZZ_MAX_DEPTH = 32;
+const unsigned int FUZZ_MAX_MILLISECONDS = 1000;
+
+/*
+	a reader only notices its deadline when it next charges the budget, and
+	containers round their allocations up, so both ceilings get some slack
+	before the run counts as failed.
+*/
+const unsigned int FUZZ_DEADLINE_SLACK_MILLISECONDS = 500;
+const unsigned int FUZZ_ALLOCATION_SLACK_PER_INPUT_BYTE = 16;
+const unsigned int FUZZ_ALLOCATION_SLACK = 1024 * 1024;
+
+
+/* counts what PeLib's containers hold at once, on the way to the default resource */
+class CountingResource : public std::pmr::memory_resource
+{
+public:
+	size_t live, peak;
+
+	CountingResource() : live(0), peak(0) {}
+
+private:
+	void* do_allocate(size_t bytes, size_t alignment) override
+	{
+		auto p = std::pmr::new_delete_resource()->allocate(bytes, alignment);
+		this->live += bytes;
+		if (this->peak < this->live)
+			this->peak = this->live;
+		return p;
+	}
+
+	void do_deallocate(void* p, size_t bytes, size_t alignment) override
+	{
+		std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+		this->live -= bytes;
+	}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+	{
+		return this == &other;
+	}
+};
+
+/* every directory reader, from the same buffer; each one is tried whether or not the last one failed */
+template <class PEFILE>
+static void readEverything(PEFILE &peFile, const unsigned char *data, unsigned int size)
+{
+	if (peFile.readMzHeader(data, size) != PeLib::NO_ERROR)
+		return;
+	if (peFile.readPeHeader(data, size) != PeLib::NO_ERROR)
+		return;
+
+	peFile.readExportDirectory(data, size);
+	peFile.readImportDirectory(data, size);
+	peFile.readBoundImportDirectory(data, size);
+	peFile.readResourceDirectory(data, size);
+	peFile.readRelocationsDirectory(data, size);
+	peFile.readComHeaderDirectory(data, size);
+	peFile.readIatDirectory(data, size);
+	peFile.readDebugDirectory(data, size);
+	peFile.readTlsDirectory(data, size);
+}
+
+template <class PEFILE>
+static void fuzzReaders(const unsigned char *data, unsigned int size)
+{
+	auto maxBytes = static_cast<unsigned int>(std::min<uint64_t>(uint64_t(size) * FUZZ_BYTES_PER_INPUT_BYTE + FUZZ_BASE_BYTES, UINT32_MAX - 1));
+	auto maxEntries = static_cast<unsigned int>(std::min<uint64_t>(uint64_t(size) * FUZZ_ENTRIES_PER_INPUT_BYTE + FUZZ_BASE_ENTRIES, UINT32_MAX - 1));
+	auto maxNodes = static_cast<unsigned int>(std::min<uint64_t>(uint64_t(size) * FUZZ_NODES_PER_INPUT_BYTE + FUZZ_BASE_NODES, UINT32_MAX - 1));
+
+	CountingResource counter;
+	auto start = std::chrono::steady_clock::now();
+	{
+		PeLib::ArenaScope arenaScope(&counter);
+		PEFILE peFile;
+		peFile.setParseBudget(PeLib::ParseBudget(maxBytes, maxNodes, maxEntries, FUZZ_MAX_DEPTH, FUZZ_MAX_MILLISECONDS));
+		readEverything(peFile, data, size);
+	}
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+
+	if (elapsed > FUZZ_MAX_MILLISECONDS + FUZZ_DEADLINE_SLACK_MILLISECONDS)
+	{
+		fprintf(stderr, "PeLib readers took %lldms on a %u byte input; some work isn't charged to the budget\n", static_cast<long long>(elapsed), size);
+		abort();
+	}
+
+	auto allocationCeiling = uint64_t(maxBytes) + uint64_t(size) * FUZZ_ALLOCATION_SLACK_PER_INPUT_BYTE + FUZZ_ALLOCATION_SLACK;
+	if (counter.peak > allocationCeiling)
+	{
+		fprintf(stderr, "PeLib readers held %zu bytes at once on a %u byte input; some allocation isn't charged to the budget\n", counter.peak, size);
+		abort();
+	}
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	/* every offset in the headers is 32-bit, so nothing past 4GB is ever looked at */
+	auto parseSize = static_cast<unsigned int>(std::min<size_t>(size, UINT32_MAX));
+
+	/* inputs which aren't either kind still go through the 32-bit headers, where the MZ and PE checks live */
+	if (PeLib::getFileType(data, parseSize) == PeLib::PEFILE64)
+		fuzzReaders<PeLib::PeFile64>(data, parseSize);
+	else
+		fuzzReaders<PeLib::PeFile32>(data, parseSize);
+	return 0;
+}
+
+
+#ifdef PE_READER_FUZZER_MAIN
+static void runInput(FILE *file)
+{
+	std::vector<uint8_t> input;
+	uint8_t chunk[64 * 1024];
+	size_t got;
+	while ((got = fread(chunk, 1, sizeof(chunk), file)) > 0)
+		input.insert(input.end(), chunk, chunk + got);
+	LLVMFuzzerTestOneInput(input.data(), input.size());
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+	{
+		runInput(stdin);
+		return 0;
+	}
+
+	for (int arg = 1; arg < argc; arg++)
+	{
+		auto file = fopen(argv[arg], "rb");
+		if (!file)
+		{
+			fprintf(stderr, "Failed to open %s\n", argv[arg]);
+			return 1;
+		}
+		runInput(file);
+		fclose(file);
+	}
+	return 0;
+}
+#endif
@@ -8,6 +8,11 @@ void preselectionStub();
 void preselectionFunc();
 void preselectionFunc_end();
 
+size_t getStubLength()
+{
+	return (size_t)&preselectionFunc_end - (size_t)&preselectionStub;
+}
+
 bool prepareStub(void* entryOffset, void* &stub, size_t &len, std::ostream &infoStream, std::ostream &errorStream)
 {
 	if (&preselectionStub > &preselectionFunc)
@@ -23,7 +28,7 @@ bool prepareStub(void* entryOffset, void* &stub, size_t &len, std::ostream &info
 	}
 
 	stub = &preselectionStub;
-	len = (size_t)&preselectionFunc_end - (size_t)&preselectionStub;
+	len = getStubLength();
 
 	infoStream << "\t\tprepareStub: preparing stub at 0x" << std::hex << stub << " (len " << std::dec << len << ")" << std::endl;
 
@@ -0,0 +1,226 @@
+#include "PeLibInclude.h"
+
+#include "AllocProfiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <new>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+
+/* must be a power of two; span names beyond this many share one site */
+const size_t ALLOC_PROFILER_SITES = 1024;
+
+const char ALLOC_PROFILER_NO_PHASE[] = "(outside any span)";
+const char ALLOC_PROFILER_OTHER[] = "(other spans)";
+
+/*
+	fixed tables only: anything allocated in here would recurse into operator new.
+	a site's name is claimed once with a compare-and-swap and never changes, so
+	counting needs no lock.
+*/
+struct AllocSite
+{
+	std::atomic<const char*> phase;
+	std::atomic<uint64_t> count;
+	std::atomic<uint64_t> bytes;
+};
+
+static AllocSite allocSites[ALLOC_PROFILER_SITES];
+static AllocSite otherSite;
+static std::atomic<bool> profiling(false);
+
+static AllocSite& findSite(const char* phase)
+{
+	if (!phase)
+		phase = ALLOC_PROFILER_NO_PHASE;
+
+	/* span names are string literals, so the pointer identifies the site */
+	auto slot = static_cast<size_t>((reinterpret_cast<uintptr_t>(phase) >> 3) * 0x9E3779B97F4A7C15ULL);
+	for (size_t probe = 0; probe < ALLOC_PROFILER_SITES; probe++)
+	{
+		auto& site = allocSites[(slot + probe) & (ALLOC_PROFILER_SITES - 1)];
+		auto current = site.phase.load(std::memory_order_acquire);
+		if (current == phase)
+			return site;
+		if (!current)
+		{
+			const char* expected = nullptr;
+			if (site.phase.compare_exchange_strong(expected, phase, std::memory_order_acq_rel) || expected == phase)
+				return site;
+		}
+	}
+	return otherSite;
+}
+
+static void countAllocation(size_t size)
+{
+	auto& site = findSite(PeLib::Trace::currentPhase());
+	site.count.fetch_add(1, std::memory_order_relaxed);
+	site.bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void AllocProfiler::enable()
+{
+	PeLib::Trace::enablePhases();
+	profiling.store(true, std::memory_order_relaxed);
+}
+
+void AllocProfiler::disable()
+{
+	profiling.store(false, std::memory_order_relaxed);
+	PeLib::Trace::disablePhases();
+}
+
+void AllocProfiler::reset()
+{
+	for (auto& site : allocSites)
+	{
+		site.count.store(0, std::memory_order_relaxed);
+		site.bytes.store(0, std::memory_order_relaxed);
+	}
+	otherSite.count.store(0, std::memory_order_relaxed);
+	otherSite.bytes.store(0, std::memory_order_relaxed);
+}
+
+void AllocProfiler::report(std::ostream &stream, size_t top)
+{
+	/* sorted in place of a vector, which would show up in the very numbers we print */
+	static AllocSite* order[ALLOC_PROFILER_SITES + 1];
+	size_t used = 0;
+	uint64_t totalCount = 0, totalBytes = 0;
+	for (auto& site : allocSites)
+	{
+		if (site.phase.load(std::memory_order_acquire) && site.count.load(std::memory_order_relaxed))
+			order[used++] = &site;
+	}
+	if (otherSite.count.load(std::memory_order_relaxed))
+		order[used++] = &otherSite;
+
+	std::sort(order, order + used, [](const AllocSite* a, const AllocSite* b) { return a->bytes.load() > b->bytes.load(); });
+	for (size_t i = 0; i < used; i++)
+	{
+		totalCount += order[i]->count.load(std::memory_order_relaxed);
+		totalBytes += order[i]->bytes.load(std::memory_order_relaxed);
+	}
+
+	stream << std::dec << "Top allocation sites:" << std::endl;
+	stream << "\t" << std::left << std::setfill(' ') << std::setw(48) << "Span";
+	stream << std::right << std::setw(12) << "Count" << std::setw(16) << "Bytes" << std::endl;
+	for (size_t i = 0; i < used && i < top; i++)
+	{
+		auto phase = (order[i] == &otherSite) ? ALLOC_PROFILER_OTHER : order[i]->phase.load(std::memory_order_relaxed);
+		stream << "\t" << std::left << std::setw(48) << phase;
+		stream << std::right << std::setw(12) << order[i]->count.load(std::memory_order_relaxed);
+		stream << std::setw(16) << order[i]->bytes.load(std::memory_order_relaxed) << std::endl;
+	}
+	stream << "\t" << std::left << std::setw(48) << "Total";
+	stream << std::right << std::setw(12) << totalCount << std::setw(16) << totalBytes << std::endl;
+}
+
+
+/*
+	every replaceable form is defined here rather than trusting the library's
+	defaults to forward: the aligned forms never reach the plain ones, and
+	sized delete only does where the library chooses to. aligned blocks come
+	from a different allocator on Windows, so they go back through their own
+	delete.
+*/
+static void* allocate(size_t size)
+{
+	if (profiling.load(std::memory_order_relaxed))
+		countAllocation(size);
+
+	for (;;)
+	{
+		auto memory = malloc(size ? size : 1);
+		if (memory)
+			return memory;
+
+		auto handler = std::get_new_handler();
+		if (!handler)
+			throw std::bad_alloc();
+		handler();
+	}
+}
+
+static void* allocateAligned(size_t size, std::align_val_t alignment)
+{
+	if (profiling.load(std::memory_order_relaxed))
+		countAllocation(size);
+
+	for (;;)
+	{
+#ifdef _WIN32
+		auto memory = _aligned_malloc(size ? size : 1, static_cast<size_t>(alignment));
+#else
+		void* memory = nullptr;
+		if (posix_memalign(&memory, std::max(static_cast<size_t>(alignment), sizeof(void*)), size ? size : 1) != 0)
+			memory = nullptr;
+#endif
+		if (memory)
+			return memory;
+
+		auto handler = std::get_new_handler();
+		if (!handler)
+			throw std::bad_alloc();
+		handler();
+	}
+}
+
+static void freeAligned(void* memory)
+{
+#ifdef _WIN32
+	_aligned_free(memory);
+#else
+	free(memory);
+#endif
+}
+
+void* operator new(size_t size) { return allocate(size); }
+void* operator new[](size_t size) { return allocate(size); }
+void* operator new(size_t size, std::align_val_t alignment) { return allocateAligned(size, alignment); }
+void* operator new[](size_t size, std::align_val_t alignment) { return allocateAligned(size, alignment); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	try { return allocate(size); }
+	catch (...) { return nullptr; }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	try { return allocate(size); }
+	catch (...) { return nullptr; }
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	try { return allocateAligned(size, alignment); }
+	catch (...) { return nullptr; }
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+	try { return allocateAligned(size, alignment); }
+	catch (...) { return nullptr; }
+}
+
+void operator delete(void* memory) noexcept { free(memory); }
+void operator delete[](void* memory) noexcept { free(memory); }
+void operator delete(void* memory, size_t) noexcept { free(memory); }
+void operator delete[](void* memory, size_t) noexcept { free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { free(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { free(memory); }
+
+void operator delete(void* memory, std::align_val_t) noexcept { freeAligned(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { freeAligned(memory); }
+void operator delete(void* memory, size_t, std::align_val_t) noexcept { freeAligned(memory); }
+void operator delete[](void* memory, size_t, std::align_val_t) noexcept { freeAligned(memory); }
+void operator delete(void* memory, std::align_val_t, const std::nothrow_t&) noexcept { freeAligned(memory); }
+void operator delete[](void* memory, std::align_val_t, const std::nothrow_t&) noexcept { freeAligned(memory); }
@@ -0,0 +1,699 @@
+#include "PeLibInclude.h"
+
+#include "BulkIo.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define BULK_IO_URING
+#endif
+#endif
+
+#ifdef BULK_IO_URING
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+
+/* entries handed to the kernel per call; a round with more of them takes several */
+const unsigned int BULK_RING_ENTRIES = 64;
+
+/* reads are whole pages, so neighbouring asks of one round share a read */
+const uint64_t BULK_PAGE_SIZE = 0x1000;
+
+/* largest single read; longer runs of pages are split, so no one read holds up a round */
+const uint64_t BULK_MAX_TRANSFER = 256 * 1024;
+
+/* the registered buffers a file is written out of; a batch of writes is all of them, full */
+const size_t BULK_WRITE_BUFFERS = 8;
+const size_t BULK_WRITE_BUFFER_SIZE = BULK_MAX_TRANSFER;
+
+
+bool BulkFile::read(uint64_t offset, void *buffer, size_t size)
+{
+	if (offset > this->fileSize || size > this->fileSize - offset)
+		return false;
+
+	/* runs are fetched a round at a time, so a range can span several */
+	auto destination = static_cast<uint8_t*>(buffer);
+	uint64_t position = offset, end = offset + size;
+	while (position < end)
+	{
+		auto run = this->fetched.upper_bound(position);
+		if (run == this->fetched.begin())
+			break;
+		run--;
+
+		auto runEnd = run->first + run->second.size();
+		if (position >= runEnd)
+			break;
+
+		auto count = std::min(end, runEnd) - position;
+		memcpy(destination + (position - offset), run->second.data() + (position - run->first), static_cast<size_t>(count));
+		position += count;
+	}
+
+	if (position == end)
+		return true;
+	if (!this->failed)
+		this->wanted.emplace_back(position, end);
+	return false;
+}
+
+
+#ifdef BULK_IO_URING
+struct BulkIo::Ring
+{
+	int fd;
+	unsigned int sqEntries;
+	void *sqRing, *cqRing;
+	size_t sqRingSize, cqRingSize;
+	io_uring_sqe* sqes;
+	size_t sqesSize;
+	unsigned int *sqTail, *sqMask, *sqArray;
+	unsigned int *cqHead, *cqTail, *cqMask;
+	io_uring_cqe* cqes;
+	bool writeFixed; /* whether writes can go out of registered buffers */
+
+	Ring() :
+		fd(-1), sqEntries(0), sqRing(nullptr), cqRing(nullptr), sqRingSize(0), cqRingSize(0), sqes(nullptr), sqesSize(0),
+		sqTail(nullptr), sqMask(nullptr), sqArray(nullptr), cqHead(nullptr), cqTail(nullptr), cqMask(nullptr), cqes(nullptr),
+		writeFixed(false) {}
+	~Ring();
+
+	bool setup();
+
+	/* registers count buffers of size each, laid out one after another from buffers */
+	bool registerBuffers(uint8_t *buffers, size_t count, size_t size);
+
+	/*
+		one round: fill() prepares an entry for each of count items, done()
+		gets each item's result. every entry of a call completes before the
+		next call, so the completion queue (twice the size) can't overflow.
+		fails only if the ring itself stops working.
+	*/
+	template <typename Fill, typename Done>
+	bool run(size_t count, Fill fill, Done done);
+};
+
+BulkIo::Ring::~Ring()
+{
+	if (this->sqes)
+		munmap(this->sqes, this->sqesSize);
+	if (this->cqRing && this->cqRing != this->sqRing)
+		munmap(this->cqRing, this->cqRingSize);
+	if (this->sqRing)
+		munmap(this->sqRing, this->sqRingSize);
+	if (this->fd >= 0)
+		::close(this->fd);
+}
+
+bool BulkIo::Ring::setup()
+{
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	this->fd = static_cast<int>(syscall(__NR_io_uring_setup, BULK_RING_ENTRIES, &params));
+	if (this->fd < 0)
+		return false;
+
+	this->sqEntries = params.sq_entries;
+	this->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	this->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	auto singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if (singleMap)
+		this->sqRingSize = this->cqRingSize = std::max(this->sqRingSize, this->cqRingSize);
+
+	auto sqRing = mmap(nullptr, this->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQ_RING);
+	if (sqRing == MAP_FAILED)
+		return false;
+	this->sqRing = sqRing;
+
+	auto cqRing = singleMap ? sqRing : mmap(nullptr, this->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_CQ_RING);
+	if (cqRing == MAP_FAILED)
+		return false;
+	this->cqRing = cqRing;
+
+	this->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+	auto sqes = mmap(nullptr, this->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		return false;
+	this->sqes = static_cast<io_uring_sqe*>(sqes);
+
+	auto sq = static_cast<uint8_t*>(sqRing);
+	this->sqTail = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+	this->sqMask = reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+	this->sqArray = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+
+	auto cq = static_cast<uint8_t*>(cqRing);
+	this->cqHead = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+	this->cqTail = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+	this->cqMask = reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+	this->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+	/* everything used here arrived by 5.6, but ask rather than guess from the version */
+	std::vector<uint8_t> probeBuffer(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+	auto probe = reinterpret_cast<io_uring_probe*>(probeBuffer.data());
+	if (syscall(__NR_io_uring_register, this->fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+		return false;
+
+	auto supported = [probe](int op) { return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED); };
+	for (auto op : { IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE })
+		if (!supported(op))
+			return false;
+
+	/* reading doesn't need it, so a ring without it is still used for that */
+	this->writeFixed = supported(IORING_OP_WRITE_FIXED);
+	return true;
+}
+
+bool BulkIo::Ring::registerBuffers(uint8_t *buffers, size_t count, size_t size)
+{
+	std::vector<iovec> vectors(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		vectors[i].iov_base = buffers + i * size;
+		vectors[i].iov_len = size;
+	}
+	return syscall(__NR_io_uring_register, this->fd, IORING_REGISTER_BUFFERS, vectors.data(), static_cast<unsigned int>(count)) >= 0;
+}
+
+template <typename Fill, typename Done>
+bool BulkIo::Ring::run(size_t count, Fill fill, Done done)
+{
+	for (size_t first = 0; first < count; first += this->sqEntries)
+	{
+		auto batch = static_cast<unsigned int>(std::min<size_t>(count - first, this->sqEntries));
+		auto tail = *this->sqTail;
+		for (unsigned int i = 0; i < batch; i++)
+		{
+			auto index = (tail + i) & *this->sqMask;
+			auto& sqe = this->sqes[index];
+			memset(&sqe, 0, sizeof(sqe));
+			fill(first + i, sqe);
+			sqe.user_data = first + i;
+			this->sqArray[index] = index;
+		}
+		__atomic_store_n(this->sqTail, tail + batch, __ATOMIC_RELEASE);
+
+		unsigned int submitted = 0, completed = 0;
+		while (completed < batch)
+		{
+			auto result = syscall(__NR_io_uring_enter, this->fd, batch - submitted, batch - completed, IORING_ENTER_GETEVENTS, nullptr, 0);
+			if (result < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				return false;
+			}
+			submitted += static_cast<unsigned int>(result);
+
+			auto head = *this->cqHead;
+			auto cqTail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+			for (; head != cqTail; head++, completed++)
+			{
+				auto& cqe = this->cqes[head & *this->cqMask];
+				done(static_cast<size_t>(cqe.user_data), cqe.res);
+			}
+			__atomic_store_n(this->cqHead, head, __ATOMIC_RELEASE);
+		}
+	}
+	return true;
+}
+#else
+struct BulkIo::Ring
+{
+};
+#endif
+
+
+/*
+	the stream a file is written through: it fills the registered buffers
+	in turn, and has BulkIo write them all out once the last one is full.
+*/
+class BulkIo::OutputBuffer : public std::streambuf
+{
+public:
+	OutputBuffer(BulkIo &_io, int _handle) : io(_io), handle(_handle), offset(0), current(0), failed(false)
+	{
+		this->start(0);
+	}
+
+	/* writes out whatever is still buffered */
+	bool finish()
+	{
+		return this->writeOut();
+	}
+
+protected:
+	int_type overflow(int_type c) override
+	{
+		if (!this->nextBuffer())
+			return traits_type::eof();
+		if (!traits_type::eq_int_type(c, traits_type::eof()))
+		{
+			*this->pptr() = traits_type::to_char_type(c);
+			this->pbump(1);
+		}
+		return traits_type::not_eof(c);
+	}
+
+	std::streamsize xsputn(const char *data, std::streamsize size) override
+	{
+		std::streamsize done = 0;
+		while (done < size)
+		{
+			if (this->pptr() == this->epptr() && !this->nextBuffer())
+				break;
+			auto count = std::min<std::streamsize>(size - done, this->epptr() - this->pptr());
+			memcpy(this->pptr(), data + done, static_cast<size_t>(count));
+			this->pbump(static_cast<int>(count));
+			done += count;
+		}
+		return done;
+	}
+
+private:
+	BulkIo &io;
+	int handle;
+	uint64_t offset; /* where the first buffer goes in the file */
+	size_t current;
+	bool failed;
+
+	void start(size_t index)
+	{
+		auto buffer = reinterpret_cast<char*>(this->io.writeBuffers.data() + index * BULK_WRITE_BUFFER_SIZE);
+		this->current = index;
+		this->setp(buffer, buffer + BULK_WRITE_BUFFER_SIZE);
+	}
+
+	bool nextBuffer()
+	{
+		if (this->current + 1 < BULK_WRITE_BUFFERS)
+		{
+			this->start(this->current + 1);
+			return true;
+		}
+		return this->writeOut();
+	}
+
+	bool writeOut()
+	{
+		auto lastSize = static_cast<size_t>(this->pptr() - this->pbase());
+		if (this->failed || (!this->current && !lastSize))
+			return !this->failed;
+
+		if (!this->io.writeOut(this->handle, this->offset, this->current + 1, lastSize))
+		{
+			this->failed = true;
+			return false;
+		}
+		this->offset += this->current * BULK_WRITE_BUFFER_SIZE + lastSize;
+		this->start(0);
+		return true;
+	}
+};
+
+
+static uint64_t nanosecondsSince(std::chrono::steady_clock::time_point startTime)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+
+BulkIo::BulkIo(uint64_t _maxFileBytes) : maxFileBytes(_maxFileBytes), writeBuffersRegistered(false)
+{
+#ifdef BULK_IO_URING
+	std::unique_ptr<Ring> candidate(new Ring());
+	if (candidate->setup())
+		this->ring = std::move(candidate);
+#endif
+}
+
+BulkIo::~BulkIo()
+{
+}
+
+bool BulkIo::ioUringSupported()
+{
+	BulkIo probe(0);
+	return probe.usingIoUring();
+}
+
+void BulkIo::failAll(std::vector<BulkFile> &files)
+{
+	for (auto& file : files)
+	{
+		file.failed = true;
+		file.wanted.clear();
+		file.fetched.clear();
+	}
+}
+
+void BulkIo::openFiles(std::vector<BulkFile> &files)
+{
+	for (auto& file : files)
+	{
+		file.fileSize = 0;
+		file.failed = false;
+		file.handle = -1;
+		file.bytesFetched = 0;
+		file.fetched.clear();
+		file.wanted.clear();
+	}
+
+#ifdef BULK_IO_URING
+	if (!this->ring)
+	{
+		this->failAll(files);
+		return;
+	}
+
+	/*
+		statted first, so only regular files get opened: opening a fifo
+		would wait for a writer. the opens then all go in together.
+	*/
+	auto startTime = std::chrono::steady_clock::now();
+	std::vector<struct statx> stats(files.size());
+	auto ok = this->ring->run(files.size(),
+		[&](size_t i, io_uring_sqe &sqe)
+		{
+			sqe.opcode = IORING_OP_STATX;
+			sqe.fd = AT_FDCWD;
+			sqe.addr = reinterpret_cast<uintptr_t>(files[i].fileName.c_str());
+			sqe.len = STATX_TYPE | STATX_SIZE;
+			sqe.addr2 = reinterpret_cast<uintptr_t>(&stats[i]);
+		},
+		[&](size_t i, int result)
+		{
+			if (result < 0 || !S_ISREG(stats[i].stx_mode))
+				files[i].failed = true;
+			else
+				files[i].fileSize = stats[i].stx_size;
+		});
+
+	std::vector<size_t> opening;
+	for (size_t i = 0; i < files.size(); i++)
+		if (!files[i].failed)
+			opening.push_back(i);
+
+	ok = ok && this->ring->run(opening.size(),
+		[&](size_t n, io_uring_sqe &sqe)
+		{
+			sqe.opcode = IORING_OP_OPENAT;
+			sqe.fd = AT_FDCWD;
+			sqe.addr = reinterpret_cast<uintptr_t>(files[opening[n]].fileName.c_str());
+			sqe.open_flags = O_RDONLY | O_CLOEXEC;
+		},
+		[&](size_t n, int result)
+		{
+			if (result < 0)
+				files[opening[n]].failed = true;
+			else
+				files[opening[n]].handle = result;
+		});
+
+	PeLib::IoStats ioDelta;
+	ioDelta.ullOpens = opening.size();
+	ioDelta.ullNanoseconds = nanosecondsSince(startTime);
+	PeLib::IoScope::charge(ioDelta);
+
+	/* a ring which failed once isn't trusted again */
+	if (!ok)
+	{
+		this->ring.reset();
+		this->failAll(files);
+	}
+#else
+	this->failAll(files);
+#endif
+}
+
+void BulkIo::fetch(std::vector<BulkFile> &files)
+{
+#ifdef BULK_IO_URING
+	if (!this->ring)
+	{
+		this->failAll(files);
+		return;
+	}
+
+	struct Transfer
+	{
+		size_t file;
+		uint64_t offset;
+		uint8_t* buffer;
+		uint32_t size;
+	};
+
+	/*
+		everything a file asked for is rounded out to whole pages, less the
+		ones it already has, and the pages left are read in runs. a file
+		which would go over its byte limit gets nothing more.
+	*/
+	std::vector<Transfer> transfers;
+	std::vector<uint64_t> pages;
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		auto& file = files[i];
+		if (file.failed || !file.wanted.size())
+			continue;
+
+		pages.clear();
+		for (auto& range : file.wanted)
+			for (auto page = range.first / BULK_PAGE_SIZE; page <= (range.second - 1) / BULK_PAGE_SIZE; page++)
+				pages.push_back(page);
+		file.wanted.clear();
+		std::sort(pages.begin(), pages.end());
+		pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+		auto alreadyFetched = [&](uint64_t page)
+		{
+			auto run = file.fetched.upper_bound(page * BULK_PAGE_SIZE);
+			if (run == file.fetched.begin())
+				return false;
+			run--;
+			return page * BULK_PAGE_SIZE < run->first + run->second.size();
+		};
+		pages.erase(std::remove_if(pages.begin(), pages.end(), alreadyFetched), pages.end());
+
+		auto firstTransfer = transfers.size();
+		for (size_t p = 0; p < pages.size(); )
+		{
+			auto first = pages[p];
+			auto last = first;
+			while (++p < pages.size() && pages[p] == last + 1 && (pages[p] - first + 1) * BULK_PAGE_SIZE <= BULK_MAX_TRANSFER)
+				last = pages[p];
+
+			auto offset = first * BULK_PAGE_SIZE;
+			auto end = std::min((last + 1) * BULK_PAGE_SIZE, file.fileSize);
+			file.bytesFetched += end - offset;
+			transfers.push_back({ i, offset, nullptr, static_cast<uint32_t>(end - offset) });
+		}
+
+		if (file.bytesFetched > this->maxFileBytes)
+		{
+			file.failed = true;
+			file.fetched.clear();
+			transfers.resize(firstTransfer);
+		}
+	}
+
+	/* the buffers go in only now, so a failed file never leaves any behind */
+	for (auto& transfer : transfers)
+	{
+		auto& buffer = files[transfer.file].fetched[transfer.offset];
+		buffer.resize(transfer.size);
+		transfer.buffer = buffer.data();
+	}
+
+	auto startTime = std::chrono::steady_clock::now();
+	std::vector<int> results(transfers.size(), 0);
+	auto ok = this->ring->run(transfers.size(),
+		[&](size_t n, io_uring_sqe &sqe)
+		{
+			auto& transfer = transfers[n];
+			sqe.opcode = IORING_OP_READ;
+			sqe.fd = files[transfer.file].handle;
+			sqe.addr = reinterpret_cast<uintptr_t>(transfer.buffer);
+			sqe.len = transfer.size;
+			sqe.off = transfer.offset;
+		},
+		[&](size_t n, int result) { results[n] = result; });
+
+	/* a file which shrank or failed to read is dropped whole, so read() never serves made-up bytes */
+	PeLib::IoStats ioDelta;
+	for (size_t n = 0; n < transfers.size(); n++)
+	{
+		auto& file = files[transfers[n].file];
+		ioDelta.ullReads++;
+		if (results[n] > 0)
+			ioDelta.ullBytesRead += static_cast<uint64_t>(results[n]);
+		if (results[n] < 0 || static_cast<uint32_t>(results[n]) != transfers[n].size)
+		{
+			file.failed = true;
+			file.fetched.clear();
+		}
+	}
+	ioDelta.ullNanoseconds = nanosecondsSince(startTime);
+	PeLib::IoScope::charge(ioDelta);
+
+	if (!ok)
+	{
+		this->ring.reset();
+		this->failAll(files);
+	}
+#else
+	this->failAll(files);
+#endif
+}
+
+void BulkIo::closeFiles(std::vector<BulkFile> &files)
+{
+#ifdef BULK_IO_URING
+	std::vector<size_t> open;
+	for (size_t i = 0; i < files.size(); i++)
+		if (files[i].handle >= 0)
+			open.push_back(i);
+
+	if (this->ring)
+	{
+		auto ok = this->ring->run(open.size(),
+			[&](size_t n, io_uring_sqe &sqe) { sqe.opcode = IORING_OP_CLOSE; sqe.fd = files[open[n]].handle; },
+			[&](size_t n, int) { files[open[n]].handle = -1; });
+		if (!ok)
+			this->ring.reset();
+	}
+
+	/* whatever the ring didn't get to still has to be closed */
+	for (auto& file : files)
+	{
+		if (file.handle >= 0)
+			::close(file.handle);
+		file.handle = -1;
+	}
+#endif
+
+	for (auto& file : files)
+	{
+		file.fetched.clear();
+		file.wanted.clear();
+	}
+}
+
+bool BulkIo::registerWriteBuffers()
+{
+#ifdef BULK_IO_URING
+	if (!this->ring || !this->ring->writeFixed)
+		return false;
+	if (this->writeBuffersRegistered)
+		return true;
+
+	/* a ring which can't take them once won't later either */
+	this->writeBuffers.resize(BULK_WRITE_BUFFERS * BULK_WRITE_BUFFER_SIZE);
+	this->writeBuffersRegistered = this->ring->registerBuffers(this->writeBuffers.data(), BULK_WRITE_BUFFERS, BULK_WRITE_BUFFER_SIZE);
+	if (!this->writeBuffersRegistered)
+	{
+		this->ring->writeFixed = false;
+		std::vector<uint8_t>().swap(this->writeBuffers);
+	}
+	return this->writeBuffersRegistered;
+#else
+	return false;
+#endif
+}
+
+bool BulkIo::writeOut(int handle, uint64_t offset, size_t bufferCount, size_t lastSize)
+{
+#ifdef BULK_IO_URING
+	auto startTime = std::chrono::steady_clock::now();
+	auto bufferAt = [&](size_t i) { return this->writeBuffers.data() + i * BULK_WRITE_BUFFER_SIZE; };
+	auto sizeOf = [&](size_t i) { return (i + 1 < bufferCount) ? BULK_WRITE_BUFFER_SIZE : lastSize; };
+
+	std::vector<int> results(bufferCount, 0);
+	if (this->ring)
+	{
+		auto ok = this->ring->run(bufferCount,
+			[&](size_t i, io_uring_sqe &sqe)
+			{
+				sqe.opcode = IORING_OP_WRITE_FIXED;
+				sqe.fd = handle;
+				sqe.addr = reinterpret_cast<uintptr_t>(bufferAt(i));
+				sqe.len = static_cast<uint32_t>(sizeOf(i));
+				sqe.off = offset + i * BULK_WRITE_BUFFER_SIZE;
+				sqe.buf_index = static_cast<uint16_t>(i);
+			},
+			[&](size_t i, int result) { results[i] = result; });
+
+		/* the writes it did finish are the same bytes at the same offsets, so writing them again is harmless */
+		if (!ok)
+		{
+			this->ring.reset();
+			results.assign(bufferCount, 0);
+		}
+	}
+
+	/* whatever the ring didn't write, or only wrote part of, is written the plain way; a real error shows up there too */
+	PeLib::IoStats ioDelta;
+	bool written = true;
+	for (size_t i = 0; i < bufferCount && written; i++)
+	{
+		ioDelta.ullWrites++;
+		auto done = static_cast<size_t>(std::max(results[i], 0));
+		while (done < sizeOf(i))
+		{
+			auto result = ::pwrite(handle, bufferAt(i) + done, sizeOf(i) - done, static_cast<off_t>(offset + i * BULK_WRITE_BUFFER_SIZE + done));
+			ioDelta.ullWrites++;
+			if (result < 0 && errno == EINTR)
+				continue;
+			if (result <= 0)
+			{
+				written = false;
+				break;
+			}
+			done += static_cast<size_t>(result);
+		}
+		ioDelta.ullBytesWritten += done;
+	}
+	ioDelta.ullNanoseconds = nanosecondsSince(startTime);
+	PeLib::IoScope::charge(ioDelta);
+	return written;
+#else
+	return false;
+#endif
+}
+
+bool BulkIo::writeFile(const std::string &fileName, const std::function<bool(std::ostream&)> &write)
+{
+#ifdef BULK_IO_URING
+	if (this->registerWriteBuffers())
+	{
+		auto startTime = std::chrono::steady_clock::now();
+		auto handle = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+		PeLib::IoStats ioDelta;
+		ioDelta.ullOpens = 1;
+		ioDelta.ullNanoseconds = nanosecondsSince(startTime);
+		PeLib::IoScope::charge(ioDelta);
+		if (handle < 0)
+			return false;
+
+		OutputBuffer buffer(*this, handle);
+		std::ostream sink(&buffer);
+		bool written = write(sink) && buffer.finish();
+		return (::close(handle) == 0) && written;
+	}
+#endif
+
+	PeLib::FileStream file(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+	bool written = file.is_open() && write(file);
+	file.close();
+	return written && file;
+}
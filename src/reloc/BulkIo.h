@@ -0,0 +1,114 @@
+#pragma once
+#include <functional>
+#include <map>
+#include <ostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/*
+	one file, read a piece at a time by code which works out what it needs
+	next from what it has read so far, the way a parser goes from the
+	headers to a directory they point at. read() hands out what has been
+	fetched and notes down what hasn't; BulkIo then fetches whatever a
+	whole batch of files asked for at once, and the code reading them runs
+	again from the start, getting further each time. a batch takes as many
+	rounds as the longest chain of reads which depend on each other.
+*/
+class BulkFile
+{
+public:
+	std::string fileName;
+	uint64_t fileSize;
+
+	/* BulkIo couldn't, or wouldn't, read this file; it has to be read some other way */
+	bool failed;
+
+	BulkFile() : fileSize(0), failed(false), handle(-1), bytesFetched(0) {}
+
+	/*
+		copies [offset, offset + size) to buffer if it has all been fetched.
+		otherwise fails, and queues whatever is missing for the next round
+		unless it lies past the end of the file.
+	*/
+	bool read(uint64_t offset, void *buffer, size_t size);
+
+	/* whether read() queued anything the last round didn't fetch */
+	bool pending() const { return !this->wanted.empty(); }
+
+private:
+	friend class BulkIo;
+
+	int handle;
+	uint64_t bytesFetched;
+	std::map<uint64_t, std::vector<uint8_t>> fetched; /* runs of whole pages, by file offset */
+	std::vector<std::pair<uint64_t, uint64_t>> wanted; /* [begin, end) */
+};
+
+/*
+	reads batches of files through an io_uring on Linux: the stats, opens,
+	reads and closes of a whole batch each go to the kernel in one call,
+	and the reads of a round are coalesced into page runs of a capped size.
+	where io_uring isn't there (other systems, older kernels, sandboxes
+	blocking it), usingIoUring() is false and the caller keeps to its own
+	way of reading files; if the ring breaks mid-batch, every file in it
+	is failed.
+
+	it writes files through the ring too, out of a fixed set of buffers
+	registered with it once, so the kernel doesn't map them in again for
+	every write. writeFile() works without io_uring all the same, writing
+	synchronously instead.
+
+	opens, reads, writes, bytes and time are charged to the thread's
+	PeLib::IoScope, as FileStream does. not thread-safe; give each thread
+	its own.
+*/
+class BulkIo
+{
+public:
+	/* a file which would need more than maxFileBytes fetched is failed instead */
+	BulkIo(uint64_t maxFileBytes);
+	~BulkIo();
+
+	BulkIo(const BulkIo&) = delete;
+	BulkIo& operator=(const BulkIo&) = delete;
+
+	/* whether io_uring, with every operation used here, can be set up on this machine */
+	static bool ioUringSupported();
+
+	bool usingIoUring() const { return this->ring != nullptr; }
+
+	/* opens every regular file and fills in fileSize; any other is failed */
+	void openFiles(std::vector<BulkFile> &files);
+
+	/* fetches everything queued by read() for files which haven't failed */
+	void fetch(std::vector<BulkFile> &files);
+
+	/* closes every file and drops what was fetched for it */
+	void closeFiles(std::vector<BulkFile> &files);
+
+	/*
+		creates fileName and has write() stream into it, filling the
+		registered buffers in turn; each time they're all full, they go to
+		the kernel as one batch of fixed-buffer writes. without io_uring,
+		or if the buffers can't be registered (they count against the
+		locked memory limit on older kernels), the file is written with a
+		PeLib::FileStream instead; if the ring breaks partway, the rest is
+		written with pwrite(). fails if write() does, or if any of it
+		doesn't make it to the file. fits PeRecompiler::OutputWriter.
+	*/
+	bool writeFile(const std::string &fileName, const std::function<bool(std::ostream&)> &write);
+
+private:
+	struct Ring;
+	class OutputBuffer;
+	std::unique_ptr<Ring> ring;
+	uint64_t maxFileBytes;
+	std::vector<uint8_t> writeBuffers; /* BULK_WRITE_BUFFERS of BULK_WRITE_BUFFER_SIZE, registered on first use */
+	bool writeBuffersRegistered;
+
+	void failAll(std::vector<BulkFile> &files);
+	bool registerWriteBuffers();
+	bool writeOut(int handle, uint64_t offset, size_t bufferCount, size_t lastSize);
+};
@@ -0,0 +1,278 @@
+#include "PeLibInclude.h"
+
+#include "LoaderEmulator.h"
+
+#include <algorithm>
+#include <string.h>
+
+
+/* refuse to map anything bigger than this; real images are far smaller */
+const uint32_t LOADER_MAX_IMAGE_SIZE = 0x40000000;
+
+/* how many differing ranges get printed before we just count them */
+const uint32_t LOADER_MAX_REPORTED_MISMATCHES = 8;
+
+template<typename T>
+static bool readImage(const std::vector<uint8_t> &memory, uint32_t rva, T &value)
+{
+	if (static_cast<uint64_t>(rva) + sizeof(T) > memory.size())
+		return false;
+	memcpy(&value, memory.data() + rva, sizeof(T));
+	return true;
+}
+
+template<typename T>
+static bool addToImage(std::vector<uint8_t> &memory, uint32_t rva, T delta)
+{
+	T value;
+	if (!readImage(memory, rva, value))
+		return false;
+	value = static_cast<T>(value + delta);
+	memcpy(memory.data() + rva, &value, sizeof(T));
+	return true;
+}
+
+/* the loader maps whole pages, so a section covers its virtual size rounded up */
+static uint32_t getMappedSectionSize(const PeLib::PeHeader32 &peHeader, unsigned int sec)
+{
+	uint32_t virtualSize = peHeader.getVirtualSize(sec);
+	if (!virtualSize)
+		virtualSize = peHeader.getSizeOfRawData(sec);
+	return PeLib::alignOffset(virtualSize, peHeader.getSectionAlignment());
+}
+
+
+LoaderEmulator::LoaderEmulator(std::ostream &_infoStream, std::ostream &_errorStream)
+	: infoStream(_infoStream), errorStream(_errorStream)
+{
+	this->infoStream << std::hex;
+	this->errorStream << std::hex;
+}
+
+bool LoaderEmulator::mapImage(const uint8_t *data, size_t size, uint32_t loadBase, MappedImage &image)
+{
+	auto peFile = std::make_shared<PeLib::PeFile32>("");
+	auto inputSize = static_cast<unsigned int>(size);
+	if (peFile->readMzHeader(data, inputSize) != PeLib::NO_ERROR || peFile->readPeHeader(data, inputSize) != PeLib::NO_ERROR)
+	{
+		this->errorStream << "\tFailed to parse PE headers of image to map" << std::endl;
+		return false;
+	}
+
+	auto& peHeader = peFile->peHeader();
+	uint32_t sizeOfImage = peHeader.getSizeOfImage();
+	if (!sizeOfImage || sizeOfImage > LOADER_MAX_IMAGE_SIZE)
+	{
+		this->errorStream << "\tSizeOfImage of 0x" << sizeOfImage << " can't be mapped" << std::endl;
+		return false;
+	}
+
+	image.peFile = peFile;
+	image.loadBase = loadBase;
+	image.relocationCount = 0;
+	image.memory.assign(sizeOfImage, 0x00);
+
+	/* headers land at the very start of the image */
+	size_t headerSize = std::min<size_t>(std::min<size_t>(peHeader.getSizeOfHeaders(), size), sizeOfImage);
+	memcpy(image.memory.data(), data, headerSize);
+
+	for (unsigned int sec = 0; sec < peHeader.calcNumberOfSections(); sec++)
+	{
+		uint32_t RVA = peHeader.getVirtualAddress(sec);
+		uint32_t mappedSize = getMappedSectionSize(peHeader, sec);
+		if (static_cast<uint64_t>(RVA) + mappedSize > sizeOfImage)
+		{
+			this->errorStream << "\tSection " << peHeader.getSectionName(sec) << " at RVA 0x" << RVA << " runs past SizeOfImage" << std::endl;
+			return false;
+		}
+
+		/*
+			the loader rounds the raw pointer down to a 512-byte boundary and
+			never copies more than fits in the mapped section. anything the
+			file doesn't have stays zeroed.
+		*/
+		size_t rawPointer = peHeader.getPointerToRawData(sec) & ~0x1FF;
+		size_t copySize = std::min<size_t>(peHeader.getSizeOfRawData(sec), mappedSize);
+		if (rawPointer >= size)
+			copySize = 0;
+		else
+			copySize = std::min<size_t>(copySize, size - rawPointer);
+
+		if (copySize)
+			memcpy(image.memory.data() + RVA, data + rawPointer, copySize);
+	}
+
+	return this->applyRelocations(image);
+}
+
+bool LoaderEmulator::applyRelocations(MappedImage &image)
+{
+	auto& peHeader = image.peFile->peHeader();
+	uint32_t delta = image.loadBase - peHeader.getImageBase();
+	if (!delta)
+		return true; // loaded at the requested base, so the loader leaves it alone
+
+	uint32_t relocRVA = peHeader.getIddBaseRelocRva();
+	uint32_t relocSize = peHeader.getIddBaseRelocSize();
+	if (!relocRVA || !relocSize)
+	{
+		this->errorStream << "\tImage must move from 0x" << peHeader.getImageBase() << " to 0x" << image.loadBase << " but has no reloc table" << std::endl;
+		return false;
+	}
+
+	if (static_cast<uint64_t>(relocRVA) + relocSize > image.memory.size())
+	{
+		this->errorStream << "\tReloc table at RVA 0x" << relocRVA << " runs past the end of the image" << std::endl;
+		return false;
+	}
+
+	/*
+		walk the table straight out of mapped memory, block by block and entry
+		by entry, exactly as the loader does. the order matters, as packed
+		output relies on overlapping entries being applied in sequence.
+	*/
+	uint32_t blockOffset = relocRVA;
+	uint32_t tableEnd = relocRVA + relocSize;
+	while (tableEnd - blockOffset >= 8)
+	{
+		uint32_t blockRVA, blockSize;
+		if (!readImage(image.memory, blockOffset, blockRVA) || !readImage(image.memory, blockOffset + 4, blockSize))
+		{
+			this->errorStream << "\tReloc block header at RVA 0x" << blockOffset << " is outside of the image" << std::endl;
+			return false;
+		}
+		if (blockSize < 8 || blockSize > tableEnd - blockOffset)
+		{
+			this->errorStream << "\tMalformed reloc block at RVA 0x" << blockOffset << " (size 0x" << blockSize << ")" << std::endl;
+			return false;
+		}
+
+		uint32_t entryCount = (blockSize - 8) / sizeof(uint16_t);
+		for (uint32_t i = 0; i < entryCount; i++)
+		{
+			uint16_t entry;
+			if (!readImage(image.memory, blockOffset + 8 + (i * sizeof(uint16_t)), entry))
+			{
+				this->errorStream << "\tReloc entry at RVA 0x" << (blockOffset + 8 + (i * sizeof(uint16_t))) << " is outside of the image" << std::endl;
+				return false;
+			}
+
+			uint16_t entryType = (entry >> 12);
+			uint32_t target = blockRVA + (entry & 0x0FFF);
+
+			bool applied;
+			switch (entryType)
+			{
+			case PeLib::PELIB_IMAGE_REL_BASED_ABSOLUTE:
+				continue;
+			case PeLib::PELIB_IMAGE_REL_BASED_HIGH:
+				applied = addToImage<uint16_t>(image.memory, target, static_cast<uint16_t>(delta >> 16));
+				break;
+			case PeLib::PELIB_IMAGE_REL_BASED_LOW:
+				applied = addToImage<uint16_t>(image.memory, target, static_cast<uint16_t>(delta));
+				break;
+			case PeLib::PELIB_IMAGE_REL_BASED_HIGHLOW:
+				applied = addToImage<uint32_t>(image.memory, target, delta);
+				break;
+			default:
+				this->errorStream << "\tUnsupported reloc type 0x" << entryType << " at RVA 0x" << target << std::endl;
+				return false;
+			}
+
+			if (!applied)
+			{
+				this->errorStream << "\tReloc target RVA 0x" << target << " is outside of the image" << std::endl;
+				return false;
+			}
+			image.relocationCount++;
+		}
+
+		blockOffset += blockSize;
+	}
+
+	return true;
+}
+
+bool LoaderEmulator::compareImages(const MappedImage &expected, const MappedImage &actual)
+{
+	auto& peHeader = expected.peFile->peHeader();
+
+	/*
+		only section contents are compared. the headers and the reloc table
+		are rewritten by design, and anything we injected has no counterpart.
+	*/
+	uint32_t relocRVA = peHeader.getIddBaseRelocRva();
+
+	uint32_t comparedBytes = 0, mismatchedBytes = 0, mismatchedRanges = 0;
+	for (unsigned int sec = 0; sec < peHeader.calcNumberOfSections(); sec++)
+	{
+		uint32_t RVA = peHeader.getVirtualAddress(sec);
+		uint32_t mappedSize = getMappedSectionSize(peHeader, sec);
+		if (relocRVA >= RVA && relocRVA < RVA + mappedSize)
+			continue;
+
+		uint32_t end = RVA + mappedSize;
+		if (end > actual.memory.size())
+		{
+			this->errorStream << "\tSection " << peHeader.getSectionName(sec) << " is missing from the output image" << std::endl;
+			return false;
+		}
+
+		for (uint32_t rva = RVA; rva < end; rva++)
+		{
+			if (expected.memory[rva] == actual.memory[rva])
+				continue;
+
+			/* report each run of differing bytes once */
+			uint32_t runEnd = rva;
+			while (runEnd < end && expected.memory[runEnd] != actual.memory[runEnd])
+				runEnd++;
+
+			if (mismatchedRanges < LOADER_MAX_REPORTED_MISMATCHES)
+			{
+				this->errorStream << "\tMismatch in " << peHeader.getSectionName(sec) << " at RVA 0x" << rva << " (0x" << (runEnd - rva) << " bytes)" << std::endl;
+			}
+
+			mismatchedRanges++;
+			mismatchedBytes += runEnd - rva;
+			rva = runEnd;
+		}
+		comparedBytes += mappedSize;
+	}
+
+	if (mismatchedRanges)
+	{
+		this->errorStream << "\t" << std::dec << mismatchedBytes << " bytes in " << mismatchedRanges << std::hex << " ranges differ after loading" << std::endl;
+		return false;
+	}
+
+	this->infoStream << "\tCompared 0x" << comparedBytes << " bytes of section contents, all match" << std::endl;
+	return true;
+}
+
+bool LoaderEmulator::verify(const uint8_t *original, size_t originalSize, const uint8_t *packed, size_t packedSize, uint32_t loadBase)
+{
+	this->infoStream << "Verifying output with loader emulation at 0x" << loadBase << std::endl;
+
+	MappedImage expected, actual;
+	if (!this->mapImage(original, originalSize, loadBase, expected))
+	{
+		this->errorStream << "Failed to map original image!" << std::endl;
+		return false;
+	}
+	this->infoStream << "\tMapped original image and applied " << std::dec << expected.relocationCount << std::hex << " relocations" << std::endl;
+
+	if (!this->mapImage(packed, packedSize, loadBase, actual))
+	{
+		this->errorStream << "Failed to map output image!" << std::endl;
+		return false;
+	}
+	this->infoStream << "\tMapped output image and applied " << std::dec << actual.relocationCount << std::hex << " relocations" << std::endl;
+
+	if (!this->compareImages(expected, actual))
+	{
+		this->errorStream << "Output does not match the original once loaded!" << std::endl;
+		return false;
+	}
+	return true;
+}
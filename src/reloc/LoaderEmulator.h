@@ -0,0 +1,37 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <iostream>
+#include <stdint.h>
+
+namespace PeLib { class PeFile32; };
+
+/*
+	maps a PE image into a flat buffer the way the windows loader would,
+	then applies its base relocations for a given load address. nothing
+	here depends on windows, so packed output can be checked on any host.
+*/
+class LoaderEmulator
+{
+public:
+	class MappedImage
+	{
+	public:
+		std::shared_ptr<PeLib::PeFile32> peFile;
+		std::vector<uint8_t> memory;
+		uint32_t loadBase;
+		uint32_t relocationCount;
+	};
+
+	LoaderEmulator(std::ostream &_infoStream, std::ostream &_errorStream);
+
+	bool mapImage(const uint8_t *data, size_t size, uint32_t loadBase, MappedImage &image);
+	bool compareImages(const MappedImage &expected, const MappedImage &actual);
+
+	bool verify(const uint8_t *original, size_t originalSize, const uint8_t *packed, size_t packedSize, uint32_t loadBase);
+
+private:
+	std::ostream &infoStream, &errorStream;
+
+	bool applyRelocations(MappedImage &image);
+};
@@ -0,0 +1,154 @@
+#include "PeLibInclude.h"
+
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <chrono>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+
+bool MappedFile::open(const std::string &fileName, uint64_t maxSize)
+{
+	/*
+		pages only come in from disk as they're touched, so the bytes mapped
+		are an upper bound on what this reads, same as a FileStream read of
+		that many bytes would be.
+	*/
+	auto startTime = std::chrono::steady_clock::now();
+	auto opened = this->map(fileName, maxSize);
+
+	PeLib::IoStats ioDelta;
+	ioDelta.ullOpens = 1;
+	ioDelta.ullBytesMapped = this->viewSize;
+	ioDelta.ullNanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count();
+	PeLib::IoScope::charge(ioDelta);
+	return opened;
+}
+
+bool MappedFile::map(const std::string &fileName, uint64_t maxSize)
+{
+	this->close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	this->fileHandle = file;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+	{
+		this->close();
+		return false;
+	}
+
+	/* empty files can't be mapped, but they're still valid (and empty) */
+	this->totalSize = static_cast<uint64_t>(fileSize.QuadPart);
+	auto mapSize = std::min(this->totalSize, maxSize);
+	if (!mapSize)
+		return true;
+	if (mapSize > SIZE_MAX)
+	{
+		this->close();
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping)
+	{
+		this->close();
+		return false;
+	}
+	this->mappingHandle = mapping;
+
+	this->view = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, static_cast<SIZE_T>(mapSize)));
+	if (!this->view)
+	{
+		this->close();
+		return false;
+	}
+	this->viewSize = static_cast<size_t>(mapSize);
+#else
+	int file = ::open(fileName.c_str(), O_RDONLY);
+	if (file < 0)
+		return false;
+
+	struct stat fileStat;
+	if (fstat(file, &fileStat) != 0 || !S_ISREG(fileStat.st_mode))
+	{
+		::close(file);
+		return false;
+	}
+
+	/* the mapping holds its own reference, so the descriptor isn't kept */
+	this->totalSize = static_cast<uint64_t>(fileStat.st_size);
+	auto mapSize = std::min(this->totalSize, maxSize);
+	if (mapSize > SIZE_MAX)
+	{
+		::close(file);
+		return false;
+	}
+	if (mapSize)
+	{
+		void* view = mmap(nullptr, static_cast<size_t>(mapSize), PROT_READ, MAP_PRIVATE, file, 0);
+		if (view == MAP_FAILED)
+		{
+			::close(file);
+			return false;
+		}
+		this->view = static_cast<const uint8_t*>(view);
+		this->viewSize = static_cast<size_t>(mapSize);
+	}
+	::close(file);
+#endif
+
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (this->view)
+		UnmapViewOfFile(this->view);
+	if (this->mappingHandle)
+		CloseHandle(this->mappingHandle);
+	if (this->fileHandle)
+		CloseHandle(this->fileHandle);
+#else
+	if (this->view)
+		munmap(const_cast<uint8_t*>(this->view), this->viewSize);
+#endif
+
+	this->view = nullptr;
+	this->viewSize = 0;
+	this->totalSize = 0;
+	this->fileHandle = nullptr;
+	this->mappingHandle = nullptr;
+}
+
+void MappedFile::prefetch(size_t size) const
+{
+	size = std::min(size, this->viewSize);
+	if (!size)
+		return;
+
+#ifndef _WIN32
+	/* let readahead fetch the whole range in big requests instead of one fault at a time */
+	madvise(const_cast<uint8_t*>(this->view), size, MADV_WILLNEED);
+#endif
+
+	/* 4K is the smallest page size anywhere this runs */
+	const size_t pageSize = 0x1000;
+	volatile uint8_t sink = 0;
+	for (size_t offset = 0; offset < size; offset += pageSize)
+		sink ^= this->view[offset];
+	sink ^= this->view[size - 1];
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <string>
+#include <stdint.h>
+
+/*
+	read-only memory mapping of a whole file. pages are only read from disk
+	when touched, so looking at the headers of a large file stays cheap.
+*/
+class MappedFile
+{
+public:
+	MappedFile() : view(nullptr), viewSize(0), totalSize(0), fileHandle(nullptr), mappingHandle(nullptr) {}
+	~MappedFile() { this->close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	/*
+		maps the first maxSize bytes at most, so the start of a file too big
+		for the address space can still be looked at. charged to the thread's
+		PeLib::IoScope as an open, plus the bytes mapped.
+	*/
+	bool open(const std::string &fileName, uint64_t maxSize = UINT64_MAX);
+	void close();
+
+	/* faults the first size bytes of the view in now, so later reads of them don't wait on the disk */
+	void prefetch(size_t size = SIZE_MAX) const;
+
+	const uint8_t* data() const { return this->view; }
+	size_t size() const { return this->viewSize; }
+
+	/* size of the whole file, mapped or not */
+	uint64_t fileSize() const { return this->totalSize; }
+
+private:
+	const uint8_t* view;
+	size_t viewSize;
+	uint64_t totalSize;
+	void* fileHandle;
+	void* mappingHandle;
+
+	bool map(const std::string &fileName, uint64_t maxSize);
+};
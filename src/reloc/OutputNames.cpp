@@ -0,0 +1,40 @@
+#include "OutputNames.h"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <set>
+
+
+static std::string foldCase(std::string name)
+{
+	std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	return name;
+}
+
+std::vector<std::string> outputFileNames(const std::vector<std::string> &inputFileNames, const std::string &outputDirectory)
+{
+	std::vector<std::string> names;
+	std::set<std::string> usedNames;
+	for (auto& inputFileName : inputFileNames)
+	{
+		names.push_back(std::filesystem::path(inputFileName).filename().string());
+		usedNames.insert(foldCase(names.back()));
+	}
+
+	/* the first input with a name keeps it; the rest get one nobody has */
+	std::set<std::string> keptNames;
+	std::vector<std::string> outputFileNames;
+	for (size_t i = 0; i < names.size(); i++)
+	{
+		auto name = names[i];
+		if (!keptNames.insert(foldCase(name)).second)
+		{
+			name = std::to_string(i) + "-" + names[i];
+			for (unsigned int counter = 2; !usedNames.insert(foldCase(name)).second; counter++)
+				name = std::to_string(i) + "-" + std::to_string(counter) + "-" + names[i];
+		}
+		outputFileNames.push_back((std::filesystem::path(outputDirectory) / name).string());
+	}
+	return outputFileNames;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <string>
+#include <vector>
+
+/*
+	where each of a batch of inputs is written in outputDirectory: under its
+	own file name, unless an earlier input already took that name, in which
+	case the input's index goes in front of it ("3-a.exe"), and then a
+	counter as well ("3-2-a.exe") until the name is free. every input's own
+	name is reserved before any is renamed, so a renamed output never takes
+	the name a later input was going to keep. names are compared ignoring
+	case, as Windows does.
+*/
+std::vector<std::string> outputFileNames(const std::vector<std::string> &inputFileNames, const std::string &outputDirectory);
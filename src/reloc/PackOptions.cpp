@@ -0,0 +1,156 @@
+#include "PackOptions.h"
+#include "PeRecompiler.h"
+
+#include <sstream>
+#include <stdlib.h>
+
+
+static bool startsWith(const std::string& s, const std::string& prefix)
+{
+	return (s.size() >= prefix.size() && s.compare(0, prefix.size(), prefix) == 0);
+}
+
+static auto split(const std::string& s, char delim, size_t max=-1)
+{
+	auto start = 0;
+	std::vector<std::string> res;
+	while (start != std::string::npos && (max == -1 || res.size() < (max - 1)))
+	{
+		auto pos = s.find(delim);
+		auto sub = (pos == std::string::npos) ? s.substr(start) : s.substr(start, pos - start);
+		res.push_back(sub);
+		start = (pos == std::string::npos) ? pos : ++pos;
+	}
+	if (start != std::string::npos)
+		res.push_back(s.substr(start));
+	return res;
+}
+
+CommandLine parseCommandLine(const std::vector<std::string> &args)
+{
+	CommandLine cl;
+	for (auto arg : args)
+	{
+		auto isSwitch = startsWith(arg, "--");
+		if (isSwitch)
+		{
+			auto parts = split(arg, '=', 2);
+			auto key = (parts.size() == 2) ? parts[0] : arg;
+			cl[key] = cl[key]; // trick to automatically new() upon first discovery
+			if (parts.size() == 2)
+				cl[key].push_back(parts[1]);
+		}
+		else
+			cl[""].push_back(arg);
+	}
+
+	return cl;
+}
+
+
+PackOptions::PackOptions()
+	: win10(false), noImports(false), rewriteHeader(false), fixupBase(false), multiPass(false), plan(false), verify(false), incremental(false),
+	loadBudget(0), entryCost(DEFAULT_ENTRY_NANOSECONDS), pageCost(DEFAULT_PAGE_NANOSECONDS)
+{
+}
+
+void PackOptions::parse(CommandLine &cl, std::ostream &infoStream)
+{
+	this->win10 = (cl.find("--win10") != cl.end());
+	this->noImports = (cl.find("--noImports") != cl.end()) || this->win10;
+	this->rewriteHeader = (cl.find("--rewriteHeader") != cl.end());
+	this->fixupBase = (cl.find("--fixupBase") != cl.end());
+	this->multiPass = (cl.find("--multipass") != cl.end());
+	this->plan = (cl.find("--plan") != cl.end());
+	this->verify = (cl.find("--verify") != cl.end());
+	this->incremental = (cl.find("--incremental") != cl.end());
+
+	this->sections = cl["--section"];
+	this->stringMatches = cl["--stringMatch"];
+
+	if (!this->stringMatches.size())
+	{
+		if (this->sections.size() == 0)
+		{
+			this->sections.push_back(".text");
+			this->sections.push_back(".data");
+			if (!this->win10)
+				this->sections.push_back(".rsrc");
+		}
+	}
+	else if (this->sections.size())
+	{
+		infoStream << "Disabling obfuscation of whole sections due to --stringMatch" << std::endl;
+		this->sections.clear();
+	}
+
+	auto loadBudgets = cl["--loadBudget"];
+	auto entryCosts = cl["--entryCost"];
+	auto pageCosts = cl["--pageCost"];
+	if (loadBudgets.size())
+		this->loadBudget = strtod(loadBudgets.back().c_str(), nullptr);
+	if (entryCosts.size())
+		this->entryCost = strtod(entryCosts.back().c_str(), nullptr);
+	if (pageCosts.size())
+		this->pageCost = strtod(pageCosts.back().c_str(), nullptr);
+}
+
+std::string PackOptions::encode() const
+{
+	std::ostringstream options;
+	options << "win10=" << this->win10 << ";noImports=" << this->noImports << ";rewriteHeader=" << this->rewriteHeader;
+	options << ";fixupBase=" << this->fixupBase << ";multipass=" << this->multiPass << ";";
+
+	/* order matters for both lists, as it decides the order of the reloc blocks */
+	for (auto& sec : this->sections)
+		options << "section:" << sec.size() << ":" << sec << ";";
+	for (auto& str : this->stringMatches)
+		options << "stringMatch:" << str.size() << ":" << str << ";";
+
+	/* only outputs which passed the budget get cached, so a hit must have passed this one */
+	if (this->loadBudget > 0)
+		options << "loadBudget=" << std::to_string(this->loadBudget) << "/" << std::to_string(this->entryCost) << "/" << std::to_string(this->pageCost) << ";";
+	return options.str();
+}
+
+void PackOptions::configure(PeRecompiler &compiler) const
+{
+	compiler.useWindows10Attack(this->win10);
+	compiler.doMultiPass(this->multiPass);
+	compiler.doPlanOnly(this->plan);
+	compiler.setLoadCostModel(this->entryCost, this->pageCost);
+	compiler.setLoadBudget(this->loadBudget);
+	compiler.useRewritePlan(this->incremental);
+}
+
+bool PackOptions::rewrite(PeRecompiler &compiler, std::ostream &infoStream) const
+{
+	/* load everything up */
+	if (!compiler.loadInputFile()) return false;
+	if (!compiler.loadInputSections()) return false;
+
+	/* statically relocate the file to prepare for rewriting */
+	if (!compiler.performOnDiskRelocations()) return false;
+
+	/* if headr is writeable, we can re-write parts of the header (such as EntryPoint) */
+	if (this->rewriteHeader) if (!compiler.rewriteHeader()) return false;
+
+	/* if header is writeable, we can make BaseAddress look normal in memory */
+	if (this->fixupBase) if (!compiler.fixupBase()) return false;
+
+	/* rewrite some sections */
+	if (this->sections.size())
+		infoStream << "Obfuscating sections" << std::endl;
+	for (auto sec : this->sections)
+		if (!compiler.rewriteSection(sec)) return false;
+
+	/* rewrite string matches */
+	if (this->stringMatches.size())
+		infoStream << "Obfuscating string matches" << std::endl;
+	for (auto str : this->stringMatches)
+		if (!compiler.rewriteMatches(str)) return false;
+
+	/* rewrite import tables */
+	if (!this->noImports) if (!compiler.rewriteImports()) return false;
+	return true;
+}
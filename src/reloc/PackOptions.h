@@ -0,0 +1,36 @@
+#pragma once
+#include <map>
+#include <vector>
+#include <string>
+#include <iostream>
+
+class PeRecompiler;
+
+/* switches map to all of their values; positional arguments are filed under "" */
+typedef std::map<std::string, std::vector<std::string>> CommandLine;
+CommandLine parseCommandLine(const std::vector<std::string> &args);
+
+/*
+	everything which decides how an input gets packed, as given on the
+	command line. shared by a normal run and the jobs of the packing server,
+	so both produce the same output for the same arguments.
+*/
+struct PackOptions
+{
+	bool win10, noImports, rewriteHeader, fixupBase, multiPass, plan, verify, incremental;
+	std::vector<std::string> sections, stringMatches;
+	double loadBudget, entryCost, pageCost;
+
+	PackOptions();
+
+	/* reads the switches and fills in the defaults which depend on them */
+	void parse(CommandLine &cl, std::ostream &infoStream);
+
+	/* every option which changes the output, in a fixed order, for --cache; --incremental doesn't */
+	std::string encode() const;
+
+	void configure(PeRecompiler &compiler) const;
+
+	/* runs every stage up to (but not including) planning or writing the output */
+	bool rewrite(PeRecompiler &compiler, std::ostream &infoStream) const;
+};
@@ -0,0 +1,437 @@
+#include "PeLibInclude.h"
+
+#include "PackPipeline.h"
+#include "BulkIo.h"
+#include "PackOptions.h"
+#include "PackPreflight.h"
+#include "PeRecompiler.h"
+#include "MappedFile.h"
+#include "OutputNames.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+
+/*
+	with io_uring, each reader preflights this many inputs at a time. an
+	input whose reloc directory needs more than PIPELINE_MAX_FETCH_BYTES
+	read is preflighted the usual way instead.
+*/
+const size_t PIPELINE_BULK_FILES = 16;
+const uint64_t PIPELINE_MAX_FETCH_BYTES = 2 * 1024 * 1024;
+
+/*
+	fixed-capacity handoff between two stages. push() blocks while the queue
+	is full, which is what holds back a stage running ahead of the next one;
+	pop() blocks while it's empty and fails once every producer is done.
+*/
+template <typename T>
+class BoundedQueue
+{
+public:
+	BoundedQueue(size_t _capacity, unsigned int _producers) : capacity(_capacity), reserved(0), producers(_producers) {}
+
+	void push(T &&item)
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->notFull.wait(lock, [this] { return this->items.size() + this->reserved < this->capacity; });
+		this->items.push_back(std::move(item));
+		this->notEmpty.notify_one();
+	}
+
+	/*
+		holds a slot for an item which is still being made, so a producer
+		blocks before doing the work instead of after. the item then goes in
+		with pushReserved(), which never blocks.
+	*/
+	void reserve()
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->notFull.wait(lock, [this] { return this->items.size() + this->reserved < this->capacity; });
+		this->reserved++;
+	}
+
+	void pushReserved(T &&item)
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->reserved--;
+		this->items.push_back(std::move(item));
+		this->notEmpty.notify_one();
+	}
+
+	bool pop(T &item)
+	{
+		std::unique_lock<std::mutex> lock(this->mutex);
+		this->notEmpty.wait(lock, [this] { return this->items.size() || !this->producers; });
+		if (!this->items.size())
+			return false;
+
+		item = std::move(this->items.front());
+		this->items.pop_front();
+		this->notFull.notify_one();
+		return true;
+	}
+
+	/* each producer calls this once; the last one wakes up every waiting consumer */
+	void producerDone()
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (!--this->producers)
+			this->notEmpty.notify_all();
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable notFull, notEmpty;
+	std::deque<T> items;
+	size_t capacity, reserved;
+	unsigned int producers;
+};
+
+/* what each stage spent working, and waiting on a full queue to hand its work on */
+struct PackStageClock
+{
+	std::atomic<uint64_t> busyUs, stalledUs;
+
+	PackStageClock() : busyUs(0), stalledUs(0) {}
+};
+
+struct PackMappedInput
+{
+	size_t index;
+	bool opened;
+	std::string rejection; /* why the preflight turned the input down, which leaves it unread */
+	std::unique_ptr<MappedFile> file; /* only the image; see PeRecompiler::mapImage() */
+
+	PackMappedInput() : index(0), opened(false) {}
+};
+
+/* a rewritten input which hasn't been written out yet; the compiler logs to log until it's gone */
+struct PackTransformedOutput
+{
+	size_t index;
+	std::unique_ptr<std::ostringstream> log;
+	std::unique_ptr<PeRecompiler> compiler; /* null if the input couldn't be packed */
+
+	PackTransformedOutput() : index(0) {}
+};
+
+static uint64_t microsecondsSince(std::chrono::steady_clock::time_point startTime)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+/*
+	PackPreflight::checkFile() over a run of inputs at once. each round
+	reads what every check still needs through bulkIo and runs the checks
+	again: the first page of each, the rest of any section table which
+	didn't fit in it, then the reloc directories. whatever BulkIo fails is
+	checked the usual way.
+*/
+static void preflightFiles(BulkIo &bulkIo, const std::string *fileNames, std::vector<PackPreflightResult> &preflights)
+{
+	std::vector<BulkFile> files(preflights.size());
+	for (size_t i = 0; i < files.size(); i++)
+		files[i].fileName = fileNames[i];
+
+	std::vector<bool> checked(files.size(), false);
+	bulkIo.openFiles(files);
+	for (bool pending = true; pending; )
+	{
+		pending = false;
+		for (size_t i = 0; i < files.size(); i++)
+		{
+			if (checked[i] || files[i].failed)
+				continue;
+
+			auto readAt = [&](uint64_t offset, uint8_t *buffer, uint64_t size) { return files[i].read(offset, buffer, static_cast<size_t>(size)); };
+			checked[i] = PackPreflight::checkFile(fileNames[i], files[i].fileSize, readAt, preflights[i]);
+			pending |= files[i].pending();
+		}
+		if (pending)
+			bulkIo.fetch(files);
+	}
+	bulkIo.closeFiles(files);
+
+	for (size_t i = 0; i < files.size(); i++)
+	{
+		if (!checked[i])
+			PackPreflight::checkFile(fileNames[i], preflights[i]);
+	}
+}
+
+
+void PackBatchResult::print(std::ostream &stream) const
+{
+	if (this->packed)
+	{
+		stream << this->fileName << " -> " << this->outputFileName << ": " << std::dec;
+		stream << this->inputSize << " bytes packed into " << this->outputSize << std::endl;
+		return;
+	}
+
+	stream << this->fileName << (this->rejected ? ": skipped" : ": packing failed") << std::endl;
+	std::istringstream log(this->log);
+	std::string line;
+	while (std::getline(log, line))
+		stream << "\t" << line << std::endl;
+}
+
+
+PackPipeline::PackPipeline(std::ostream &_infoStream, std::ostream &_errorStream)
+	: infoStream(_infoStream), errorStream(_errorStream)
+{
+}
+
+bool PackPipeline::packFiles(
+	const std::vector<std::string> &inputFileNames, const std::string &outputDirectory,
+	const PackOptions &options, PackPipelineConfig config, std::vector<PackBatchResult> &results
+)
+{
+	auto startTime = std::chrono::steady_clock::now();
+
+	std::error_code ec;
+	std::filesystem::create_directories(outputDirectory, ec);
+	if (!std::filesystem::is_directory(outputDirectory, ec))
+	{
+		this->errorStream << "Failed to create output directory: " << outputDirectory << std::endl;
+		return false;
+	}
+
+	auto outputFileNames = ::outputFileNames(inputFileNames, outputDirectory);
+	auto firstResult = results.size();
+	results.resize(firstResult + inputFileNames.size());
+	for (size_t i = 0; i < inputFileNames.size(); i++)
+	{
+		results[firstResult + i].fileName = inputFileNames[i];
+		results[firstResult + i].outputFileName = outputFileNames[i];
+	}
+
+	/*
+		reading and writing mostly wait on the disk, so a couple of threads
+		each keep it busy; transforming is all CPU and gets a thread per core.
+		a queue deep enough for every transformer to find its next input
+		ready is all the read-ahead that pays off.
+	*/
+	auto fileCount = std::max<size_t>(1, inputFileNames.size());
+	if (!config.readThreads)
+		config.readThreads = 2;
+	if (!config.transformThreads)
+		config.transformThreads = std::max(1u, std::thread::hardware_concurrency());
+	if (!config.writeThreads)
+		config.writeThreads = 2;
+	config.readThreads = static_cast<unsigned int>(std::min<size_t>(config.readThreads, fileCount));
+	config.transformThreads = static_cast<unsigned int>(std::min<size_t>(config.transformThreads, fileCount));
+	config.writeThreads = static_cast<unsigned int>(std::min<size_t>(config.writeThreads, fileCount));
+	if (!config.queueDepth)
+		config.queueDepth = config.transformThreads;
+
+	/*
+		same as a PackServer worker, PeLib memory stays pooled in each
+		transformer between files. a compiler is finished and destroyed by a
+		writer, still allocating from the pool of the transformer which made
+		it, so the pools are synchronized and outlive every stage.
+	*/
+	std::vector<std::unique_ptr<std::pmr::synchronized_pool_resource>> arenas;
+	for (unsigned int t = 0; t < config.transformThreads; t++)
+		arenas.emplace_back(new std::pmr::synchronized_pool_resource());
+
+	BoundedQueue<PackMappedInput> mappedInputs(config.queueDepth, config.readThreads);
+	BoundedQueue<PackTransformedOutput> transformedOutputs(config.queueDepth, config.transformThreads);
+	PackStageClock readClock, transformClock, writeClock;
+
+	auto bulk = config.ioUring && BulkIo::ioUringSupported();
+	if (config.ioUring && !bulk)
+		this->infoStream << "io_uring isn't available, preflighting inputs one at a time and writing outputs the usual way instead" << std::endl;
+
+	std::atomic<size_t> nextFile(0);
+	auto reader = [&]() -> void
+	{
+		std::unique_ptr<BulkIo> bulkIo(bulk ? new BulkIo(PIPELINE_MAX_FETCH_BYTES) : nullptr);
+		auto claim = bulk ? PIPELINE_BULK_FILES : 1;
+		std::vector<PackPreflightResult> preflights;
+		for (size_t first = nextFile.fetch_add(claim); first < inputFileNames.size(); first = nextFile.fetch_add(claim))
+		{
+			auto stageTime = std::chrono::steady_clock::now();
+			preflights.assign(std::min(claim, inputFileNames.size() - first), PackPreflightResult());
+			{
+				PeLib::TraceSpan span("PackPipeline::preflight", "reloc");
+				if (bulkIo)
+					preflightFiles(*bulkIo, &inputFileNames[first], preflights);
+				else
+					PackPreflight::checkFile(inputFileNames[first], preflights[0]);
+			}
+			readClock.busyUs += microsecondsSince(stageTime);
+
+			for (size_t i = first; i < first + preflights.size(); i++)
+			{
+				/* an input being read takes up its queue slot already, so read-ahead is queueDepth in all */
+				stageTime = std::chrono::steady_clock::now();
+				mappedInputs.reserve();
+				readClock.stalledUs += microsecondsSince(stageTime);
+
+				stageTime = std::chrono::steady_clock::now();
+				PackMappedInput input;
+				input.index = i;
+				input.file.reset(new MappedFile());
+				{
+					PeLib::TraceSpan span("PackPipeline::read", "reloc");
+					auto& preflight = preflights[i - first];
+					size_t imageSize = 0;
+					if (preflight.supported())
+						input.opened = PeRecompiler::mapImage(inputFileNames[i], *input.file, imageSize);
+					else
+						input.rejection = preflight.reason();
+
+					if (input.opened)
+						input.file->prefetch(imageSize);
+					else
+						input.file.reset();
+				}
+				readClock.busyUs += microsecondsSince(stageTime);
+
+				mappedInputs.pushReserved(std::move(input));
+			}
+		}
+		mappedInputs.producerDone();
+	};
+
+	auto transformer = [&](std::pmr::memory_resource *arena) -> void
+	{
+		PackMappedInput input;
+		while (mappedInputs.pop(input))
+		{
+			auto stageTime = std::chrono::steady_clock::now();
+			auto& result = results[firstResult + input.index];
+			PackTransformedOutput output;
+			output.index = input.index;
+
+			if (!input.rejection.empty())
+			{
+				result.rejected = true;
+				result.log = input.rejection + "\n";
+			}
+			else if (!input.opened)
+				result.log = "Failed to open input file: " + result.fileName + "\n";
+			else
+			{
+				PeLib::ArenaScope arenaScope(arena);
+				PeLib::TraceSpan span("PackPipeline::transform", "reloc");
+
+				/*
+					the compiler maps the input itself, which the reader has
+					already faulted in. sections are never copied: rewrites are
+					queued against the mapping and applied as a writer streams
+					them out.
+				*/
+				result.inputSize = input.file->fileSize();
+				output.log.reset(new std::ostringstream());
+				output.compiler.reset(new PeRecompiler(*output.log, *output.log, result.fileName, result.outputFileName));
+				options.configure(*output.compiler);
+				if (!options.rewrite(*output.compiler, *output.log))
+				{
+					output.compiler.reset();
+					result.log = output.log->str();
+				}
+				input.file.reset();
+			}
+			transformClock.busyUs += microsecondsSince(stageTime);
+
+			stageTime = std::chrono::steady_clock::now();
+			transformedOutputs.push(std::move(output));
+			transformClock.stalledUs += microsecondsSince(stageTime);
+		}
+		transformedOutputs.producerDone();
+	};
+
+	auto writer = [&]() -> void
+	{
+		std::unique_ptr<BulkIo> bulkIo(bulk ? new BulkIo(0) : nullptr);
+		auto writeFile = [&bulkIo](const std::string &fileName, const std::function<bool(std::ostream&)> &write)
+		{
+			return bulkIo->writeFile(fileName, write);
+		};
+
+		PackTransformedOutput output;
+		while (transformedOutputs.pop(output))
+		{
+			if (!output.compiler)
+				continue;
+
+			auto stageTime = std::chrono::steady_clock::now();
+			auto& result = results[firstResult + output.index];
+			{
+				PeLib::TraceSpan span("PackPipeline::write", "reloc");
+				if (bulkIo)
+					output.compiler->useOutputWriter(writeFile);
+				result.packed = output.compiler->writeOutputFile();
+				if (result.packed && options.verify)
+					result.packed = output.compiler->verifyOutputFile();
+				output.compiler.reset();
+
+				std::error_code ec;
+				if (result.packed)
+					result.outputSize = std::filesystem::file_size(result.outputFileName, ec);
+				result.log = output.log->str();
+			}
+			writeClock.busyUs += microsecondsSince(stageTime);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned int t = 0; t < config.readThreads; t++)
+		threads.emplace_back(reader);
+	for (unsigned int t = 0; t < config.transformThreads; t++)
+		threads.emplace_back(transformer, arenas[t].get());
+	for (unsigned int t = 1; t < config.writeThreads; t++)
+		threads.emplace_back(writer);
+	writer();
+	for (auto& thread : threads)
+		thread.join();
+
+	size_t packedFiles = 0, rejectedFiles = 0;
+	for (size_t i = firstResult; i < results.size(); i++)
+	{
+		auto& result = results[i];
+		if (result.packed)
+		{
+			result.print(this->infoStream);
+			packedFiles++;
+		}
+		else
+		{
+			result.print(this->errorStream);
+			if (result.rejected)
+				rejectedFiles++;
+		}
+	}
+
+	/* a stage which is mostly stalled has more threads than the one after it can keep up with */
+	auto elapsed = microsecondsSince(startTime) / 1000;
+	this->infoStream << "Packed " << std::dec << packedFiles << " of " << inputFileNames.size() << " files in " << elapsed << "ms";
+	if (rejectedFiles)
+		this->infoStream << ", skipped " << rejectedFiles << " which can't be packed";
+	this->infoStream << std::endl;
+	auto printStage = [&](const char* name, unsigned int threadCount, const PackStageClock &clock, bool feedsQueue) -> void
+	{
+		this->infoStream << "\t" << name << ": " << threadCount << " threads, " << (clock.busyUs / 1000) << "ms busy";
+		if (feedsQueue)
+			this->infoStream << ", " << (clock.stalledUs / 1000) << "ms stalled on a full queue";
+		this->infoStream << std::endl;
+	};
+	printStage("read", config.readThreads, readClock, true);
+	printStage("transform", config.transformThreads, transformClock, true);
+	printStage("write", config.writeThreads, writeClock, false);
+
+	return packedFiles == inputFileNames.size();
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdint.h>
+
+struct PackOptions;
+
+class PackBatchResult
+{
+public:
+	std::string fileName, outputFileName, log;
+	bool packed;
+	bool rejected; /* by PackPreflight, without being read in; log says why */
+	uint64_t inputSize, outputSize;
+
+	PackBatchResult() : packed(false), rejected(false), inputSize(0), outputSize(0) {}
+
+	void print(std::ostream &stream) const;
+};
+
+/* how many threads each stage gets, and how far one stage may run ahead of the next */
+struct PackPipelineConfig
+{
+	unsigned int readThreads, transformThreads, writeThreads;
+	unsigned int queueDepth;
+	bool ioUring; /* readers preflight runs of inputs together, and writers batch their writes, through io_uring where the system has it */
+
+	PackPipelineConfig() : readThreads(0), transformThreads(0), writeThreads(0), queueDepth(0), ioUring(false) {}
+};
+
+/*
+	packs a batch of files with the same options as three stages joined by
+	bounded queues: readers preflight the inputs, a run at a time through
+	io_uring if asked to, and fault in the image of each one which can be
+	packed, but not an overlay behind it; transformers rewrite them with
+	PeRecompiler, which only queues the changes; writers stream the
+	outputs to disk a window at a time, through io_uring in batches of
+	registered buffers if asked to. a full queue stalls the stage feeding
+	it, so neither inputs nor rewritten images can pile up faster than the
+	next stage takes them, and the disks keep working while the cores do.
+	no stage holds a whole image in memory.
+*/
+class PackPipeline
+{
+public:
+	PackPipeline(std::ostream &_infoStream, std::ostream &_errorStream);
+
+	bool packFiles(
+		const std::vector<std::string> &inputFileNames, const std::string &outputDirectory,
+		const PackOptions &options, PackPipelineConfig config, std::vector<PackBatchResult> &results
+	);
+
+private:
+	std::ostream &infoStream, &errorStream;
+};
@@ -0,0 +1,260 @@
+#include "PeLibInclude.h"
+
+#include "PackPreflight.h"
+#include "PeRecompiler.h"
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+#include <string.h>
+
+
+/* the headers and section table of nearly every image fit in the first read */
+const uint64_t PREFLIGHT_FIRST_READ = 0x1000;
+
+/*
+	what PeLib needs of IMAGE_DOS_HEADER and IMAGE_NT_HEADERS32 before it
+	knows where the PE header is and how many data directories and
+	sections follow it, and where it finds those
+*/
+const uint32_t PREFLIGHT_DOS_HEADER_SIZE = 0x40;
+const uint32_t PREFLIGHT_ADDRESS_OF_PE_HEADER = 0x3C;
+const uint32_t PREFLIGHT_NT_HEADERS_SIZE = 120;
+const uint32_t PREFLIGHT_NUMBER_OF_SECTIONS = 6;
+const uint32_t PREFLIGHT_NUMBER_OF_RVA_AND_SIZES = 116;
+const uint32_t PREFLIGHT_DATA_DIRECTORY_SIZE = 8;
+const uint32_t PREFLIGHT_SECTION_HEADER_SIZE = 0x28;
+
+/* PeRecompiler::getSectionByRVA() over the sections it would load, which are the ones in the header */
+static int findSection(const PeLib::PeHeader32 &peHeader, uint32_t RVA, uint32_t size)
+{
+	for (unsigned int sec = 0; sec < peHeader.getNumberOfSections(); sec++)
+	{
+		if (PeRecompiler::sectionHoldsRange(peHeader.getVirtualAddress(sec), peHeader.getSizeOfRawData(sec), RVA, size))
+			return static_cast<int>(sec);
+	}
+	return -1;
+}
+
+
+std::string PackPreflightResult::reason() const
+{
+	std::ostringstream stream;
+	stream << std::hex;
+	switch (this->verdict)
+	{
+	case VERDICT_SUPPORTED: break;
+	case VERDICT_UNREADABLE: stream << "Failed to open input file: " << this->fileName; break;
+	case VERDICT_BAD_MZ_HEADER: stream << "Failed to read MzHeader: " << this->fileName; break;
+	case VERDICT_BAD_PE_HEADER: stream << "Failed to read PeHeader: " << this->fileName; break;
+	case VERDICT_NO_RELOC_SECTION: stream << "Failed to locate reloc section!"; break;
+	case VERDICT_RELOC_NOT_FINAL: stream << "Reloc section '" << this->relocSection << "' is not final section; currently unsupported"; break;
+	case VERDICT_NO_ASLR: stream << "Binary must have ASLR enabled to perform on-disk relocations!"; break;
+	case VERDICT_BAD_RELOC_TABLE: stream << "Failed to read reloc directory!"; break;
+	case VERDICT_UNMATCHED_BLOCK: stream << "Reloc has no matching section! RVA: 0x" << this->detail; break;
+	case VERDICT_BAD_TARGET: stream << "Failed to read original value to reloc!"; break;
+	case VERDICT_UNKNOWN_TYPE: stream << "Unknown reloc type: 0x" << this->detail; break;
+	}
+	return stream.str();
+}
+
+void PackPreflightResult::print(std::ostream &stream) const
+{
+	stream << this->fileName << "\t" << std::dec;
+	if (this->supported())
+		stream << "supported";
+	else
+		stream << "rejected, " << this->reason();
+	stream << " (read " << this->bytesRead << " of " << this->fileSize << " bytes)" << std::hex << std::endl;
+}
+
+
+bool PackPreflight::readHeaders(uint64_t parseLimit, const ReadAt &readAt, std::vector<uint8_t> &headers)
+{
+	headers.clear();
+	auto readHeadersTo = [&](uint64_t end) -> bool
+	{
+		end = std::min(end, parseLimit);
+		if (end <= headers.size())
+			return true;
+
+		auto start = headers.size();
+		headers.resize(static_cast<size_t>(end));
+		return readAt(start, headers.data() + start, end - start);
+	};
+
+	if (!readHeadersTo(PREFLIGHT_FIRST_READ))
+		return false;
+
+	/*
+		the section table can reach past the first read, e.g. behind a long
+		DOS stub. when it would reach past the end of the file, PeLib fails
+		on the size alone, so that's known without reading any of it.
+	*/
+	if (headers.size() < PREFLIGHT_DOS_HEADER_SIZE)
+		return true;
+	uint32_t peOffset32;
+	memcpy(&peOffset32, headers.data() + PREFLIGHT_ADDRESS_OF_PE_HEADER, sizeof(peOffset32));
+	uint64_t peOffset = peOffset32;
+	if (peOffset + PREFLIGHT_NT_HEADERS_SIZE > parseLimit)
+		return true;
+	if (!readHeadersTo(peOffset + PREFLIGHT_NT_HEADERS_SIZE))
+		return false;
+
+	uint16_t numberOfSections;
+	uint32_t numberOfRvaAndSizes;
+	memcpy(&numberOfSections, headers.data() + peOffset + PREFLIGHT_NUMBER_OF_SECTIONS, sizeof(numberOfSections));
+	memcpy(&numberOfRvaAndSizes, headers.data() + peOffset + PREFLIGHT_NUMBER_OF_RVA_AND_SIZES, sizeof(numberOfRvaAndSizes));
+
+	/* in 64 bits, as PeLib checks it, so a huge count can't wrap around to something small */
+	uint64_t headerSize = PREFLIGHT_NT_HEADERS_SIZE + static_cast<uint64_t>(numberOfRvaAndSizes) * PREFLIGHT_DATA_DIRECTORY_SIZE + static_cast<uint64_t>(numberOfSections) * PREFLIGHT_SECTION_HEADER_SIZE;
+	if (peOffset + headerSize > parseLimit)
+		return true;
+	return readHeadersTo(peOffset + headerSize);
+}
+
+bool PackPreflight::checkFile(const std::string &fileName, PackPreflightResult &result)
+{
+	PeLib::FileStream file(fileName, std::ios::in | std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+	{
+		result = PackPreflightResult();
+		result.fileName = fileName;
+		result.verdict = PackPreflightResult::VERDICT_UNREADABLE;
+		return false;
+	}
+
+	auto readAt = [&](uint64_t offset, uint8_t *buffer, uint64_t size) -> bool
+	{
+		file.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+		return !!file.read(reinterpret_cast<char*>(buffer), static_cast<std::streamsize>(size));
+	};
+	return checkFile(fileName, static_cast<uint64_t>(file.tellg()), readAt, result);
+}
+
+bool PackPreflight::checkFile(const std::string &fileName, uint64_t fileSize, const ReadAt &readAt, PackPreflightResult &result)
+{
+	PeLib::TraceSpan span("PackPreflight::checkFile", "reloc");
+	result = PackPreflightResult();
+	result.fileName = fileName;
+	result.fileSize = fileSize;
+
+	auto countedReadAt = [&](uint64_t offset, uint8_t *buffer, uint64_t size) -> bool
+	{
+		if (!size)
+			return true;
+		if (!readAt(offset, buffer, size))
+			return false;
+		result.bytesRead += size;
+		return true;
+	};
+
+	/*
+		PeRecompiler::loadInputFile() parses at most the first 4GB. PeLib
+		gets the headers in a buffer which holds all of the part of the file
+		it looks at, so its checks come out as they would for the whole file.
+	*/
+	auto parseLimit = std::min<uint64_t>(result.fileSize, UINT32_MAX);
+	std::vector<uint8_t> headers;
+	if (!readHeaders(parseLimit, countedReadAt, headers))
+	{
+		result.verdict = PackPreflightResult::VERDICT_UNREADABLE;
+		return false;
+	}
+
+	PeLib::PeFile32 peFile(fileName);
+	if (peFile.readMzHeader(headers.data(), static_cast<unsigned int>(headers.size())) != PeLib::NO_ERROR)
+	{
+		result.verdict = PackPreflightResult::VERDICT_BAD_MZ_HEADER;
+		return true;
+	}
+
+	if (peFile.readPeHeader(headers.data(), static_cast<unsigned int>(headers.size())) != PeLib::NO_ERROR)
+	{
+		result.verdict = PackPreflightResult::VERDICT_BAD_PE_HEADER;
+		return true;
+	}
+
+	/* PeRecompiler::loadInputSections() */
+	auto& peHeader = peFile.peHeader();
+	auto relocIndex = findSection(peHeader, peHeader.getIddBaseRelocRva(), 4);
+	if (relocIndex < 0)
+	{
+		result.verdict = PackPreflightResult::VERDICT_NO_RELOC_SECTION;
+		return true;
+	}
+	result.relocSection = peHeader.getSectionName(static_cast<PeLib::word>(relocIndex));
+	if (relocIndex != (peHeader.getNumberOfSections() - 1))
+	{
+		result.verdict = PackPreflightResult::VERDICT_RELOC_NOT_FINAL;
+		return true;
+	}
+
+	/* PeRecompiler::performOnDiskRelocations() */
+	if (!(peHeader.getDllCharacteristics() & PeLib::PELIB_IMAGE_DLLCHARACTERISTICS_DYNAMIC_BASE))
+	{
+		result.verdict = PackPreflightResult::VERDICT_NO_ASLR;
+		return true;
+	}
+
+	/* the same checks as PeFile::readRelocationsDirectory(), but only the directory itself is read */
+	uint32_t relocSize = peHeader.getIddBaseRelocSize();
+	uint32_t relocOffset = static_cast<uint32_t>(peHeader.rvaToOffset(peHeader.getIddBaseRelocRva()));
+	if (peHeader.calcNumberOfRvaAndSizes() < 6 || !relocSize || relocOffset >= parseLimit || parseLimit - relocOffset < relocSize)
+	{
+		result.verdict = PackPreflightResult::VERDICT_BAD_RELOC_TABLE;
+		return true;
+	}
+
+	std::vector<uint8_t> relocData(relocSize);
+	if (!countedReadAt(relocOffset, relocData.data(), relocSize))
+	{
+		result.verdict = PackPreflightResult::VERDICT_UNREADABLE;
+		return false;
+	}
+	if (peFile.relocDir().read(relocData.data(), relocSize) != PeLib::NO_ERROR)
+	{
+		result.verdict = PackPreflightResult::VERDICT_BAD_RELOC_TABLE;
+		return true;
+	}
+
+	/* the relocated values themselves are never read; only whether they'd be in bounds */
+	auto& reloc = peFile.relocDir();
+	for (unsigned int rel = 0; rel < reloc.calcNumberOfRelocations(); rel++)
+	{
+		uint32_t relocBlockRVA = reloc.getVirtualAddress(rel);
+		auto sec = findSection(peHeader, relocBlockRVA, 4);
+		if (sec < 0)
+		{
+			result.verdict = PackPreflightResult::VERDICT_UNMATCHED_BLOCK;
+			result.detail = relocBlockRVA;
+			return true;
+		}
+
+		uint32_t sectionRVA = peHeader.getVirtualAddress(sec);
+		uint32_t sectionSize = peHeader.getSizeOfRawData(sec);
+		auto relocBlockCount = reloc.calcNumberOfRelocationData(rel);
+		for (unsigned int relEntry = 0; relEntry < relocBlockCount; relEntry++)
+		{
+			uint16_t entry = reloc.getRelocationData(rel, relEntry);
+			uint16_t entryType = (entry >> 12);
+			uint32_t entryAddress = relocBlockRVA + (entry & 0x0FFF);
+
+			switch (PeRecompiler::checkRelocEntry(entryType, entryAddress - sectionRVA, sectionSize))
+			{
+			case PeRecompiler::RELOC_ENTRY_SKIP:
+			case PeRecompiler::RELOC_ENTRY_APPLY:
+				break;
+			case PeRecompiler::RELOC_ENTRY_OUT_OF_BOUNDS:
+				result.verdict = PackPreflightResult::VERDICT_BAD_TARGET;
+				result.detail = entryAddress;
+				return true;
+			case PeRecompiler::RELOC_ENTRY_UNKNOWN_TYPE:
+				result.verdict = PackPreflightResult::VERDICT_UNKNOWN_TYPE;
+				result.detail = entryType;
+				return true;
+			}
+		}
+	}
+	return true;
+}
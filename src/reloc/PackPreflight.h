@@ -0,0 +1,69 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdint.h>
+
+class PackPreflightResult
+{
+public:
+	/* in the order the packer runs into them; only the first one found is reported */
+	enum Verdict
+	{
+		VERDICT_SUPPORTED,
+		VERDICT_UNREADABLE,			/* the file couldn't be opened or read */
+		VERDICT_BAD_MZ_HEADER,		/* too short for an MZ header */
+		VERDICT_BAD_PE_HEADER,		/* the PE header or section table is cut short */
+		VERDICT_NO_RELOC_SECTION,	/* the reloc directory isn't inside any section */
+		VERDICT_RELOC_NOT_FINAL,	/* the section holding the reloc directory isn't the last one */
+		VERDICT_NO_ASLR,			/* IMAGE_DLLCHARACTERISTICS_DYNAMIC_BASE isn't set */
+		VERDICT_BAD_RELOC_TABLE,	/* the reloc directory is empty or runs past the end of the file */
+		VERDICT_UNMATCHED_BLOCK,	/* a reloc block lies outside every section; detail is its RVA */
+		VERDICT_BAD_TARGET,			/* a relocation patches past the end of its section; detail is its RVA */
+		VERDICT_UNKNOWN_TYPE,		/* a relocation type the packer can't apply; detail is the type */
+	};
+
+	std::string fileName;
+	std::string relocSection; /* name of the section holding the reloc directory, once found */
+	Verdict verdict;
+	uint32_t detail;
+	uint64_t fileSize, bytesRead;
+
+	PackPreflightResult() : verdict(VERDICT_SUPPORTED), detail(0), fileSize(0), bytesRead(0) {}
+
+	bool supported() const { return this->verdict == VERDICT_SUPPORTED; }
+
+	/* the error the packer itself would have stopped with */
+	std::string reason() const;
+
+	void print(std::ostream &stream) const;
+};
+
+/*
+	checks every precondition of PeRecompiler::loadInputFile(),
+	loadInputSections() and performOnDiskRelocations() while reading nothing
+	but the first page, the rest of the section table if it doesn't fit
+	there, and the reloc directory. a file rejected here fails packing the
+	same way, so batches can skip it without reading it in; one which passes
+	can still fail later on, e.g. a rewrite or --loadBudget.
+*/
+class PackPreflight
+{
+public:
+	/* copies [offset, offset + size) of the file to buffer, or fails */
+	typedef std::function<bool(uint64_t offset, uint8_t *buffer, uint64_t size)> ReadAt;
+
+	static bool checkFile(const std::string &fileName, PackPreflightResult &result);
+
+	/* the same check over a file which is read some other way, e.g. a BulkFile */
+	static bool checkFile(const std::string &fileName, uint64_t fileSize, const ReadAt &readAt, PackPreflightResult &result);
+
+	/*
+		reads what PeLib parses of the headers: the first page, then the
+		rest of the NT headers and section table if they don't fit in it.
+		where they'd run past parseLimit it stops without reading them, and
+		PeLib fails on the short buffer as it would on the whole file.
+	*/
+	static bool readHeaders(uint64_t parseLimit, const ReadAt &readAt, std::vector<uint8_t> &headers);
+};
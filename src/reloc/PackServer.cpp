@@ -0,0 +1,536 @@
+#include "PeLibInclude.h"
+
+#include "PackServer.h"
+#include "PackOptions.h"
+#include "PeRecompiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <memory_resource>
+#include <sstream>
+#include <thread>
+#include <errno.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <sddl.h>
+#else
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+
+/*
+	wire format, in native byte order since both ends run on the same machine:
+
+	request:  magic, argument count, (length, bytes) per argument, input size (64-bit), input bytes
+	response: magic, succeeded, output size (64-bit), output bytes, (length, bytes) of the log, then of the metrics
+
+	a connection carries any number of jobs back to back, until the client
+	closes it.
+*/
+const uint32_t PACK_REQUEST_MAGIC = 0x4A434C52;		/* "RLCJ" */
+const uint32_t PACK_RESPONSE_MAGIC = 0x52434C52;	/* "RLCR" */
+
+/* anything bigger is taken as a broken or hostile client */
+const uint32_t PACK_MAX_ARGUMENTS = 256;
+const uint32_t PACK_MAX_ARGUMENT_SIZE = 64 * 1024;
+const uint64_t PACK_MAX_INPUT_SIZE = 512ULL * 1024 * 1024;
+
+const size_t PACK_IO_CHUNK = 1024 * 1024;
+const uint32_t PACK_PIPE_BUFFER_SIZE = 64 * 1024;
+
+#ifdef _WIN32
+const char PACK_PIPE_PREFIX[] = "\\\\.\\pipe\\";
+#endif
+
+class PackConnection
+{
+public:
+#ifdef _WIN32
+	explicit PackConnection(HANDLE _handle) : handle(_handle) {}
+#else
+	explicit PackConnection(int _handle) : handle(_handle) {}
+#endif
+
+	bool read(void* data, size_t size)
+	{
+		auto bytes = static_cast<char*>(data);
+		while (size)
+		{
+			auto chunk = std::min(size, PACK_IO_CHUNK);
+#ifdef _WIN32
+			DWORD done = 0;
+			if (!ReadFile(this->handle, bytes, static_cast<DWORD>(chunk), &done, NULL) || !done)
+				return false;
+#else
+			auto done = ::recv(this->handle, bytes, chunk, 0);
+			if (done <= 0)
+				return false;
+#endif
+			bytes += done;
+			size -= done;
+		}
+		return true;
+	}
+
+	bool write(const void* data, size_t size)
+	{
+		auto bytes = static_cast<const char*>(data);
+		while (size)
+		{
+			auto chunk = std::min(size, PACK_IO_CHUNK);
+#ifdef _WIN32
+			DWORD done = 0;
+			if (!WriteFile(this->handle, bytes, static_cast<DWORD>(chunk), &done, NULL) || !done)
+				return false;
+#else
+			auto done = ::send(this->handle, bytes, chunk, 0);
+			if (done <= 0)
+				return false;
+#endif
+			bytes += done;
+			size -= done;
+		}
+		return true;
+	}
+
+	template <typename T>
+	bool readValue(T &value) { return this->read(&value, sizeof(value)); }
+	template <typename T>
+	bool writeValue(const T &value) { return this->write(&value, sizeof(value)); }
+
+	bool readString(std::string &value, uint32_t maxSize)
+	{
+		uint32_t size;
+		if (!this->readValue(size) || size > maxSize)
+			return false;
+		value.resize(size);
+		return !size || this->read(&value[0], size);
+	}
+
+	bool writeString(const std::string &value)
+	{
+		auto size = static_cast<uint32_t>(value.size());
+		return this->writeValue(size) && this->write(value.data(), size);
+	}
+
+	bool readBytes(std::vector<uint8_t> &value, uint64_t maxSize)
+	{
+		uint64_t size;
+		if (!this->readValue(size) || size > maxSize)
+			return false;
+		value.resize(static_cast<size_t>(size));
+		return !size || this->read(value.data(), value.size());
+	}
+
+	bool writeBytes(const std::vector<uint8_t> &value)
+	{
+		auto size = static_cast<uint64_t>(value.size());
+		return this->writeValue(size) && this->write(value.data(), value.size());
+	}
+
+	bool readJob(PackJob &job)
+	{
+		uint32_t magic, count;
+		if (!this->readValue(magic) || magic != PACK_REQUEST_MAGIC)
+			return false;
+		if (!this->readValue(count) || count > PACK_MAX_ARGUMENTS)
+			return false;
+
+		job.arguments.resize(count);
+		for (auto& argument : job.arguments)
+			if (!this->readString(argument, PACK_MAX_ARGUMENT_SIZE))
+				return false;
+		return this->readBytes(job.input, PACK_MAX_INPUT_SIZE);
+	}
+
+	bool writeJob(const PackJob &job)
+	{
+		if (!this->writeValue(PACK_REQUEST_MAGIC) || !this->writeValue(static_cast<uint32_t>(job.arguments.size())))
+			return false;
+		for (auto& argument : job.arguments)
+			if (!this->writeString(argument))
+				return false;
+		return this->writeBytes(job.input);
+	}
+
+	bool readResult(PackJobResult &result)
+	{
+		uint32_t magic, succeeded;
+		if (!this->readValue(magic) || magic != PACK_RESPONSE_MAGIC || !this->readValue(succeeded))
+			return false;
+		result.succeeded = (succeeded != 0);
+		return this->readBytes(result.output, UINT64_MAX) && this->readString(result.log, UINT32_MAX) && this->readString(result.metrics, UINT32_MAX);
+	}
+
+	bool writeResult(const PackJobResult &result)
+	{
+		return this->writeValue(PACK_RESPONSE_MAGIC) && this->writeValue(static_cast<uint32_t>(result.succeeded)) &&
+			this->writeBytes(result.output) && this->writeString(result.log) && this->writeString(result.metrics);
+	}
+
+private:
+#ifdef _WIN32
+	HANDLE handle;
+#else
+	int handle;
+#endif
+};
+
+#ifndef _WIN32
+/* only ever removes a stale socket, never a file which happens to have the endpoint's name */
+static bool removeStaleSocket(const std::string &path, std::ostream &errorStream)
+{
+	struct stat status;
+	if (::lstat(path.c_str(), &status) != 0)
+		return (errno == ENOENT);
+
+	if (!S_ISSOCK(status.st_mode))
+	{
+		errorStream << "Refusing to replace " << path << ", which isn't a socket" << std::endl;
+		return false;
+	}
+	return (::unlink(path.c_str()) == 0 || errno == ENOENT);
+}
+#else
+/*
+	a security descriptor whose DACL grants the user running the server full
+	access, and no one else anything, to match the owner-only unix socket.
+	the default DACL would let other users connect. freed with LocalFree().
+*/
+static PSECURITY_DESCRIPTOR makeOwnerOnlySecurity()
+{
+	HANDLE token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, &token))
+		return NULL;
+
+	DWORD size = 0;
+	GetTokenInformation(token, TokenUser, NULL, 0, &size);
+	std::vector<uint8_t> user(size);
+	auto ok = size && GetTokenInformation(token, TokenUser, user.data(), size, &size);
+	CloseHandle(token);
+
+	LPSTR sid = NULL;
+	if (!ok || !ConvertSidToStringSidA(reinterpret_cast<TOKEN_USER*>(user.data())->User.Sid, &sid))
+		return NULL;
+	auto sddl = std::string("D:P(A;;GA;;;") + sid + ")";
+	LocalFree(sid);
+
+	PSECURITY_DESCRIPTOR descriptor = NULL;
+	if (!ConvertStringSecurityDescriptorToSecurityDescriptorA(sddl.c_str(), SDDL_REVISION_1, &descriptor, NULL))
+		return NULL;
+	return descriptor;
+}
+#endif
+
+
+PackServer::PackServer(std::ostream &_infoStream, std::ostream &_errorStream)
+	: infoStream(_infoStream), errorStream(_errorStream), listenSocket(-1), pipeSecurity(nullptr)
+{
+}
+
+bool PackServer::serve(const std::string &endpoint, unsigned int threadCount, const std::string &fileRoot)
+{
+	if (!fileRoot.empty())
+	{
+		std::error_code ec;
+		auto root = std::filesystem::canonical(fileRoot, ec);
+		if (ec || !std::filesystem::is_directory(root, ec))
+		{
+			this->errorStream << "Server file root isn't a directory: " << fileRoot << std::endl;
+			return false;
+		}
+		this->fileRoot = root.string();
+	}
+
+#ifdef _WIN32
+	this->endpointPath = (endpoint.compare(0, strlen(PACK_PIPE_PREFIX), PACK_PIPE_PREFIX) == 0) ? endpoint : PACK_PIPE_PREFIX + endpoint;
+
+	/* anyone who can connect can have the server read files, so only the owner may */
+	this->pipeSecurity = makeOwnerOnlySecurity();
+	if (!this->pipeSecurity)
+	{
+		this->errorStream << "Failed to create an owner-only security descriptor for pipe: " << this->endpointPath << std::endl;
+		return false;
+	}
+#else
+	this->endpointPath = endpoint;
+
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (endpoint.size() >= sizeof(address.sun_path))
+	{
+		this->errorStream << "Socket path is too long: " << endpoint << std::endl;
+		return false;
+	}
+	memcpy(address.sun_path, endpoint.c_str(), endpoint.size() + 1);
+
+	/* a client hanging up mid-response must not take the server down */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (!removeStaleSocket(endpoint, this->errorStream))
+	{
+		this->errorStream << "Failed to listen on socket: " << endpoint << std::endl;
+		return false;
+	}
+
+	/* the socket is created owner-only; anyone who can connect can have the server read files */
+	int listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	auto oldMask = ::umask(0077);
+	bool bound = (listener >= 0 && ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0);
+	::umask(oldMask);
+	if (!bound || ::listen(listener, SOMAXCONN) != 0)
+	{
+		this->errorStream << "Failed to listen on socket: " << endpoint << std::endl;
+		if (listener >= 0)
+			::close(listener);
+		return false;
+	}
+	this->listenSocket = listener;
+#endif
+
+	if (!threadCount)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	this->infoStream << "Serving packing jobs on " << this->endpointPath << " with " << std::dec << threadCount << " threads" << std::hex << std::endl;
+
+	std::vector<std::thread> threads;
+	for (unsigned int t = 1; t < threadCount; t++)
+		threads.emplace_back([this]() { this->serveConnections(); });
+	this->serveConnections();
+	for (auto& thread : threads)
+		thread.join();
+
+#ifdef _WIN32
+	LocalFree(this->pipeSecurity);
+	this->pipeSecurity = nullptr;
+#else
+	::close(listener);
+	removeStaleSocket(endpoint, this->errorStream);
+#endif
+	return false;
+}
+
+void PackServer::serveConnections()
+{
+	/*
+		the arena outlives the jobs and keeps what they freed pooled, so a warm
+		worker reuses its memory instead of going back to the shared heap.
+	*/
+	std::pmr::unsynchronized_pool_resource arena;
+
+	while (true)
+	{
+#ifdef _WIN32
+		/* remote clients are turned away as well; jobs only come from this machine */
+		SECURITY_ATTRIBUTES security = { sizeof(security), this->pipeSecurity, FALSE };
+		HANDLE handle = CreateNamedPipeA(this->endpointPath.c_str(), PIPE_ACCESS_DUPLEX, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+			PIPE_UNLIMITED_INSTANCES, PACK_PIPE_BUFFER_SIZE, PACK_PIPE_BUFFER_SIZE, 0, &security);
+		if (handle == INVALID_HANDLE_VALUE)
+		{
+			std::lock_guard<std::mutex> lock(this->logMutex);
+			this->errorStream << "Failed to create pipe: " << this->endpointPath << std::endl;
+			return;
+		}
+		if (!ConnectNamedPipe(handle, NULL) && GetLastError() != ERROR_PIPE_CONNECTED)
+		{
+			CloseHandle(handle);
+			continue;
+		}
+#else
+		int handle = ::accept(static_cast<int>(this->listenSocket), nullptr, nullptr);
+		if (handle < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			std::lock_guard<std::mutex> lock(this->logMutex);
+			this->errorStream << "Failed to accept connection on: " << this->endpointPath << std::endl;
+			return;
+		}
+#endif
+
+		PackConnection connection(handle);
+		PackJob job;
+		while (connection.readJob(job))
+		{
+			PackJobResult result;
+			if (job.input.size() || this->resolveInputFile(job, result))
+			{
+				PeLib::ArenaScope arenaScope(&arena);
+				runJob(job, result);
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(this->logMutex);
+				this->infoStream << "Job " << (result.succeeded ? "succeeded" : "failed") << ": " << std::dec << job.input.size() << " bytes in, ";
+				this->infoStream << result.output.size() << " bytes out" << std::hex << std::endl;
+			}
+
+			if (!connection.writeResult(result))
+				break;
+		}
+
+#ifdef _WIN32
+		FlushFileBuffers(handle);
+		DisconnectNamedPipe(handle);
+		CloseHandle(handle);
+#else
+		::close(handle);
+#endif
+	}
+}
+
+bool PackServer::resolveInputFile(PackJob &job, PackJobResult &result) const
+{
+	if (this->fileRoot.empty())
+	{
+		result.log = "This server doesn't read input files; send the input bytes, or start it with --serveRoot=<dir>\n";
+		return false;
+	}
+
+	/* runJob turns down anything other than exactly one positional argument itself */
+	auto isInput = [](const std::string &argument) { return argument.compare(0, 2, "--") != 0; };
+	auto input = std::find_if(job.arguments.begin(), job.arguments.end(), isInput);
+	if (input == job.arguments.end() || std::count_if(job.arguments.begin(), job.arguments.end(), isInput) != 1)
+		return true;
+
+	std::filesystem::path root(this->fileRoot);
+	std::filesystem::path path(*input);
+	if (path.is_relative())
+		path = root / path;
+
+	/* resolved first, so neither ".." nor a link can lead out from under the root */
+	std::error_code ec;
+	auto resolved = std::filesystem::canonical(path, ec);
+	if (ec || std::mismatch(root.begin(), root.end(), resolved.begin(), resolved.end()).first != root.end())
+	{
+		result.log = "Input file isn't under the server's file root: " + *input + "\n";
+		return false;
+	}
+
+	*input = resolved.string();
+	return true;
+}
+
+void PackServer::runJob(const PackJob &job, PackJobResult &result)
+{
+	runJob(job.arguments, job.input.data(), job.input.size(), result);
+}
+
+void PackServer::runJob(const std::vector<std::string> &arguments, const uint8_t *input, size_t inputSize, PackJobResult &result)
+{
+	auto startTime = std::chrono::steady_clock::now();
+	result = PackJobResult();
+
+	std::ostringstream log;
+	auto cl = parseCommandLine(arguments);
+	PackOptions options;
+	options.parse(cl, log);
+
+	auto inputs = cl[""];
+	if (!inputSize && inputs.size() != 1)
+	{
+		result.log = "A job needs either input bytes or exactly one input file name\n";
+		return;
+	}
+
+	std::unique_ptr<PeRecompiler> compiler;
+	if (inputSize)
+		compiler.reset(new PeRecompiler(log, log, input, inputSize));
+	else
+		compiler.reset(new PeRecompiler(log, log, inputs[0], ""));
+
+	options.configure(*compiler);
+	do
+	{
+		if (!options.rewrite(*compiler, log)) break;
+
+		if (options.plan)
+		{
+			PeOutputPlan outputPlan;
+			if (!compiler->planOutput(outputPlan)) break;
+			outputPlan.print(log);
+			result.succeeded = true;
+			break;
+		}
+
+		if (!compiler->writeOutput(result.output)) break;
+		if (options.verify) if (!compiler->verifyOutput(result.output)) break;
+		result.succeeded = true;
+	} while (0);
+
+	if (!result.succeeded)
+		result.output.clear();
+
+	auto& io = compiler->ioStats();
+	auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+	std::ostringstream metrics;
+	metrics << "elapsedUs=" << elapsed << "\n";
+	metrics << "inputBytes=" << inputSize << "\n";
+	metrics << "outputBytes=" << result.output.size() << "\n";
+	metrics << "ioOpens=" << io.ullOpens << "\n";
+	metrics << "ioReads=" << io.ullReads << "\n";
+	metrics << "ioBytesRead=" << io.ullBytesRead << "\n";
+	metrics << "ioBytesMapped=" << io.ullBytesMapped << "\n";
+	result.metrics = metrics.str();
+	result.log = log.str();
+}
+
+bool PackServer::submit(const std::string &endpoint, const PackJob &job, PackJobResult &result, std::string &error)
+{
+#ifdef _WIN32
+	auto path = (endpoint.compare(0, strlen(PACK_PIPE_PREFIX), PACK_PIPE_PREFIX) == 0) ? endpoint : PACK_PIPE_PREFIX + endpoint;
+
+	HANDLE handle;
+	while (true)
+	{
+		handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+		if (handle != INVALID_HANDLE_VALUE)
+			break;
+
+		/* every instance is busy; wait for one of the workers to free up */
+		if (GetLastError() != ERROR_PIPE_BUSY || !WaitNamedPipeA(path.c_str(), NMPWAIT_WAIT_FOREVER))
+		{
+			error = "Failed to connect to pipe: " + path;
+			return false;
+		}
+	}
+#else
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (endpoint.size() >= sizeof(address.sun_path))
+	{
+		error = "Socket path is too long: " + endpoint;
+		return false;
+	}
+	memcpy(address.sun_path, endpoint.c_str(), endpoint.size() + 1);
+
+	int handle = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if (handle < 0 || ::connect(handle, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+	{
+		if (handle >= 0)
+			::close(handle);
+		error = "Failed to connect to socket: " + endpoint;
+		return false;
+	}
+#endif
+
+	PackConnection connection(handle);
+	auto ok = connection.writeJob(job) && connection.readResult(result);
+	if (!ok)
+		error = "Lost connection to the packing server";
+
+#ifdef _WIN32
+	CloseHandle(handle);
+#else
+	::close(handle);
+#endif
+	return ok;
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <iostream>
+#include <stdint.h>
+
+/* a packing job as a client sends it: the arguments of a normal run, minus the file names, and the input image */
+struct PackJob
+{
+	std::vector<std::string> arguments;
+	std::vector<uint8_t> input;
+};
+
+struct PackJobResult
+{
+	bool succeeded;
+	std::vector<uint8_t> output;
+	std::string log;
+	std::string metrics; /* one "name=value" per line */
+
+	PackJobResult() : succeeded(false) {}
+};
+
+/*
+	long-running packing server. clients connect over a named pipe (on Windows)
+	or a unix domain socket (elsewhere) and send any number of jobs. each worker
+	thread serves one connection at a time and keeps its PeLib arena between
+	jobs, so a warm server spends on a job only what packing it takes.
+
+	when a job carries no input bytes, a positional argument names an input
+	file for the server to read. that's only allowed when the server was given
+	a file root, and the file must resolve (links and all) to somewhere under
+	it. the output image is always sent back rather than written by the
+	server. --cache and the process-wide switches such as --trace only apply
+	to the server's own command line.
+
+	the unix socket is created readable and writable only by the user running
+	the server, and the named pipe gets a DACL allowing only that user and
+	turns away remote clients, so no one else can submit jobs at all.
+*/
+class PackServer
+{
+public:
+	PackServer(std::ostream &_infoStream, std::ostream &_errorStream);
+
+	/* serves jobs until the process is terminated; jobs may only name input files under fileRoot, or none if it's empty */
+	bool serve(const std::string &endpoint, unsigned int threadCount, const std::string &fileRoot);
+
+	/* runs a single job, exactly as the server does */
+	static void runJob(const PackJob &job, PackJobResult &result);
+
+	/* the same, for input bytes which aren't in a PackJob; with no input, a positional argument names the file */
+	static void runJob(const std::vector<std::string> &arguments, const uint8_t *input, size_t inputSize, PackJobResult &result);
+
+	/* client side: sends a job to a running server and waits for the result */
+	static bool submit(const std::string &endpoint, const PackJob &job, PackJobResult &result, std::string &error);
+
+private:
+	std::ostream &infoStream, &errorStream;
+	std::mutex logMutex;
+	std::string endpointPath; /* full pipe name or socket path */
+	intptr_t listenSocket; /* unused on Windows, where each worker creates its own pipe instance */
+	void* pipeSecurity; /* owner-only security descriptor of every pipe instance; Windows only */
+	std::string fileRoot; /* canonical, or empty when jobs can't name files */
+
+	void serveConnections();
+	bool resolveInputFile(PackJob &job, PackJobResult &result) const;
+};
@@ -3,18 +3,70 @@
 #include "PeRecompiler.h"
 #include "VectorUtils.h"
 #include "RewriteBlock.h"
+#include "ResultCache.h"
+#include "LoaderEmulator.h"
 #include "ASLRPreselectionStub.h"
 
 #include <algorithm>
+#include <filesystem>
 #include <functional>
+#include <map>
+#include <set>
+#include <sstream>
 
 #include <Windows.h>
 
 
-const uint32_t TRICKY_BASE_ADDRESS = 0xFFFF0000;
-const uint32_t ACTUALIZED_BASE_ADDRESS = 0x00010000;
+const uint32_t LOADER_PAGE_SIZE = 0x1000;
 
-PeSectionContents::PeSectionContents(uint32_t index, std::shared_ptr<PeLib::PeFile32> &_header, std::ifstream &file)
+/* how much of a section is read, searched or written out at once */
+const uint32_t SECTION_WINDOW_SIZE = 64 * 1024;
+
+/* 32-bit images have to end below this to load at their requested base */
+const uint64_t USER_ADDRESS_LIMIT = 0x80000000;
+
+/* mapped first to find where the image ends; real headers fit many times over */
+const uint64_t HEADER_PROBE_SIZE = 1024 * 1024;
+
+/* bump this whenever the layout of a rewrite plan or the meaning of its fields changes */
+const char REWRITE_PLAN_FORMAT[] = "reloc-plan-2";
+const char REWRITE_PLAN_EXTENSION[] = ".plan";
+const char REWRITE_PLAN_TEMP_EXTENSION[] = ".tmp";
+const char OUTPUT_TEMP_EXTENSION[] = ".tmp";
+
+
+/*
+	how much of a file the image itself takes up: the headers and the raw
+	data of every section. whatever follows, like an overlay or a signature,
+	never makes it into the output, so it doesn't have to be read or kept.
+	fails if the headers don't parse.
+*/
+static bool findImageSpan(const uint8_t *data, size_t size, uint64_t &span)
+{
+	/* every offset in the headers is 32-bit, so they can't be looking past 4GB anyway */
+	auto parseSize = static_cast<unsigned int>(std::min<size_t>(size, UINT32_MAX));
+	PeLib::PeFile32 peFile("");
+	if (peFile.readMzHeader(data, parseSize) != NO_ERROR || peFile.readPeHeader(data, parseSize) != NO_ERROR)
+		return false;
+
+	auto& peHeader = peFile.peHeader();
+	span = peHeader.getSizeOfHeaders();
+	for (unsigned int sec = 0; sec < peHeader.getNumberOfSections(); sec++)
+		span = std::max<uint64_t>(span, static_cast<uint64_t>(peHeader.getPointerToRawData(sec)) + peHeader.getSizeOfRawData(sec));
+	return true;
+}
+
+/* the OutputWriter writeOutputFile() uses unless it's given another */
+static bool writeFileStream(const std::string &fileName, const std::function<bool(std::ostream&)> &write)
+{
+	PeLib::FileStream file(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+	bool written = file.is_open() && write(file);
+	file.close();
+	return written && file;
+}
+
+
+PeSectionContents::PeSectionContents(uint32_t index, std::shared_ptr<PeLib::PeFile32> &_header, const uint8_t *image, size_t imageSize)
 {
 	auto& peHeader = _header->peHeader();
 	this->index = index;
@@ -24,34 +76,212 @@ PeSectionContents::PeSectionContents(uint32_t index, std::shared_ptr<PeLib::PeFi
 	this->virtualSize = peHeader.getVirtualSize(index);
 	this->name = peHeader.getSectionName(index);
 
-	char* block = new char[this->size];
-	file.seekg(this->rawPointer, std::ios::beg);
-	file.read(block, this->size);
+	/*
+		sections fully inside the image just point at it; nothing is copied,
+		and whatever is done to them is queued (see adjustEntry()). sections
+		which run past the end of the image are zero-filled, same as a short
+		read, so they need private storage right away.
+	*/
+	this->source = nullptr;
+	this->adjustmentCount = 0;
+	if (this->rawPointer <= imageSize && this->size <= imageSize - this->rawPointer)
+	{
+		this->source = image + this->rawPointer;
+		return;
+	}
 
-	this->data = std::vector<uint8_t>(block, block + this->size);
-	delete[] block;
+	this->data = std::vector<uint8_t>(this->size, 0);
+	if (this->rawPointer < imageSize)
+	{
+		auto available = std::min<size_t>(this->size, imageSize - this->rawPointer);
+		std::copy(image + this->rawPointer, image + this->rawPointer + available, this->data.begin());
+	}
 }
 
-void PeSectionContents::print(std::ostream &stream)
+size_t PeSectionContents::length() const
+{
+	return this->source ? this->size : this->data.size();
+}
+
+bool PeSectionContents::holdsEntry(uint32_t offset) const
+{
+	return static_cast<size_t>(offset) + sizeof(uint32_t) < this->length();
+}
+
+bool PeSectionContents::adjustEntry(uint32_t offset, uint32_t value)
+{
+	const uint32_t dataSize = 4;
+	if (!this->holdsEntry(offset))
+		return false;
+
+	auto window = offset / SECTION_WINDOW_SIZE;
+	if (this->adjustments.size() <= window)
+		this->adjustments.resize(window + 1);
+
+	/*
+		a dword right after the last ones queued, by the same value, joins them.
+		none of them overlap and nothing was queued in between, so applying
+		them all at once comes out the same as one after the other.
+	*/
+	auto& queued = this->adjustments[window];
+	if (queued.size())
+	{
+		auto& last = queued.back();
+		if (last.order == this->adjustmentCount - 1 && last.value == value && last.offset + (last.count * dataSize) == offset)
+		{
+			last.count++;
+			return true;
+		}
+	}
+
+	queued.push_back({ this->adjustmentCount++, offset, 1, value });
+	return true;
+}
+
+void PeSectionContents::read(size_t offset, size_t size, std::vector<uint8_t> &window) const
 {
-	auto writePadHex = [&stream](uint32_t val) -> void
+	const uint32_t dataSize = 4;
+	window.clear();
+	auto end = std::min(offset + size, this->length());
+	if (offset >= end)
+		return;
+
+	/*
+		adding to a dword only carries upward, so a byte comes out right as
+		long as each adjustment landing on it saw the right bytes below it in
+		its dword. walking back from the newest adjustment, every one landing
+		on a byte that's still needed makes the rest of its dword needed too,
+		which ends at the lowest byte the window depends on. that's rarely
+		more than a few bytes down, as the dwords of one rewrite never overlap.
+	*/
+	std::vector<const Adjustment*> involved;
+	size_t first = offset;
+	size_t firstWindow = ((offset >= dataSize - 1) ? offset - (dataSize - 1) : 0) / SECTION_WINDOW_SIZE;
+	size_t lastWindow = std::min((end - 1) / SECTION_WINDOW_SIZE + 1, this->adjustments.size());
+	while (true)
 	{
-		stream << "0x" << std::hex << std::left << std::setfill('0') << std::setw(8) << val << "  ";
-	};
+		involved.clear();
+		for (auto win = firstWindow; win < lastWindow; win++)
+			for (auto& adjustment : this->adjustments[win])
+				involved.push_back(&adjustment);
+		std::sort(involved.begin(), involved.end(), [](const Adjustment *a, const Adjustment *b) { return a->order < b->order; });
+
+		first = offset;
+		for (auto iadj = involved.rbegin(); iadj != involved.rend(); iadj++)
+		{
+			auto adjustment = *iadj;
+			/* the lowest of its dwords which ends past first */
+			auto entry = (first > adjustment->offset) ? static_cast<uint32_t>((first - adjustment->offset) / dataSize) : 0;
+			auto entryOffset = static_cast<size_t>(adjustment->offset) + (static_cast<size_t>(entry) * dataSize);
+			if (entry < adjustment->count && entryOffset < end)
+				first = std::min(first, entryOffset);
+		}
+
+		/* dwords starting in the window below reach up to 3 bytes into this one */
+		if (!firstWindow || first >= (firstWindow * SECTION_WINDOW_SIZE) + (dataSize - 1))
+			break;
+		firstWindow--;
+	}
+
+	/* dwords starting near the end run past it; whatever they carry out there is dropped */
+	auto contents = this->source ? this->source : this->data.data();
+	auto bufferEnd = std::min(end + dataSize, this->length());
+	window.assign(contents + first, contents + bufferEnd);
+	for (auto adjustment : involved)
+	{
+		for (uint32_t entry = 0; entry < adjustment->count; entry++)
+		{
+			auto entryOffset = static_cast<size_t>(adjustment->offset) + (static_cast<size_t>(entry) * dataSize);
+			if (entryOffset < first)
+				continue;
+			if (entryOffset >= end)
+				break;
+
+			uint32_t value;
+			auto at = static_cast<unsigned int>(entryOffset - first);
+			getData(window, at, value);
+			putData(window, at, value + adjustment->value);
+		}
+	}
+	window.erase(window.begin() + (end - first), window.end());
+	window.erase(window.begin(), window.begin() + (offset - first));
+}
 
+void PeSectionContents::replaceSource(const uint8_t *contents)
+{
+	this->source = contents;
+	this->data.clear();
+	this->adjustments.clear();
+	this->adjustmentCount = 0;
+}
+
+std::vector<uint8_t>& PeSectionContents::clearData()
+{
+	this->source = nullptr;
+	this->data.clear();
+	this->adjustments.clear();
+	this->adjustmentCount = 0;
+	return this->data;
+}
+
+/* zero-padded on the left, so 0xf7b prints as 0x00000f7b and the columns line up */
+static void writePadHex(std::ostream &stream, uint32_t val)
+{
+	stream << "0x" << std::hex << std::right << std::setfill('0') << std::setw(8) << val << "  ";
+}
+
+void PeSectionContents::print(std::ostream &stream)
+{
 	stream << "\t";
 	stream << std::left << std::setfill(' ') << std::setw(10) << this->name;
-	writePadHex(this->virtualSize);
-	writePadHex(this->size);
-	writePadHex(this->RVA);
-	writePadHex(this->rawPointer);
+	writePadHex(stream, this->virtualSize);
+	writePadHex(stream, this->size);
+	writePadHex(stream, this->RVA);
+	writePadHex(stream, this->rawPointer);
 	stream << std::endl;
 }
 
+void PeLoadCost::print(std::ostream &stream) const
+{
+	stream << std::dec;
+	stream << "\tLoad cost: " << this->relocationCount << " fixups over " << this->pagesTouched << " pages";
+	stream << " (" << this->tablePages << " table pages)" << std::endl;
+	stream << "\t\tEntries per page: " << this->maxEntriesPerPage << " max, " << this->averageEntriesPerPage << " average" << std::endl;
+	stream << "\t\tBytes patched: " << this->bytesPatched << std::endl;
+	stream << "\t\tEstimated fixup time: " << this->estimatedMicroseconds << "us" << std::endl;
+	stream << std::hex;
+}
+
+void PeOutputPlan::print(std::ostream &stream)
+{
+	stream << std::dec;
+	stream << "\tOriginal relocations applied: " << this->relocationCount << std::endl;
+	stream << "\tRewrite blocks: " << this->rewriteBlockCount << std::endl;
+	stream << "\tRewrite entries: " << this->rewriteEntryCount << " (" << this->rewriteCoverage << " bytes covered)" << std::endl;
+	stream << "\tPacked reloc blocks: " << this->packedBlockCount << " (" << this->relocEntryCount << " entries)" << std::endl;
+	stream << "\tReloc table size: " << this->relocTableSize << " bytes" << std::endl;
+	stream << "\tOutput size: " << this->outputSize << " bytes" << std::endl;
+	this->loadCost.print(stream);
+
+	stream << "\tSections:" << std::endl;
+	for (auto& sec : this->sections)
+	{
+		stream << "\t";
+		stream << std::left << std::setfill(' ') << std::setw(10) << sec.name;
+		writePadHex(stream, sec.virtualSize);
+		writePadHex(stream, sec.rawSize);
+		writePadHex(stream, sec.RVA);
+		writePadHex(stream, sec.rawPointer);
+		stream << std::endl;
+	}
+	stream << std::hex;
+}
+
 
 template <class RWBLOCK, typename... ARGS>
 void PeRecompiler::addRewriteBlock(ARGS... args)
 {
+	PeLib::TraceSpan span("PeRecompiler::addRewriteBlock", "reloc");
 	auto block = std::shared_ptr<RewriteBlock>(new RWBLOCK(args...));
 	this->rewriteBlocks.push_back(block);
 
@@ -75,12 +305,38 @@ PeRecompiler::PeRecompiler(
 	std::ostream &_infoStream, std::ostream &_errorStream,
 	const std::string &_inputFileName, const std::string &_outputFileName
 )
-	: infoStream(_infoStream), errorStream(_errorStream),
+	: multiPass(false), planOnly(false), relocationCount(0),
+	entryCost(DEFAULT_ENTRY_NANOSECONDS), pageCost(DEFAULT_PAGE_NANOSECONDS), loadBudget(0),
+	shouldUseWin10Attack(false), infoStream(_infoStream), errorStream(_errorStream),
 	inputFileName(_inputFileName), outputFileName(_outputFileName),
-	multiPass(false), shouldUseWin10Attack(false)
+	inputImage(nullptr), inputSize(0), keepRewritePlan(false), io(std::make_shared<PeLib::IoStats>())
+{
+	this->infoStream << std::hex;
+	this->errorStream << std::hex;
+
+	if (!this->outputFileName.empty())
+		this->planFileName = this->outputFileName + REWRITE_PLAN_EXTENSION;
+}
+
+PeRecompiler::PeRecompiler(
+	std::ostream &_infoStream, std::ostream &_errorStream,
+	const uint8_t *_inputData, size_t _inputSize
+)
+	: multiPass(false), planOnly(false), relocationCount(0),
+	entryCost(DEFAULT_ENTRY_NANOSECONDS), pageCost(DEFAULT_PAGE_NANOSECONDS), loadBudget(0),
+	shouldUseWin10Attack(false), infoStream(_infoStream), errorStream(_errorStream),
+	inputImage(nullptr), inputSize(0), keepRewritePlan(false), io(std::make_shared<PeLib::IoStats>())
 {
 	this->infoStream << std::hex;
 	this->errorStream << std::hex;
+
+	/* only the image is copied; see findImageSpan() */
+	uint64_t span;
+	if (findImageSpan(_inputData, _inputSize, span) && span < _inputSize)
+		_inputSize = static_cast<size_t>(span);
+	this->inputData.assign(_inputData, _inputData + _inputSize);
+	this->inputImage = this->inputData.data();
+	this->inputSize = this->inputData.size();
 }
 
 
@@ -94,38 +350,155 @@ void PeRecompiler::doMultiPass(bool multi)
 	this->multiPass = multi;
 }
 
+void PeRecompiler::doPlanOnly(bool plan)
+{
+	this->planOnly = plan;
+}
+
+void PeRecompiler::setLoadCostModel(double entryNanoseconds, double pageNanoseconds)
+{
+	this->entryCost = entryNanoseconds;
+	this->pageCost = pageNanoseconds;
+}
+
+void PeRecompiler::setLoadBudget(double microseconds)
+{
+	this->loadBudget = microseconds;
+}
+
+void PeRecompiler::useResultCache(std::shared_ptr<ResultCache> cache, const std::string &options)
+{
+	this->resultCache = cache;
+	this->cacheOptions = options;
+	this->cacheKey.clear();
+}
+
+void PeRecompiler::useRewritePlan(bool incremental)
+{
+	/* only an output written to a file is still around for the next run to build on */
+	this->keepRewritePlan = incremental && !this->planFileName.empty();
+}
+
+void PeRecompiler::useOutputWriter(OutputWriter writer)
+{
+	this->outputWriter = writer;
+}
+
+bool PeRecompiler::fetchCachedOutput()
+{
+	PeLib::TraceSpan span("PeRecompiler::fetchCachedOutput", "reloc");
+	if (!this->resultCache || this->outputFileName.empty())
+		return false;
+
+	if (!this->readInputImage())
+		return false;
+
+	/*
+		the options string must describe everything that affects the output;
+		the caller builds it, since only the caller knows which rewrites it's
+		going to ask for.
+	*/
+	this->cacheKey = ResultCache::makeKey(this->inputImage, this->inputSize, this->cacheOptions);
+	if (!this->resultCache->fetch(this->cacheKey, this->outputFileName))
+		return false;
+	this->discardRewritePlan();
+
+	this->infoStream << "Found cached output for " << this->inputFileName << " (" << this->cacheKey << ")" << std::endl;
+	this->infoStream << "\tWrote output file: " << this->outputFileName << std::endl;
+	return true;
+}
+
+bool PeRecompiler::readInputImage()
+{
+	PeLib::TraceSpan span("PeRecompiler::readInputImage", "reloc");
+	PeLib::IoScope ioScope(*this->io);
+	/*
+		when we were given a path, the file is mapped rather than read up
+		front. pages come in as they're looked at, so sections which are
+		never rewritten go from the page cache straight to the output, and
+		only the image itself is mapped, so an overlay of any size costs
+		nothing. everything after this point works from this->inputImage.
+	*/
+	if (!this->inputFileName.empty() && !this->inputImage)
+	{
+		size_t imageSize;
+		if (!mapImage(this->inputFileName, this->inputMapping, imageSize))
+		{
+			this->errorStream << "Failed to open input file: " << this->inputFileName << std::endl;
+			return false;
+		}
+
+		this->inputImage = this->inputMapping.data();
+		this->inputSize = imageSize;
+
+		/*
+			packing in place replaces the file the image is mapped from, which
+			windows won't do while it's mapped, so then the image is copied out
+			and unmapped.
+		*/
+		std::error_code ec;
+		if (!this->outputFileName.empty() && std::filesystem::equivalent(this->inputFileName, this->outputFileName, ec))
+		{
+			this->inputData.assign(this->inputImage, this->inputImage + this->inputSize);
+			this->inputMapping.close();
+			this->inputImage = this->inputData.data();
+		}
+	}
+	return true;
+}
+
+bool PeRecompiler::mapImage(const std::string &fileName, MappedFile &mapping, size_t &imageSize)
+{
+	if (!mapping.open(fileName, HEADER_PROBE_SIZE))
+		return false;
+
+	uint64_t span;
+	if (!findImageSpan(mapping.data(), mapping.size(), span))
+		span = UINT64_MAX;
+
+	if (span > mapping.size() && mapping.size() < mapping.fileSize())
+	{
+		if (!mapping.open(fileName, span))
+			return false;
+	}
+
+	imageSize = static_cast<size_t>(std::min<uint64_t>(mapping.size(), span));
+	return true;
+}
+
 bool PeRecompiler::loadInputFile()
 {
+	PeLib::TraceSpan span("PeRecompiler::loadInputFile", "reloc");
+	if (!this->readInputImage())
+		return false;
+
+	auto inputName = this->inputFileName.empty() ? std::string("<memory>") : this->inputFileName;
+	auto parseSize = static_cast<unsigned int>(std::min<size_t>(this->inputSize, UINT32_MAX));
+
 	auto peFile = std::make_shared<PeLib::PeFile32>(this->inputFileName);
-	if (peFile->readMzHeader() != NO_ERROR)
+	if (peFile->readMzHeader(this->inputImage, parseSize) != NO_ERROR)
 	{
-		this->errorStream << "Failed to read MzHeader: " << this->inputFileName << std::endl;
+		this->errorStream << "Failed to read MzHeader: " << inputName << std::endl;
 		return false;
 	}
 
-	if (peFile->readPeHeader() != NO_ERROR)
+	if (peFile->readPeHeader(this->inputImage, parseSize) != NO_ERROR)
 	{
-		this->errorStream << "Failed to read PeHeader: " << this->inputFileName << std::endl;
+		this->errorStream << "Failed to read PeHeader: " << inputName << std::endl;
 		return false;
 	}
 
 	this->peFile = peFile;
-	this->infoStream << "Successfully loaded PE File: " << this->inputFileName << std::endl;
+	this->infoStream << "Successfully loaded PE File: " << inputName << std::endl;
 	return true;
 }
 
 bool PeRecompiler::loadInputSections()
 {
+	PeLib::TraceSpan span("PeRecompiler::loadInputSections", "reloc");
 	if (!this->peFile)
 		return false;
 
-	std::ifstream file(this->inputFileName.c_str(), std::ios::in | std::ios::binary | std::ios::ate);
-	if (!file.is_open())
-	{
-		this->errorStream << "Failed to open original file for section reading: " << this->inputFileName << std::endl;
-		return false;
-	}
-
 	auto& peHeader = this->peFile->peHeader();
 	this->infoStream << "Loading sections" << std::endl;
 	this->infoStream << "\t";
@@ -138,13 +511,11 @@ bool PeRecompiler::loadInputSections()
 
 	for (unsigned int sec = 0; sec < peHeader.getNumberOfSections(); sec++)
 	{
-		auto sc = std::make_shared<PeSectionContents>(sec, this->peFile, file);
+		auto sc = std::make_shared<PeSectionContents>(sec, this->peFile, this->inputImage, this->inputSize);
 		sc->print(this->infoStream);
 		this->sectionContents.push_back(sc);
 	}
 
-	file.close();
-
 	/* 
 	TODO:
 		when allocSection() has been properly finished and is able to serve
@@ -169,6 +540,7 @@ bool PeRecompiler::loadInputSections()
 
 bool PeRecompiler::performOnDiskRelocations()
 {
+	PeLib::TraceSpan span("PeRecompiler::performOnDiskRelocations", "reloc");
 	if (!this->peFile)
 		return false;
 
@@ -190,7 +562,7 @@ bool PeRecompiler::performOnDiskRelocations()
 		return false;
 	}
 
-	if (this->peFile->readRelocationsDirectory())
+	if (this->peFile->readRelocationsDirectory(this->inputImage, static_cast<unsigned int>(std::min<size_t>(this->inputSize, UINT32_MAX))))
 	{
 		this->errorStream << "Failed to read reloc directory!" << std::endl;
 		return false;
@@ -201,6 +573,9 @@ bool PeRecompiler::performOnDiskRelocations()
 	/*
 		now, our first step is to remove the ASLR flag and request a base of TRICKY_BASE_ADDRESS.
 		this actually causes us to load at ACTUALIZED_BASE_ADDRESS, though, so we will relocate to there.
+
+		the in-memory header is changed in plan mode as well: the plan is sized
+		from it, and rewrites check for the new base (see doRewriteReadyCheck()).
 	*/
 	if (!this->shouldUseWin10Attack)
 	{
@@ -259,18 +634,22 @@ bool PeRecompiler::performOnDiskRelocations()
 			uint32_t entryAddress = relocBlockRVA + (entry & 0x0FFF);
 
 			uint32_t si = entryAddress - sc->RVA;
-			if (entryType & IMAGE_REL_BASED_HIGHLOW)
-			{
-				uint32_t original;
-				if (!getData(sc->data, si, original))
-				{
-					this->errorStream << "Failed to read original value to reloc!" << std::endl;
-					return false;
-				}
-				putData(sc->data, si, original + relocDelta);
-			}
-			else if (entryType)
+			switch (checkRelocEntry(entryType, si, sc->length()))
 			{
+			case RELOC_ENTRY_SKIP:
+				break;
+			case RELOC_ENTRY_APPLY:
+				/*
+					queued when planning too, which leaves the section as it is:
+					--stringMatch searches windows with these applied, the same
+					relocated bytes a real run searches.
+				*/
+				sc->adjustEntry(si, static_cast<uint32_t>(relocDelta));
+				break;
+			case RELOC_ENTRY_OUT_OF_BOUNDS:
+				this->errorStream << "Failed to read original value to reloc!" << std::endl;
+				return false;
+			case RELOC_ENTRY_UNKNOWN_TYPE:
 				this->errorStream << "Unknown reloc type: 0x" << entryType << std::endl;
 				return false;
 			}
@@ -279,6 +658,7 @@ bool PeRecompiler::performOnDiskRelocations()
 		}
 	}
 
+	this->relocationCount = numberOfRelocsPerformed;
 	this->infoStream << "\tParsed original reloc table and applied " << std::dec << numberOfRelocsPerformed << std::hex << " relocations" << std::endl;
 	this->infoStream << "\t\tDelta of 0x" << relocDelta << " applied, as binary will load at 0x" << ACTUALIZED_BASE_ADDRESS << std::endl;
 
@@ -293,6 +673,7 @@ bool PeRecompiler::performOnDiskRelocations()
 
 bool PeRecompiler::rewriteHeader()
 {
+	PeLib::TraceSpan span("PeRecompiler::rewriteHeader", "reloc");
 	if (!this->doRewriteReadyCheck())
 		return false;
 
@@ -310,6 +691,7 @@ bool PeRecompiler::rewriteHeader()
 
 bool PeRecompiler::fixupBase()
 {
+	PeLib::TraceSpan span("PeRecompiler::fixupBase", "reloc");
 	if (!this->doRewriteReadyCheck())
 		return false;
 
@@ -321,6 +703,7 @@ bool PeRecompiler::fixupBase()
 
 bool PeRecompiler::rewriteSection(const std::string &name)
 {
+	PeLib::TraceSpan span("PeRecompiler::rewriteSection", "reloc");
 	if (!this->doRewriteReadyCheck())
 		return false;
 
@@ -341,6 +724,7 @@ bool PeRecompiler::rewriteSection(const std::string &name)
 
 bool PeRecompiler::rewriteImports()
 {
+	PeLib::TraceSpan span("PeRecompiler::rewriteImports", "reloc");
 	if (!this->doRewriteReadyCheck())
 		return false;
 
@@ -376,12 +760,16 @@ bool PeRecompiler::rewriteImports()
 	{
 		uint32_t iatOffset = iatRVA - iatSec->RVA;
 
+		/* the table as relocated, with room for the last dword to be read past its end */
+		std::vector<uint8_t> iat;
+		iatSec->read(iatOffset, iatSize + sizeof(uint32_t), iat);
+
 		uint32_t lowestNameRVA = 0xFFFFFFFF;
 		uint32_t highestNameRVA = 0;
 		for (uint32_t imp = iatOffset; imp < iatOffset + iatSize; imp += 4)
 		{
 			uint32_t temp;
-			if (!getData(iatSec->data, imp, temp))
+			if (!getData(iat, imp - iatOffset, temp))
 				break;
 			if (temp == 0) continue;
 			else if (temp < lowestNameRVA) lowestNameRVA = temp;
@@ -399,105 +787,750 @@ bool PeRecompiler::rewriteImports()
 
 bool PeRecompiler::rewriteMatches(const std::string &needle)
 {
+	PeLib::TraceSpan span("PeRecompiler::rewriteMatches", "reloc");
 	if (!this->doRewriteReadyCheck())
 		return false;
 
 	this->infoStream << "\tObfuscating all instances of string: " << needle << std::endl;
 	std::boyer_moore_horspool_searcher<std::string::const_iterator> searcher(needle.cbegin(), needle.cend());
+	std::vector<uint8_t> window;
 	for (auto isec = this->sectionContents.begin(); isec != this->sectionContents.end(); isec++)
 	{
 		auto& sec = *isec;
-		auto schunk = std::string(sec->data.begin(), sec->data.end());
-		auto res = schunk.cbegin();
-		while (true)
+
+		/*
+			search the relocated contents a window at a time. each window reads
+			on for all but one byte of the needle, and only matches starting
+			before its end are taken, so every match is found once, in order.
+		*/
+		for (size_t windowOffset = 0; windowOffset < sec->length(); windowOffset += SECTION_WINDOW_SIZE)
 		{
-			res = std::search(res, schunk.cend(), searcher);
-			if (res == schunk.cend())
+			sec->read(windowOffset, SECTION_WINDOW_SIZE + needle.length() - 1, window);
+			auto chunkBegin = reinterpret_cast<const char*>(window.data());
+			auto chunkEnd = chunkBegin + window.size();
+			auto res = chunkBegin;
+			while (true)
+			{
+				res = std::search(res, chunkEnd, searcher);
+				if (res == chunkEnd || res - chunkBegin >= SECTION_WINDOW_SIZE)
+					break;
+				auto index = windowOffset + ((res - chunkBegin) * sizeof(std::string::value_type));
+
+				this->infoStream << "\t\tMatch in " << sec->name << " at offset 0x" << std::hex << index << std::endl;
+				this->addRewriteBlock<PeSectionRewriteBlock>(sec, index, needle.length() + 1);
+				res++;
+			}
+		}
+	}
+
+	return true;
+}
+
+
+void PeRecompiler::packRewriteBlocks(std::list<PackedBlock> &packedBlocks, bool apply)
+{
+	PeLib::TraceSpan span("PeRecompiler::packRewriteBlocks", "reloc");
+	auto& peHeader = this->peFile->peHeader();
+
+	const uint32_t requestedBase = peHeader.getImageBase();
+	const uint32_t packDelta = (ACTUALIZED_BASE_ADDRESS - requestedBase);
+
+	/* every entry we rewrite, in the order it was decremented */
+	std::vector<uint32_t> entryRVAs;
+	this->collectRewriteEntries(this->rewriteBlocks, packDelta, apply, entryRVAs);
+
+	std::vector<LayeredEntry> layeredEntries;
+	this->layerRewriteEntries(entryRVAs, layeredEntries);
+	this->packLayeredEntries(layeredEntries, packedBlocks);
+}
+
+void PeRecompiler::collectRewriteEntries(const std::vector<std::shared_ptr<RewriteBlock>> &blocks, uint32_t packDelta, bool apply, std::vector<uint32_t> &entryRVAs)
+{
+	const uint32_t dataSize = 4;
+	for (auto iblock = blocks.begin(); iblock != blocks.end(); iblock++)
+	{
+		auto& block = *iblock;
+		if (!block)
+			continue;
+
+		uint32_t rva, offset;
+		if (!block->getFirstEntryLoc(dataSize, rva, offset))
+			continue;
+
+		do
+		{
+			/* when only planning, check the entry could be rewritten but leave it be */
+			if (apply ? !block->decrementEntry(offset, packDelta) : !block->canDecrementEntry(offset))
 				break;
-			auto index = (res - schunk.cbegin()) * sizeof(std::string::value_type);
+			entryRVAs.push_back(rva);
+		}
+		while (block->getNextEntryLoc(dataSize, offset, rva, offset));
+	}
+}
+
+void PeRecompiler::layerRewriteEntries(const std::vector<uint32_t> &entryRVAs, std::vector<LayeredEntry> &layeredEntries)
+{
+	const uint32_t dataSize = 4;
+
+	/*
+		the loader applies the table in order, so entries which overlap must be
+		applied in the reverse of the order they were decremented in. entries
+		which don't overlap commute, so they can go wherever we like.
+
+		walking the entries in loader order, each one lands in the layer after
+		the highest layer of anything it overlaps. nothing within a layer
+		overlaps, so each layer is emitted as one block per page in ascending
+		order; without multipass or overlapping matches there is a single layer.
+	*/
+	std::map<uint32_t, uint32_t> placedLayers;
+	layeredEntries.reserve(layeredEntries.size() + entryRVAs.size());
+	for (auto irva = entryRVAs.rbegin(); irva != entryRVAs.rend(); irva++)
+	{
+		auto rva = *irva;
+		uint32_t layer = 0;
+		auto first = placedLayers.lower_bound((rva >= dataSize - 1) ? rva - (dataSize - 1) : 0);
+		for (auto placed = first; placed != placedLayers.end() && placed->first < rva + dataSize; placed++)
+			layer = std::max(layer, placed->second + 1);
+
+		placedLayers[rva] = layer;
+		layeredEntries.push_back(std::make_pair(layer, rva));
+	}
+}
+
+void PeRecompiler::packLayeredEntries(std::vector<LayeredEntry> &layeredEntries, std::list<PackedBlock> &packedBlocks)
+{
+	const uint32_t pageSize = 1024 * 4;
+	std::sort(layeredEntries.begin(), layeredEntries.end());
+
+	uint32_t lastLayer = UINT32_MAX, lastPage = UINT32_MAX;
+	for (auto& entry : layeredEntries)
+	{
+		uint32_t page = entry.second & ~(pageSize - 1);
+		if (entry.first != lastLayer || page != lastPage)
+		{
+			packedBlocks.push_back(PackedBlock(entry.first, page));
+			lastLayer = entry.first;
+			lastPage = page;
+		}
+		packedBlocks.back().offsets.push_back(static_cast<uint16_t>(entry.second - page));
+	}
+}
+
+/*
+	a rewrite plan describes the last output written to outputFileName: the
+	input it was packed from, its rewrite blocks in order, the sections those
+	left changed and the reloc blocks generated for them. when this run has
+	the same blocks plus new ones which don't overlap any of them, the old
+	rewrites are already done in that output. their sections are taken from
+	it as they are, only the new blocks are applied, and only their entries
+	get layered before being merged with the recorded ones, which comes out
+	the same as doing everything over. returns false without having changed
+	anything if the plan doesn't fit this run.
+*/
+bool PeRecompiler::applyRewritePlan(std::list<PackedBlock> &packedBlocks)
+{
+	PeLib::TraceSpan span("PeRecompiler::applyRewritePlan", "reloc");
+	PeLib::IoScope ioScope(*this->io);
+
+	auto rejectPlan = [this](const char *reason) -> bool
+	{
+		this->infoStream << "\tNot using rewrite plan " << this->planFileName << ": " << reason << std::endl;
+		return false;
+	};
+
+	PeLib::FileStream planFile(this->planFileName, std::ios::in | std::ios::binary);
+	if (!planFile.is_open())
+		return false;
+
+	struct PlannedSection
+	{
+		uint32_t index, rawPointer, size;
+		std::string hash;
+	};
+
+	std::string line, inputHash;
+	uint32_t plannedBase = 0;
+	std::vector<std::string> plannedBlocks;
+	std::vector<PlannedSection> plannedSections;
+	std::vector<LayeredEntry> layeredEntries;
+	if (!std::getline(planFile, line) || line != REWRITE_PLAN_FORMAT)
+		return rejectPlan("unknown format");
+
+	while (std::getline(planFile, line))
+	{
+		std::istringstream fields(line);
+		std::string kind;
+		fields >> kind >> std::hex;
+
+		bool parsed = true;
+		if (kind == "input")
+			parsed = !!(fields >> inputHash);
+		else if (kind == "block")
+		{
+			std::string description;
+			std::getline(fields >> std::ws, description);
+			parsed = !description.empty();
+			plannedBlocks.push_back(description);
+		}
+		else if (kind == "section")
+		{
+			PlannedSection sec;
+			parsed = !!(fields >> sec.index >> sec.rawPointer >> sec.size >> sec.hash);
+			plannedSections.push_back(sec);
+		}
+		else if (kind == "base")
+			parsed = !!(fields >> plannedBase);
+		else if (kind == "reloc")
+		{
+			/* an offset has to fit in the 12 bits of a reloc entry */
+			uint32_t layer, page, offset;
+			parsed = !!(fields >> layer >> page) && !(page & 0x0FFF);
+			while (parsed && fields >> offset)
+			{
+				parsed = (offset <= 0x0FFF);
+				layeredEntries.push_back(std::make_pair(layer, page + offset));
+			}
+		}
+		if (!parsed)
+			return rejectPlan("malformed");
+	}
+
+	if (inputHash != ResultCache::hashData(this->inputImage, this->inputSize))
+		return rejectPlan("the input changed");
+
+	/* the planned blocks have to still be there, in the same order; whatever else there is is new */
+	std::vector<std::shared_ptr<RewriteBlock>> headerBlocks, newBlocks;
+	size_t planned = 0;
+	for (auto& block : this->rewriteBlocks)
+	{
+		if (!block)
+			continue;
+		if (planned < plannedBlocks.size() && block->describe() == plannedBlocks[planned])
+		{
+			planned++;
+			if (block->rewritesHeader())
+				headerBlocks.push_back(block);
+		}
+		else
+			newBlocks.push_back(block);
+	}
+	if (planned != plannedBlocks.size())
+		return rejectPlan("rewrites were removed or reordered");
+
+	/* the planned sections were decremented by the delta from this base, e.g. not with --win10 */
+	auto& peHeader = this->peFile->peHeader();
+	if (plannedBase != peHeader.getImageBase())
+		return rejectPlan("the image base changed");
+
+	const uint32_t packDelta = (ACTUALIZED_BASE_ADDRESS - peHeader.getImageBase());
+	const uint32_t dataSize = 4;
+
+	/* an entry overlapping an old one would have to be layered against it, and change what came before */
+	std::vector<uint32_t> entryRVAs;
+	this->collectRewriteEntries(newBlocks, packDelta, false, entryRVAs);
+
+	std::set<uint32_t> plannedRVAs;
+	for (auto& entry : layeredEntries)
+		plannedRVAs.insert(entry.second);
+	for (auto rva : entryRVAs)
+	{
+		auto nearest = plannedRVAs.lower_bound((rva >= dataSize - 1) ? rva - (dataSize - 1) : 0);
+		if (nearest != plannedRVAs.end() && *nearest < rva + dataSize)
+			return rejectPlan("new rewrites overlap planned ones");
+	}
+
+	/* the reused sections are streamed out of the previous output, which writeOutputFile() only replaces once it's done */
+	auto& previousOutput = this->previousOutput;
+	if (!previousOutput.open(this->outputFileName))
+		return rejectPlan("the previous output is missing");
 
-			this->infoStream << "\t\tMatch in " << sec->name << " at offset 0x" << std::hex << index << std::endl;
-			this->addRewriteBlock<PeSectionRewriteBlock>(sec, index, needle.length() + 1);
-			res++;
+	std::vector<std::shared_ptr<PeSectionContents>> plannedContents;
+	for (auto& planSec : plannedSections)
+	{
+		std::shared_ptr<PeSectionContents> found;
+		for (auto& sec : this->sectionContents)
+			if (sec->index == planSec.index)
+				found = sec;
+
+		if (!found || found->rawPointer != planSec.rawPointer || found->length() != planSec.size ||
+			planSec.rawPointer > previousOutput.size() || planSec.size > previousOutput.size() - planSec.rawPointer ||
+			ResultCache::hashData(previousOutput.data() + planSec.rawPointer, planSec.size) != planSec.hash)
+		{
+			previousOutput.close();
+			return rejectPlan("the previous output was modified");
 		}
+		plannedContents.push_back(found);
 	}
 
+	for (size_t sec = 0; sec < plannedContents.size(); sec++)
+		plannedContents[sec]->replaceSource(previousOutput.data() + plannedSections[sec].rawPointer);
+
+	/* the header is rebuilt from the input every run, so its planned rewrites are done again */
+	std::vector<uint32_t> headerRVAs;
+	this->collectRewriteEntries(headerBlocks, packDelta, true, headerRVAs);
+
+	entryRVAs.clear();
+	this->collectRewriteEntries(newBlocks, packDelta, true, entryRVAs);
+	this->layerRewriteEntries(entryRVAs, layeredEntries);
+	this->packLayeredEntries(layeredEntries, packedBlocks);
+
+	this->infoStream << "\tReused rewrite plan " << this->planFileName << ": " << std::dec << planned << " rewrite blocks already applied, ";
+	this->infoStream << newBlocks.size() << " new (" << entryRVAs.size() << " entries)" << std::hex << std::endl;
 	return true;
 }
 
+bool PeRecompiler::saveRewritePlan()
+{
+	PeLib::TraceSpan span("PeRecompiler::saveRewritePlan", "reloc");
+	PeLib::IoScope ioScope(*this->io);
+	auto& peHeader = this->peFile->peHeader();
 
-bool PeRecompiler::writeOutputFile()
+	/* the rewrites in the header are left out; it is rebuilt every run */
+	auto relocSec = this->getSectionByRVA(peHeader.getIddBaseRelocRva(), 4);
+	std::map<uint32_t, std::shared_ptr<PeSectionContents>> changedSections;
+	for (auto& packedBlock : this->emittedBlocks)
+	{
+		for (auto offset : packedBlock.offsets)
+		{
+			auto sec = this->getSectionByRVA(packedBlock.beginRVA + offset, 4);
+			if (!sec)
+				continue;
+			if (sec == relocSec)
+				return false;
+			changedSections[sec->index] = sec;
+		}
+	}
+
+	/* sections are hashed as they were written, which is what the next run checks them against */
+	MappedFile output;
+	if (!output.open(this->outputFileName))
+		return false;
+
+	std::ostringstream plan;
+	plan << REWRITE_PLAN_FORMAT << std::endl << std::hex;
+	plan << "input " << ResultCache::hashData(this->inputImage, this->inputSize) << std::endl;
+	plan << "base " << peHeader.getImageBase() << std::endl;
+	for (auto& block : this->rewriteBlocks)
+		if (block)
+			plan << "block " << block->describe() << std::endl;
+	for (auto& changed : changedSections)
+	{
+		auto& sec = changed.second;
+		auto writeSize = std::min<size_t>(sec->length(), peHeader.getSizeOfRawData(sec->index));
+		if (peHeader.getPointerToRawData(sec->index) != sec->rawPointer || sec->rawPointer > output.size() || writeSize > output.size() - sec->rawPointer)
+			return false;
+		plan << "section " << sec->index << " " << sec->rawPointer << " " << writeSize << " " << ResultCache::hashData(output.data() + sec->rawPointer, writeSize) << std::endl;
+	}
+	for (auto& packedBlock : this->emittedBlocks)
+	{
+		plan << "reloc " << packedBlock.layer << " " << packedBlock.beginRVA;
+		for (auto offset : packedBlock.offsets)
+			plan << " " << offset;
+		plan << std::endl;
+	}
+
+	/* written aside and renamed into place, so a plan is never seen half written */
+	std::error_code ignored;
+	auto tempName = this->planFileName + REWRITE_PLAN_TEMP_EXTENSION;
+	PeLib::FileStream file(tempName, std::ios::out | std::ios::binary | std::ios::trunc);
+	auto contents = plan.str();
+	if (!file.is_open() || !file.write(contents.data(), contents.size()))
+	{
+		file.close();
+		std::filesystem::remove(tempName, ignored);
+		return false;
+	}
+	file.close();
+
+	std::error_code ec;
+	std::filesystem::rename(tempName, this->planFileName, ec);
+	if (ec)
+	{
+		std::filesystem::remove(tempName, ignored);
+		return false;
+	}
+	return true;
+}
+
+/* called whenever the output file is replaced, so a plan never outlives the output it describes */
+void PeRecompiler::discardRewritePlan()
+{
+	if (this->planFileName.empty())
+		return;
+
+	std::error_code ignored;
+	std::filesystem::remove(this->planFileName, ignored);
+}
+
+void PeRecompiler::estimateLoadCost(std::vector<uint32_t> &targets, uint32_t tableRVA, uint32_t tableSize, PeLoadCost &cost)
+{
+	cost = PeLoadCost();
+	cost.relocationCount = static_cast<uint32_t>(targets.size());
+	cost.bytesPatched = cost.relocationCount * sizeof(uint32_t);
+	if (tableSize)
+		cost.tablePages = ((tableRVA + tableSize - 1) / LOADER_PAGE_SIZE) - (tableRVA / LOADER_PAGE_SIZE) + 1;
+
+	/* a dword straddling a page boundary makes the loader touch both pages */
+	std::sort(targets.begin(), targets.end());
+	uint32_t lastPage = UINT32_MAX, entryPage = UINT32_MAX, pageEntries = 0;
+	for (auto target : targets)
+	{
+		uint32_t firstPage = target / LOADER_PAGE_SIZE;
+		uint32_t endPage = (target + sizeof(uint32_t) - 1) / LOADER_PAGE_SIZE;
+		for (auto page = firstPage; page <= endPage; page++)
+		{
+			if (lastPage != UINT32_MAX && page <= lastPage)
+				continue;
+			cost.pagesTouched++;
+			lastPage = page;
+		}
+
+		if (firstPage != entryPage)
+		{
+			entryPage = firstPage;
+			pageEntries = 0;
+		}
+		cost.maxEntriesPerPage = std::max(cost.maxEntriesPerPage, ++pageEntries);
+	}
+
+	if (cost.pagesTouched)
+		cost.averageEntriesPerPage = static_cast<double>(cost.relocationCount) / cost.pagesTouched;
+
+	double nanoseconds = (cost.relocationCount * this->entryCost) + ((cost.pagesTouched + cost.tablePages) * this->pageCost);
+	cost.estimatedMicroseconds = nanoseconds / 1000.0;
+}
+
+bool PeRecompiler::checkLoadBudget(const PeLoadCost &cost)
 {
+	if (this->loadBudget <= 0 || cost.estimatedMicroseconds <= this->loadBudget)
+		return true;
+
+	this->errorStream << "Estimated fixup time of " << std::dec << cost.estimatedMicroseconds << "us exceeds the load budget of " << this->loadBudget << "us" << std::hex << std::endl;
+	return false;
+}
+
+bool PeRecompiler::planOutput(PeOutputPlan &plan)
+{
+	PeLib::TraceSpan span("PeRecompiler::planOutput", "reloc");
 	if (!this->peFile)
 		return false;
 
 	if (!this->sectionContents.size())
 	{
-		this->errorStream << "Section contents must be loaded before writing output!" << std::endl;
+		this->errorStream << "Section contents must be loaded before planning output!" << std::endl;
 		return false;
 	}
 
-	this->infoStream << "Generating output file" << std::endl;
+	this->infoStream << "Planning output image" << std::endl;
 
 	auto& reloc = this->peFile->relocDir();
 	auto& peHeader = this->peFile->peHeader();
 	auto& mzHeader = this->peFile->mzHeader();
 
+	plan = PeOutputPlan();
+	plan.relocationCount = this->relocationCount;
+	for (auto& block : this->rewriteBlocks)
+		if (block)
+			plan.rewriteBlockCount++;
+
 	/*
-		first, we need to actually DO THE REWRITES that we have queued up.
-		we will modify the contents buffers we have in rewriteBlocks and
-		keep a ledger of those so we can generate a reloc table later.
+		walk the rewrites the same way prepareOutput() does, but without
+		decrementing anything; everything below is derived arithmetically.
+		nothing here changes the PE header or the sections, but the header
+		is the one performOnDiskRelocations() already changed, in plan mode
+		too: DllCharacteristics and ImageBase are as they'll be written, and
+		the original reloc directory is cleared.
+	*/
+	std::list<PackedBlock> packedBlocks;
+	this->packRewriteBlocks(packedBlocks, false);
 
-		in order to support overlapping relocs, we must record blocks in the
-		reverse order that we decrement them, as relocations are processed
-		in a linear fashion. this is done using .push_front().
+	if (packedBlocks.size() && reloc.calcNumberOfRelocations())
+	{
+		this->errorStream << "No relocation table should exist if rewrites are present!" << std::endl;
+		return false;
+	}
 
-		this will work as long as each entry in rewriteBlocks contains _no overlap_,
-		as the reversal happens between entries in rewriteBlocks, not between relocations
-		in each entry.
-	*/
-	struct PackedBlock
+	/* any original relocations left in place are rebuilt as-is */
+	std::vector<uint32_t> fixupRVAs;
+	for (unsigned int rel = 0; rel < reloc.calcNumberOfRelocations(); rel++)
 	{
-		PackedBlock(unsigned int _beginRVA) : beginRVA(_beginRVA), offsets() {}
-		unsigned int beginRVA;
-		std::vector<unsigned short> offsets;
-	};
-	std::list<PackedBlock> packedBlocks;
+		plan.relocTableSize += 8 + (reloc.calcNumberOfRelocationData(rel) * sizeof(uint16_t));
+		for (unsigned int relEntry = 0; relEntry < reloc.calcNumberOfRelocationData(rel); relEntry++)
+		{
+			auto entry = reloc.getRelocationData(rel, relEntry);
+			if ((entry >> 12) == IMAGE_REL_BASED_HIGHLOW)
+				fixupRVAs.push_back(reloc.getVirtualAddress(rel) + (entry & 0x0FFF));
+		}
+	}
 
-	const uint32_t requestedBase = peHeader.getImageBase();
-	const uint32_t packDelta = (ACTUALIZED_BASE_ADDRESS - requestedBase);
+	std::vector<uint32_t> entryRVAs;
+	for (auto ipb = packedBlocks.begin(); ipb != packedBlocks.end(); ipb++)
+	{
+		auto& packedBlock = *ipb;
+		uint32_t entries = static_cast<uint32_t>(packedBlock.offsets.size());
+		uint32_t paddedEntries = entries + (entries % 2);
+
+		plan.packedBlockCount++;
+		plan.rewriteEntryCount += entries;
+		plan.relocEntryCount += paddedEntries;
+		plan.relocTableSize += (paddedEntries * sizeof(uint16_t)) + 8;
+
+		for (auto offset = packedBlock.offsets.begin(); offset != packedBlock.offsets.end(); offset++)
+			entryRVAs.push_back(packedBlock.beginRVA + *offset);
+	}
+
+	/* overlapping entries (multipass) only count their bytes once */
 	const uint32_t dataSize = 4;
-	const uint32_t chunkSize = 1024 * dataSize;
-	for (auto iblock = this->rewriteBlocks.begin(); iblock != this->rewriteBlocks.end(); iblock++)
+	std::sort(entryRVAs.begin(), entryRVAs.end());
+	uint32_t coveredEnd = 0;
+	for (auto rva : entryRVAs)
 	{
-		auto& block = *iblock;
-		if (!block)
-			continue;
+		auto begin = std::max(rva, coveredEnd);
+		if (rva + dataSize > begin)
+			plan.rewriteCoverage += (rva + dataSize) - begin;
+		coveredEnd = std::max(coveredEnd, rva + dataSize);
+	}
 
-		uint32_t rva, offset;
-		if (!block->getFirstEntryLoc(dataSize, rva, offset))
-			continue;
-		packedBlocks.push_front(PackedBlock(rva));
+	/* the reloc section gets resized to hold the new table, padded to 512 bytes */
+	auto relocSec = this->getSectionByRVA(peHeader.getIddBaseRelocRva(), 4);
+	if (!relocSec)
+	{
+		this->errorStream << "Failed to locate reloc section!" << std::endl;
+		return false;
+	}
 
-		do
+	uint32_t headerSize = peHeader.size();
+	uint32_t nextOffset = headerSize, nextRVA = headerSize;
+	for (unsigned int sec = 0; sec < peHeader.calcNumberOfSections(); sec++)
+	{
+		PeOutputPlan::SectionPlan section;
+		section.name = peHeader.getSectionName(sec);
+		section.RVA = peHeader.getVirtualAddress(sec);
+		section.virtualSize = peHeader.getVirtualSize(sec);
+		section.rawPointer = peHeader.getPointerToRawData(sec);
+		section.rawSize = peHeader.getSizeOfRawData(sec);
+		if (sec == relocSec->index)
 		{
-			if (!block->decrementEntry(offset, packDelta))
-				break;
+			section.virtualSize = plan.relocTableSize;
+			section.rawSize = PeLib::alignOffset(plan.relocTableSize, 512);
+		}
 
-			auto packedBlock = packedBlocks.begin();
-			auto rvaOffset = static_cast<uint16_t>((rva - packedBlock->beginRVA));
-			if (rvaOffset >= chunkSize)
-			{
-				rvaOffset = 0;
-				packedBlocks.push_front(PackedBlock(rva));
-				packedBlock = packedBlocks.begin();
-			}
+		nextOffset = std::max(nextOffset, section.rawPointer + section.rawSize);
+		nextRVA = std::max(nextRVA, section.RVA + std::max(section.virtualSize, section.rawSize));
+		plan.sections.push_back(section);
+	}
 
-			packedBlock->offsets.push_back(rvaOffset);
+	if (this->shouldUseWin10Attack)
+	{
+		/*
+			mirror PeHeader::makeValid() and addSection(). the stub currently gets
+			a section header from both allocSection() and prepareOutput(), so two
+			are accounted for here to match what actually gets written.
+		*/
+		uint32_t fileAlignment = PeLib::alignOffset(peHeader.getFileAlignment(), 0x200);
+		uint32_t sectionAlignment = PeLib::alignOffset(peHeader.getSectionAlignment(), 0x1000);
+		if (!fileAlignment) fileAlignment = 0x200;
+		if (!sectionAlignment) sectionAlignment = 0x1000;
+
+		auto stubLen = static_cast<uint32_t>(getStubLength());
+		for (int i = 0; i < 2; i++)
+		{
+			PeOutputPlan::SectionPlan section;
+			section.name = ".presel";
+			section.rawPointer = PeLib::alignOffset(std::max(nextOffset, headerSize), fileAlignment);
+			section.rawSize = PeLib::alignOffset(stubLen, fileAlignment);
+			section.RVA = PeLib::alignOffset(std::max(nextRVA, headerSize), sectionAlignment);
+			section.virtualSize = PeLib::alignOffset(stubLen, sectionAlignment);
+
+			headerSize += PeLib::PELIB_IMAGE_SECTION_HEADER::size();
+			nextOffset = section.rawPointer + section.rawSize;
+			nextRVA = section.RVA + std::max(section.virtualSize, section.rawSize);
+			plan.sections.push_back(section);
 		}
-		while (block->getNextEntryLoc(dataSize, offset, rva, offset));
 	}
 
+	plan.outputSize = std::max<size_t>(static_cast<size_t>(mzHeader.getAddressOfPeHeader()) + headerSize, nextOffset);
+
+	fixupRVAs.insert(fixupRVAs.end(), entryRVAs.begin(), entryRVAs.end());
+	this->estimateLoadCost(fixupRVAs, peHeader.getIddBaseRelocRva(), plan.relocTableSize, plan.loadCost);
+	if (!this->checkLoadBudget(plan.loadCost))
+		return false;
+
+	this->infoStream << "\tPlanned " << std::dec << plan.packedBlockCount << " reloc blocks (" << plan.relocEntryCount << " entries) for an output of " << plan.outputSize << std::hex << " bytes" << std::endl;
+	return true;
+}
+
+bool PeRecompiler::writeOutputFile()
+{
+	PeLib::TraceSpan span("PeRecompiler::writeOutputFile", "reloc");
+	if (this->outputFileName.empty())
+	{
+		this->errorStream << "No output file name was given; use writeOutput() instead" << std::endl;
+		return false;
+	}
+
+	std::vector<uint8_t> headerImage;
+	std::vector<OutputExtent> extents;
+	size_t imageSize;
+	if (!this->prepareOutput(headerImage, extents, imageSize))
+		return false;
+
+	PeLib::IoScope ioScope(*this->io);
+	this->discardRewritePlan();
+
+	/*
+		written aside and renamed into place: a reused rewrite plan streams
+		sections out of the previous output, which mustn't be truncated
+		while it's still being read.
+	*/
+	std::error_code ec, ignored;
+	auto tempName = this->outputFileName + OUTPUT_TEMP_EXTENSION;
+	auto write = [&](std::ostream &sink) { return this->streamOutput(sink, extents, imageSize); };
+	bool written = this->outputWriter ? this->outputWriter(tempName, write) : writeFileStream(tempName, write);
+	this->previousOutput.close();
+	if (written)
+		std::filesystem::rename(tempName, this->outputFileName, ec);
+	if (!written || ec)
+	{
+		std::filesystem::remove(tempName, ignored);
+		this->errorStream << "Failed to write output file: " << this->outputFileName << std::endl;
+		return false;
+	}
+
+	this->infoStream << "\tWrote output file: " << this->outputFileName << std::endl;
+
+	/* a failure to cache the result doesn't fail the job */
+	if (this->resultCache)
+	{
+		if (this->cacheKey.empty())
+			this->cacheKey = ResultCache::makeKey(this->inputImage, this->inputSize, this->cacheOptions);
+
+		if (this->resultCache->store(this->cacheKey, this->outputFileName))
+			this->infoStream << "\tStored output in result cache (" << this->cacheKey << ")" << std::endl;
+		else
+			this->infoStream << "\tFailed to store output in result cache" << std::endl;
+	}
+
+	/* nor does a failure to keep the rewrite plan; the next run just rewrites everything */
+	if (this->keepRewritePlan)
+	{
+		if (this->saveRewritePlan())
+			this->infoStream << "\tSaved rewrite plan: " << this->planFileName << std::endl;
+		else
+			this->infoStream << "\tFailed to save rewrite plan" << std::endl;
+	}
+	return true;
+}
+
+bool PeRecompiler::writeOutput(std::ostream &sink)
+{
+	PeLib::TraceSpan span("PeRecompiler::writeOutput", "reloc");
+	std::vector<uint8_t> headerImage;
+	std::vector<OutputExtent> extents;
+	size_t imageSize;
+	if (!this->prepareOutput(headerImage, extents, imageSize))
+		return false;
+
+	if (!this->streamOutput(sink, extents, imageSize))
+	{
+		this->errorStream << "Failed to write output image to sink" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool PeRecompiler::writeOutput(std::vector<uint8_t> &output)
+{
+	PeLib::TraceSpan span("PeRecompiler::writeOutput", "reloc");
+	std::vector<uint8_t> headerImage;
+	std::vector<OutputExtent> extents;
+	size_t imageSize;
+	if (!this->prepareOutput(headerImage, extents, imageSize))
+		return false;
+
+	/* later extents win where they overlap, same as sequential writes to a file */
+	output.assign(imageSize, 0x00);
+	for (auto& extent : extents)
+		copyExtent(extent, output.data() + extent.offset);
+	return true;
+}
+
+bool PeRecompiler::verifyOutputFile()
+{
+	PeLib::TraceSpan span("PeRecompiler::verifyOutputFile", "reloc");
+	PeLib::IoScope ioScope(*this->io);
+	MappedFile output;
+	if (!output.open(this->outputFileName))
+	{
+		this->errorStream << "Failed to open output file for verification: " << this->outputFileName << std::endl;
+		return false;
+	}
+	return this->verifyOutput(output.data(), output.size());
+}
+
+bool PeRecompiler::verifyOutput(const std::vector<uint8_t> &output)
+{
+	return this->verifyOutput(output.data(), output.size());
+}
+
+bool PeRecompiler::verifyOutput(const uint8_t *output, size_t outputSize)
+{
+	PeLib::TraceSpan span("PeRecompiler::verifyOutput", "reloc");
+	if (!this->readInputImage())
+		return false;
+
+	/*
+		load both images at the base we expect to land on and make sure the
+		loader turns our output back into the relocated original.
+	*/
+	LoaderEmulator loader(this->infoStream, this->errorStream);
+	return loader.verify(this->inputImage, this->inputSize, output, outputSize, ACTUALIZED_BASE_ADDRESS);
+}
+
+const PeLib::IoStats& PeRecompiler::ioStats() const
+{
+	return *this->io;
+}
+
+bool PeRecompiler::prepareOutput(std::vector<uint8_t> &headerImage, std::vector<OutputExtent> &extents, size_t &imageSize)
+{
+	PeLib::TraceSpan span("PeRecompiler::prepareOutput", "reloc");
+	if (!this->peFile)
+		return false;
+
+	if (!this->sectionContents.size())
+	{
+		this->errorStream << "Section contents must be loaded before writing output!" << std::endl;
+		return false;
+	}
+
+	if (this->planOnly)
+	{
+		this->errorStream << "Output cannot be written in plan-only mode!" << std::endl;
+		return false;
+	}
+
+	this->infoStream << "Generating output image" << std::endl;
+
+	auto& reloc = this->peFile->relocDir();
+	auto& peHeader = this->peFile->peHeader();
+	auto& mzHeader = this->peFile->mzHeader();
+
+	/*
+		first, we need to actually DO THE REWRITES that we have queued up.
+		we will modify the contents buffers we have in rewriteBlocks and
+		keep a ledger of those so we can generate a reloc table later.
+
+		in order to support overlapping relocs, overlapping entries must be
+		recorded in the reverse order that we decrement them, as relocations
+		are processed in a linear fashion. packRewriteBlocks() takes care of
+		that while bucketing everything else into one block per page.
+	*/
+	std::list<PackedBlock> packedBlocks;
+	if (!this->keepRewritePlan || !this->applyRewritePlan(packedBlocks))
+		this->packRewriteBlocks(packedBlocks, true);
+	this->emittedBlocks = packedBlocks;
+
 	/* now that that's done, we actually need to generate a reloc table... */
 	if (packedBlocks.size())
 	{
@@ -550,16 +1583,34 @@ bool PeRecompiler::writeOutputFile()
 		return false;
 	}
 
-	relocSec->data.clear();
-	reloc.rebuild(relocSec->data);
-	peHeader.setVirtualSize(relocSec->index, relocSec->data.size());
-	peHeader.setIddBaseRelocSize(relocSec->data.size());
-	while (relocSec->data.size() % 512)
-		relocSec->data.push_back(0x00);
-	peHeader.setSizeOfRawData(relocSec->index, relocSec->data.size());
+	auto& relocData = relocSec->clearData();
+	reloc.rebuild(relocData);
+	peHeader.setVirtualSize(relocSec->index, relocData.size());
+	peHeader.setIddBaseRelocSize(relocData.size());
+	while (relocData.size() % 512)
+		relocData.push_back(0x00);
+	peHeader.setSizeOfRawData(relocSec->index, relocData.size());
 
 	this->infoStream << "\tUpdated PE header with new reloc meta-data" << std::endl;
 
+	/* report what the loader will have to do with that table, and hold it to the budget */
+	std::vector<uint32_t> fixupRVAs;
+	for (unsigned int rel = 0; rel < reloc.calcNumberOfRelocations(); rel++)
+	{
+		for (unsigned int relEntry = 0; relEntry < reloc.calcNumberOfRelocationData(rel); relEntry++)
+		{
+			auto entry = reloc.getRelocationData(rel, relEntry);
+			if ((entry >> 12) == IMAGE_REL_BASED_HIGHLOW)
+				fixupRVAs.push_back(reloc.getVirtualAddress(rel) + (entry & 0x0FFF));
+		}
+	}
+
+	PeLoadCost loadCost;
+	this->estimateLoadCost(fixupRVAs, peHeader.getIddBaseRelocRva(), peHeader.getIddBaseRelocSize(), loadCost);
+	loadCost.print(this->infoStream);
+	if (!this->checkLoadBudget(loadCost))
+		return false;
+
 	/* validate the binary since we changed some sections */
 	peHeader.makeValid(mzHeader.getAddressOfPeHeader());
 	this->infoStream << "\tValidated new PE header" << std::endl;
@@ -597,31 +1648,113 @@ bool PeRecompiler::writeOutputFile()
 		this->infoStream << "\t\tEP updated to RVA" << std::endl;
 
 		/* write the stub to the section */
-		pushBytes((const char*)stub, stubLen, sc->data);
+		pushBytes((const char*)stub, stubLen, sc->clearData());
 	}
 	
-	/* write original MZ and PE headers to new binary */
-	mzHeader.write(this->outputFileName, 0);
-	this->infoStream << "\tWrote MZ Header to output file" << std::endl;
-
-    peHeader.write(this->outputFileName, mzHeader.getAddressOfPeHeader());
-	this->infoStream << "\tWrote PE Header to output file" << std::endl;
-        
-	/* write section meta-data and contents to new binary */
-    peHeader.writeSections(this->outputFileName);
-	this->infoStream << "\tWrote PE Section meta-data to output file" << std::endl;
+	/*
+		describe the new binary as a list of extents instead of assembling it.
+		the headers get one buffer (anything between them, like the DOS stub,
+		is left zeroed); sections are read out a window at a time as they're
+		written, so none of them is ever held whole.
+	*/
+	headerImage.clear();
+	extents.clear();
+
+	std::vector<uint8_t> headerBuffer;
+	mzHeader.rebuild(headerBuffer);
+	putBytes(headerImage, 0, headerBuffer.data(), headerBuffer.size());
+	this->infoStream << "\tWrote MZ Header to output image" << std::endl;
+
+	headerBuffer.clear();
+	peHeader.rebuild(headerBuffer);
+	putBytes(headerImage, mzHeader.getAddressOfPeHeader(), headerBuffer.data(), headerBuffer.size());
+	extents.push_back({ 0, headerImage.data(), nullptr, headerImage.size() });
+	this->infoStream << "\tWrote PE Header to output image" << std::endl;
+
+	/* size the image to hold every section's raw data */
+	imageSize = headerImage.size();
+	for (unsigned int sec = 0; sec < peHeader.calcNumberOfSections(); sec++)
+	{
+		size_t sectionEnd = static_cast<size_t>(peHeader.getPointerToRawData(sec)) + peHeader.getSizeOfRawData(sec);
+		if (imageSize < sectionEnd)
+			imageSize = sectionEnd;
+	}
+	this->infoStream << "\tWrote PE Section meta-data to output image" << std::endl;
 
+	size_t modified = 0;
 	for (auto isec = this->sectionContents.begin(); isec != this->sectionContents.end(); isec++)
 	{
 		auto& sec = *isec;
-		if (sec->size)
-			peHeader.writeSectionData(this->outputFileName, sec->index, sec->data);
+		if (!sec->size)
+			continue;
+		auto writeSize = std::min<size_t>(sec->length(), peHeader.getSizeOfRawData(sec->index));
+		extents.push_back({ peHeader.getPointerToRawData(sec->index), nullptr, sec.get(), writeSize });
+		if (sec->isModified())
+			modified++;
 	}
-	this->infoStream << "\tWrote PE Section Contents to output file" << std::endl;
+	this->infoStream << "\tWrote PE Section Contents to output image (" << std::dec << modified << " of " << this->sectionContents.size() << std::hex << " sections modified)" << std::endl;
 
 	return true;
 }
 
+bool PeRecompiler::streamOutput(std::ostream &sink, const std::vector<OutputExtent> &extents, size_t imageSize)
+{
+	PeLib::TraceSpan span("PeRecompiler::streamOutput", "reloc");
+	auto ordered = extents;
+	std::stable_sort(ordered.begin(), ordered.end(), [](const OutputExtent& a, const OutputExtent& b) { return a.offset < b.offset; });
+
+	for (size_t i = 1; i < ordered.size(); i++)
+	{
+		if (ordered[i].offset < ordered[i - 1].offset + ordered[i - 1].size)
+		{
+			/* overlapping extents need write-order semantics; flatten them first */
+			std::vector<uint8_t> image(imageSize, 0x00);
+			for (auto& extent : extents)
+				copyExtent(extent, image.data() + extent.offset);
+			return static_cast<bool>(sink.write(reinterpret_cast<const char*>(image.data()), image.size()));
+		}
+	}
+
+	/* write extents in file order, zero-filling the gaps between them */
+	const char zeros[512] = { 0 };
+	std::vector<uint8_t> window;
+	size_t position = 0;
+	for (auto& extent : ordered)
+	{
+		for (; position < extent.offset; position += std::min(sizeof(zeros), extent.offset - position))
+			sink.write(zeros, std::min(sizeof(zeros), extent.offset - position));
+
+		if (!extent.section)
+			sink.write(reinterpret_cast<const char*>(extent.data), extent.size);
+		for (size_t done = 0; extent.section && done < extent.size; done += SECTION_WINDOW_SIZE)
+		{
+			extent.section->read(done, std::min<size_t>(SECTION_WINDOW_SIZE, extent.size - done), window);
+			sink.write(reinterpret_cast<const char*>(window.data()), window.size());
+		}
+		position += extent.size;
+	}
+	for (; position < imageSize; position += std::min(sizeof(zeros), imageSize - position))
+		sink.write(zeros, std::min(sizeof(zeros), imageSize - position));
+
+	return static_cast<bool>(sink);
+}
+
+void PeRecompiler::copyExtent(const OutputExtent &extent, uint8_t *destination)
+{
+	if (!extent.section)
+	{
+		std::copy(extent.data, extent.data + extent.size, destination);
+		return;
+	}
+
+	std::vector<uint8_t> window;
+	for (size_t done = 0; done < extent.size; done += SECTION_WINDOW_SIZE)
+	{
+		extent.section->read(done, std::min<size_t>(SECTION_WINDOW_SIZE, extent.size - done), window);
+		std::copy(window.begin(), window.end(), destination + done);
+	}
+}
+
 
 bool PeRecompiler::doRewriteReadyCheck()
 {
@@ -646,17 +1779,37 @@ bool PeRecompiler::doRewriteReadyCheck()
 	return true;
 }
 
-std::shared_ptr<PeSectionContents> PeRecompiler::getSectionByRVA(uint32_t RVA, uint32_t size)
+bool PeRecompiler::baseUnusable(uint32_t imageBase, uint32_t sizeOfImage)
+{
+	return static_cast<uint64_t>(imageBase) + sizeOfImage > USER_ADDRESS_LIMIT || imageBase < ACTUALIZED_BASE_ADDRESS;
+}
+
+bool PeRecompiler::sectionHoldsRange(uint32_t sectionRVA, uint32_t sectionSize, uint32_t RVA, uint32_t size)
 {
 	if (!RVA || !size)
-		return nullptr;
+		return false;
+	return !(RVA < sectionRVA || RVA >= (sectionRVA + sectionSize) || (RVA + size) > (sectionRVA + sectionSize));
+}
 
+PeRecompiler::RelocEntryAction PeRecompiler::checkRelocEntry(uint16_t entryType, uint32_t sectionOffset, size_t sectionSize)
+{
+	/* any type sharing a bit with HIGHLOW is applied as one; the bound is the one getData() checks */
+	if (entryType & IMAGE_REL_BASED_HIGHLOW)
+	{
+		if (sectionOffset + static_cast<uint32_t>(sizeof(uint32_t)) >= sectionSize)
+			return RELOC_ENTRY_OUT_OF_BOUNDS;
+		return RELOC_ENTRY_APPLY;
+	}
+	return entryType ? RELOC_ENTRY_UNKNOWN_TYPE : RELOC_ENTRY_SKIP;
+}
+
+std::shared_ptr<PeSectionContents> PeRecompiler::getSectionByRVA(uint32_t RVA, uint32_t size)
+{
 	for (auto isec = this->sectionContents.begin(); isec != this->sectionContents.end(); isec++)
 	{
 		auto& sec = *isec;
-		if (RVA < sec->RVA || RVA >= (sec->RVA + sec->size) || (RVA + size) > (sec->RVA + sec->size))
-			continue;
-		return sec;
+		if (sectionHoldsRange(sec->RVA, sec->size, RVA, size))
+			return sec;
 	}
 	return nullptr;
 }
@@ -1,4 +1,5 @@
 #pragma once
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
@@ -7,18 +8,124 @@
 #include <iomanip>
 #include <stdint.h>
 
+#include "MappedFile.h"
+
 class RewriteBlock;
-namespace PeLib { class PeFile32; };
+class ResultCache;
+namespace PeLib { class PeFile32; struct IoStats; };
+
+/*
+	packed images ask for TRICKY_BASE_ADDRESS, which can never be honored;
+	the loader falls back to ACTUALIZED_BASE_ADDRESS and relocates there.
+*/
+const uint32_t TRICKY_BASE_ADDRESS = 0xFFFF0000;
+const uint32_t ACTUALIZED_BASE_ADDRESS = 0x00010000;
+
+/*
+	ballpark defaults for a 32-bit image on a desktop: a fixup is a load, an
+	add and a store, while a touched page costs a soft fault plus a copy on
+	write. both are meant to be replaced with numbers measured on the target.
+*/
+const double DEFAULT_ENTRY_NANOSECONDS = 2.0;
+const double DEFAULT_PAGE_NANOSECONDS = 2000.0;
 
+/*
+	the contents of one input section. they're served straight from the input
+	image (mapped, for files) and never copied: relocations and rewrites are
+	queued as dwords to add to, in the order they're made, and applied one
+	window at a time whenever something reads the section, which is how it
+	gets searched and streamed out. memory goes with what's queued, and runs
+	of dwords queued in one go take one entry, so rewriting a whole section
+	costs next to nothing. only sections built here, like the reloc table and
+	the stub, hold their contents themselves.
+*/
 class PeSectionContents
 {
 public:
 	std::string name;
-	std::vector<uint8_t> data;
 	uint32_t index, RVA, size, virtualSize, rawPointer;
 
-	PeSectionContents() {}
-	PeSectionContents(uint32_t index, std::shared_ptr<PeLib::PeFile32> &_header, std::ifstream &file);
+	PeSectionContents() : source(nullptr), adjustmentCount(0) {}
+	PeSectionContents(uint32_t index, std::shared_ptr<PeLib::PeFile32> &_header, const uint8_t *image, size_t imageSize);
+
+	size_t length() const;
+
+	/* whether the dword at offset can be adjusted; the bound is the one getData() checks */
+	bool holdsEntry(uint32_t offset) const;
+
+	/* queues value to be added to the dword at offset, after everything queued so far */
+	bool adjustEntry(uint32_t offset, uint32_t value);
+
+	/* [offset, offset + size) with everything queued applied, clipped to the section */
+	void read(size_t offset, size_t size, std::vector<uint8_t> &window) const;
+
+	/* serves the section from contents, which holds length() bytes, dropping anything queued */
+	void replaceSource(const uint8_t *contents);
+	std::vector<uint8_t>& clearData();
+	bool isModified() const { return this->source == nullptr || this->adjustmentCount; }
+
+	void print(std::ostream &stream);
+
+private:
+	/* count dwords, 4 bytes apart from offset on, which all get value added at once */
+	struct Adjustment
+	{
+		uint32_t order, offset, count, value;
+	};
+
+	const uint8_t* source;
+	std::vector<uint8_t> data;
+	uint32_t adjustmentCount;
+	std::vector<std::vector<Adjustment>> adjustments; /* by the window their first dword starts in */
+};
+
+/*
+	what the loader has to do to apply a reloc table: every page a fixup
+	lands on gets faulted in and copied on write before it is patched.
+	the estimate is only as good as the per-entry and per-page costs it
+	is given, which should be measured on the target.
+*/
+class PeLoadCost
+{
+public:
+	uint32_t relocationCount;		/* HIGHLOW entries the loader applies */
+	uint32_t pagesTouched;			/* distinct image pages patched, including straddled ones */
+	uint32_t tablePages;			/* pages the reloc table itself spans */
+	uint32_t maxEntriesPerPage;
+	double averageEntriesPerPage;
+	uint32_t bytesPatched;
+	double estimatedMicroseconds;
+
+	PeLoadCost() :
+		relocationCount(0), pagesTouched(0), tablePages(0), maxEntriesPerPage(0),
+		averageEntriesPerPage(0), bytesPatched(0), estimatedMicroseconds(0) {}
+
+	void print(std::ostream &stream) const;
+};
+
+class PeOutputPlan
+{
+public:
+	struct SectionPlan
+	{
+		std::string name;
+		uint32_t RVA, virtualSize, rawPointer, rawSize;
+	};
+
+	uint32_t relocationCount;		/* original relocations applied on disk */
+	uint32_t rewriteBlockCount;		/* queued rewrite blocks, including multipass siblings */
+	uint32_t rewriteEntryCount;		/* dwords that will be decremented */
+	uint32_t rewriteCoverage;		/* distinct bytes touched by those dwords */
+	uint32_t packedBlockCount;		/* blocks in the generated reloc table */
+	uint32_t relocEntryCount;		/* entries in the generated reloc table, including padding */
+	uint32_t relocTableSize;
+	size_t outputSize;
+	std::vector<SectionPlan> sections;
+	PeLoadCost loadCost;
+
+	PeOutputPlan() :
+		relocationCount(0), rewriteBlockCount(0), rewriteEntryCount(0), rewriteCoverage(0),
+		packedBlockCount(0), relocEntryCount(0), relocTableSize(0), outputSize(0) {}
 
 	void print(std::ostream &stream);
 };
@@ -30,11 +137,38 @@ public:
 		std::ostream &_infoStream, std::ostream &_errorStream,
 		const std::string &_inputFileName, const std::string &_outputFileName
 	);
+	PeRecompiler(
+		std::ostream &_infoStream, std::ostream &_errorStream,
+		const uint8_t *_inputData, size_t _inputSize
+	);
 	~PeRecompiler() {}
 
 	void useWindows10Attack(bool win10);
 	void doMultiPass(bool multi);
 
+	/*
+		plan mode goes through the same stages, but reports on the output
+		instead of writing it. performOnDiskRelocations() still changes the
+		in-memory PE header as for a real run: DllCharacteristics (the dynamic
+		base flag), ImageBase (unless --win10), and the reloc directory, which
+		it clears. section contents are never written; see PeSectionContents.
+	*/
+	void doPlanOnly(bool plan);
+	void setLoadCostModel(double entryNanoseconds, double pageNanoseconds);
+	void setLoadBudget(double microseconds);
+	void useResultCache(std::shared_ptr<ResultCache> cache, const std::string &options);
+	void useRewritePlan(bool incremental);
+
+	/*
+		creates fileName, has write() stream an output into it and closes it,
+		failing if any of that does. writeOutputFile() writes its temporary
+		file through one, a PeLib::FileStream unless it's given another.
+	*/
+	typedef std::function<bool(const std::string &fileName, const std::function<bool(std::ostream&)> &write)> OutputWriter;
+	void useOutputWriter(OutputWriter writer);
+
+	bool fetchCachedOutput();
+
 	bool loadInputFile();
 	bool loadInputSections();
 
@@ -47,23 +181,116 @@ public:
 
 	bool rewriteMatches(const std::string &needle);
 
+	bool planOutput(PeOutputPlan &plan);
+
 	bool writeOutputFile();
+	bool writeOutput(std::vector<uint8_t> &output);
+	bool writeOutput(std::ostream &sink);
+
+	bool verifyOutputFile();
+	bool verifyOutput(const std::vector<uint8_t> &output);
+	bool verifyOutput(const uint8_t *output, size_t outputSize);
+
+	/* file I/O done by this run so far */
+	const PeLib::IoStats& ioStats() const;
+
+	/*
+		the rules the original reloc table is applied by, which PackPreflight
+		checks a file against without loading it. both use 32-bit arithmetic,
+		wraparound included, as the packer always has.
+	*/
+	enum RelocEntryAction
+	{
+		RELOC_ENTRY_SKIP,			/* padding */
+		RELOC_ENTRY_APPLY,
+		RELOC_ENTRY_OUT_OF_BOUNDS,	/* the patched dword isn't inside the section */
+		RELOC_ENTRY_UNKNOWN_TYPE,
+	};
+
+	/*
+		maps as much of fileName as the image takes up, which leaves out an
+		overlay or anything else past the raw data of the last section;
+		imageSize is how much of the mapping that is. a file whose headers
+		don't parse is mapped whole, for loadInputFile() to complain about.
+	*/
+	static bool mapImage(const std::string &fileName, MappedFile &mapping, size_t &imageSize);
+
+	/*
+		whether the loader can't put an image at its ImageBase, with or
+		without ASLR, and has to relocate it: it would reach past the 32-bit
+		user address space, or start below ACTUALIZED_BASE_ADDRESS
+	*/
+	static bool baseUnusable(uint32_t imageBase, uint32_t sizeOfImage);
+
+	/* whether [RVA, RVA + size) lies in the raw data of a section */
+	static bool sectionHoldsRange(uint32_t sectionRVA, uint32_t sectionSize, uint32_t RVA, uint32_t size);
+
+	/* what applying an entry of entryType, sectionOffset bytes into a section of sectionSize, comes to */
+	static RelocEntryAction checkRelocEntry(uint16_t entryType, uint32_t sectionOffset, size_t sectionSize);
 
 private:
+	/* section extents are read a window at a time; the others are written from data */
+	struct OutputExtent
+	{
+		size_t offset;
+		const uint8_t* data;
+		const PeSectionContents* section;
+		size_t size;
+	};
+
+	struct PackedBlock
+	{
+		PackedBlock(unsigned int _layer, unsigned int _beginRVA) : layer(_layer), beginRVA(_beginRVA), offsets() {}
+		unsigned int layer;
+		unsigned int beginRVA;
+		std::vector<unsigned short> offsets;
+	};
+
+	/* (layer, RVA) of one rewritten entry; see layerRewriteEntries() */
+	typedef std::pair<uint32_t, uint32_t> LayeredEntry;
+
 	bool multiPass;
+	bool planOnly;
+	uint32_t relocationCount;
+	double entryCost, pageCost, loadBudget;
 	bool shouldUseWin10Attack;
 	std::ostream &infoStream, &errorStream;
 	std::string inputFileName, outputFileName;
+	std::vector<uint8_t> inputData; /* the image, when given as bytes... */
+	MappedFile inputMapping; /* ...or mapped from inputFileName */
+	MappedFile previousOutput; /* what a reused rewrite plan takes its sections from, until the new output replaces it */
+	const uint8_t* inputImage;
+	size_t inputSize;
+	std::shared_ptr<ResultCache> resultCache;
+	std::string cacheOptions, cacheKey;
+	std::string planFileName; /* where the rewrite plan of the output file goes */
+	bool keepRewritePlan;
+	OutputWriter outputWriter;
+	std::list<PackedBlock> emittedBlocks; /* reloc blocks generated for the rewrites of the last output */
 	std::shared_ptr<PeLib::PeFile32> peFile;
+	std::shared_ptr<PeLib::IoStats> io;
 	
 	std::list<std::shared_ptr<PeSectionContents>> sectionPool;
 	std::vector<std::shared_ptr<PeSectionContents>> sectionContents;
 	std::vector<std::shared_ptr<RewriteBlock>> rewriteBlocks;
 
+	bool readInputImage();
 	bool doRewriteReadyCheck();
 	std::shared_ptr<PeSectionContents> getSectionByRVA(uint32_t RVA, uint32_t size);
 	std::shared_ptr<PeSectionContents> allocSection(const std::string& name, uint32_t size, uint32_t access);
 	bool rewriteSubsectionByRVA(uint32_t RVA, uint32_t size);
+	void packRewriteBlocks(std::list<PackedBlock> &packedBlocks, bool apply);
+	void collectRewriteEntries(const std::vector<std::shared_ptr<RewriteBlock>> &blocks, uint32_t packDelta, bool apply, std::vector<uint32_t> &entryRVAs);
+	void layerRewriteEntries(const std::vector<uint32_t> &entryRVAs, std::vector<LayeredEntry> &layeredEntries);
+	void packLayeredEntries(std::vector<LayeredEntry> &layeredEntries, std::list<PackedBlock> &packedBlocks);
+	bool applyRewritePlan(std::list<PackedBlock> &packedBlocks);
+	bool saveRewritePlan();
+	void discardRewritePlan();
+	void estimateLoadCost(std::vector<uint32_t> &targets, uint32_t tableRVA, uint32_t tableSize, PeLoadCost &cost);
+	bool checkLoadBudget(const PeLoadCost &cost);
+	bool prepareOutput(std::vector<uint8_t> &headerImage, std::vector<OutputExtent> &extents, size_t &imageSize);
+	bool streamOutput(std::ostream &sink, const std::vector<OutputExtent> &extents, size_t imageSize);
+	static void copyExtent(const OutputExtent &extent, uint8_t *destination);
 	
 
 	template <class RWBLOCK, typename... ARGS>
@@ -0,0 +1,133 @@
+#include "PeLibInclude.h"
+
+#include "RelocApi.h"
+#include "PackServer.h"
+
+#include <memory_resource>
+#include <new>
+#include <string.h>
+
+
+/*
+	a context packs exactly the way a server job does; the options are kept
+	as the switches they stand for and parsed by PackOptions on every pack.
+	nothing may throw across the C boundary, so every entry point which
+	allocates catches everything.
+*/
+struct reloc_context
+{
+	std::vector<std::string> arguments;
+	PackJobResult result;
+
+	/* as in a PackServer worker, PeLib memory stays pooled in the context between packs */
+	std::pmr::unsynchronized_pool_resource arena;
+};
+
+static const char* const RELOC_FLAG_OPTIONS[] = { "win10", "noImports", "rewriteHeader", "fixupBase", "multipass", "plan", "verify" };
+static const char* const RELOC_VALUE_OPTIONS[] = { "section", "stringMatch", "loadBudget", "entryCost", "pageCost" };
+
+
+unsigned int reloc_api_version(void)
+{
+	return RELOC_API_VERSION;
+}
+
+reloc_context* reloc_create(void)
+{
+	try
+	{
+		return new reloc_context();
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+void reloc_destroy(reloc_context* context)
+{
+	delete context;
+}
+
+int reloc_set_option(reloc_context* context, const char* name, const char* value)
+{
+	if (!context || !name)
+		return RELOC_ERROR_INVALID_ARGUMENT;
+
+	try
+	{
+		for (auto flag : RELOC_FLAG_OPTIONS)
+		{
+			if (!strcmp(name, flag))
+			{
+				context->arguments.push_back(std::string("--") + name);
+				return RELOC_OK;
+			}
+		}
+
+		for (auto option : RELOC_VALUE_OPTIONS)
+		{
+			if (!strcmp(name, option))
+			{
+				if (!value)
+					return RELOC_ERROR_INVALID_ARGUMENT;
+				context->arguments.push_back(std::string("--") + name + "=" + value);
+				return RELOC_OK;
+			}
+		}
+		return RELOC_ERROR_UNKNOWN_OPTION;
+	}
+	catch (...)
+	{
+		return RELOC_ERROR_INTERNAL;
+	}
+}
+
+int reloc_clear_options(reloc_context* context)
+{
+	if (!context)
+		return RELOC_ERROR_INVALID_ARGUMENT;
+
+	context->arguments.clear();
+	return RELOC_OK;
+}
+
+int reloc_pack(reloc_context* context, const uint8_t* input, size_t inputSize)
+{
+	if (!context)
+		return RELOC_ERROR_INVALID_ARGUMENT;
+
+	context->result = PackJobResult();
+	if (!input || !inputSize)
+		return RELOC_ERROR_INVALID_ARGUMENT;
+
+	try
+	{
+		PeLib::ArenaScope arenaScope(&context->arena);
+		PackServer::runJob(context->arguments, input, inputSize, context->result);
+		return context->result.succeeded ? RELOC_OK : RELOC_ERROR_PACK_FAILED;
+	}
+	catch (...)
+	{
+		context->result = PackJobResult();
+		return RELOC_ERROR_INTERNAL;
+	}
+}
+
+const uint8_t* reloc_get_output(const reloc_context* context, size_t* outputSize)
+{
+	auto size = context ? context->result.output.size() : 0;
+	if (outputSize)
+		*outputSize = size;
+	return size ? context->result.output.data() : nullptr;
+}
+
+const char* reloc_get_log(const reloc_context* context)
+{
+	return context ? context->result.log.c_str() : "";
+}
+
+const char* reloc_get_metrics(const reloc_context* context)
+{
+	return context ? context->result.metrics.c_str() : "";
+}
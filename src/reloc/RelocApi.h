@@ -0,0 +1,88 @@
+#pragma once
+/*
+	C interface to the packer, for calling it in-process from other languages
+	and services instead of running reloc.exe per job. built as relocapi.dll
+	(relocapi.vcxproj) from the same sources as reloc.exe.
+
+	the ABI only ever grows: functions aren't changed or removed, handles are
+	opaque and nothing but integers, pointers and NUL-terminated strings
+	crosses it. a context isn't thread-safe, but any number of contexts can
+	be used at once from different threads.
+
+	typical use:
+
+		reloc_context* ctx = reloc_create();
+		reloc_set_option(ctx, "section", ".text");
+		reloc_set_option(ctx, "verify", NULL);
+		if (reloc_pack(ctx, input, inputSize) == RELOC_OK)
+			output = reloc_get_output(ctx, &outputSize);
+		reloc_destroy(ctx);
+*/
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#if defined(RELOC_API_EXPORTS)
+#define RELOC_API __declspec(dllexport)
+#else
+#define RELOC_API __declspec(dllimport)
+#endif
+#else
+#define RELOC_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* bumped whenever functions are added */
+#define RELOC_API_VERSION 1
+
+#define RELOC_OK 0
+#define RELOC_ERROR_INVALID_ARGUMENT 1	/* a null context or input, or an option missing its value */
+#define RELOC_ERROR_UNKNOWN_OPTION 2	/* not one of the options listed for reloc_set_option() */
+#define RELOC_ERROR_PACK_FAILED 3		/* the input couldn't be packed; reloc_get_log() says why */
+#define RELOC_ERROR_INTERNAL 4			/* out of memory, or a bug */
+
+typedef struct reloc_context reloc_context;
+
+/* RELOC_API_VERSION of the library actually loaded, which may be newer than the header */
+RELOC_API unsigned int reloc_api_version(void);
+
+/* returns NULL when out of memory */
+RELOC_API reloc_context* reloc_create(void);
+RELOC_API void reloc_destroy(reloc_context* context);
+
+/*
+	options are the packing switches of reloc.exe, without the leading "--",
+	and keep their values for every reloc_pack() until cleared.
+
+	flags (value is ignored and may be NULL):
+		win10, noImports, rewriteHeader, fixupBase, multipass, plan, verify
+	repeatable, in order:
+		section, stringMatch
+	numbers:
+		loadBudget, entryCost, pageCost
+*/
+RELOC_API int reloc_set_option(reloc_context* context, const char* name, const char* value);
+RELOC_API int reloc_clear_options(reloc_context* context);
+
+/*
+	packs input (a whole PE file) with the options set so far. the input is
+	copied, so it can be freed as soon as this returns. the previous output,
+	log and metrics are replaced, even on failure.
+*/
+RELOC_API int reloc_pack(reloc_context* context, const uint8_t* input, size_t inputSize);
+
+/* the packed file from the last successful reloc_pack(), owned by the context until the next one; empty with "plan" */
+RELOC_API const uint8_t* reloc_get_output(const reloc_context* context, size_t* outputSize);
+
+/* everything reloc.exe would have printed for the last reloc_pack() */
+RELOC_API const char* reloc_get_log(const reloc_context* context);
+
+/* "name=value" lines for the last reloc_pack(): elapsedUs, inputBytes, outputBytes, ioOpens, ioReads, ioBytesRead, ioBytesMapped */
+RELOC_API const char* reloc_get_metrics(const reloc_context* context);
+
+#ifdef __cplusplus
+}
+#endif
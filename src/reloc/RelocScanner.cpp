@@ -0,0 +1,374 @@
+#include "PeLibInclude.h"
+
+#include "RelocScanner.h"
+#include "BulkIo.h"
+#include "MappedFile.h"
+#include "PackPreflight.h"
+#include "PeRecompiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <memory_resource>
+#include <thread>
+#include <string.h>
+
+
+/*
+	a page holds 1024 dwords; compilers emit a few hundred relocations per
+	page at most, even for pointer tables. more than this is not code.
+*/
+const uint32_t SCAN_DENSE_PAGE_RELOCATIONS = 512;
+const uint32_t SCAN_PAGE_SIZE = 0x1000;
+
+/*
+	every file gets the same PeLib parse budget, so a hostile header can't
+	make one worker allocate more than this, or keep it busy for longer,
+	however the tree is scheduled. the largest real reloc tables are a few MB.
+*/
+const unsigned int SCAN_MAX_PARSE_BYTES = 64 * 1024 * 1024;
+const unsigned int SCAN_MAX_PARSE_NODES = 1024 * 1024;
+const unsigned int SCAN_MAX_PARSE_ENTRIES = 16 * 1024 * 1024;
+const unsigned int SCAN_MAX_PARSE_DEPTH = 32;
+const unsigned int SCAN_MAX_PARSE_MILLISECONDS = 2000;
+
+/*
+	with io_uring, each worker reads this many files at a time. a file
+	which needs more than SCAN_MAX_FETCH_BYTES read, e.g. for a huge reloc
+	table, is mapped instead, so a batch's buffers stay small.
+*/
+const size_t SCAN_BULK_FILES = 32;
+const uint64_t SCAN_MAX_FETCH_BYTES = 2 * 1024 * 1024;
+
+/*
+	the scan, over a file read through readAt, which is only asked for the
+	headers, the reloc table and the relocated values. false if a read
+	failed; the values are all asked for regardless, so a BulkFile queues
+	every one of them in the same round.
+*/
+static bool scanReadable(uint64_t fileSize, const PackPreflight::ReadAt &readAt, RelocScanResult &result)
+{
+	/* PeLib sees at most the first 4GB, as it did of a whole mapped file */
+	auto parseLimit = std::min<uint64_t>(fileSize, UINT32_MAX);
+	std::vector<uint8_t> headers;
+	if (!PackPreflight::readHeaders(parseLimit, readAt, headers))
+		return false;
+
+	/* anything PeLib won't parse as a 32-bit image isn't ours to judge */
+	PeLib::PeFile32 peFile;
+	peFile.setParseBudget(PeLib::ParseBudget(SCAN_MAX_PARSE_BYTES, SCAN_MAX_PARSE_NODES, SCAN_MAX_PARSE_ENTRIES, SCAN_MAX_PARSE_DEPTH, SCAN_MAX_PARSE_MILLISECONDS));
+	auto headersSize = static_cast<unsigned int>(headers.size());
+	if (peFile.readMzHeader(headers.data(), headersSize) != PeLib::NO_ERROR || peFile.readPeHeader(headers.data(), headersSize) != PeLib::NO_ERROR)
+		return true;
+	result.isPe = true;
+
+	auto& peHeader = peFile.peHeader();
+	uint32_t imageBase = peHeader.getImageBase();
+	uint32_t sizeOfImage = peHeader.getSizeOfImage();
+	uint32_t sizeOfHeaders = peHeader.getSizeOfHeaders();
+	result.imageBase = imageBase;
+
+	/* e.g. 0xFFFF0000: can't be honored, and without ASLR the loader won't pick a base for us either */
+	if (!(peHeader.getDllCharacteristics() & PeLib::PELIB_IMAGE_DLLCHARACTERISTICS_DYNAMIC_BASE) &&
+		PeRecompiler::baseUnusable(imageBase, sizeOfImage))
+		result.flags |= RelocScanResult::FLAG_UNUSABLE_BASE;
+
+	/* the checks of PeFile::readRelocationsDirectory(), but only the directory itself is read */
+	uint32_t relocRva = peHeader.getIddBaseRelocRva();
+	uint32_t relocSize = peHeader.getIddBaseRelocSize();
+	if (peHeader.calcNumberOfRvaAndSizes() < 6 || !relocRva || !relocSize)
+		return true;
+	auto relocOffset = static_cast<uint32_t>(peHeader.rvaToOffset(relocRva));
+	if (relocOffset >= parseLimit || parseLimit - relocOffset < relocSize)
+		return true;
+
+	/* PeLib charges the whole table to the budget before parsing it, so don't read one it would refuse */
+	if (relocSize > SCAN_MAX_PARSE_BYTES)
+	{
+		result.overBudget = true;
+		return true;
+	}
+
+	std::vector<uint8_t> relocData(relocSize);
+	if (!readAt(relocOffset, relocData.data(), relocSize))
+		return false;
+	auto relocResult = peFile.relocDir().read(relocData.data(), relocSize, &peFile.parseBudget());
+	if (relocResult == PeLib::ERROR_BUDGET_EXCEEDED)
+		result.overBudget = true;
+	if (relocResult != PeLib::NO_ERROR)
+		return true;
+
+	bool readAll = true;
+	auto& reloc = peFile.relocDir();
+	std::vector<uint32_t> targets;
+	for (unsigned int rel = 0; rel < reloc.calcNumberOfRelocations(); rel++)
+	{
+		uint32_t blockRVA = reloc.getVirtualAddress(rel);
+		auto entryCount = reloc.calcNumberOfRelocationData(rel);
+		for (unsigned int relEntry = 0; relEntry < entryCount; relEntry++)
+		{
+			uint16_t entry = reloc.getRelocationData(rel, relEntry);
+			uint16_t entryType = (entry >> 12);
+			uint32_t target = blockRVA + (entry & 0x0FFF);
+			if (entryType == PeLib::PELIB_IMAGE_REL_BASED_ABSOLUTE)
+				continue;
+
+			result.relocationCount++;
+			if (entryType != PeLib::PELIB_IMAGE_REL_BASED_HIGHLOW)
+			{
+				result.unusualTypes++;
+				continue;
+			}
+
+			if (target < sizeOfHeaders)
+				result.headerTargets++;
+
+			/* a real fixup holds an address inside the image, relative to ImageBase */
+			auto offset = static_cast<uint64_t>(peHeader.rvaToOffset(target));
+			if (offset + sizeof(uint32_t) <= fileSize)
+			{
+				uint32_t value;
+				if (!readAt(offset, reinterpret_cast<uint8_t*>(&value), sizeof(value)))
+					readAll = false;
+				else if (value - imageBase >= sizeOfImage)
+					result.nonPointerTargets++;
+			}
+
+			targets.push_back(target);
+		}
+	}
+	if (!readAll)
+		return false;
+
+	/* blocks aren't necessarily page-aligned or sorted, so look at the targets themselves */
+	std::sort(targets.begin(), targets.end());
+	uint32_t pageRelocations = 0;
+	for (size_t i = 0; i < targets.size(); i++)
+	{
+		if (i && targets[i] - targets[i - 1] < sizeof(uint32_t))
+			result.overlappingTargets++;
+
+		if (i && (targets[i] / SCAN_PAGE_SIZE) != (targets[i - 1] / SCAN_PAGE_SIZE))
+			pageRelocations = 0;
+		if (++pageRelocations == SCAN_DENSE_PAGE_RELOCATIONS + 1)
+			result.densePages++;
+	}
+
+	if (result.headerTargets)
+		result.flags |= RelocScanResult::FLAG_HEADER_TARGETS;
+	if (result.nonPointerTargets)
+		result.flags |= RelocScanResult::FLAG_NON_POINTER_TARGETS;
+	if (result.overlappingTargets)
+		result.flags |= RelocScanResult::FLAG_OVERLAPPING_TARGETS;
+	if (result.densePages)
+		result.flags |= RelocScanResult::FLAG_DENSE_PAGES;
+	if (result.unusualTypes)
+		result.flags |= RelocScanResult::FLAG_UNUSUAL_TYPES;
+	return true;
+}
+
+
+void RelocScanResult::print(std::ostream &stream) const
+{
+	struct FlagName { uint32_t flag; const char* name; uint32_t count; };
+	const FlagName names[] =
+	{
+		{ FLAG_UNUSABLE_BASE, "unusableBase", 0 },
+		{ FLAG_HEADER_TARGETS, "headerTargets", this->headerTargets },
+		{ FLAG_NON_POINTER_TARGETS, "nonPointerTargets", this->nonPointerTargets },
+		{ FLAG_OVERLAPPING_TARGETS, "overlappingTargets", this->overlappingTargets },
+		{ FLAG_DENSE_PAGES, "densePages", this->densePages },
+		{ FLAG_UNUSUAL_TYPES, "unusualTypes", this->unusualTypes },
+	};
+
+	stream << this->fileName << "\t" << std::dec;
+	if (!this->isPe)
+	{
+		stream << "not a PE32 image" << std::endl;
+		return;
+	}
+	if (this->overBudget)
+	{
+		stream << "parse budget exceeded" << std::endl;
+		return;
+	}
+
+	stream << this->relocationCount << " relocations, ImageBase 0x" << std::hex << this->imageBase << std::dec;
+	for (auto& name : names)
+	{
+		if (!(this->flags & name.flag))
+			continue;
+		stream << ", " << name.name;
+		if (name.count)
+			stream << "(" << name.count << ")";
+	}
+	stream << std::hex << std::endl;
+}
+
+
+RelocScanner::RelocScanner(std::ostream &_infoStream, std::ostream &_errorStream)
+	: infoStream(_infoStream), errorStream(_errorStream), ioUring(false)
+{
+	this->infoStream << std::hex;
+	this->errorStream << std::hex;
+}
+
+void RelocScanner::useIoUring(bool enable)
+{
+	this->ioUring = enable;
+}
+
+bool RelocScanner::scanImage(const uint8_t *data, size_t size, RelocScanResult &result)
+{
+	PeLib::TraceSpan span("RelocScanner::scanImage", "reloc");
+	auto readAt = [&](uint64_t offset, uint8_t *buffer, uint64_t count) -> bool
+	{
+		if (offset > size || count > size - offset)
+			return false;
+		memcpy(buffer, data + offset, static_cast<size_t>(count));
+		return true;
+	};
+	scanReadable(size, readAt, result);
+	return true;
+}
+
+bool RelocScanner::scanFile(const std::string &fileName, RelocScanResult &result)
+{
+	PeLib::TraceSpan span("RelocScanner::scanFile", "reloc");
+	result = RelocScanResult();
+	result.fileName = fileName;
+
+	MappedFile file;
+	if (!file.open(fileName))
+		return false;
+	return this->scanImage(file.data(), file.size(), result);
+}
+
+bool RelocScanner::scanTree(const std::string &directory, unsigned int threadCount, std::vector<RelocScanResult> &results)
+{
+	auto startTime = std::chrono::steady_clock::now();
+
+	std::vector<std::string> fileNames;
+	std::error_code ec;
+	auto options = std::filesystem::directory_options::skip_permission_denied;
+	for (auto it = std::filesystem::recursive_directory_iterator(directory, options, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec))
+	{
+		std::error_code entryError;
+		if (it->is_regular_file(entryError))
+			fileNames.push_back(it->path().string());
+	}
+
+	if (ec)
+	{
+		this->errorStream << "Failed to walk directory: " << directory << std::endl;
+		return false;
+	}
+
+	/*
+		workers pull the next file off a shared counter, so a handful of big
+		files can't leave the other threads idle. each result has its own
+		slot, so nothing else needs locking.
+
+		PeLib allocates from a per-worker arena which is dropped in one go
+		after each file, so the workers don't fight over the heap.
+
+		with io_uring, a worker takes SCAN_BULK_FILES at a time and scans
+		them all over again after each round of reads, until none of them
+		asks for more: the headers, then the reloc table they point at, then
+		the values it relocates. whatever BulkIo fails is mapped instead.
+	*/
+	auto firstResult = results.size();
+	results.resize(firstResult + fileNames.size());
+
+	auto bulk = this->ioUring && BulkIo::ioUringSupported();
+	if (this->ioUring && !bulk)
+		this->infoStream << "io_uring isn't available, mapping files instead" << std::endl;
+
+	std::atomic<size_t> nextFile(0);
+	std::atomic<uint32_t> unreadableFiles(0);
+	auto worker = [&]() -> void
+	{
+		std::pmr::monotonic_buffer_resource arena;
+		PeLib::ArenaScope arenaScope(&arena);
+		if (!bulk)
+		{
+			for (size_t i = nextFile++; i < fileNames.size(); i = nextFile++)
+			{
+				if (!this->scanFile(fileNames[i], results[firstResult + i]))
+					unreadableFiles++;
+				arena.release();
+			}
+			return;
+		}
+
+		BulkIo bulkIo(SCAN_MAX_FETCH_BYTES);
+		std::vector<BulkFile> files;
+		std::vector<bool> scanned;
+		for (size_t first = nextFile.fetch_add(SCAN_BULK_FILES); first < fileNames.size(); first = nextFile.fetch_add(SCAN_BULK_FILES))
+		{
+			files.assign(std::min(SCAN_BULK_FILES, fileNames.size() - first), BulkFile());
+			scanned.assign(files.size(), false);
+			for (size_t i = 0; i < files.size(); i++)
+				files[i].fileName = fileNames[first + i];
+
+			bulkIo.openFiles(files);
+			for (bool pending = true; pending; )
+			{
+				pending = false;
+				for (size_t i = 0; i < files.size(); i++)
+				{
+					if (scanned[i] || files[i].failed)
+						continue;
+
+					auto& result = results[firstResult + first + i];
+					result = RelocScanResult();
+					result.fileName = files[i].fileName;
+					auto readAt = [&](uint64_t offset, uint8_t *buffer, uint64_t size) { return files[i].read(offset, buffer, static_cast<size_t>(size)); };
+					scanned[i] = scanReadable(files[i].fileSize, readAt, result);
+					pending |= files[i].pending();
+					arena.release();
+				}
+				if (pending)
+					bulkIo.fetch(files);
+			}
+			bulkIo.closeFiles(files);
+
+			for (size_t i = 0; i < files.size(); i++)
+			{
+				if (scanned[i])
+					continue;
+				if (!this->scanFile(fileNames[first + i], results[firstResult + first + i]))
+					unreadableFiles++;
+				arena.release();
+			}
+		}
+	};
+
+	if (!threadCount)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	threadCount = static_cast<unsigned int>(std::min<size_t>(threadCount, std::max<size_t>(1, fileNames.size())));
+
+	std::vector<std::thread> threads;
+	for (unsigned int t = 1; t < threadCount; t++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto& thread : threads)
+		thread.join();
+
+	uint32_t peFiles = 0, flaggedFiles = 0, overBudgetFiles = 0;
+	for (size_t i = firstResult; i < results.size(); i++)
+	{
+		if (results[i].isPe)
+			peFiles++;
+		if (results[i].flags)
+			flaggedFiles++;
+		if (results[i].overBudget)
+			overBudgetFiles++;
+	}
+
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime).count();
+	this->infoStream << "Scanned " << std::dec << fileNames.size() << " files (" << peFiles << " PE32) in " << elapsed << "ms on " << threadCount << " threads" << (bulk ? " through io_uring" : "") << std::endl;
+	this->infoStream << "\t" << flaggedFiles << " flagged, " << overBudgetFiles << " over budget, " << unreadableFiles.load() << " unreadable" << std::hex << std::endl;
+	return true;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdint.h>
+
+class RelocScanResult
+{
+public:
+	enum Flags
+	{
+		FLAG_UNUSABLE_BASE = 1 << 0,		/* ImageBase can't be honored, so the loader must relocate */
+		FLAG_HEADER_TARGETS = 1 << 1,		/* relocations patch the PE headers */
+		FLAG_NON_POINTER_TARGETS = 1 << 2,	/* relocations patch values which don't point into the image */
+		FLAG_OVERLAPPING_TARGETS = 1 << 3,	/* relocations patch the same bytes more than once */
+		FLAG_DENSE_PAGES = 1 << 4,			/* pages with far more relocations than real code has */
+		FLAG_UNUSUAL_TYPES = 1 << 5,		/* relocation types other than HIGHLOW in a 32-bit image */
+	};
+
+	std::string fileName;
+	bool isPe, overBudget;
+	uint32_t flags;
+	uint32_t imageBase, relocationCount;
+	uint32_t headerTargets, nonPointerTargets, overlappingTargets, densePages, unusualTypes;
+
+	RelocScanResult() :
+		isPe(false), overBudget(false), flags(0), imageBase(0), relocationCount(0),
+		headerTargets(0), nonPointerTargets(0), overlappingTargets(0), densePages(0), unusualTypes(0) {}
+
+	void print(std::ostream &stream) const;
+};
+
+/*
+	flags relocation-based packing by looking at nothing but the headers,
+	the reloc table and the values it points at. files are memory-mapped
+	so only the pages which get touched are read, or with useIoUring(),
+	read in batches of just those pages through a BulkIo.
+*/
+class RelocScanner
+{
+public:
+	RelocScanner(std::ostream &_infoStream, std::ostream &_errorStream);
+
+	/* scanTree() reads files in batches through io_uring where the system has it */
+	void useIoUring(bool enable);
+
+	bool scanImage(const uint8_t *data, size_t size, RelocScanResult &result);
+	bool scanFile(const std::string &fileName, RelocScanResult &result);
+	bool scanTree(const std::string &directory, unsigned int threadCount, std::vector<RelocScanResult> &results);
+
+private:
+	std::ostream &infoStream, &errorStream;
+	bool ioUring;
+};
@@ -0,0 +1,466 @@
+#include "PeLibInclude.h"
+
+#include "RelocUnpacker.h"
+#include "MappedFile.h"
+#include "OutputNames.h"
+#include "PeRecompiler.h"
+#include "VectorUtils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <thread>
+#include <string.h>
+
+
+const uint32_t UNPACK_PAGE_SIZE = 0x1000;
+
+struct UnpackFixup
+{
+	uint32_t target;
+	uint16_t type;
+};
+
+/* the bytes of a fixup which ran off the end of one page, and what is still to be added to them */
+struct UnpackCarry
+{
+	uint32_t index; /* of the fixup, so the rest of it lands in table order */
+	uint32_t width, value;
+};
+
+void RelocUnpackResult::print(std::ostream &stream) const
+{
+	if (!this->unpacked)
+	{
+		stream << "Failed to unpack " << this->fileName << ": " << this->error << std::endl;
+		return;
+	}
+
+	stream << "Unpacked " << this->fileName << " to " << this->outputFileName << std::endl;
+	stream << "\tImageBase 0x" << std::hex << this->imageBase << ", predicted load base 0x" << this->loadBase;
+	stream << " (delta 0x" << (this->loadBase - this->imageBase) << ")" << std::endl;
+	stream << "\tReplayed " << std::dec << this->relocationCount << " relocations";
+	if (this->straddlingRelocations)
+		stream << " (" << this->straddlingRelocations << " ran off the end of a section and were skipped)";
+	stream << std::endl;
+
+	for (auto& section : this->sections)
+	{
+		uint32_t pages = 0;
+		for (auto& run : section.changedPages)
+			pages += ((run.second - run.first) / UNPACK_PAGE_SIZE) + 1;
+
+		stream << "\t" << std::left << std::setfill(' ') << std::setw(10) << section.name << std::dec;
+		stream << section.relocationCount << " relocations, " << section.changedBytes << " bytes changed in " << pages << " pages" << std::endl;
+		for (auto& run : section.changedPages)
+			stream << "\t\t0x" << std::hex << run.first << " - 0x" << (run.second + UNPACK_PAGE_SIZE - 1) << std::endl;
+	}
+	stream << std::hex;
+}
+
+/*
+	a base the loader can't honor makes it relocate to the lowest address it
+	can, which is how TRICKY_BASE_ADDRESS turns into ACTUALIZED_BASE_ADDRESS.
+	the win10 variant keeps a sane base but its stub forces the same result.
+*/
+static uint32_t predictLoadBase(const PeLib::PeHeader32 &peHeader)
+{
+	uint32_t imageBase = peHeader.getImageBase();
+	if (PeRecompiler::baseUnusable(imageBase, peHeader.getSizeOfImage()))
+		return ACTUALIZED_BASE_ADDRESS;
+
+	auto entrySection = peHeader.getSectionWithRva(peHeader.getAddressOfEntryPoint());
+	if (entrySection != 0xFFFF && peHeader.getSectionName(entrySection) == ".presel")
+		return ACTUALIZED_BASE_ADDRESS;
+
+	return imageBase;
+}
+
+/* how many bytes a fixup of this type patches, and what the loader adds to them */
+static uint32_t fixupWidth(uint16_t type, uint32_t delta, uint32_t &value)
+{
+	if (type == PeLib::PELIB_IMAGE_REL_BASED_HIGH)
+	{
+		value = delta >> 16;
+		return sizeof(uint16_t);
+	}
+	if (type == PeLib::PELIB_IMAGE_REL_BASED_LOW)
+	{
+		value = delta & 0xFFFF;
+		return sizeof(uint16_t);
+	}
+	value = delta;
+	return sizeof(uint32_t);
+}
+
+/*
+	adds value to the width-byte little-endian number at offset, wrapping
+	around as the loader's add does. the buffer holds only length bytes;
+	if the number runs past them, the rest of it and the carry out of the
+	part which fit go into carry, to be added at the start of the next page.
+*/
+static bool addToPage(uint8_t *buffer, uint32_t length, uint32_t offset, uint32_t width, uint32_t value, UnpackCarry &carry)
+{
+	uint32_t inPage = std::min(width, length - offset);
+	uint64_t mask = (1ull << (8 * inPage)) - 1;
+	uint64_t sum = 0;
+	memcpy(&sum, buffer + offset, inPage);
+	sum += value & mask;
+	memcpy(buffer + offset, &sum, inPage);
+	if (inPage == width)
+		return false;
+
+	carry.width = width - inPage;
+	carry.value = static_cast<uint32_t>((static_cast<uint64_t>(value) >> (8 * inPage)) + (sum >> (8 * inPage)));
+	return true;
+}
+
+/* applies fixups to a buffer holding the image starting at baseRVA, in the order given */
+static uint32_t replayFixups(std::vector<uint8_t> &buffer, uint32_t baseRVA, const std::vector<UnpackFixup> &fixups,
+	const std::vector<uint32_t> &indices, uint32_t delta, uint32_t &straddling)
+{
+	uint32_t applied = 0;
+	for (auto index : indices)
+	{
+		auto& fixup = fixups[index];
+		uint32_t offset = fixup.target - baseRVA;
+		uint32_t value;
+		auto width = fixupWidth(fixup.type, delta, value);
+		if (offset >= buffer.size() || buffer.size() - offset < width)
+		{
+			straddling++;
+			continue;
+		}
+
+		UnpackCarry carry;
+		addToPage(buffer.data(), static_cast<uint32_t>(buffer.size()), offset, width, value, carry);
+		applied++;
+	}
+	return applied;
+}
+
+/* copies [begin, end) of the input to the output in page-sized writes */
+static bool copyInput(std::ofstream &output, const uint8_t *data, size_t begin, size_t end)
+{
+	PeLib::TraceSpan span("RelocUnpacker::copyInput", "reloc");
+	for (size_t position = begin; position < end; position += UNPACK_PAGE_SIZE)
+	{
+		auto chunk = std::min<size_t>(UNPACK_PAGE_SIZE, end - position);
+		if (!output.write(reinterpret_cast<const char*>(data + position), chunk))
+			return false;
+	}
+	return true;
+}
+
+
+RelocUnpacker::RelocUnpacker(std::ostream &_infoStream, std::ostream &_errorStream)
+	: infoStream(_infoStream), errorStream(_errorStream)
+{
+	this->infoStream << std::hex;
+	this->errorStream << std::hex;
+}
+
+bool RelocUnpacker::unpackFile(const std::string &inputFileName, const std::string &outputFileName, RelocUnpackResult &result)
+{
+	PeLib::TraceSpan span("RelocUnpacker::unpackFile", "reloc");
+	result = RelocUnpackResult();
+	result.fileName = inputFileName;
+	result.outputFileName = outputFileName;
+
+	MappedFile file;
+	if (!file.open(inputFileName))
+	{
+		result.error = "failed to open input file";
+		return false;
+	}
+
+	const uint8_t* data = file.data();
+	size_t size = file.size();
+	auto inputSize = static_cast<unsigned int>(std::min<size_t>(size, UINT32_MAX));
+
+	PeLib::PeFile32 peFile;
+	if (peFile.readMzHeader(data, inputSize) != PeLib::NO_ERROR || peFile.readPeHeader(data, inputSize) != PeLib::NO_ERROR)
+	{
+		result.error = "not a PE32 image";
+		return false;
+	}
+
+	auto& peHeader = peFile.peHeader();
+	result.imageBase = peHeader.getImageBase();
+	result.loadBase = predictLoadBase(peHeader);
+	uint32_t delta = result.loadBase - result.imageBase;
+
+	/* flatten the table once, keeping the loader's block and entry order */
+	std::vector<UnpackFixup> fixups;
+	if (delta && peFile.readRelocationsDirectory(data, inputSize) == PeLib::NO_ERROR)
+	{
+		auto& reloc = peFile.relocDir();
+		for (unsigned int rel = 0; rel < reloc.calcNumberOfRelocations(); rel++)
+		{
+			uint32_t blockRVA = reloc.getVirtualAddress(rel);
+			auto entryCount = reloc.calcNumberOfRelocationData(rel);
+			for (unsigned int relEntry = 0; relEntry < entryCount; relEntry++)
+			{
+				uint16_t entry = reloc.getRelocationData(rel, relEntry);
+				uint16_t entryType = (entry >> 12);
+				if (entryType == PeLib::PELIB_IMAGE_REL_BASED_ABSOLUTE)
+					continue;
+				if (entryType != PeLib::PELIB_IMAGE_REL_BASED_HIGH && entryType != PeLib::PELIB_IMAGE_REL_BASED_LOW && entryType != PeLib::PELIB_IMAGE_REL_BASED_HIGHLOW)
+				{
+					result.error = "unsupported reloc type";
+					return false;
+				}
+				fixups.push_back({ blockRVA + (entry & 0x0FFF), entryType });
+			}
+		}
+	}
+
+	if (delta && fixups.empty())
+	{
+		result.error = "image would have to be relocated but has no usable reloc table";
+		return false;
+	}
+
+	/*
+		bucket the fixups by where they land, keeping their order: index 0 is
+		the headers, the rest are sections. replaying is exact as long as each
+		bucket is applied in order, so sections are replayed one at a time.
+	*/
+	uint32_t sizeOfHeaders = peHeader.getSizeOfHeaders();
+	unsigned int sectionCount = peHeader.calcNumberOfSections();
+	std::vector<std::vector<uint32_t>> regionFixups(sectionCount + 1);
+	for (uint32_t i = 0; i < fixups.size(); i++)
+	{
+		if (fixups[i].target < sizeOfHeaders)
+		{
+			regionFixups[0].push_back(i);
+			continue;
+		}
+
+		auto sec = peHeader.getSectionWithRva(fixups[i].target);
+		if (sec == 0xFFFF)
+			result.straddlingRelocations++;
+		else
+			regionFixups[sec + 1].push_back(i);
+	}
+
+	/*
+		relocate the headers, then mark the image as already living at the
+		predicted base: no reloc table, no ASLR. nothing will move it again.
+	*/
+	std::vector<uint8_t> headers(sizeOfHeaders, 0x00);
+	memcpy(headers.data(), data, std::min<size_t>(sizeOfHeaders, size));
+	result.relocationCount += replayFixups(headers, 0, fixups, regionFixups[0], delta, result.straddlingRelocations);
+
+	PeLib::PeFile32 headerFile;
+	auto headerSize = static_cast<unsigned int>(headers.size());
+	auto& newHeader = (headerFile.readMzHeader(headers.data(), headerSize) == PeLib::NO_ERROR &&
+		headerFile.readPeHeader(headers.data(), headerSize) == PeLib::NO_ERROR) ? headerFile.peHeader() : peHeader;
+	newHeader.setImageBase(result.loadBase);
+	newHeader.setDllCharacteristics(newHeader.getDllCharacteristics() & ~PeLib::PELIB_IMAGE_DLLCHARACTERISTICS_DYNAMIC_BASE);
+	newHeader.setIddBaseRelocRva(0);
+	newHeader.setIddBaseRelocSize(0);
+
+	std::vector<uint8_t> headerBuffer;
+	newHeader.rebuild(headerBuffer);
+	putBytes(headers, peFile.mzHeader().getAddressOfPeHeader(), headerBuffer.data(), headerBuffer.size());
+
+	std::ofstream output(outputFileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!output.is_open() || !output.write(reinterpret_cast<const char*>(headers.data()), std::min<size_t>(headers.size(), size)))
+	{
+		result.error = "failed to write output file";
+		return false;
+	}
+	size_t position = std::min<size_t>(headers.size(), size);
+
+	/* sections are written back in file order, with anything between them copied as-is */
+	std::vector<unsigned int> fileOrder;
+	for (unsigned int sec = 0; sec < sectionCount; sec++)
+		fileOrder.push_back(sec);
+	std::stable_sort(fileOrder.begin(), fileOrder.end(), [&peHeader](unsigned int a, unsigned int b) { return peHeader.getPointerToRawData(a) < peHeader.getPointerToRawData(b); });
+
+	for (auto sec : fileOrder)
+	{
+		uint32_t RVA = peHeader.getVirtualAddress(sec);
+		uint32_t virtualSize = peHeader.getVirtualSize(sec) ? peHeader.getVirtualSize(sec) : peHeader.getSizeOfRawData(sec);
+		uint32_t mappedSize = PeLib::alignOffset(virtualSize, peHeader.getSectionAlignment());
+
+		/* same raw pointer rounding as the loader, so file bytes line up with RVAs */
+		size_t rawPointer = peHeader.getPointerToRawData(sec) & ~0x1FF;
+		size_t rawSize = std::min<size_t>(peHeader.getSizeOfRawData(sec), mappedSize);
+		rawSize = (rawPointer >= size) ? 0 : std::min<size_t>(rawSize, size - rawPointer);
+
+		RelocUnpackResult::SectionDiff diff;
+		diff.name = peHeader.getSectionName(sec);
+		diff.RVA = RVA;
+		diff.changedBytes = 0;
+		diff.relocationCount = 0;
+
+		if (rawSize)
+		{
+			if (rawPointer < position)
+			{
+				result.error = "section raw data overlaps the headers or another section";
+				return false;
+			}
+			if (!copyInput(output, data, position, rawPointer))
+			{
+				result.error = "failed to write output file";
+				return false;
+			}
+			position = rawPointer + rawSize;
+		}
+
+		/* fixups running off the end of the section are skipped, as the loader would fail them */
+		auto& indices = regionFixups[sec + 1];
+		indices.erase(std::remove_if(indices.begin(), indices.end(), [&](uint32_t index)
+		{
+			uint32_t offset = fixups[index].target - RVA, value;
+			auto width = fixupWidth(fixups[index].type, delta, value);
+			if (offset < mappedSize && mappedSize - offset >= width)
+				return false;
+			result.straddlingRelocations++;
+			return true;
+		}), indices.end());
+		std::stable_sort(indices.begin(), indices.end(), [&](uint32_t a, uint32_t b)
+		{
+			return (fixups[a].target - RVA) / UNPACK_PAGE_SIZE < (fixups[b].target - RVA) / UNPACK_PAGE_SIZE;
+		});
+
+		/*
+			replay one page at a time, each page's fixups in table order. a
+			fixup running off the end of a page is finished at the start of
+			the next, with the carry out of its first bytes, in its place in
+			that page's order. the result is the same as replaying over the
+			whole section, and only one page of it is ever held.
+		*/
+		std::vector<uint8_t> page(UNPACK_PAGE_SIZE);
+		std::vector<UnpackCarry> carries, nextCarries;
+		size_t nextFixup = 0;
+		for (uint32_t pageStart = 0; pageStart < mappedSize; pageStart += UNPACK_PAGE_SIZE)
+		{
+			uint32_t pageLength = std::min<uint32_t>(UNPACK_PAGE_SIZE, mappedSize - pageStart);
+			uint32_t rawLength = (pageStart < rawSize) ? std::min<uint32_t>(pageLength, static_cast<uint32_t>(rawSize) - pageStart) : 0;
+			const uint8_t* original = data + rawPointer + pageStart;
+			memset(page.data(), 0x00, pageLength);
+			if (rawLength)
+				memcpy(page.data(), original, rawLength);
+
+			size_t pageFixups = nextFixup, nextCarry = 0;
+			while (pageFixups < indices.size() && fixups[indices[pageFixups]].target - RVA < pageStart + pageLength)
+				pageFixups++;
+
+			nextCarries.clear();
+			while (nextFixup < pageFixups || nextCarry < carries.size())
+			{
+				UnpackCarry carry;
+				if (nextCarry < carries.size() && (nextFixup == pageFixups || carries[nextCarry].index < indices[nextFixup]))
+				{
+					addToPage(page.data(), pageLength, 0, carries[nextCarry].width, carries[nextCarry].value, carry);
+					nextCarry++;
+					continue;
+				}
+
+				auto index = indices[nextFixup++];
+				uint32_t value;
+				auto width = fixupWidth(fixups[index].type, delta, value);
+				if (addToPage(page.data(), pageLength, fixups[index].target - RVA - pageStart, width, value, carry))
+				{
+					carry.index = index;
+					nextCarries.push_back(carry);
+				}
+				diff.relocationCount++;
+			}
+			carries.swap(nextCarries);
+
+			/* compare against what was on disk (or zero, past the raw data) */
+			uint32_t changed = 0;
+			for (uint32_t i = 0; i < pageLength; i++)
+			{
+				if (page[i] != ((i < rawLength) ? original[i] : 0x00))
+					changed++;
+			}
+			if (changed)
+			{
+				diff.changedBytes += changed;
+				if (diff.changedPages.size() && diff.changedPages.back().second + UNPACK_PAGE_SIZE == RVA + pageStart)
+					diff.changedPages.back().second = RVA + pageStart;
+				else
+					diff.changedPages.push_back(std::make_pair(RVA + pageStart, RVA + pageStart));
+			}
+
+			if (rawLength && !output.write(reinterpret_cast<const char*>(page.data()), rawLength))
+			{
+				result.error = "failed to write output file";
+				return false;
+			}
+		}
+		result.relocationCount += diff.relocationCount;
+		result.sections.push_back(diff);
+	}
+
+	/* and whatever trails the last section, such as an overlay */
+	if (!copyInput(output, data, position, size))
+	{
+		result.error = "failed to write output file";
+		return false;
+	}
+	output.close();
+
+	/* the diff report sits next to the output */
+	std::ofstream report((outputFileName + ".txt").c_str(), std::ios::out | std::ios::trunc);
+	result.unpacked = true;
+	result.print(report);
+	return true;
+}
+
+bool RelocUnpacker::unpackFiles(const std::vector<std::string> &inputFileNames, const std::string &outputDirectory, unsigned int threadCount, std::vector<RelocUnpackResult> &results)
+{
+	std::error_code ec;
+	std::filesystem::create_directories(outputDirectory, ec);
+	if (!std::filesystem::is_directory(outputDirectory, ec))
+	{
+		this->errorStream << "Failed to create output directory: " << outputDirectory << std::endl;
+		return false;
+	}
+
+	auto outputFileNames = ::outputFileNames(inputFileNames, outputDirectory);
+
+	/* same scheme as RelocScanner::scanTree(): a shared counter and a result slot per file */
+	auto firstResult = results.size();
+	results.resize(firstResult + inputFileNames.size());
+
+	std::atomic<size_t> nextFile(0);
+	auto worker = [&]() -> void
+	{
+		for (size_t i = nextFile++; i < inputFileNames.size(); i = nextFile++)
+			this->unpackFile(inputFileNames[i], outputFileNames[i], results[firstResult + i]);
+	};
+
+	if (!threadCount)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+	threadCount = static_cast<unsigned int>(std::min<size_t>(threadCount, std::max<size_t>(1, inputFileNames.size())));
+
+	std::vector<std::thread> threads;
+	for (unsigned int t = 1; t < threadCount; t++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto& thread : threads)
+		thread.join();
+
+	bool allUnpacked = true;
+	for (size_t i = firstResult; i < results.size(); i++)
+	{
+		auto& result = results[i];
+		if (result.unpacked)
+			result.print(this->infoStream);
+		else
+		{
+			result.print(this->errorStream);
+			allUnpacked = false;
+		}
+	}
+	return allUnpacked;
+}
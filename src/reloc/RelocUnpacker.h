@@ -0,0 +1,45 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <stdint.h>
+
+class RelocUnpackResult
+{
+public:
+	struct SectionDiff
+	{
+		std::string name;
+		uint32_t RVA, changedBytes, relocationCount;
+		std::vector<std::pair<uint32_t, uint32_t>> changedPages; /* runs of [first, last] page RVAs */
+	};
+
+	std::string fileName, outputFileName, error;
+	bool unpacked;
+	uint32_t imageBase, loadBase;
+	uint32_t relocationCount, straddlingRelocations;
+	std::vector<SectionDiff> sections;
+
+	RelocUnpackResult() : unpacked(false), imageBase(0), loadBase(0), relocationCount(0), straddlingRelocations(0) {}
+
+	void print(std::ostream &stream) const;
+};
+
+/*
+	undoes relocation-based packing without running anything: predicts the
+	base the loader will really use, replays the reloc table over the
+	sections in loader order and writes the result back out as a PE file
+	which no longer needs relocating, alongside a report of what changed.
+*/
+class RelocUnpacker
+{
+public:
+	RelocUnpacker(std::ostream &_infoStream, std::ostream &_errorStream);
+
+	bool unpackFile(const std::string &inputFileName, const std::string &outputFileName, RelocUnpackResult &result);
+	bool unpackFiles(const std::vector<std::string> &inputFileNames, const std::string &outputDirectory, unsigned int threadCount, std::vector<RelocUnpackResult> &results);
+
+private:
+	std::ostream &infoStream, &errorStream;
+};
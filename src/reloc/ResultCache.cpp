@@ -0,0 +1,269 @@
+#include "ResultCache.h"
+
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <string.h>
+
+
+/* bump this whenever the output for a given input and option set changes */
+const char RESULT_CACHE_FORMAT[] = "reloc-cache-2";
+
+const char RESULT_CACHE_ENTRY_EXTENSION[] = ".bin";
+const char RESULT_CACHE_TEMP_EXTENSION[] = ".tmp";
+
+static const uint32_t SHA256_ROUND_CONSTANTS[64] =
+{
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+};
+
+static inline uint32_t rotr32(uint32_t value, int bits)
+{
+	return (value >> bits) | (value << (32 - bits));
+}
+
+/*
+	SHA-256, fed incrementally. the input is untrusted, so keys have to be
+	collision resistant: a crafted collision would otherwise serve one
+	input the cached output of another.
+*/
+class Sha256
+{
+public:
+	Sha256()
+		: state{ 0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19 },
+		totalBytes(0), pendingBytes(0) { }
+
+	void update(const uint8_t *data, size_t size)
+	{
+		this->totalBytes += size;
+		if (this->pendingBytes)
+		{
+			size_t take = std::min(size, sizeof(this->pending) - this->pendingBytes);
+			memcpy(this->pending + this->pendingBytes, data, take);
+			this->pendingBytes += take;
+			data += take;
+			size -= take;
+			if (this->pendingBytes < sizeof(this->pending))
+				return;
+			this->compress(this->pending);
+			this->pendingBytes = 0;
+		}
+
+		for (; size >= sizeof(this->pending); data += sizeof(this->pending), size -= sizeof(this->pending))
+			this->compress(data);
+
+		memcpy(this->pending, data, size);
+		this->pendingBytes = size;
+	}
+
+	void update(const std::string &text)
+	{
+		this->update(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+	}
+
+	/* the digest as 64 lowercase hex digits */
+	std::string finish()
+	{
+		uint64_t totalBits = this->totalBytes * 8;
+		const uint8_t padStart = 0x80;
+		const uint8_t padZero = 0x00;
+		this->update(&padStart, 1);
+		while (this->pendingBytes != sizeof(this->pending) - sizeof(totalBits))
+			this->update(&padZero, 1);
+
+		uint8_t lengthBytes[sizeof(totalBits)];
+		for (size_t i = 0; i < sizeof(totalBits); i++)
+			lengthBytes[i] = static_cast<uint8_t>(totalBits >> (56 - (i * 8)));
+		this->update(lengthBytes, sizeof(lengthBytes));
+
+		std::ostringstream digest;
+		digest << std::hex << std::setfill('0');
+		for (auto word : this->state)
+			digest << std::setw(8) << word;
+		return digest.str();
+	}
+
+private:
+	uint32_t state[8];
+	uint64_t totalBytes;
+	uint8_t pending[64];
+	size_t pendingBytes;
+
+	void compress(const uint8_t *block)
+	{
+		uint32_t schedule[64];
+		for (int i = 0; i < 16; i++)
+			schedule[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16) | (uint32_t(block[i * 4 + 2]) << 8) | uint32_t(block[i * 4 + 3]);
+		for (int i = 16; i < 64; i++)
+		{
+			uint32_t s0 = rotr32(schedule[i - 15], 7) ^ rotr32(schedule[i - 15], 18) ^ (schedule[i - 15] >> 3);
+			uint32_t s1 = rotr32(schedule[i - 2], 17) ^ rotr32(schedule[i - 2], 19) ^ (schedule[i - 2] >> 10);
+			schedule[i] = schedule[i - 16] + s0 + schedule[i - 7] + s1;
+		}
+
+		uint32_t a = this->state[0], b = this->state[1], c = this->state[2], d = this->state[3];
+		uint32_t e = this->state[4], f = this->state[5], g = this->state[6], h = this->state[7];
+		for (int i = 0; i < 64; i++)
+		{
+			uint32_t t1 = h + (rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_ROUND_CONSTANTS[i] + schedule[i];
+			uint32_t t2 = (rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		this->state[0] += a; this->state[1] += b; this->state[2] += c; this->state[3] += d;
+		this->state[4] += e; this->state[5] += f; this->state[6] += g; this->state[7] += h;
+	}
+};
+
+
+ResultCache::ResultCache(const std::string &_directory, uint64_t _maxBytes)
+	: directory(_directory), maxBytes(_maxBytes) { }
+
+std::string ResultCache::makeKey(const uint8_t *data, size_t size, const std::string &options)
+{
+	/*
+		one digest over the whole canonical options string and the input, with
+		the options length-prefixed so no two (options, input) pairs encode alike
+	*/
+	Sha256 key;
+	key.update(std::string(RESULT_CACHE_FORMAT) + "\n" + std::to_string(options.size()) + "\n" + options);
+	key.update(data, size);
+	return key.finish();
+}
+
+std::string ResultCache::hashData(const uint8_t *data, size_t size)
+{
+	Sha256 hash;
+	hash.update(data, size);
+	return hash.finish();
+}
+
+bool ResultCache::fetch(const std::string &key, const std::string &outputFileName)
+{
+	std::error_code ec;
+	auto entry = this->entryPath(key);
+	if (!std::filesystem::is_regular_file(entry, ec))
+		return false;
+
+	if (!std::filesystem::copy_file(entry, outputFileName, std::filesystem::copy_options::overwrite_existing, ec))
+		return false;
+
+	/* refresh the entry so eviction treats it as recently used */
+	std::filesystem::last_write_time(entry, std::filesystem::file_time_type::clock::now(), ec);
+	return true;
+}
+
+bool ResultCache::store(const std::string &key, const std::string &resultFileName)
+{
+	std::error_code ec;
+	std::filesystem::create_directories(this->directory, ec);
+
+	/*
+		copy next to the entry under a unique name, then rename it into place.
+		concurrent writers of the same key produce identical bytes, so it
+		doesn't matter which rename lands last.
+	*/
+	std::ostringstream tempName;
+	tempName << key << "." << std::hex << std::random_device()() << RESULT_CACHE_TEMP_EXTENSION;
+	auto temp = this->directory / tempName.str();
+
+	std::error_code ignored;
+	if (!std::filesystem::copy_file(resultFileName, temp, std::filesystem::copy_options::overwrite_existing, ec))
+	{
+		std::filesystem::remove(temp, ignored);
+		return false;
+	}
+
+	std::filesystem::rename(temp, this->entryPath(key), ec);
+	if (ec)
+	{
+		std::filesystem::remove(temp, ignored);
+		return false;
+	}
+
+	this->evict();
+	return true;
+}
+
+std::filesystem::path ResultCache::entryPath(const std::string &key) const
+{
+	return this->directory / (key + RESULT_CACHE_ENTRY_EXTENSION);
+}
+
+void ResultCache::evict()
+{
+	struct Entry
+	{
+		std::filesystem::path path;
+		uint64_t size;
+		std::filesystem::file_time_type lastUsed;
+	};
+
+	std::vector<Entry> entries;
+	uint64_t totalBytes = 0;
+
+	/* temp files this old were left behind by a writer that died mid-copy */
+	auto staleTime = std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);
+
+	std::error_code ec;
+	for (auto it = std::filesystem::directory_iterator(this->directory, ec); !ec && it != std::filesystem::directory_iterator(); it.increment(ec))
+	{
+		std::error_code entryError;
+		if (!it->is_regular_file(entryError))
+			continue;
+
+		auto extension = it->path().extension().string();
+		auto lastUsed = std::filesystem::last_write_time(it->path(), entryError);
+		if (entryError)
+			continue;
+
+		if (extension == RESULT_CACHE_TEMP_EXTENSION)
+		{
+			if (lastUsed < staleTime)
+				std::filesystem::remove(it->path(), entryError);
+			continue;
+		}
+		if (extension != RESULT_CACHE_ENTRY_EXTENSION)
+			continue;
+
+		auto size = std::filesystem::file_size(it->path(), entryError);
+		if (entryError)
+			continue;
+
+		entries.push_back({ it->path(), size, lastUsed });
+		totalBytes += size;
+	}
+
+	if (totalBytes <= this->maxBytes)
+		return;
+
+	/* drop least recently used entries first */
+	std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.lastUsed < b.lastUsed; });
+	for (auto& entry : entries)
+	{
+		if (totalBytes <= this->maxBytes)
+			break;
+
+		std::error_code removeError;
+		if (std::filesystem::remove(entry.path, removeError))
+			totalBytes -= entry.size;
+	}
+}
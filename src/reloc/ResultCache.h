@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include <filesystem>
+#include <stdint.h>
+
+/*
+	on-disk cache of finished output images, keyed by the SHA-256 of the
+	input bytes together with a canonical encoding of the options used to
+	produce them.
+
+	entries are written to a temp file and renamed into place, so readers
+	never see a partial entry. once the directory grows past maxBytes, the
+	least recently used entries are deleted.
+*/
+class ResultCache
+{
+public:
+	ResultCache(const std::string &_directory, uint64_t _maxBytes);
+
+	/* 64 hex digits; the input is untrusted, so this has to be collision resistant */
+	static std::string makeKey(const uint8_t *data, size_t size, const std::string &options);
+
+	/* SHA-256 of the data alone, as 64 hex digits */
+	static std::string hashData(const uint8_t *data, size_t size);
+
+	bool fetch(const std::string &key, const std::string &outputFileName);
+	bool store(const std::string &key, const std::string &resultFileName);
+
+private:
+	std::filesystem::path directory;
+	uint64_t maxBytes;
+
+	std::filesystem::path entryPath(const std::string &key) const;
+	void evict();
+};
@@ -2,7 +2,8 @@
 
 #include "RewriteBlock.h"
 #include "PeRecompiler.h"
-#include "VectorUtils.h"
+
+#include <sstream>
 
 
 EntryPointRewriteBlock::EntryPointRewriteBlock(std::shared_ptr<PeLib::PeFile32> _header)
@@ -88,10 +89,20 @@ bool PeSectionRewriteBlock::getNextEntryLoc(uint32_t size, uint32_t lastEntryOff
 
 bool PeSectionRewriteBlock::decrementEntry(uint32_t offset, uint32_t value)
 {
-	uint32_t original;
-	if (!getData(this->sec->data, offset, original)) return false;
-	if (!putData(this->sec->data, offset, (original - value) )) return false;
-	return true;
+	// queued, and only applied when the section is read out
+	return this->sec->adjustEntry(offset, 0 - value);
+}
+
+bool PeSectionRewriteBlock::canDecrementEntry(uint32_t offset) const
+{
+	return this->sec->holdsEntry(offset);
+}
+
+std::string PeSectionRewriteBlock::describe() const
+{
+	std::ostringstream description;
+	description << std::hex << "section " << this->sec->index << " " << this->startOffset << " " << this->endOffset;
+	return description.str();
 }
 
 std::shared_ptr<RewriteBlock> PeSectionRewriteBlock::getNextMultiPassBlock(uint32_t num)
@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 #include <memory>
+#include <string>
 namespace PeLib { class PeFile32; };
 
 class PeSectionContents;
@@ -12,7 +13,10 @@ public:
 	virtual bool getFirstEntryLoc(uint32_t size, uint32_t &firstEntryRVA, uint32_t &firstEntryOffset) const = 0;
 	virtual bool getNextEntryLoc(uint32_t size, uint32_t lastEntryOffset, uint32_t &nextEntryRVA, uint32_t &nextEntryOffset) const = 0;
 	virtual bool decrementEntry(uint32_t offset, uint32_t value) = 0;
+	virtual bool canDecrementEntry(uint32_t /*offset*/) const { return true; } // decrementEntry() would succeed, without doing it
 	virtual std::shared_ptr<RewriteBlock> getNextMultiPassBlock(uint32_t num) { return nullptr;  }
+	virtual std::string describe() const = 0; // identifies the block in a rewrite plan; equal descriptions rewrite the same entries
+	virtual bool rewritesHeader() const { return false; } // decrements the PE header, which is rebuilt from the input every run
 };
 
 class EntryPointRewriteBlock : public RewriteBlock
@@ -23,6 +27,8 @@ public:
 	virtual bool getFirstEntryLoc(uint32_t size, uint32_t &firstEntryRVA, uint32_t &firstEntryOffset) const;
 	virtual bool getNextEntryLoc(uint32_t size, uint32_t lastEntryOffset, uint32_t &nextEntryRVA, uint32_t &nextEntryOffset) const;
 	virtual bool decrementEntry(uint32_t offset, uint32_t value);
+	virtual std::string describe() const { return "entryPoint"; }
+	virtual bool rewritesHeader() const { return true; }
 
 private:
 	std::shared_ptr<PeLib::PeFile32> header;
@@ -36,6 +42,8 @@ public:
 	virtual bool getFirstEntryLoc(uint32_t size, uint32_t &firstEntryRVA, uint32_t &firstEntryOffset) const;
 	virtual bool getNextEntryLoc(uint32_t size, uint32_t lastEntryOffset, uint32_t &nextEntryRVA, uint32_t &nextEntryOffset) const;
 	virtual bool decrementEntry(uint32_t offset, uint32_t value);
+	virtual std::string describe() const { return "baseAddress"; }
+	virtual bool rewritesHeader() const { return true; }
 
 private:
 	std::shared_ptr<PeLib::PeFile32> header;
@@ -50,8 +58,10 @@ public:
 	virtual bool getFirstEntryLoc(uint32_t size, uint32_t &firstEntryRVA, uint32_t &firstEntryOffset) const;
 	virtual bool getNextEntryLoc(uint32_t size, uint32_t lastEntryOffset, uint32_t &nextEntryRVA, uint32_t &nextEntryOffset) const;
 	virtual bool decrementEntry(uint32_t offset, uint32_t value);
+	virtual bool canDecrementEntry(uint32_t offset) const;
 
 	virtual std::shared_ptr<RewriteBlock> getNextMultiPassBlock(uint32_t num);
+	virtual std::string describe() const;
 
 private:
 	uint32_t startOffset, endOffset;
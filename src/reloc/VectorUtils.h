@@ -8,21 +8,26 @@ void pushBytes(const char* data, const size_t size, std::vector<TI> &dest)
 }
 
 template<typename T, typename TI>
-bool getData(const std::vector<TI> &input, unsigned int offset, T& output)
+bool getData(const TI* input, size_t inputSize, unsigned int offset, T& output)
 {
 	unsigned int size = sizeof(T);
-	if (offset + size >= input.size())
+	if (offset + size >= inputSize)
 		return false;
-	
-	char* data = new char[size];
+
+	char data[sizeof(T)];
 	for (unsigned int i = 0; i < size; i++)
 		data[i] = input[offset + i];
 
 	output = *(T*)&data[0];
-	delete [] data;
 	return true;
 }
 
+template<typename T, typename TI>
+bool getData(const std::vector<TI> &input, unsigned int offset, T& output)
+{
+	return getData(input.data(), input.size(), offset, output);
+}
+
 template<typename T, typename TI>
 bool putData(std::vector<TI> &destination, unsigned int offset, const T& input)
 {
@@ -34,4 +39,13 @@ bool putData(std::vector<TI> &destination, unsigned int offset, const T& input)
 	for (unsigned int i = 0; i < size; i++)
 		destination[offset + i] = data[i];
 	return true;
-}
\ No newline at end of file
+}
+
+template<typename TI>
+void putBytes(std::vector<TI> &destination, size_t offset, const TI* data, const size_t size)
+{
+	if (destination.size() < offset + size)
+		destination.resize(offset + size, 0);
+	for (size_t i = 0; i < size; i++)
+		destination[offset + i] = data[i];
+}
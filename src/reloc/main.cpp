@@ -1,9 +1,19 @@
+#include "PeLibInclude.h"
 #include "PeRecompiler.h"
+#include "ResultCache.h"
+#include "RelocScanner.h"
+#include "RelocUnpacker.h"
+#include "AllocProfiler.h"
+#include "PackOptions.h"
+#include "PackServer.h"
+#include "PackPipeline.h"
+#include "PackPreflight.h"
 #include <Windows.h>
 
 #include <map>
 #include <vector>
 #include <string>
+#include <sstream>
 
 
 /*
@@ -20,55 +30,126 @@
 // IMPROVEMENT: need to add "dodging" so obfuscation can work 'around' certain data/structures which are
 //              needed by loader before relocations without sacrificing obfuscation of an entire section
 
-bool startsWith(const std::string& s, const std::string& prefix)
+/* records a timeline for --trace and writes it out however main() returns */
+struct TraceOutput
 {
-	return (s.size() >= prefix.size() && s.compare(0, prefix.size(), prefix) == 0);
-}
+	std::string fileName;
+
+	TraceOutput(const std::vector<std::string>& fileNames)
+	{
+		if (fileNames.size())
+		{
+			this->fileName = fileNames.back();
+			PeLib::Trace::enable();
+		}
+	}
 
-auto split(const std::string& s, char delim, size_t max=-1)
+	~TraceOutput()
+	{
+		if (this->fileName.empty())
+			return;
+
+		PeLib::Trace::disable();
+		if (PeLib::Trace::writeChromeTrace(this->fileName) != NO_ERROR)
+			std::cerr << "Failed to write trace file: " << this->fileName << std::endl;
+	}
+};
+
+/* counts allocations per span for --allocStats and reports the top sites however main() returns */
+struct AllocReport
 {
-	auto start = 0;
-	std::vector<std::string> res;
-	while (start != std::string::npos && (max == -1 || res.size() < (max - 1)))
-	{
-		auto pos = s.find(delim);
-		auto sub = (pos == std::string::npos) ? s.substr(start) : s.substr(start, pos - start);
-		res.push_back(sub);
-		start = (pos == std::string::npos) ? pos : ++pos;
+	size_t top;
+
+	AllocReport(const CommandLine& cl) : top(0)
+	{
+		auto option = cl.find("--allocStats");
+		if (option == cl.end())
+			return;
+
+		this->top = option->second.size() ? strtoul(option->second.back().c_str(), nullptr, 10) : 10;
+		AllocProfiler::reset();
+		AllocProfiler::enable();
+	}
+
+	~AllocReport()
+	{
+		if (!this->top)
+			return;
+
+		AllocProfiler::disable();
+		AllocProfiler::report(std::cout, this->top);
 	}
-	if (start != std::string::npos)
-		res.push_back(s.substr(start));
-	return res;
+};
+
+/* one line of I/O counts for --ioStats, meant to be compared between runs */
+void printIoStats(std::ostream& stream, const PeLib::IoStats& io)
+{
+	stream << std::dec << "I/O: " << io.ullOpens << " opens, " << io.ullSeeks << " seeks, ";
+	stream << io.ullReads << " reads (" << io.ullBytesRead << " bytes), ";
+	stream << io.ullWrites << " writes (" << io.ullBytesWritten << " bytes), ";
+	stream << io.ullBytesMapped << " bytes mapped, ";
+	stream << std::fixed << std::setprecision(3) << (io.ullNanoseconds / 1000000.0) << " ms" << std::endl;
 }
 
-typedef std::map<std::string, std::vector<std::string>> CommandLine;
-auto parseCommandLine(int argc, char* argv[])
+/* --connect: hands the job to a running --serve instance and writes out what comes back */
+int submitToServer(const std::string& endpoint, int argc, char* argv[], const std::vector<std::string>& args, bool plan)
 {
-	std::vector<std::string> args;
-	for (int i = 0; i < argc; i++)
-		args.push_back(argv[i]);
+	PackJob job;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg(argv[i]);
+		if (arg.compare(0, 2, "--") == 0 && arg.compare(0, 10, "--connect=") != 0)
+			job.arguments.push_back(arg);
+	}
 
-	CommandLine cl;
-	for (auto arg : args)
+	PeLib::FileStream input(args[1], std::ios::in | std::ios::binary | std::ios::ate);
+	if (!input.is_open())
 	{
-		auto isSwitch = startsWith(arg, "--");
-		if (isSwitch)
+		std::cerr << "Failed to open input file: " << args[1] << std::endl;
+		return 1;
+	}
+	job.input.resize(static_cast<size_t>(input.tellg()));
+	input.seekg(0, std::ios::beg);
+	if (job.input.size() && !input.read(reinterpret_cast<char*>(job.input.data()), job.input.size()))
+	{
+		std::cerr << "Failed to read input file: " << args[1] << std::endl;
+		return 1;
+	}
+
+	PackJobResult result;
+	std::string error;
+	if (!PackServer::submit(endpoint, job, result, error))
+	{
+		std::cerr << error << std::endl;
+		std::cout << "Packing failed!" << std::endl;
+		return 1;
+	}
+
+	std::cout << result.log << "Server metrics:" << std::endl << result.metrics;
+	if (result.succeeded && !plan)
+	{
+		PeLib::FileStream output(args[2], std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!output.is_open() || (result.output.size() && !output.write(reinterpret_cast<const char*>(result.output.data()), result.output.size())))
 		{
-			auto parts = split(arg, '=', 2);
-			auto key = (parts.size() == 2) ? parts[0] : arg;
-			cl[key] = cl[key]; // trick to automatically new() upon first discovery
-			if (parts.size() == 2)
-				cl[key].push_back(parts[1]);
+			std::cerr << "Failed to write output file: " << args[2] << std::endl;
+			result.succeeded = false;
 		}
-		else
-			cl[""].push_back(arg);
 	}
-	
-	return cl;
+
+	std::cout << (!result.succeeded ? "Packing failed!" : plan ? "Planning succeeded!" : "Packing succeeded!") << std::endl;
+	return result.succeeded ? 0 : 1;
 }
 
-const char* usageString =
-"Usage: reloc.exe [--section=<name> | --multipass | --win10 | --noImports | --rewriteHeader | --stringMatch=<text>] input.exe output.exe\n" \
+/* the load cost defaults come from PeRecompiler.h, so the usage can't drift from what's used */
+static std::string formatCost(double nanoseconds)
+{
+	std::ostringstream text;
+	text << nanoseconds;
+	return text.str();
+}
+
+const std::string usageString = std::string() +
+"Usage: reloc.exe [--section=<name> | --multipass | --win10 | --noImports | --rewriteHeader | --stringMatch=<text> | --plan | --cache=<dir> | --verify | --incremental | --loadBudget=<us> | --ioStats] input.exe output.exe\n" \
 "    --section=<name>       Rewrite section with <name>\n" \
 "    --win10                Use runtime ASLR Preselection attack, required for targets running Windows 10\n" \
 "    --noImports            Don't rewrite import names or pointers\n" \
@@ -76,6 +157,42 @@ const char* usageString =
 "    --rewriteHeader        Rewrite entrypoint; incompatible with --win10 and header must be writable\n" \
 "    --fixupBase            Relocate ImageBase in PE header to match actual base; header must be writeable\n" \
 "    --stringMatch=<text>   Relocate all occurrences of the string <text>; disables obfuscation of whole sections\n" \
+"    --plan                 Report reloc table, section and output sizes without writing anything; output.exe may be omitted\n" \
+"    --cache=<dir>          Reuse output from <dir> when the same input was packed with the same options before\n" \
+"    --cacheSize=<MB>       Evict least recently used entries once --cache grows past <MB> megabytes (default 1024)\n" \
+"    --verify               Emulate loading the output at its actual base and check it matches the original\n" \
+"    --incremental          Keep the rewrite plan in output.exe.plan; re-packing the same input with rewrites added only applies the new ones\n" \
+"    --loadBudget=<us>      Fail if the estimated loader fixup time of the output exceeds <us> microseconds\n" \
+"    --entryCost=<ns>       Calibrated loader cost of a single fixup, for the load estimate (default " + formatCost(DEFAULT_ENTRY_NANOSECONDS) + ")\n" +
+"    --pageCost=<ns>        Calibrated loader cost of faulting in and copying a patched page (default " + formatCost(DEFAULT_PAGE_NANOSECONDS) + ")\n" \
+"    --ioStats              Print how many opens, seeks, reads, writes and mapped bytes the run did, and the time they took\n" \
+"\n" \
+"Usage: reloc.exe --scan=<dir> [--threads=<count>] [--ioUring]\n" \
+"    --scan=<dir>           Flag relocation-based packing in every file under <dir>, instead of packing anything\n" \
+"\n" \
+"Usage: reloc.exe --unpack=<dir> [--threads=<count>] packed.exe [packed2.exe ...]\n" \
+"    --unpack=<dir>         Statically undo relocation-based packing, writing each result and a diff report (.txt) to <dir>\n" \
+"\n" \
+"Usage: reloc.exe --preflight input.exe [input2.exe ...]\n" \
+"    --preflight            Say whether each input can be packed, and if not why, reading only its headers and reloc table\n" \
+"\n" \
+"Usage: reloc.exe --serve=<endpoint> [--serveRoot=<dir>] [--threads=<count>]\n" \
+"    --serve=<endpoint>     Keep running and pack the jobs sent to the named pipe (or unix socket path) <endpoint>\n" \
+"    --serveRoot=<dir>      Let jobs name input files for the server to read, as long as they're under <dir>\n" \
+"\n" \
+"Usage: reloc.exe --connect=<endpoint> [packing options] input.exe output.exe\n" \
+"    --connect=<endpoint>   Have the server on <endpoint> pack input.exe, instead of starting up to do it here\n" \
+"\n" \
+"Usage: reloc.exe --batch=<dir> [packing options] [--readThreads=<count>] [--threads=<count>] [--writeThreads=<count>] [--queueDepth=<count>] [--ioUring] input.exe [input2.exe ...]\n" \
+"    --batch=<dir>          Pack every input with the same options, writing the outputs to <dir>\n" \
+"    --readThreads=<count>  Number of inputs to map and read ahead at once (default: 2)\n" \
+"    --writeThreads=<count> Number of outputs to write out at once (default: 2)\n" \
+"    --queueDepth=<count>   Number of inputs read, or outputs packed, ahead of the next stage (default: --threads)\n" \
+"\n" \
+"    --threads=<count>      Number of files to scan, unpack or pack, or jobs to serve, at once (default: one per core)\n" \
+"    --ioUring              With --scan or --batch, read headers and reloc tables of many files at once through io_uring where Linux has it; --batch also writes its outputs through it\n" \
+"    --trace=<file>         In any mode, record a timeline of the run to <file> as Chrome trace-event JSON\n" \
+"    --allocStats[=<n>]     In any mode, count allocations per PeLib or PeRecompiler span and print the top <n> (default 10)\n" \
 "\n" \
 "Notes:\n" \
 "    - If no sections are specified, .text, .data, and .rsrc will be used\n" \
@@ -93,6 +210,8 @@ const char* usageString =
 "    reloc.exe --stringMatch=\"hello world\" malware.exe obfuscated_malware.exe\n" \
 "Example 5 - Obfuscate Strings (Multi-Pass):\n" \
 "    reloc.exe --multipass --stringMatch=\"hello world\" malware.exe obfuscated_malware.exe\n" \
+"Example 6 - Preview Output Size:\n" \
+"    reloc.exe --plan --multipass malware.exe\n" \
 "\n" \
 "If the output executable crashes or fails to start:\n" \
 "    - Obfuscating .rdata can cause issues with certain parts of the PE which may be needed pre-reloc\n" \
@@ -102,97 +221,190 @@ const char* usageString =
 
 int main(int argc, char* argv[])
 {
-	auto cl = parseCommandLine(argc, argv);
+	auto cl = parseCommandLine(std::vector<std::string>(argv, argv + argc));
+	TraceOutput trace(cl["--trace"]);
+	AllocReport allocReport(cl);
 
-	auto args = cl[""];
-	if (args.size() != 3)
+	/* scanning is its own mode; nothing gets packed */
+	auto scanDirs = cl["--scan"];
+	if (scanDirs.size())
 	{
-		std::cout << usageString << std::endl;
-		return ERROR_INVALID_PARAMETER;
+		auto threadCounts = cl["--threads"];
+		auto threadCount = threadCounts.size() ? strtoul(threadCounts.back().c_str(), nullptr, 10) : 0;
+
+		RelocScanner scanner(std::cout, std::cerr);
+		scanner.useIoUring(cl.find("--ioUring") != cl.end());
+		std::vector<RelocScanResult> results;
+		bool failed = false;
+		for (auto& dir : scanDirs)
+			failed |= !scanner.scanTree(dir, threadCount, results);
+
+		for (auto& result : results)
+			if (result.flags)
+				result.print(std::cout);
+		return failed ? 1 : 0;
 	}
 
-	auto win10 = (cl.find("--win10") != cl.end());
-	auto noImports = (cl.find("--noImports") != cl.end()) || win10;
-	auto rewriteHeader = (cl.find("--rewriteHeader") != cl.end());
-	auto fixupBase = (cl.find("--fixupBase") != cl.end());
-	auto multi = (cl.find("--multipass") != cl.end());
+	/* so is unpacking */
+	auto unpackDirs = cl["--unpack"];
+	if (unpackDirs.size())
+	{
+		auto threadCounts = cl["--threads"];
+		auto threadCount = threadCounts.size() ? strtoul(threadCounts.back().c_str(), nullptr, 10) : 0;
 
-	auto sections = cl["--section"];
-	auto stringMatchList = cl["--stringMatch"];
+		auto inputs = cl[""];
+		if (inputs.size() < 2)
+		{
+			std::cout << usageString << std::endl;
+			return ERROR_INVALID_PARAMETER;
+		}
+		inputs.erase(inputs.begin());
 
-	if (!stringMatchList.size())
+		RelocUnpacker unpacker(std::cout, std::cerr);
+		std::vector<RelocUnpackResult> results;
+		return unpacker.unpackFiles(inputs, unpackDirs.back(), threadCount, results) ? 0 : 1;
+	}
+
+	/* and triage, which only says which inputs packing would turn down */
+	if (cl.find("--preflight") != cl.end())
 	{
-		if (sections.size() == 0)
+		auto inputs = cl[""];
+		if (inputs.size() < 2)
 		{
-			sections.push_back(".text");
-			sections.push_back(".data");
-			if (!win10)
-				sections.push_back(".rsrc");
+			std::cout << usageString << std::endl;
+			return ERROR_INVALID_PARAMETER;
 		}
+		inputs.erase(inputs.begin());
+
+		bool allSupported = true;
+		for (auto& input : inputs)
+		{
+			PackPreflightResult result;
+			PackPreflight::checkFile(input, result);
+			result.print(std::cout);
+			allSupported &= result.supported();
+		}
+		return allSupported ? 0 : 1;
 	}
-	else if (sections.size())
+
+	/* serving keeps packing jobs coming in until the process is killed */
+	auto serveEndpoints = cl["--serve"];
+	if (serveEndpoints.size())
 	{
-		std::cout << "Disabling obfuscation of whole sections due to --stringMatch" << std::endl;
-		sections.clear();
+		auto threadCounts = cl["--threads"];
+		auto threadCount = threadCounts.size() ? strtoul(threadCounts.back().c_str(), nullptr, 10) : 0;
+
+		auto serveRoots = cl["--serveRoot"];
+		auto serveRoot = serveRoots.size() ? serveRoots.back() : "";
+
+		PackServer server(std::cout, std::cerr);
+		return server.serve(serveEndpoints.back(), threadCount, serveRoot) ? 0 : 1;
 	}
 
-	PeRecompiler compiler(std::cout, std::cerr, args[1], args[2]);
-	do
+	/* batches go through the read/transform/write pipeline, with every file packed the same way */
+	auto batchDirs = cl["--batch"];
+	if (batchDirs.size())
 	{
-		compiler.useWindows10Attack(win10);
-		compiler.doMultiPass(multi);
+		auto inputs = cl[""];
+		if (inputs.size() < 2)
+		{
+			std::cout << usageString << std::endl;
+			return ERROR_INVALID_PARAMETER;
+		}
+		inputs.erase(inputs.begin());
 
-		/* load everything up */
-		if (!compiler.loadInputFile()) break;
-		if (!compiler.loadInputSections()) break;
+		PackOptions options;
+		options.parse(cl, std::cout);
+		if (options.plan)
+		{
+			std::cerr << "--plan can't be used with --batch" << std::endl;
+			return ERROR_INVALID_PARAMETER;
+		}
 
-		/* statically relocate the file to prepare for rewriting */
-		if (!compiler.performOnDiskRelocations()) break;
+		auto countOf = [&](const char* name) -> unsigned int
+		{
+			auto counts = cl[name];
+			return counts.size() ? strtoul(counts.back().c_str(), nullptr, 10) : 0;
+		};
+		PackPipelineConfig config;
+		config.readThreads = countOf("--readThreads");
+		config.transformThreads = countOf("--threads");
+		config.writeThreads = countOf("--writeThreads");
+		config.queueDepth = countOf("--queueDepth");
+		config.ioUring = (cl.find("--ioUring") != cl.end());
+
+		PackPipeline pipeline(std::cout, std::cerr);
+		std::vector<PackBatchResult> results;
+		return pipeline.packFiles(inputs, batchDirs.back(), options, config, results) ? 0 : 1;
+	}
+
+	auto args = cl[""];
+	PackOptions options;
+	if (args.size() != 3 && !(cl.find("--plan") != cl.end() && args.size() == 2))
+	{
+		std::cout << usageString << std::endl;
+		return ERROR_INVALID_PARAMETER;
+	}
+	options.parse(cl, std::cout);
 
-		/* if headr is writeable, we can re-write parts of the header (such as EntryPoint) */
-		if (rewriteHeader) if (!compiler.rewriteHeader()) break;
+	/* hand the job to a running server instead of packing it here */
+	auto connectEndpoints = cl["--connect"];
+	if (connectEndpoints.size())
+		return submitToServer(connectEndpoints.back(), argc, argv, args, options.plan);
 
-		/* if header is writeable, we can make BaseAddress look normal in memory */
-		if (fixupBase) if (!compiler.fixupBase()) break;
+	auto ioStats = (cl.find("--ioStats") != cl.end());
+	auto cacheDirs = cl["--cache"];
+	auto cacheSizes = cl["--cacheSize"];
+	uint64_t cacheSize = 1024;
+	if (cacheSizes.size())
+		cacheSize = strtoull(cacheSizes.back().c_str(), nullptr, 10);
 
-		/* rewrite some sections */
-		if (sections.size())
-			std::cout << "Obfuscating sections" << std::endl;
-		bool failed = false;
-		for (auto sec : sections)
+	PeRecompiler compiler(std::cout, std::cerr, args[1], (args.size() == 3) ? args[2] : "");
+	do
+	{
+		options.configure(compiler);
+
+		/* skip all of the work if we've already packed this input with these options */
+		if (cacheDirs.size() && !options.plan)
 		{
-			if (!compiler.rewriteSection(sec))
+			auto cache = std::make_shared<ResultCache>(cacheDirs.back(), cacheSize * 1024 * 1024);
+			compiler.useResultCache(cache, options.encode());
+			if (compiler.fetchCachedOutput())
 			{
-				failed = true;
-				break;
+				if (options.verify) if (!compiler.verifyOutputFile()) break;
+
+				if (ioStats) printIoStats(std::cout, compiler.ioStats());
+				std::cout << "Packing succeeded!" << std::endl;
+				return 0;
 			}
 		}
-		if (failed) break;
 
-		/* rewrite string matches */
-		if (stringMatchList.size())
-			std::cout << "Obfuscating string matches" << std::endl;
-		failed = false;
-		for (auto str : stringMatchList)
+		if (!options.rewrite(compiler, std::cout)) break;
+
+		/* if we're only planning, report what would be written and stop */
+		if (options.plan)
 		{
-			if (!compiler.rewriteMatches(str))
-			{
-				failed = true;
-				break;
-			}
-		}
-		if (failed) break;
+			PeOutputPlan outputPlan;
+			if (!compiler.planOutput(outputPlan)) break;
 
-		/* rewrite import tables */
-		if (!noImports) if (!compiler.rewriteImports()) break;
+			outputPlan.print(std::cout);
+			if (ioStats) printIoStats(std::cout, compiler.ioStats());
+			std::cout << "Planning succeeded!" << std::endl;
+			return 0;
+		}
 
 		/* write out the new binary */
 		if (!compiler.writeOutputFile()) break;
 
+		/* make sure it loads back into what we started with */
+		if (options.verify) if (!compiler.verifyOutputFile()) break;
+
+		if (ioStats) printIoStats(std::cout, compiler.ioStats());
 		std::cout << "Packing succeeded!" << std::endl;
 		return 0;
 	} while(0);
 	
+	if (ioStats) printIoStats(std::cout, compiler.ioStats());
 	std::cout << "Packing failed!" << std::endl;
 	return 1;
 }
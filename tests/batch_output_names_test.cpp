@@ -0,0 +1,102 @@
+/*
+	checks that --batch gives every input an output of its own when the
+	inputs' names collide, including with the name a renamed output would
+	otherwise get.
+
+	the inputs are copies of one file as d1\a.exe, d2\a.exe, 1-a.exe and
+	d3\A.EXE: the second a.exe can't become 1-a.exe, which the third input
+	keeps, and A.EXE is the same name as a.exe on Windows. two inputs
+	sharing an output would have their writers race on one temporary file
+	and leave fewer outputs than inputs, so the test counts them, and as
+	every input is the same file, checks they all came out the same too.
+
+	built and run by batch_output_names_test.vcxproj in RelocBonus.sln; the
+	project runs it on samples\normal-nofixup.exe after every build, and a
+	failure fails the build. it can't be built with g++, for the same
+	reasons as plan_string_match_test.cpp, and links PeLib32.lib
+	(PeLib32d.lib in Debug), so build deps\PeLib first.
+*/
+#include "PackOptions.h"
+#include "PackPipeline.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+const char* const INPUT_NAMES[] = { "d1/a.exe", "d2/a.exe", "1-a.exe", "d3/A.EXE" };
+
+static std::vector<char> readFile(const std::filesystem::path &fileName)
+{
+	std::ifstream file(fileName, std::ios::binary);
+	return std::vector<char>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+int main(int argc, char **argv)
+{
+	std::string fileName = (argc > 1) ? argv[1] : "../samples/normal-nofixup.exe";
+
+	auto workDirectory = std::filesystem::temp_directory_path() / "batch_output_names_test";
+	auto outputDirectory = workDirectory / "out";
+	std::error_code ec;
+	std::filesystem::remove_all(workDirectory, ec);
+
+	std::vector<std::string> inputFileNames;
+	for (auto inputName : INPUT_NAMES)
+	{
+		auto inputFileName = workDirectory / inputName;
+		std::filesystem::create_directories(inputFileName.parent_path(), ec);
+		if (!std::filesystem::copy_file(fileName, inputFileName, ec))
+		{
+			std::cerr << "Failed to copy " << fileName << " to " << inputFileName.string() << std::endl;
+			return 1;
+		}
+		inputFileNames.push_back(inputFileName.string());
+	}
+
+	std::ostringstream log;
+	PackOptions options;
+	PackPipelineConfig config;
+	std::vector<PackBatchResult> results;
+	PackPipeline pipeline(log, log);
+	if (!pipeline.packFiles(inputFileNames, outputDirectory.string(), options, config, results))
+	{
+		std::cerr << log.str() << "Packing the batch failed" << std::endl;
+		return 1;
+	}
+
+	bool distinct = true;
+	std::set<std::string> outputNames;
+	for (auto& result : results)
+	{
+		std::cout << result.fileName << " -> " << result.outputFileName << std::endl;
+		if (!result.packed || !outputNames.insert(std::filesystem::path(result.outputFileName).filename().string()).second)
+			distinct = false;
+	}
+
+	size_t outputCount = 0;
+	auto expected = readFile(results.front().outputFileName);
+	for (auto& entry : std::filesystem::directory_iterator(outputDirectory, ec))
+	{
+		outputCount++;
+		if (readFile(entry.path()) != expected)
+		{
+			std::cerr << entry.path().string() << " differs from " << results.front().outputFileName << std::endl;
+			distinct = false;
+		}
+	}
+	if (outputCount != inputFileNames.size())
+	{
+		std::cerr << outputCount << " outputs written for " << inputFileNames.size() << " inputs" << std::endl;
+		distinct = false;
+	}
+
+	std::filesystem::remove_all(workDirectory, ec);
+	std::cout << (distinct ? "every input has its own output" : "inputs share outputs") << std::endl;
+	return distinct ? 0 : 1;
+}
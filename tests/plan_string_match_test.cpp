@@ -0,0 +1,114 @@
+/*
+	checks that --plan --stringMatch sizes the same output a real run writes,
+	on a needle which one of the input's own fixups overlaps.
+
+	the needle is the unrelocated bytes under the first HIGHLOW fixup of the
+	input. a real run searches the relocated bytes, where they no longer
+	match, so a plan which searched the input as-is would queue a rewrite
+	the real run never does, and size a different reloc table and output.
+
+	built and run by plan_string_match_test.vcxproj in RelocBonus.sln; the
+	project runs it on samples\normal-nofixup.exe after every build, and a
+	mismatch fails the build. it can't be built with g++: PeRecompiler pulls
+	in <Windows.h> and the MSVC inline assembly of the ASLR preselection stub.
+	it links PeLib32.lib (PeLib32d.lib in Debug), so build deps\PeLib first.
+*/
+#include "PeLibInclude.h"
+#include "PeRecompiler.h"
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+/* bytes taken around the fixup, so the needle is unlikely to occur anywhere else */
+const uint32_t NEEDLE_BYTES_BEFORE = 2;
+const uint32_t NEEDLE_BYTES = 8;
+
+static bool findFixupNeedle(const std::string &fileName, std::string &needle)
+{
+	PeLib::PeFile32 peFile(fileName);
+	if (peFile.readMzHeader() != PeLib::NO_ERROR || peFile.readPeHeader() != PeLib::NO_ERROR || peFile.readRelocationsDirectory() != PeLib::NO_ERROR)
+		return false;
+
+	std::ifstream file(fileName, std::ios::binary);
+	std::vector<char> image((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+	auto& peHeader = peFile.peHeader();
+	auto& reloc = peFile.relocDir();
+	for (unsigned int rel = 0; rel < reloc.calcNumberOfRelocations(); rel++)
+	{
+		for (unsigned int relEntry = 0; relEntry < reloc.calcNumberOfRelocationData(rel); relEntry++)
+		{
+			auto entry = reloc.getRelocationData(rel, relEntry);
+			if ((entry >> 12) != PeLib::PELIB_IMAGE_REL_BASED_HIGHLOW)
+				continue;
+
+			auto offset = static_cast<size_t>(peHeader.rvaToOffset(reloc.getVirtualAddress(rel) + (entry & 0x0FFF)));
+			if (offset < NEEDLE_BYTES_BEFORE || offset - NEEDLE_BYTES_BEFORE + NEEDLE_BYTES > image.size())
+				continue;
+
+			needle.assign(image.begin() + (offset - NEEDLE_BYTES_BEFORE), image.begin() + (offset - NEEDLE_BYTES_BEFORE + NEEDLE_BYTES));
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool planRun(const std::string &fileName, const std::string &needle, bool planOnly, PeOutputPlan &plan, std::vector<uint8_t> &output)
+{
+	std::ostringstream log;
+	PeRecompiler compiler(log, log, fileName, "");
+	compiler.doPlanOnly(planOnly);
+	if (!compiler.loadInputFile() || !compiler.loadInputSections() || !compiler.performOnDiskRelocations() || !compiler.rewriteMatches(needle))
+	{
+		std::cerr << log.str();
+		return false;
+	}
+
+	if (!compiler.planOutput(plan))
+	{
+		std::cerr << log.str();
+		return false;
+	}
+	return planOnly || compiler.writeOutput(output);
+}
+
+int main(int argc, char **argv)
+{
+	std::string fileName = (argc > 1) ? argv[1] : "../samples/normal-nofixup.exe";
+
+	std::string needle;
+	if (!findFixupNeedle(fileName, needle))
+	{
+		std::cerr << "No HIGHLOW fixup to build a needle from in " << fileName << std::endl;
+		return 1;
+	}
+
+	PeOutputPlan planned, real;
+	std::vector<uint8_t> output, unused;
+	if (!planRun(fileName, needle, true, planned, unused) || !planRun(fileName, needle, false, real, output))
+	{
+		std::cerr << "Packing " << fileName << " failed" << std::endl;
+		return 1;
+	}
+
+	bool same = true;
+	auto expect = [&same](const char *name, size_t plannedValue, size_t realValue)
+	{
+		if (plannedValue == realValue)
+			return;
+		std::cerr << name << ": planned " << plannedValue << ", real run " << realValue << std::endl;
+		same = false;
+	};
+	expect("rewrite blocks", planned.rewriteBlockCount, real.rewriteBlockCount);
+	expect("rewrite entries", planned.rewriteEntryCount, real.rewriteEntryCount);
+	expect("reloc table size", planned.relocTableSize, real.relocTableSize);
+	expect("output size", planned.outputSize, output.size());
+
+	std::cout << (same ? "plan matches the real run" : "plan differs from the real run") << std::endl;
+	return same ? 0 : 1;
+}
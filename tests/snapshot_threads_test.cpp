@@ -0,0 +1,125 @@
+/*
+	checks that a PeLib snapshot frozen inside an ArenaScope survives the
+	arena being released, and that several threads can read it at once.
+
+	the arena works out of a buffer owned here, which is scribbled over once
+	the arena is released, so anything of the snapshot still left in it
+	reads back as garbage (or trips AddressSanitizer) instead of passing by
+	luck.
+
+	snapshot_threads_test.vcxproj in RelocBonus.sln builds it and runs it on
+	samples\normal-nofixup.exe after every build. outside Visual Studio,
+	PeLib only builds with -fpermissive:
+
+		g++ -std=c++17 -fpermissive -pthread -I../deps/PeLib snapshot_threads_test.cpp \
+			../deps/PeLib/*.cpp ../deps/PeLib/buffer/*.cpp -o snapshot_threads_test
+		./snapshot_threads_test ../samples/normal-nofixup.exe
+*/
+#include "PeLib.h"
+
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+const size_t ARENA_BUFFER_SIZE = 16 * 1024 * 1024;
+const unsigned char ARENA_SCRIBBLE = 0xCD;
+const unsigned int READER_THREADS = 8;
+const unsigned int READS_PER_THREAD = 200;
+
+/* everything the test reads back, including the lookups which go through the PE header's caches */
+template <class PEFILE>
+static std::string describe(const PEFILE &peFile)
+{
+	std::ostringstream text;
+	text << std::hex;
+
+	auto& peHeader = peFile.peHeader();
+	for (PeLib::word sec = 0; sec < peHeader.calcNumberOfSections(); sec++)
+	{
+		auto rva = peHeader.getVirtualAddress(sec);
+		text << peHeader.getSectionName(sec) << " " << rva << " " << peHeader.rvaToOffset(rva) << " " << peHeader.getSectionWithRva(rva) << "\n";
+	}
+
+	auto& reloc = peFile.relocDir();
+	for (unsigned int rel = 0; rel < reloc.calcNumberOfRelocations(); rel++)
+	{
+		text << "reloc " << reloc.getVirtualAddress(rel);
+		for (unsigned int relEntry = 0; relEntry < reloc.calcNumberOfRelocationData(rel); relEntry++)
+			text << " " << reloc.getRelocationData(rel, relEntry);
+		text << "\n";
+	}
+
+	auto& imports = peFile.impDir();
+	for (PeLib::dword file = 0; file < imports.getNumberOfFiles(PeLib::OLDDIR); file++)
+	{
+		text << "import " << imports.getFileName(file, PeLib::OLDDIR);
+		for (PeLib::dword func = 0; func < imports.getNumberOfFunctions(file, PeLib::OLDDIR); func++)
+			text << " " << imports.getFunctionName(file, func, PeLib::OLDDIR);
+		text << "\n";
+	}
+
+	text << "resources " << peFile.resDir().getNumberOfResourceTypes() << "\n";
+	return text.str();
+}
+
+int main(int argc, char **argv)
+{
+	std::string fileName = (argc > 1) ? argv[1] : "../samples/normal-nofixup.exe";
+
+	std::vector<unsigned char> arenaBuffer(ARENA_BUFFER_SIZE);
+	std::pmr::monotonic_buffer_resource arena(arenaBuffer.data(), arenaBuffer.size());
+
+	std::string expected;
+	std::shared_ptr<const PeLib::PeFileSnapshot32> snapshot;
+	{
+		PeLib::ArenaScope arenaScope(&arena);
+		PeLib::PeFile32 peFile(fileName);
+		if (peFile.readMzHeader() != PeLib::NO_ERROR || peFile.readPeHeader() != PeLib::NO_ERROR)
+		{
+			std::cerr << "Failed to read the headers of " << fileName << std::endl;
+			return 1;
+		}
+		peFile.readImportDirectory();
+		peFile.readRelocationsDirectory();
+		peFile.readResourceDirectory();
+
+		expected = describe(peFile);
+		snapshot = PeLib::freeze(peFile);
+	}
+
+	/* the file is gone with the scope; now its arena goes too */
+	arena.release();
+	memset(arenaBuffer.data(), ARENA_SCRIBBLE, arenaBuffer.size());
+
+	std::atomic<unsigned int> mismatches(0);
+	std::vector<std::thread> readers;
+	for (unsigned int t = 0; t < READER_THREADS; t++)
+	{
+		readers.emplace_back([&]()
+		{
+			for (unsigned int read = 0; read < READS_PER_THREAD; read++)
+			{
+				if (describe(*snapshot) != expected)
+					mismatches++;
+			}
+		});
+	}
+	for (auto& reader : readers)
+		reader.join();
+
+	if (mismatches)
+	{
+		std::cerr << mismatches << " of " << (READER_THREADS * READS_PER_THREAD) << " reads of the snapshot differ from the file it was taken from" << std::endl;
+		return 1;
+	}
+
+	std::cout << "snapshot read back intact from " << READER_THREADS << " threads" << std::endl;
+	return 0;
+}